@@ -0,0 +1,411 @@
+#include <threadpool.h>
+#include <opencl.h>
+#include <tune.h>
+#include <cpu.h>
+#include <float.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Benchmark of the square double kernels of the library: every kernel runs at every size and thread count of the
+ * sweep, first warmup times and then trials timed times. One line of CSV (or one JSON object) per configuration
+ * holds the median and 95th percentile time, the GFLOP/s and bandwidth at the median, the parallel efficiency
+ * against the one thread run and the error against a reference product. The exit status is 1 when any result is
+ * off by more than its bound, so a nightly run catches wrong answers as well as slow ones.
+ *
+ *   matmulbench [--sizes 256,512,1024] [--kernels name,...] [--threads 1,2,4] [--trials 5] [--warmup 1]
+ *               [--format csv|json] [--list] [--tune]
+ *
+ * --tune writes the tuning profile of this machine instead (see tune.h), measured up to the largest size and thread
+ * count of the sweep, and prints it. Run the sweep afterwards to see what it gained.
+ */
+
+void matmulNaive(const double* a, const double* b, double* res, size_t size);
+void matmulNaiveTransposeFirst(const double* a, double* b, double* res, size_t size);
+void matmulMT(double* a, double* b, double* res, size_t size, size_t threadCount);
+void simdMultiplyFour(double* a, double* b, double* res, size_t size);
+void simdMoreOptimized(double* a, double* b, double* res, size_t size);
+void matmulSIMDMT(double* a, double* b, double* res, size_t size, size_t threadCount);
+void matmulPacked(double* a, double* b, double* res, size_t size);
+void matmulPackedMT(double* a, double* b, double* res, size_t size, size_t threadCount);
+void matmulStrassen(const double* a, const double* b, double* res, size_t size, size_t crossover, size_t threadCount);
+double matmulStrassenErrorBound(size_t size, size_t crossover, double normA, double normB);
+void matmulOpenClNaive(double* a, double* b, double* res, size_t size);
+void matmulOpenCl(const double* a, const double* b, double* res, size_t size);
+void matmulHybrid(const double* a, const double* b, double* res, size_t size, size_t threadCount);
+
+#define MAX_LIST 64
+
+struct BenchKernel {
+    const char* name;
+    void (*run)(double* a, double* b, double* res, size_t size, size_t threadCount);
+    // Runs on the pool, so it is measured at every thread count of the sweep instead of once
+    bool threaded;
+    // Sizes that are not a multiple of this are skipped
+    size_t multiple;
+    bool opencl;
+    // Error bound of the kernel on top of the one of the reference, zero for the bound of the O(n^3) kernels
+    double (*errorBound)(size_t size, double normA, double normB);
+};
+
+static void runNaive(double* a, double* b, double* res, const size_t size, const size_t threadCount){
+    (void)threadCount;
+    matmulNaive(a, b, res, size);
+}
+
+static void runNaiveTransposeFirst(double* a, double* b, double* res, const size_t size, const size_t threadCount){
+    (void)threadCount;
+    matmulNaiveTransposeFirst(a, b, res, size);
+}
+
+static void runSimdFour(double* a, double* b, double* res, const size_t size, const size_t threadCount){
+    (void)threadCount;
+    simdMultiplyFour(a, b, res, size);
+}
+
+static void runSimdMore(double* a, double* b, double* res, const size_t size, const size_t threadCount){
+    (void)threadCount;
+    simdMoreOptimized(a, b, res, size);
+}
+
+static void runPacked(double* a, double* b, double* res, const size_t size, const size_t threadCount){
+    (void)threadCount;
+    matmulPacked(a, b, res, size);
+}
+
+static void runStrassen(double* a, double* b, double* res, const size_t size, const size_t threadCount){
+    matmulStrassen(a, b, res, size, 0, threadCount);
+}
+
+static double strassenBound(const size_t size, const double normA, const double normB){
+    return matmulStrassenErrorBound(size, 0, normA, normB);
+}
+
+static void runOpenClNaive(double* a, double* b, double* res, const size_t size, const size_t threadCount){
+    (void)threadCount;
+    matmulOpenClNaive(a, b, res, size);
+}
+
+static void runOpenCl(double* a, double* b, double* res, const size_t size, const size_t threadCount){
+    (void)threadCount;
+    matmulOpenCl(a, b, res, size);
+}
+
+static void runHybrid(double* a, double* b, double* res, const size_t size, const size_t threadCount){
+    matmulHybrid(a, b, res, size, threadCount);
+}
+
+static const struct BenchKernel kernels[] = {
+    {"matmulNaive", runNaive, false, 1, false, NULL},
+    {"matmulNaiveTransposeFirst", runNaiveTransposeFirst, false, 1, false, NULL},
+    {"simdMultiplyFour", runSimdFour, false, 4, false, NULL},
+    {"simdMoreOptimized", runSimdMore, false, 4, false, NULL},
+    {"matmulPacked", runPacked, false, 1, false, NULL},
+    {"matmulMT", matmulMT, true, 1, false, NULL},
+    {"matmulSIMDMT", matmulSIMDMT, true, 4, false, NULL},
+    {"matmulPackedMT", matmulPackedMT, true, 1, false, NULL},
+    {"matmulStrassen", runStrassen, true, 1, false, strassenBound},
+    {"matmulOpenClNaive", runOpenClNaive, false, 1, true, NULL},
+    {"matmulOpenCl", runOpenCl, false, 1, true, NULL},
+    {"matmulHybrid", runHybrid, true, 1, true, NULL},
+};
+#define KERNELCOUNT (sizeof(kernels)/sizeof(kernels[0]))
+
+struct BenchOptions {
+    size_t sizes[MAX_LIST];
+    size_t sizeCount;
+    const struct BenchKernel* kernels[KERNELCOUNT];
+    size_t kernelCount;
+    size_t threads[MAX_LIST];
+    size_t threadCount;
+    size_t trials;
+    size_t warmup;
+    bool json;
+    bool tune;
+};
+
+struct BenchResult {
+    double median;
+    double p95;
+    double error;
+    double bound;
+};
+
+static double now(void){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+static int compareDoubles(const void* x, const void* y){
+    const double a = *(const double*)x;
+    const double b = *(const double*)y;
+    return (a > b) - (a < b);
+}
+
+static void usage(const char* const program){
+    fprintf(stderr, "Usage: %s [--sizes n,...] [--kernels name,...] [--threads t,...] [--trials n] [--warmup n] [--format csv|json] [--list] [--tune]\n", program);
+    exit(1);
+}
+
+static size_t parseCount(const char* const text, const char* const option){
+    char* end;
+    const unsigned long long value = strtoull(text, &end, 10);
+    if (end == text || *end != 0){
+        fprintf(stderr, "%s expects a number, got %s\n", option, text);
+        exit(1);
+    }
+    return (size_t)value;
+}
+
+static size_t parseCounts(char* const text, size_t* const values, const char* const option){
+    size_t count = 0;
+    for (char* item = strtok(text, ","); item != NULL; item = strtok(NULL, ",")){
+        if (count == MAX_LIST){
+            fprintf(stderr, "%s takes at most %d values\n", option, MAX_LIST);
+            exit(1);
+        }
+        values[count] = parseCount(item, option);
+        if (values[count] == 0){
+            fprintf(stderr, "%s values must be positive\n", option);
+            exit(1);
+        }
+        ++count;
+    }
+    return count;
+}
+
+static size_t parseKernels(char* const text, const struct BenchKernel** const selected){
+    size_t count = 0;
+    for (char* item = strtok(text, ","); item != NULL; item = strtok(NULL, ",")){
+        size_t i = 0;
+        while (i < KERNELCOUNT && strcmp(kernels[i].name, item) != 0) ++i;
+        if (i == KERNELCOUNT){
+            fprintf(stderr, "Unknown kernel %s, --list shows the kernels\n", item);
+            exit(1);
+        }
+        if (count < KERNELCOUNT) selected[count++] = &kernels[i];
+    }
+    return count;
+}
+
+static void parseOptions(const int argc, char** const argv, struct BenchOptions* const options){
+    *options = (struct BenchOptions){
+        .sizes = {256, 512, 1024},
+        .sizeCount = 3,
+        .trials = 5,
+        .warmup = 1,
+    };
+    for (size_t i = 0; i < KERNELCOUNT; ++i){
+        options->kernels[options->kernelCount++] = &kernels[i];
+    }
+    // Powers of two up to the pool size and the pool size itself
+    const size_t poolSize = threadPoolSize();
+    for (size_t t = 1; t < poolSize && options->threadCount < MAX_LIST - 1; t *= 2){
+        options->threads[options->threadCount++] = t;
+    }
+    options->threads[options->threadCount++] = poolSize;
+    for (int i = 1; i < argc; ++i){
+        const char* const option = argv[i];
+        if (strcmp(option, "--list") == 0){
+            for (size_t k = 0; k < KERNELCOUNT; ++k) printf("%s\n", kernels[k].name);
+            exit(0);
+        }
+        if (strcmp(option, "--tune") == 0){
+            options->tune = true;
+            continue;
+        }
+        if (i + 1 == argc) usage(argv[0]);
+        char* const value = argv[++i];
+        if (strcmp(option, "--sizes") == 0){
+            options->sizeCount = parseCounts(value, options->sizes, option);
+        } else if (strcmp(option, "--kernels") == 0){
+            options->kernelCount = parseKernels(value, options->kernels);
+        } else if (strcmp(option, "--threads") == 0){
+            options->threadCount = parseCounts(value, options->threads, option);
+        } else if (strcmp(option, "--trials") == 0){
+            options->trials = parseCount(value, option);
+        } else if (strcmp(option, "--warmup") == 0){
+            options->warmup = parseCount(value, option);
+        } else if (strcmp(option, "--format") == 0){
+            if (strcmp(value, "csv") != 0 && strcmp(value, "json") != 0) usage(argv[0]);
+            options->json = strcmp(value, "json") == 0;
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (options->trials == 0){
+        fprintf(stderr, "--trials must be at least 1\n");
+        exit(1);
+    }
+}
+
+static double* allocMatrix(const size_t size){
+    double* matrix = aligned_alloc(64, (size*size*sizeof(double) + 63)/64*64);
+    if (matrix == NULL){
+        fprintf(stderr, "Failed to allocate a %zu x %zu matrix\n", size, size);
+        exit(1);
+    }
+    return matrix;
+}
+
+// The reference product, an i-k-j loop that shares no code with the kernels under test
+static void reference(const double* const a, const double* const b, double* const res, const size_t size){
+    memset(res, 0, size*size*sizeof(double));
+    for (size_t i = 0; i < size; ++i){
+        for (size_t k = 0; k < size; ++k){
+            const double aik = a[i*size + k];
+            for (size_t j = 0; j < size; ++j){
+                res[i*size + j] += aik*b[k*size + j];
+            }
+        }
+    }
+}
+
+static double maxAbs(const double* const x, const size_t count){
+    double max = 0;
+    for (size_t i = 0; i < count; ++i){
+        if (fabs(x[i]) > max) max = fabs(x[i]);
+    }
+    return max;
+}
+
+static struct BenchResult measure(const struct BenchKernel* const kernel, double* const a, double* const b, double* const res, const double* const ref,
+        const size_t size, const size_t threadCount, const struct BenchOptions* const options){
+    for (size_t i = 0; i < options->warmup; ++i){
+        kernel->run(a, b, res, size, threadCount);
+    }
+    double times[options->trials];
+    double error = 0;
+    for (size_t i = 0; i < options->trials; ++i){
+        // NaN marks the entries a kernel leaves unwritten
+        for (size_t j = 0; j < size*size; ++j) res[j] = NAN;
+        const double start = now();
+        kernel->run(a, b, res, size, threadCount);
+        times[i] = now() - start;
+        for (size_t j = 0; j < size*size; ++j){
+            const double diff = fabs(res[j] - ref[j]);
+            if (!(diff <= error)) error = isnan(diff) ? INFINITY : diff;
+        }
+    }
+    qsort(times, options->trials, sizeof(double), compareDoubles);
+    const double normA = maxAbs(a, size*size);
+    const double normB = maxAbs(b, size*size);
+    // The reference is off by up to the bound of the O(n^3) kernels as well
+    const double standard = matmulStrassenErrorBound(size, size, normA, normB);
+    const double bound = standard + (kernel->errorBound != NULL ? kernel->errorBound(size, normA, normB) : standard);
+    const double normRes = maxAbs(ref, size*size);
+    const double scale = normRes > 0 ? normRes : 1;
+    return (struct BenchResult){
+        .median = options->trials % 2 == 1 ? times[options->trials/2] : (times[options->trials/2 - 1] + times[options->trials/2])/2,
+        .p95 = times[(size_t)ceil(0.95*options->trials) - 1],
+        .error = error/scale,
+        .bound = bound/scale,
+    };
+}
+
+static void printHeader(const struct BenchOptions* const options){
+    if (options->json){
+        printf("[\n");
+    } else {
+        printf("kernel,isa,size,threads,trials,median_s,p95_s,gflops,bytes,gbytes_per_s,efficiency,rel_error,rel_bound,valid\n");
+    }
+}
+
+static void printResult(const struct BenchOptions* const options, const struct BenchKernel* const kernel, const size_t size, const size_t threadCount,
+        const struct BenchResult* const result, const double efficiency, const bool first){
+    const double gflops = 2.0*size*size*size/result->median*1e-9;
+    // Every kernel reads a and b and writes res at least once, caches and transposes come on top
+    const double bytes = 3.0*size*size*sizeof(double);
+    const bool valid = result->error <= result->bound;
+    if (options->json){
+        printf("%s  {\"kernel\": \"%s\", \"isa\": \"%s\", \"size\": %zu, \"threads\": %zu, \"trials\": %zu, \"median_s\": %.9f, \"p95_s\": %.9f, "
+                "\"gflops\": %.3f, \"bytes\": %.0f, \"gbytes_per_s\": %.3f, \"efficiency\": ",
+                first ? "" : ",\n", kernel->name, matmulIsaName(), size, threadCount, options->trials, result->median, result->p95,
+                gflops, bytes, bytes/result->median*1e-9);
+        if (efficiency > 0){
+            printf("%.3f", efficiency);
+        } else {
+            printf("null");
+        }
+        printf(", \"rel_error\": %.3e, \"rel_bound\": %.3e, \"valid\": %s}", isinf(result->error) ? DBL_MAX : result->error, result->bound, valid ? "true" : "false");
+    } else {
+        printf("%s,%s,%zu,%zu,%zu,%.9f,%.9f,%.3f,%.0f,%.3f,", kernel->name, matmulIsaName(), size, threadCount, options->trials, result->median, result->p95,
+                gflops, bytes, bytes/result->median*1e-9);
+        if (efficiency > 0) printf("%.3f", efficiency);
+        printf(",%.3e,%.3e,%s\n", result->error, result->bound, valid ? "true" : "false");
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char** argv){
+    struct BenchOptions options;
+    parseOptions(argc, argv, &options);
+    size_t maxThreads = 1;
+    for (size_t t = 0; t < options.threadCount; ++t){
+        if (options.threads[t] > maxThreads) maxThreads = options.threads[t];
+    }
+    if (maxThreads > threadPoolSize()) threadPoolInit(maxThreads);
+    if (options.tune){
+        size_t maxSize = 0;
+        for (size_t s = 0; s < options.sizeCount; ++s){
+            if (options.sizes[s] > maxSize) maxSize = options.sizes[s];
+        }
+        matmulTune(NULL, maxSize, maxThreads);
+        FILE* profile = fopen(matmulTuneProfilePath(), "r");
+        if (profile == NULL){
+            fprintf(stderr, "Cannot read back the tuning profile %s\n", matmulTuneProfilePath());
+            return 1;
+        }
+        printf("# %s\n", matmulTuneProfilePath());
+        char line[512];
+        while (fgets(line, sizeof(line), profile) != NULL) fputs(line, stdout);
+        fclose(profile);
+        return 0;
+    }
+    const bool opencl = matmulOpenClAvailable();
+    bool allValid = true;
+    bool first = true;
+    printHeader(&options);
+    srand(1);
+    for (size_t s = 0; s < options.sizeCount; ++s){
+        const size_t size = options.sizes[s];
+        double* a = allocMatrix(size);
+        double* b = allocMatrix(size);
+        double* res = allocMatrix(size);
+        double* ref = allocMatrix(size);
+        for (size_t i = 0; i < size*size; ++i){
+            a[i] = rand()/(double)RAND_MAX;
+            b[i] = rand()/(double)RAND_MAX;
+        }
+        reference(a, b, ref, size);
+        for (size_t k = 0; k < options.kernelCount; ++k){
+            const struct BenchKernel* const kernel = options.kernels[k];
+            if (size % kernel->multiple != 0 || (kernel->opencl && !opencl)) continue;
+            double singleSeconds = 0;
+            for (size_t t = 0; t < (kernel->threaded ? options.threadCount : 1); ++t){
+                const size_t threadCount = kernel->threaded ? options.threads[t] : 1;
+                const struct BenchResult result = measure(kernel, a, b, res, ref, size, threadCount, &options);
+                if (threadCount == 1) singleSeconds = result.median;
+                const double efficiency = singleSeconds > 0 ? singleSeconds/(result.median*threadCount) : 0;
+                printResult(&options, kernel, size, threadCount, &result, efficiency, first);
+                first = false;
+                if (!(result.error <= result.bound)){
+                    allValid = false;
+                    fprintf(stderr, "%s at size %zu on %zu threads is off by %g relative, the bound is %g\n", kernel->name, size, threadCount, result.error, result.bound);
+                }
+            }
+        }
+        free(a);
+        free(b);
+        free(res);
+        free(ref);
+    }
+    if (options.json) printf("\n]\n");
+    return allValid ? 0 : 1;
+}
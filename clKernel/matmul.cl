@@ -0,0 +1,72 @@
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+
+/*
+ * res = a*b^T, or res += a*b^T when accumulate is set, on one tile of the product. The rows and columns of the tile
+ * are the NDRange, the depth K and the row length LDC of res are built in with -D K=<depth> -D LDC=<columns>, so that
+ * all loop bounds are constants. matmulTiled also takes -D TILE, -D WPT and -D TK. Every dimension is a multiple of
+ * TILE and TK: the host pads a and b^T with zeros. b is passed transposed, so both operands are read along k.
+ */
+
+// One output per work-item, read straight from global memory
+__kernel void matmulNaive(__global const double* a, __global const double* bt, __global double* res, const int accumulate){
+    const size_t col = get_global_id(0);
+    const size_t row = get_global_id(1);
+    double sum = 0;
+    for (size_t k = 0; k < K; ++k){
+        sum += a[row*K + k]*bt[col*K + k];
+    }
+    res[row*LDC + col] = accumulate ? res[row*LDC + col] + sum : sum;
+}
+
+#ifdef TILE
+
+#define GROUP_COLS (TILE/4)
+#define GROUP_ROWS (TILE/WPT)
+#define GROUP_ITEMS (GROUP_COLS*GROUP_ROWS)
+
+/*
+ * A work-group computes a TILE x TILE block of res and every work-item WPT rows x 4 columns of it, one double4 per
+ * row. The rows of a work-item are GROUP_ROWS apart, so neighbouring work-items read neighbouring rows of the tile.
+ * a and b^T are staged through __local tiles of depth TK, which the work-group loads with double4 reads along k.
+ */
+__kernel __attribute__((reqd_work_group_size(GROUP_COLS, GROUP_ROWS, 1)))
+void matmulTiled(__global const double* a, __global const double* bt, __global double* res, const int accumulate){
+    __local double aTile[TILE][TK];
+    __local double bTile[TK][TILE];
+    const size_t lc = get_local_id(0);
+    const size_t lr = get_local_id(1);
+    const size_t col0 = get_group_id(0)*TILE;
+    const size_t row0 = get_group_id(1)*TILE;
+    const size_t id = lr*GROUP_COLS + lc;
+    double4 acc[WPT];
+    for (int w = 0; w < WPT; ++w){
+        acc[w] = (double4)(0.0);
+    }
+    for (size_t k0 = 0; k0 < K; k0 += TK){
+        for (size_t v = id; v < TILE*TK/4; v += GROUP_ITEMS){
+            const size_t r = v/(TK/4);
+            const size_t kk = (v % (TK/4))*4;
+            vstore4(vload4(0, &a[(row0 + r)*K + k0 + kk]), 0, &aTile[r][kk]);
+            // b^T is stored transposed again so that the 4 columns of a work-item are one double4 in the tile
+            const double4 b = vload4(0, &bt[(col0 + r)*K + k0 + kk]);
+            bTile[kk][r] = b.s0;
+            bTile[kk + 1][r] = b.s1;
+            bTile[kk + 2][r] = b.s2;
+            bTile[kk + 3][r] = b.s3;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+        for (size_t k = 0; k < TK; ++k){
+            const double4 b = vload4(0, &bTile[k][lc*4]);
+            for (int w = 0; w < WPT; ++w){
+                acc[w] += aTile[lr + w*GROUP_ROWS][k]*b;
+            }
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    for (int w = 0; w < WPT; ++w){
+        __global double* out = &res[(row0 + lr + w*GROUP_ROWS)*LDC + col0 + lc*4];
+        vstore4(accumulate ? vload4(0, out) + acc[w] : acc[w], 0, out);
+    }
+}
+
+#endif
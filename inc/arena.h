@@ -0,0 +1,54 @@
+#ifndef __ARENA__
+#define __ARENA__
+
+#include <stddef.h>
+
+/*
+ * The scratch memory of the library: transposed and packed operands, packing panels and workspaces. Blocks are
+ * anonymous mappings that are kept in a cache when they are released and handed out again to the next call that
+ * fits, so that repeated multiplies neither map nor fault in their buffers again. Blocks of a huge page or more are
+ * aligned to and rounded up to 2 MB pages, which cuts the TLB misses of the strided walks over b.
+ *
+ * The MATMUL_HUGEPAGES environment variable picks how, read on first use: "madvise" (the default) asks for
+ * transparent huge pages with MADV_HUGEPAGE, "hugetlb" takes pages from the reserved pool with MAP_HUGETLB and falls
+ * back to madvise when it is empty, "off" maps normal pages. MATMUL_ARENA_MB limits the cached bytes, 1024 by
+ * default, see matmulArenaLimit.
+ *
+ * All functions are thread safe.
+ */
+
+/*
+ * At least bytes of uninitialized memory, 64 byte aligned. Exits with an error when the memory is not available.
+ */
+void* arenaAlloc(size_t bytes);
+
+/*
+ * arenaAlloc with the pages preferably placed on node (see topologyAlloc). The cache keeps blocks by node, so a
+ * block is only handed out again for the node it was placed on.
+ */
+void* arenaAllocNode(size_t bytes, size_t node);
+
+/*
+ * Give a block of arenaAlloc or arenaAllocNode back, it is cached for reuse unless that would exceed the limit. NULL is ignored.
+ */
+void arenaRelease(void* ptr);
+
+/*
+ * The exported form of arenaAlloc and arenaRelease, for operands that the caller wraps, like numpy arrays that then
+ * pass the alignment checks of the SIMD kernels without a copy.
+ */
+void* matmulAlloc(size_t bytes);
+void matmulFree(void* ptr);
+
+/*
+ * Set the most bytes that released blocks may keep mapped, trimming the cache down to it. Zero disables the cache.
+ */
+void matmulArenaLimit(size_t bytes);
+
+/*
+ * Unmap all cached blocks, and the bytes they hold.
+ */
+void matmulArenaTrim(void);
+size_t matmulArenaCached(void);
+
+#endif /* __ARENA__ */
@@ -0,0 +1,30 @@
+#ifndef __BATCHED__
+#define __BATCHED__
+
+#include <stddef.h>
+
+/*
+ * The square sizes that get a kernel with the size known at compile time. Adding a size to this list is all it takes
+ * to generate its kernels (see batched_template.h).
+ */
+#define BATCHED_SIZES(X) X(4) X(8) X(16) X(32)
+
+// c = a*b for one size x size row major product
+typedef void (*BatchedFixed)(const double* a, const double* b, double* c);
+
+#define BATCHED_FIELD(N) BatchedFixed fixed##N;
+
+/*
+ * The small matrix kernels of one instruction set level. generic handles every other shape, c = a*b with a m x k,
+ * b k x n and c m x n, all row major and contiguous.
+ */
+struct BatchedKernels {
+    const char* name;
+    BATCHED_SIZES(BATCHED_FIELD)
+    void (*generic)(size_t m, size_t n, size_t k, const double* a, const double* b, double* c);
+};
+
+extern const struct BatchedKernels batchedKernelsSse2;
+extern const struct BatchedKernels batchedKernelsAvx2;
+
+#endif /* __BATCHED__ */
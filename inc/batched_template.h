@@ -0,0 +1,57 @@
+/*
+ * Small matrix kernels, included once by every instruction set specific batched kernel file, which defines
+ * BATCHED_NAME (the struct BatchedKernels to define) and BATCHED_ISA (its name). There is deliberately no include
+ * guard.
+ *
+ * With the size a compile time constant the compiler unrolls the loops completely, vectorises the rows for the
+ * instruction set of the including file and keeps a row of c in registers while it accumulates.
+ */
+
+#define BATCHED_KERNEL(N) \
+    static void fixed##N(const double* const restrict a, const double* const restrict b, double* const restrict c){ \
+        for (size_t i = 0; i < N; ++i){ \
+            double acc[N] = {0}; \
+            _Pragma("GCC unroll 32") \
+            for (size_t p = 0; p < N; ++p){ \
+                const double x = a[i*N + p]; \
+                for (size_t j = 0; j < N; ++j){ \
+                    acc[j] += x*b[p*N + j]; \
+                } \
+            } \
+            for (size_t j = 0; j < N; ++j){ \
+                c[i*N + j] = acc[j]; \
+            } \
+        } \
+    }
+
+BATCHED_SIZES(BATCHED_KERNEL)
+
+// i, p, j order so that the inner loop streams rows of b and c, which are in L1 for the sizes this is used for
+static void generic(const size_t m, const size_t n, const size_t k, const double* const restrict a, const double* const restrict b, double* const restrict c){
+    for (size_t i = 0; i < m; ++i){
+        double* const row = &c[i*n];
+        for (size_t j = 0; j < n; ++j){
+            row[j] = 0;
+        }
+        for (size_t p = 0; p < k; ++p){
+            const double x = a[i*k + p];
+            const double* const bRow = &b[p*n];
+            for (size_t j = 0; j < n; ++j){
+                row[j] += x*bRow[j];
+            }
+        }
+    }
+}
+
+#define BATCHED_INIT(N) .fixed##N = fixed##N,
+
+const struct BatchedKernels BATCHED_NAME = {
+    .name = BATCHED_ISA,
+    BATCHED_SIZES(BATCHED_INIT)
+    .generic = generic,
+};
+
+#undef BATCHED_KERNEL
+#undef BATCHED_INIT
+#undef BATCHED_NAME
+#undef BATCHED_ISA
@@ -0,0 +1,39 @@
+#ifndef __CPU__
+#define __CPU__
+
+/*
+ * Instruction set levels, ordered so that every level includes the ones below it.
+ */
+enum CpuIsa {
+    ISA_SSE2,
+    ISA_AVX,
+    ISA_AVX2,       // AVX2 and FMA
+    ISA_AVX512,     // AVX-512F, AVX2 and FMA
+};
+
+// For helpers that use intrinsics above the SSE2 baseline the library is compiled for
+#define TARGET_AVX __attribute__((target("avx")))
+
+/*
+ * The best level the cpu and operating system support, detected once with cpuid. The MATMUL_ISA environment
+ * variable (sse2, avx, avx2 or avx512) lowers it, which is meant for benchmarking the variants against each other.
+ */
+enum CpuIsa cpuIsa(void);
+
+/*
+ * The name of the level returned by cpuIsa.
+ */
+const char* matmulIsaName(void);
+
+/*
+ * The names of the levels, indexed by enum CpuIsa, and the level of a name or -1 when it is none of them.
+ */
+const char* cpuIsaName(enum CpuIsa isa);
+int cpuIsaFromName(const char* name);
+
+/*
+ * The processor brand string reported by cpuid, for telling apart results measured on different machines.
+ */
+const char* cpuBrand(void);
+
+#endif /* __CPU__ */
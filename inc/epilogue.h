@@ -0,0 +1,90 @@
+#ifndef __EPILOGUE__
+#define __EPILOGUE__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+enum MatmulBias {
+    MATMUL_BIAS_NONE,
+    // One value per row of the result, m of them
+    MATMUL_BIAS_ROW,
+    // One value per column of the result, n of them
+    MATMUL_BIAS_COLUMN,
+};
+
+enum MatmulActivation {
+    MATMUL_ACTIVATION_NONE,
+    MATMUL_ACTIVATION_RELU,
+    // The exact x*Phi(x) form, with erf
+    MATMUL_ACTIVATION_GELU,
+    MATMUL_ACTIVATION_SIGMOID,
+    MATMUL_ACTIVATION_TANH,
+};
+
+enum MatmulOutput {
+    // The element type of the product, written to c
+    MATMUL_OUTPUT_NATIVE,
+    MATMUL_OUTPUT_FLOAT64,
+    MATMUL_OUTPUT_FLOAT32,
+    // Rounded to nearest and saturated
+    MATMUL_OUTPUT_INT32,
+    MATMUL_OUTPUT_INT8,
+};
+
+/*
+ * What a GEMM does with an element of its result before it is stored: c = act(alpha*a*b + beta*c + bias). It is
+ * applied to every tile right after the micro kernel has written it, while the tile is still in L1, so that the
+ * result is swept once instead of once more for every step done in numpy. The values are computed in double.
+ *
+ * With an output other than MATMUL_OUTPUT_NATIVE the result is converted and written to out, which has the storage
+ * order of c and the leading dimension ldo, and beta scales the old contents of out. c is then only used for the
+ * partial sums when k spans several blocks of the packed GEMM and may be NULL, in which case the library allocates
+ * one panel of them.
+ */
+struct MatmulEpilogue {
+    enum MatmulBias bias;
+    const double* biasValues;
+    enum MatmulActivation activation;
+    enum MatmulOutput output;
+    void* out;
+    size_t ldo;
+};
+
+/*
+ * An epilogue as the kernels apply it to a row major product. The row and column bias are swapped for a column
+ * major result, which the GEMMs compute as its row major transpose.
+ */
+struct EpilogueRun {
+    enum MatmulBias bias;
+    const double* biasValues;
+    enum MatmulActivation activation;
+    enum MatmulOutput output;
+    void* out;
+    size_t ldo;
+    // Multiplies the product first, the alpha of the integer GEMMs whose kernels only scale by integers
+    double scale;
+    // beta for a converted output, the kernels do not read out
+    double beta;
+};
+
+/*
+ * Check epilogue for a m x n result (in the storage order of the caller) and describe it for the kernels.
+ * Returns false for a NULL epilogue or one that does nothing.
+ */
+bool epiloguePrepare(const struct MatmulEpilogue* epilogue, bool colMajor, size_t m, size_t n, double scale, double beta,
+        struct EpilogueRun* run, const char* caller);
+
+static inline bool epilogueConverts(const struct EpilogueRun* const run){
+    return run != NULL && run->output != MATMUL_OUTPUT_NATIVE;
+}
+
+/*
+ * Apply run to the rows x cols tile at (row, col) of the product, which the kernel left in tile (leading
+ * dimension ldt). A native output is written back to the tile, a converted one to out.
+ */
+void epilogueDouble(const struct EpilogueRun* run, size_t row, size_t col, size_t rows, size_t cols, double* tile, size_t ldt);
+void epilogueFloat(const struct EpilogueRun* run, size_t row, size_t col, size_t rows, size_t cols, float* tile, size_t ldt);
+void epilogueInt32(const struct EpilogueRun* run, size_t row, size_t col, size_t rows, size_t cols, int32_t* tile, size_t ldt);
+
+#endif /* __EPILOGUE__ */
@@ -0,0 +1,108 @@
+#ifndef __GEMM__
+#define __GEMM__
+
+#include <cpu.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * A micro kernel multiplies a packed micro panel of a (the mr values of one column consecutive) with a packed micro
+ * panel of b (the nr values of one row consecutive) over kc steps and writes the tile back as
+ * res = alpha*a*b + beta*res. Only the top left rows x cols part of the tile is written and res is not read when
+ * beta is zero.
+ * When kgroup is larger than one, kgroup consecutive values of k are interleaved: a micro panel of a holds, for
+ * every group of k, mr runs of kgroup values and a micro panel of b nr runs of kgroup values. kc is then padded with
+ * zeros to a multiple of kgroup. This feeds the integer multiply-add instructions that sum neighbouring products.
+ *
+ * One instruction set variant of the packed GEMM is the register tile of its micro kernel and the cache blocking
+ * that goes with it. mc is a multiple of mr, nc a multiple of nr and kc a multiple of kgroup.
+ */
+#define GEMM_KERNEL_STRUCT(NAME, T, ACC) \
+    struct NAME { \
+        const char* name; \
+        size_t mr; \
+        size_t nr; \
+        size_t mc; \
+        size_t kc; \
+        size_t nc; \
+        size_t kgroup; \
+        void (*micro)(size_t kc, const T* pa, const T* pb, ACC* res, size_t ldr, size_t rows, size_t cols, ACC alpha, ACC beta); \
+    }
+
+GEMM_KERNEL_STRUCT(GemmKernel, double, double);
+GEMM_KERNEL_STRUCT(SgemmKernel, float, float);
+GEMM_KERNEL_STRUCT(I32gemmKernel, int32_t, int32_t);
+// int8 operands, int32 accumulation and result
+GEMM_KERNEL_STRUCT(I8gemmKernel, int8_t, int32_t);
+
+extern const struct GemmKernel gemmKernelSse2;
+extern const struct GemmKernel gemmKernelAvx2;
+extern const struct GemmKernel gemmKernelAvx512;
+extern const struct SgemmKernel sgemmKernelSse2;
+extern const struct SgemmKernel sgemmKernelAvx2;
+extern const struct SgemmKernel sgemmKernelAvx512;
+extern const struct I32gemmKernel i32gemmKernelScalar;
+extern const struct I32gemmKernel i32gemmKernelAvx2;
+extern const struct I32gemmKernel i32gemmKernelAvx512;
+extern const struct I8gemmKernel i8gemmKernelScalar;
+extern const struct I8gemmKernel i8gemmKernelAvx2;
+
+/*
+ * The fastest variant of every element type for this cpu, see cpuIsa, and the best one up to a given level.
+ */
+const struct GemmKernel* gemmKernel(void);
+const struct SgemmKernel* sgemmKernel(void);
+const struct I32gemmKernel* i32gemmKernel(void);
+const struct I8gemmKernel* i8gemmKernel(void);
+const struct GemmKernel* gemmKernelFor(enum CpuIsa isa);
+const struct SgemmKernel* sgemmKernelFor(enum CpuIsa isa);
+const struct I32gemmKernel* i32gemmKernelFor(enum CpuIsa isa);
+const struct I8gemmKernel* i8gemmKernelFor(enum CpuIsa isa);
+
+/*
+ * res = alpha*a*b + beta*res on the packed GEMM, for use by the other kernels in the library.
+ * Element (i, p) of a is a[i*rsa + p*csa], element (p, j) of b is b[p*rsb + j*csb] and res is row major.
+ */
+void gemmStrided(size_t m, size_t n, size_t k, double alpha, const double* a, size_t rsa, size_t csa,
+        const double* b, size_t rsb, size_t csb, double beta, double* res, size_t ldr, size_t threadCount);
+
+struct EpilogueRun;
+
+// gemmStrided with an epilogue, see epilogue.h
+void gemmStridedEpilogue(size_t m, size_t n, size_t k, double alpha, const double* a, size_t rsa, size_t csa,
+        const double* b, size_t rsb, size_t csb, double beta, double* res, size_t ldr, const struct EpilogueRun* epilogue, size_t threadCount);
+
+struct Prepacked;
+
+/*
+ * Pack op(b) (k x n) once into the panel layout of the packed GEMM, and c = alpha*op(a)*b + beta*c with such a b,
+ * see matmul_gemm.c.
+ */
+struct Prepacked* matmulDgemmPrepackB(bool colMajor, bool transB, size_t k, size_t n, const double* b, size_t ldb);
+void matmulDgemmPrepacked(bool transA, size_t m, double alpha, const double* a, size_t lda, const struct Prepacked* b, double beta,
+        double* c, size_t ldc, size_t threadCount);
+
+/*
+ * c = alpha*op(a)*op(b) + beta*c, see matmul_gemm.c.
+ */
+void matmulDgemm(bool colMajor, bool transA, bool transB, size_t m, size_t n, size_t k, double alpha, const double* a, size_t lda,
+        const double* b, size_t ldb, double beta, double* c, size_t ldc, size_t threadCount);
+
+// The float form of matmulDgemm, see matmul_gemm_float.c
+void matmulSgemm(bool colMajor, bool transA, bool transB, size_t m, size_t n, size_t k, float alpha, const float* a, size_t lda,
+        const float* b, size_t ldb, float beta, float* c, size_t ldc, size_t threadCount);
+
+/*
+ * c = a*b for row major int32 matrices and for int8 ones with an int32 result, wrapping around on overflow, see
+ * matmul_gemm_int.c.
+ */
+void matmulGemmInt32(size_t m, size_t n, size_t k, const int32_t* a, size_t lda, const int32_t* b, size_t ldb, int32_t* c,
+        size_t ldc, size_t threadCount);
+void matmulGemmInt8(size_t m, size_t n, size_t k, const int8_t* a, size_t lda, const int8_t* b, size_t ldb, int32_t* c,
+        size_t ldc, size_t threadCount);
+
+// res = a*b for size x size row major matrices with the AVX tile kernel, see matmul_simd_multithread.c
+void matmulSIMDMT(double* a, double* b, double* res, size_t size, size_t threadCount);
+
+#endif /* __GEMM__ */
@@ -0,0 +1,123 @@
+/*
+ * Type generic register tiled micro kernel (see gemm.h), included once per element type by the instruction set
+ * specific kernel files. There is deliberately no include guard. The includer defines:
+ *
+ *   MICRO_NAME          name of the generated static function
+ *   MICRO_T             element type of a, b and res
+ *   MICRO_VEC           vector type
+ *   MICRO_VLEN          elements per vector
+ *   MICRO_MR            rows of the register tile
+ *   MICRO_NV            vectors per row of the register tile, the tile is MICRO_MR x MICRO_NV*MICRO_VLEN
+ *   MICRO_ZERO()        a vector of zeros
+ *   MICRO_LOAD(p)       an aligned load
+ *   MICRO_LOADU(p)      an unaligned load
+ *   MICRO_STOREU(p, v)  an unaligned store
+ *   MICRO_SET1(x)       x in every lane
+ *   MICRO_MUL(a, b)     a*b
+ *   MICRO_FMA(a, b, c)  a*b + c
+ *
+ * and, when the instruction set has masked memory accesses:
+ *
+ *   MICRO_MASK_T              a lane mask
+ *   MICRO_MASK(n)             the mask of the first n lanes, 0 < n <= MICRO_VLEN
+ *   MICRO_MASKLOAD(p, m)      a load of the lanes in m, the others are zero and their memory is not touched
+ *   MICRO_MASKSTORE(p, m, v)  a store of the lanes in m
+ *
+ * Edge tiles are then read and written with masked accesses straight in res, otherwise they go through a scratch
+ * row.
+ *
+ * The accumulators are MICRO_MR*MICRO_NV vectors that the compiler keeps in registers, so MICRO_MR*(MICRO_NV + 1)
+ * plus MICRO_NV must not exceed the register count. All macros are undefined again at the end.
+ */
+
+#define MICRO_NR (MICRO_NV*MICRO_VLEN)
+
+static void MICRO_NAME(const size_t kc, const MICRO_T* restrict pa, const MICRO_T* restrict pb, MICRO_T* const restrict res, const size_t ldr, const size_t rows, const size_t cols, const MICRO_T alpha, const MICRO_T beta){
+    MICRO_VEC acc[MICRO_MR][MICRO_NV];
+    for (size_t i = 0; i < MICRO_MR; ++i){
+        for (size_t v = 0; v < MICRO_NV; ++v){
+            acc[i][v] = MICRO_ZERO();
+        }
+    }
+    // Unrolling the k loop makes the compiler spill accumulators, every step already is MICRO_MR*MICRO_NV FMAs
+    #pragma GCC unroll 1
+    for (size_t p = 0; p < kc; ++p){
+        MICRO_VEC b[MICRO_NV];
+        for (size_t v = 0; v < MICRO_NV; ++v){
+            b[v] = MICRO_LOAD(pb + v*MICRO_VLEN);
+        }
+        for (size_t i = 0; i < MICRO_MR; ++i){
+            const MICRO_VEC a = MICRO_SET1(pa[i]);
+            for (size_t v = 0; v < MICRO_NV; ++v){
+                acc[i][v] = MICRO_FMA(a, b[v], acc[i][v]);
+            }
+        }
+        pa += MICRO_MR;
+        pb += MICRO_NR;
+    }
+    const MICRO_VEC alphaV = MICRO_SET1(alpha);
+    if (rows == MICRO_MR && cols == MICRO_NR){
+        const MICRO_VEC betaV = MICRO_SET1(beta);
+        for (size_t i = 0; i < MICRO_MR; ++i){
+            MICRO_T* const row = &res[i*ldr];
+            for (size_t v = 0; v < MICRO_NV; ++v){
+                MICRO_VEC x = MICRO_MUL(acc[i][v], alphaV);
+                if (beta != 0) x = MICRO_FMA(betaV, MICRO_LOADU(row + v*MICRO_VLEN), x);
+                MICRO_STOREU(row + v*MICRO_VLEN, x);
+            }
+        }
+        return;
+    }
+#ifdef MICRO_MASK
+    // Edge tiles are read and written in place, the masks keep every access inside the matrix
+    const MICRO_VEC betaV = MICRO_SET1(beta);
+    for (size_t v = 0; v < MICRO_NV && v*MICRO_VLEN < cols; ++v){
+        const size_t lanes = cols - v*MICRO_VLEN < MICRO_VLEN ? cols - v*MICRO_VLEN : MICRO_VLEN;
+        const MICRO_MASK_T mask = MICRO_MASK(lanes);
+        for (size_t i = 0; i < rows; ++i){
+            MICRO_T* const p = &res[i*ldr + v*MICRO_VLEN];
+            MICRO_VEC x = MICRO_MUL(acc[i][v], alphaV);
+            if (beta != 0) x = MICRO_FMA(betaV, MICRO_MASKLOAD(p, mask), x);
+            MICRO_MASKSTORE(p, mask, x);
+        }
+    }
+#else
+    // Edge tiles go through a scratch row so that nothing outside the matrix is touched. The row is combined with
+    // the same macros as a full tile, so that the arithmetic is that of the includer's type.
+    const MICRO_VEC betaV = MICRO_SET1(beta);
+    MICRO_T tile[MICRO_NR] __attribute__((aligned(64)));
+    for (size_t i = 0; i < rows; ++i){
+        MICRO_T* const row = &res[i*ldr];
+        for (size_t j = 0; j < MICRO_NR; ++j){
+            tile[j] = beta != 0 && j < cols ? row[j] : 0;
+        }
+        for (size_t v = 0; v < MICRO_NV; ++v){
+            MICRO_VEC x = MICRO_MUL(acc[i][v], alphaV);
+            if (beta != 0) x = MICRO_FMA(betaV, MICRO_LOAD(tile + v*MICRO_VLEN), x);
+            MICRO_STOREU(tile + v*MICRO_VLEN, x);
+        }
+        for (size_t j = 0; j < cols; ++j){
+            row[j] = tile[j];
+        }
+    }
+#endif
+}
+
+#undef MICRO_NR
+#undef MICRO_NAME
+#undef MICRO_T
+#undef MICRO_VEC
+#undef MICRO_VLEN
+#undef MICRO_MR
+#undef MICRO_NV
+#undef MICRO_ZERO
+#undef MICRO_LOAD
+#undef MICRO_LOADU
+#undef MICRO_STOREU
+#undef MICRO_SET1
+#undef MICRO_MUL
+#undef MICRO_FMA
+#undef MICRO_MASK_T
+#undef MICRO_MASK
+#undef MICRO_MASKLOAD
+#undef MICRO_MASKSTORE
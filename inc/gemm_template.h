@@ -0,0 +1,347 @@
+/*
+ * Type generic Goto/BLIS style blocked matrix multiply, included once per element type by the GEMM translation
+ * units. There is deliberately no include guard. The includer defines:
+ *
+ *   GEMM_T         element type of a and b
+ *   GEMM_ACC       element type of res, alpha and beta
+ *   GEMM_KERNEL    the kernel descriptor type (see gemm.h)
+ *   GEMM_SELECT()  the kernel descriptor for this cpu
+ *   GEMM_SELECT_ISA(isa)  the kernel descriptor for an instruction set level up to that of this cpu
+ *   GEMM_TUNE      the enum TuneKernel of the type, for the tuning profile (see tune.h)
+ *   GEMM_EPILOGUE  the epilogue function for GEMM_ACC tiles (see epilogue.h)
+ *   GEMM_FN(x)     prefixes the generated names, so one file can instantiate several types
+ *
+ * The loops around the micro kernel are ordered jc (nc) -> pc (kc) -> ic (mc) -> jr (nr) -> ir (mr).
+ * A kc x nc panel of b is packed so that it stays in L3, a mc x kc block of a is packed so that it stays in L2
+ * and the micro kernel streams a kc x nr sliver of b through L1 while the mr x nr tile of res lives in registers.
+ * The micro kernel and the block sizes come from the instruction set variant picked at runtime (see gemm.h), the
+ * code in this file is plain C so that it runs on every cpu.
+ */
+
+#ifndef GEMM_TEMPLATE_SHARED
+#define GEMM_TEMPLATE_SHARED
+
+// Panels come from the scratch arena (see arena.h), so consecutive calls reuse them and the large ones sit on huge pages
+static inline void* allocPanel(const size_t bytes){
+    return arenaAlloc(bytes);
+}
+
+// With pinned workers on several nodes (see threadPoolNuma) panels are placed on the node of the worker that reads them
+static inline void* allocNodePanel(const size_t bytes, const bool nodeLocal, const size_t node){
+    return nodeLocal ? arenaAllocNode(bytes, node) : allocPanel(bytes);
+}
+
+static inline size_t roundUp(const size_t value, const size_t multiple){
+    return ((value + multiple - 1)/multiple)*multiple;
+}
+
+static inline void checkLeadingDimension(const char* const name, const size_t ld, const size_t minimum){
+    if (ld < minimum || ld == 0){
+        fprintf(stderr, "Leading dimension %s is %zu, but must be at least %zu\n", name, ld, minimum > 0 ? minimum : 1);
+        exit(1);
+    }
+}
+
+#endif /* GEMM_TEMPLATE_SHARED */
+
+/*
+ * Pack a mc x kc block of a into micro panels of mr rows. Within a micro panel the mr values of one column (or,
+ * with a kgroup above one, of kgroup neighbouring columns) are consecutive, so the micro kernel reads a with unit
+ * stride. Rows beyond mc and columns beyond kc are padded with zeros.
+ * Element (i, p) of the block is a[i*rsa + p*csa], which covers row major, column major and transposed operands.
+ */
+static void GEMM_FN(PackA)(const GEMM_T* const restrict a, const size_t rsa, const size_t csa, const size_t mc, const size_t kc, const size_t mr, const size_t group, GEMM_T* restrict packed){
+    const size_t kcPadded = roundUp(kc, group);
+    for (size_t i = 0; i < mc; i += mr){
+        const size_t rows = mc - i < mr ? mc - i : mr;
+        for (size_t r = 0; r < rows; ++r){
+            const GEMM_T* const row = &a[(i + r)*rsa];
+            if (group == 1){
+                for (size_t p = 0; p < kc; ++p){
+                    packed[p*mr + r] = row[p*csa];
+                }
+            } else {
+                for (size_t p = 0; p < kcPadded; ++p){
+                    packed[((p/group)*mr + r)*group + p%group] = p < kc ? row[p*csa] : 0;
+                }
+            }
+        }
+        for (size_t r = rows; r < mr; ++r){
+            for (size_t p = 0; p < kcPadded; ++p){
+                packed[((p/group)*mr + r)*group + p%group] = 0;
+            }
+        }
+        packed += mr*kcPadded;
+    }
+}
+
+/*
+ * Pack a kc x nc panel of b into micro panels of nr columns. Within a micro panel the nr values of one row (or the
+ * kgroup values of one column, for all nr columns) are consecutive. Columns beyond nc and rows beyond kc are padded
+ * with zeros. Element (p, j) of the panel is b[p*rsb + j*csb].
+ */
+static void GEMM_FN(PackB)(const GEMM_T* const restrict b, const size_t rsb, const size_t csb, const size_t kc, const size_t nc, const size_t nr, const size_t group, GEMM_T* restrict packed){
+    const size_t kcPadded = roundUp(kc, group);
+    for (size_t j = 0; j < nc; j += nr){
+        const size_t cols = nc - j < nr ? nc - j : nr;
+        if (group == 1){
+            for (size_t p = 0; p < kc; ++p){
+                const GEMM_T* const row = &b[p*rsb + j*csb];
+                if (csb == 1){
+                    memcpy(packed, row, cols*sizeof(GEMM_T));
+                } else {
+                    for (size_t c = 0; c < cols; ++c){
+                        packed[c] = row[c*csb];
+                    }
+                }
+                for (size_t c = cols; c < nr; ++c){
+                    packed[c] = 0;
+                }
+                packed += nr;
+            }
+        } else {
+            for (size_t p = 0; p < kcPadded; ++p){
+                GEMM_T* const dst = &packed[(p/group)*nr*group + p%group];
+                for (size_t c = 0; c < nr; ++c){
+                    dst[c*group] = p < kc && c < cols ? b[p*rsb + (j + c)*csb] : 0;
+                }
+            }
+            packed += nr*kcPadded;
+        }
+    }
+}
+
+/*
+ * Multiply a packed mc x kc block of a with a packed kc x nc panel of b into res. With an epilogue, which is only
+ * passed for the last block of k, every tile is finished right after the micro kernel wrote it, (row, col) is the
+ * position of res in the product. res is NULL for a converted output that needs no partial sums, the tiles then go
+ * through a scratch tile on the stack.
+ */
+static void GEMM_FN(MacroKernel)(const GEMM_KERNEL* const kernel, const size_t mc, const size_t nc, const size_t kc, const GEMM_T* const restrict pa, const GEMM_T* const restrict pb, GEMM_ACC* const restrict res, const size_t ldr, const GEMM_ACC alpha, const GEMM_ACC beta,
+        const struct EpilogueRun* const epilogue, const size_t row, const size_t col){
+    const size_t mr = kernel->mr;
+    const size_t nr = kernel->nr;
+    const size_t kcPadded = roundUp(kc, kernel->kgroup);
+    GEMM_ACC tile[res == NULL ? mr*nr : 1];
+    for (size_t j = 0; j < nc; j += nr){
+        const size_t cols = nc - j < nr ? nc - j : nr;
+        for (size_t i = 0; i < mc; i += mr){
+            const size_t rows = mc - i < mr ? mc - i : mr;
+            GEMM_ACC* const dst = res != NULL ? &res[i*ldr + j] : tile;
+            const size_t ldd = res != NULL ? ldr : nr;
+            kernel->micro(kcPadded, &pa[i*kcPadded], &pb[j*kcPadded], dst, ldd, rows, cols, alpha, beta);
+            if (epilogue != NULL) GEMM_EPILOGUE(epilogue, row + i, col + j, rows, cols, dst, ldd);
+        }
+    }
+}
+
+/*
+ * Describes res = alpha*a*b + beta*res with a m x k, b k x n and res m x n. Element (i, p) of a is
+ * a[i*rsa + p*csa], element (p, j) of b is b[p*rsb + j*csb] and res is row major with leading dimension ldr.
+ */
+struct GEMM_FN(Job) {
+    const GEMM_KERNEL* kernel;
+    size_t m;
+    const GEMM_T* a;
+    size_t rsa;
+    size_t csa;
+    const GEMM_T* b;
+    size_t rsb;
+    size_t csb;
+    GEMM_ACC* res;
+    size_t ldr;
+    GEMM_ACC alpha;
+    GEMM_ACC beta;
+    // Applied on the last block of k, NULL for none
+    const struct EpilogueRun* epilogue;
+    // The column of res that holds column jc of the product, 0 when res is a scratch panel
+    size_t resColumn;
+    bool lastBlock;
+    size_t jc;
+    size_t nc;
+    size_t pc;
+    size_t kc;
+    size_t chunkColumns;
+    size_t tileColumns;
+    // When set, b is ignored and its panels are taken from here instead of being packed per call. One copy per
+    // node when b was replicated, prepackedNodes long.
+    const GEMM_T* const* prepacked;
+    size_t prepackedNodes;
+    // The current b panel, one copy for each of the nodes the workers span when replicating
+    GEMM_T** pb;
+    size_t nodes;
+    // The node of every worker when the run was set up, see threadPoolNodeMap
+    const size_t* workerNodes;
+    GEMM_T** pa;
+};
+
+// Pack the part of the current b panel that belongs to one chunk of columns, into the copy of one node
+static void GEMM_FN(PackBTask)(void* s, const size_t task, const size_t worker){
+    (void)worker;
+    const struct GEMM_FN(Job)* job = s;
+    const size_t j = (task % job->tileColumns)*job->chunkColumns;
+    const size_t cols = job->nc - j < job->chunkColumns ? job->nc - j : job->chunkColumns;
+    GEMM_FN(PackB)(&job->b[job->pc*job->rsb + (job->jc + j)*job->csb], job->rsb, job->csb, job->kc, cols, job->kernel->nr, job->kernel->kgroup,
+            &job->pb[task/job->tileColumns][j*roundUp(job->kc, job->kernel->kgroup)]);
+}
+
+// Compute one mc x chunkColumns tile of res, packing the block of a it needs into the buffer of the worker
+static void GEMM_FN(ComputeTask)(void* s, const size_t task, const size_t worker){
+    const struct GEMM_FN(Job)* job = s;
+    const size_t blockRows = job->kernel->mc;
+    const size_t ic = (task / job->tileColumns)*blockRows;
+    const size_t j = (task % job->tileColumns)*job->chunkColumns;
+    const size_t mc = job->m - ic < blockRows ? job->m - ic : blockRows;
+    const size_t cols = job->nc - j < job->chunkColumns ? job->nc - j : job->chunkColumns;
+    GEMM_T* const pa = job->pa[worker];
+    GEMM_FN(PackA)(&job->a[ic*job->rsa + job->pc*job->csa], job->rsa, job->csa, mc, job->kc, job->kernel->mr, job->kernel->kgroup, pa);
+    // Only the first block of k applies beta, the later ones accumulate onto it
+    const GEMM_ACC beta = job->pc == 0 ? job->beta : 1;
+    const GEMM_T* const pb = job->pb[job->nodes > 1 ? job->workerNodes[worker] : 0];
+    GEMM_FN(MacroKernel)(job->kernel, mc, cols, job->kc, pa, &pb[j*roundUp(job->kc, job->kernel->kgroup)],
+            job->res != NULL ? &job->res[ic*job->ldr + job->resColumn + j] : NULL, job->ldr, job->alpha, beta,
+            job->lastBlock ? job->epilogue : NULL, ic, job->jc + j);
+}
+
+/*
+ * A prepacked b holds, for every nc wide block of columns, the packed kc x nc panels of all blocks of k after each
+ * other. Every block but the last is nc wide and only the last block of k is padded to a multiple of kgroup, so the
+ * block starting at column jc starts at jc*roundUp(k, kgroup).
+ */
+static inline size_t GEMM_FN(PanelOffset)(const GEMM_KERNEL* const kernel, const size_t k, const size_t jc, const size_t pc, const size_t nc){
+    return jc*roundUp(k, kernel->kgroup) + pc*roundUp(nc, kernel->nr);
+}
+
+static void GEMM_FN(ScaleResult)(const size_t m, const size_t n, GEMM_ACC* const restrict res, const size_t ldr, const GEMM_ACC beta){
+    for (size_t i = 0; i < m; ++i){
+        for (size_t j = 0; j < n; ++j){
+            res[i*ldr + j] = beta == 0 ? 0 : beta*res[i*ldr + j];
+        }
+    }
+}
+
+// The result of an empty product, beta*c run through the epilogue
+static void GEMM_FN(EmptyProduct)(const struct GEMM_FN(Job)* const job, const size_t n){
+    if (!epilogueConverts(job->epilogue)){
+        GEMM_FN(ScaleResult)(job->m, n, job->res, job->ldr, job->beta);
+        if (job->epilogue != NULL) GEMM_EPILOGUE(job->epilogue, 0, 0, job->m, n, job->res, job->ldr);
+        return;
+    }
+    GEMM_ACC* const zeros = calloc(n, sizeof(GEMM_ACC));
+    if (zeros == NULL){
+        fprintf(stderr, "Failed to allocate a row of %zu zeros\n", n);
+        exit(1);
+    }
+    for (size_t i = 0; i < job->m; ++i){
+        GEMM_EPILOGUE(job->epilogue, i, 0, 1, n, zeros, n);
+        memset(zeros, 0, n*sizeof(GEMM_ACC));
+    }
+    free(zeros);
+}
+
+/*
+ * The tuning profile may pick another variant, other block sizes and fewer threads for the shape. The layout of a
+ * prepacked b depends on the variant, kc and nc, so only mc and the thread count apply to it.
+ */
+static void GEMM_FN(ApplyTuning)(GEMM_KERNEL* const kernel, const size_t m, const size_t n, const size_t k, const bool packsB, size_t* const workers){
+    struct TuneConfig config;
+    if (!tuneLookup(GEMM_TUNE, m, n, k, *workers, &config)) return;
+    if (packsB && config.isa <= cpuIsa()) *kernel = *GEMM_SELECT_ISA(config.isa);
+    if (config.mc > 0) kernel->mc = roundUp(config.mc, kernel->mr);
+    if (packsB && config.kc > 0) kernel->kc = roundUp(config.kc, kernel->kgroup);
+    if (packsB && config.nc > 0) kernel->nc = roundUp(config.nc, kernel->nr);
+    if (config.threads > 0 && config.threads < *workers) *workers = config.threads;
+}
+
+static void GEMM_FN(Run)(struct GEMM_FN(Job)* const job, const size_t n, const size_t k, const size_t threadCount){
+    const size_t m = job->m;
+    if (m == 0 || n == 0) return;
+    // A converted output applies beta itself, the kernels start from zero
+    if (epilogueConverts(job->epilogue)) job->beta = 0;
+    if (k == 0 || job->alpha == 0){
+        GEMM_FN(EmptyProduct)(job, n);
+        return;
+    }
+    size_t workers = threadCount == 1 ? 1 : threadPoolSize();
+    if (threadCount != 0 && threadCount < workers) workers = threadCount;
+    GEMM_KERNEL tuned = *GEMM_SELECT();
+    GEMM_FN(ApplyTuning)(&tuned, m, n, k, job->prepacked == NULL, &workers);
+    const GEMM_KERNEL* const kernel = &tuned;
+    job->kernel = kernel;
+    // The panels and the compute tasks use the same snapshot of the nodes, even if the pool is resized meanwhile
+    size_t workerNodes[workers];
+    const size_t spanned = threadPoolNodeMap(workers, workerNodes);
+    const bool nodeLocal = spanned > 1;
+    job->nodes = threadPoolNuma() == POOL_NUMA_REPLICATE ? spanned : 1;
+    job->workerNodes = workerNodes;
+    const size_t paBytes = kernel->mc*kernel->kc*sizeof(GEMM_T);
+    GEMM_T* pa[workers];
+    for (size_t i = 0; i < workers; ++i){
+        pa[i] = allocNodePanel(paBytes, nodeLocal, workerNodes[i]);
+    }
+    job->pa = pa;
+    const size_t pbBytes = kernel->kc*(kernel->nc < n ? kernel->nc : roundUp(n, kernel->nr))*sizeof(GEMM_T);
+    GEMM_T* pbBuffers[job->nodes];
+    GEMM_T* pb[job->nodes];
+    for (size_t node = 0; node < job->nodes; ++node){
+        pbBuffers[node] = job->prepacked == NULL ? allocNodePanel(pbBytes, nodeLocal, node) : NULL;
+    }
+    job->pb = pb;
+    // Partial sums of a converted output over several blocks of k go to the caller's c or to one panel of scratch
+    GEMM_ACC* scratch = NULL;
+    const size_t scratchColumns = kernel->nc < n ? kernel->nc : n;
+    if (epilogueConverts(job->epilogue) && k <= kernel->kc){
+        job->res = NULL;
+    } else if (epilogueConverts(job->epilogue) && job->res == NULL){
+        scratch = allocPanel(m*scratchColumns*sizeof(GEMM_ACC));
+        job->res = scratch;
+        job->ldr = scratchColumns;
+    }
+    const size_t rowBlocks = (m + kernel->mc - 1)/kernel->mc;
+    for (size_t jc = 0; jc < n; jc += kernel->nc){
+        job->jc = jc;
+        job->nc = n - jc < kernel->nc ? n - jc : kernel->nc;
+        job->resColumn = scratch != NULL ? 0 : jc;
+        // Split the panel into column chunks until there are enough tiles to keep every worker busy
+        job->chunkColumns = roundUp(job->nc, kernel->nr);
+        while (workers > 1 && rowBlocks*((job->nc + job->chunkColumns - 1)/job->chunkColumns) < 4*workers && job->chunkColumns > 4*kernel->nr){
+            job->chunkColumns = roundUp(job->chunkColumns/2, kernel->nr);
+        }
+        job->tileColumns = (job->nc + job->chunkColumns - 1)/job->chunkColumns;
+        for (size_t pc = 0; pc < k; pc += kernel->kc){
+            job->pc = pc;
+            job->kc = k - pc < kernel->kc ? k - pc : kernel->kc;
+            job->lastBlock = pc + job->kc == k;
+            if (job->prepacked == NULL){
+                for (size_t node = 0; node < job->nodes; ++node) pb[node] = pbBuffers[node];
+                const double start = statsStart();
+                threadPoolRun(workers, job->nodes*job->tileColumns, GEMM_FN(PackBTask), job);
+                statsStop(MATMUL_PHASE_PACK, start);
+            } else {
+                for (size_t node = 0; node < job->nodes; ++node){
+                    const GEMM_T* const panels = job->prepacked[node < job->prepackedNodes ? node : 0];
+                    pb[node] = (GEMM_T*)&panels[GEMM_FN(PanelOffset)(kernel, k, jc, pc, job->nc)];
+                }
+            }
+            const double start = statsStart();
+            threadPoolRun(workers, rowBlocks*job->tileColumns, GEMM_FN(ComputeTask), job);
+            statsStop(MATMUL_PHASE_COMPUTE, start);
+        }
+    }
+    for (size_t i = 0; i < workers; ++i){
+        arenaRelease(pa[i]);
+    }
+    for (size_t node = 0; node < job->nodes; ++node){
+        arenaRelease(pbBuffers[node]);
+    }
+    arenaRelease(scratch);
+}
+
+#undef GEMM_T
+#undef GEMM_ACC
+#undef GEMM_KERNEL
+#undef GEMM_SELECT
+#undef GEMM_SELECT_ISA
+#undef GEMM_TUNE
+#undef GEMM_EPILOGUE
+#undef GEMM_FN
@@ -0,0 +1,41 @@
+#ifndef __GEMV__
+#define __GEMV__
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Matrix times vector, y = alpha*a*x + beta*y for a row major m x n a, or y = alpha*a^T*x + beta*y when trans is set.
+ * x and y are contiguous, y is not read when beta is zero. A GEMV does two flops for every element of a it loads, so
+ * it runs at the speed of memory: the kernels stream the rows of a once, in place, and the rows (a*x) or the rows and
+ * the columns (a^T*x) are split across the pool threads. threadCount limits the pool threads, zero uses all of them.
+ */
+void matmulGemv(bool trans, size_t m, size_t n, double alpha, const double* a, size_t lda, const double* x, double beta,
+        double* y, size_t threadCount);
+
+/*
+ * A chain of products res = a[0]*a[1]*...*a[count - 1], matrix i being a row major dims[i] x dims[i + 1] array.
+ * The plan picks the order with the fewest multiply-adds by dynamic programming over the dims, and owns one workspace
+ * that holds every intermediate product, so that running it again allocates nothing. A dims of 1 at either end
+ * makes the chain end in a vector, those products run on the GEMV.
+ */
+struct MatmulChain;
+
+struct MatmulChain* matmulChainPlan(size_t count, const size_t* dims);
+void matmulChainRun(const struct MatmulChain* plan, const double* const* a, double* res, size_t threadCount);
+// The multiply-adds of the order of the plan, and of the left to right order
+double matmulChainCost(const struct MatmulChain* plan);
+double matmulChainNaiveCost(const struct MatmulChain* plan);
+void matmulChainFree(struct MatmulChain* plan);
+
+/*
+ * dots[i] = row i of a times x for rows rows of n elements, and acc[j] += sum over i of x[i]*a[i][j] for cols
+ * columns. The first kernel is the a*x GEMV, the second the a^T*x one.
+ */
+typedef void (*GemvRows)(size_t rows, size_t n, const double* a, size_t lda, const double* x, double* dots);
+typedef void (*GemvColumns)(size_t rows, size_t cols, const double* a, size_t lda, const double* x, double* acc);
+
+void gemvRowsAvx2(size_t rows, size_t n, const double* a, size_t lda, const double* x, double* dots);
+void gemvColumnsAvx2(size_t rows, size_t cols, const double* a, size_t lda, const double* x, double* acc);
+
+#endif /* __GEMV__ */
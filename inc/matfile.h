@@ -0,0 +1,79 @@
+#ifndef __MATFILE__
+#define __MATFILE__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * On-disk matrices for products that do not fit in memory. A file is a MATFILE_HEADER_BYTES header followed by the
+ * matrix in square tiles: the tiles are stored row after row of tiles, every tile is tile x tile elements in row
+ * major order, and the tiles on the right and bottom edge are padded with zeros to full size. A tile is one
+ * contiguous, page aligned range of the file, so it can be mapped, prefetched and dropped on its own.
+ * All fields are little endian.
+ */
+
+#define MATFILE_MAGIC "MATMULF"
+#define MATFILE_VERSION 1
+#define MATFILE_HEADER_BYTES 4096
+// Tiles are a multiple of this, so that every tile starts on a page
+#define MATFILE_TILE_ALIGN 64
+#define MATFILE_DEFAULT_TILE 512
+
+enum MatFileType {
+    MATFILE_FLOAT64 = 1,
+};
+
+struct MatFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t type;
+    uint64_t rows;
+    uint64_t cols;
+    uint64_t tile;
+    uint64_t dataOffset;
+};
+
+/*
+ * An open matrix file, mapped whole. The mapping only reserves address space, pages are read on first touch.
+ */
+struct MatFile {
+    int fd;
+    bool writable;
+    size_t rows;
+    size_t cols;
+    size_t tile;
+    size_t tileRows;
+    size_t tileCols;
+    unsigned char* map;
+    size_t mapBytes;
+    double* data;
+};
+
+/*
+ * Create (or truncate) a rows x cols float64 matrix file of zeros with the given tile size, zero picks
+ * MATFILE_DEFAULT_TILE. The file is sparse until written.
+ */
+struct MatFile* matfileCreate(const char* path, size_t rows, size_t cols, size_t tile);
+
+struct MatFile* matfileOpen(const char* path, bool writable);
+
+void matfileClose(struct MatFile* file);
+
+size_t matfileRows(const struct MatFile* file);
+size_t matfileCols(const struct MatFile* file);
+
+/*
+ * Tile (i, j), tile x tile doubles.
+ */
+double* matfileTile(const struct MatFile* file, size_t i, size_t j);
+
+size_t matfileTileBytes(const struct MatFile* file);
+
+/*
+ * Copy count rows starting at row between the file and a row major buffer with leading dimension ld.
+ */
+void matfileWriteRows(struct MatFile* file, size_t row, size_t count, const double* src, size_t ld);
+void matfileReadRows(const struct MatFile* file, size_t row, size_t count, double* dst, size_t ld);
+
+#endif /* __MATFILE__ */
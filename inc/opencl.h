@@ -0,0 +1,41 @@
+#ifndef __MATMUL_OPENCL__
+#define __MATMUL_OPENCL__
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * The OpenCL side of the library as used by the other kernels, see matmul_opencl.c. Matrices are size x size and
+ * row major. Requests run asynchronously: the host matrices they were started with must stay valid until
+ * matmulOpenClWait returns.
+ */
+
+struct ClPrepacked;
+struct ClRequest;
+
+/*
+ * Whether an OpenCL device is available, initializing it if so.
+ */
+bool matmulOpenClAvailable(void);
+
+struct ClPrepacked* matmulOpenClPrepackB(const double* b, size_t size);
+
+void matmulOpenClFreePrepacked(struct ClPrepacked* prepacked);
+
+struct ClRequest* matmulOpenClAsync(const double* a, const double* b, double* res, size_t size);
+
+struct ClRequest* matmulOpenClPrepackedAsync(const double* a, const struct ClPrepacked* prepacked, double* res, size_t size);
+
+/*
+ * Rows [rowBegin, rowEnd) of res = a*b.
+ */
+struct ClRequest* matmulOpenClRowsAsync(const double* a, const struct ClPrepacked* prepacked, double* res, size_t size, size_t rowBegin, size_t rowEnd);
+
+bool matmulOpenClDone(const struct ClRequest* request);
+
+/*
+ * Block until the request is done and free it.
+ */
+void matmulOpenClWait(struct ClRequest* request);
+
+#endif /* __MATMUL_OPENCL__ */
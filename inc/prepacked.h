@@ -0,0 +1,64 @@
+#ifndef __PREPACKED__
+#define __PREPACKED__
+
+#include <stddef.h>
+
+enum PrepackedLayout {
+    // b^T stored row major, as consumed by the dot product kernels that walk a row of a and a row of b^T
+    PREPACKED_TRANSPOSED,
+    // The KC x NR micro panels of b in the order the packed GEMM consumes them
+    PREPACKED_PANELS,
+};
+
+/*
+ * A right hand operand b (rows x columns) that was rearranged once into the layout a kernel prefers, so that many
+ * multiplies with the same b skip the allocation and the rearranging pass. Python only sees an opaque pointer.
+ */
+struct Prepacked {
+    enum PrepackedLayout layout;
+    size_t rows;
+    size_t columns;
+    double* data;
+    // Node local memory (see threadPoolNuma): data on every node the readers span, replicas[0] is data. NULL when
+    // data is a plain allocation.
+    double** replicas;
+    size_t replicaCount;
+    size_t bytes;
+};
+
+/*
+ * Allocate a handle with room for elements doubles, 64 byte aligned, for kernels that read it on threadCount pool
+ * threads (zero means all). With MATMUL_NUMA=replicate and readers on several nodes there is a replica per node,
+ * fill data and call prepackedReplicate.
+ */
+struct Prepacked* prepackedAlloc(enum PrepackedLayout layout, size_t rows, size_t columns, size_t elements, size_t threadCount);
+
+/*
+ * Copy data to the other replicas, if any.
+ */
+void prepackedReplicate(struct Prepacked* prepacked);
+
+/*
+ * The copy of the data closest to a pool worker, as passed to a task.
+ */
+double* prepackedData(const struct Prepacked* prepacked, size_t worker);
+
+/*
+ * Exit with an error when the handle does not hold a rows x columns matrix in the given layout.
+ */
+void prepackedCheck(const struct Prepacked* prepacked, enum PrepackedLayout layout, size_t rows, size_t columns, const char* caller);
+
+/*
+ * Transpose a size x size b once for matmulMTPrepacked, matmulSIMDMTPrepacked, simdMultiplyFourPrepacked and
+ * simdMoreOptimizedPrepacked.
+ */
+struct Prepacked* matmulPrepackB(const double* b, size_t size);
+
+/*
+ * matmulPrepackB on threadCount pool threads (zero means all), for kernels that read it on as many.
+ */
+struct Prepacked* prepackedTranspose(const double* b, size_t size, size_t threadCount);
+
+void matmulFreePrepacked(struct Prepacked* prepacked);
+
+#endif /* __PREPACKED__ */
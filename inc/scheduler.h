@@ -0,0 +1,40 @@
+#ifndef __SCHEDULER__
+#define __SCHEDULER__
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Multiplies submitted from many threads at once, like the threads of a service that calls the library through
+ * ctypes. Jobs go into one process wide queue that a dispatcher thread drains into the pool, a round at a time, so
+ * every core works on one job and the callers only block in matmulJobWait:
+ *  - small jobs of a round run together as one pool run, one serial job per task, so that a stream of them pays for
+ *    one wake up of the pool instead of one each;
+ *  - large jobs run one per task as well while the round has at least as many of them as there are pool threads,
+ *    and otherwise one after another on all threads.
+ * The matrices of a job must stay valid until matmulJobWait returns. Jobs do not count toward the stats section of
+ * the submitting thread, and must not be waited for from inside a pool task, whose run blocks the dispatcher.
+ */
+struct MatmulJob;
+
+/*
+ * Queue c = alpha*op(a)*op(b) + beta*c and return without waiting. The arguments are those of matmulDgemm, see
+ * matmul_gemm.c.
+ */
+struct MatmulJob* matmulSubmitDgemm(bool colMajor, bool transA, bool transB, size_t m, size_t n, size_t k,
+        double alpha, const double* a, size_t lda, const double* b, size_t ldb, double beta, double* c, size_t ldc);
+
+// res = a*b for size x size row major matrices
+struct MatmulJob* matmulSubmit(const double* a, const double* b, double* res, size_t size);
+
+/*
+ * Whether c of the job is ready, without blocking.
+ */
+bool matmulJobDone(const struct MatmulJob* job);
+
+/*
+ * Block until c of the job is ready, then free the job.
+ */
+void matmulJobWait(struct MatmulJob* job);
+
+#endif /* __SCHEDULER__ */
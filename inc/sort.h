@@ -0,0 +1,37 @@
+#ifndef __SORT__
+#define __SORT__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Ascending sorts of int32 keys. Inputs below a few thousand keys are cut into blocks of 64 that an AVX2 sorting
+ * network turns into runs of 8, which are then merged. Larger ones take an LSD radix sort on bytes that skips the
+ * bytes all keys share. With more than one thread the input is split into one chunk per thread, the chunks are
+ * sorted on the pool and merged pairwise, every merge split into pieces at the merge path so that all threads take
+ * part. threadCount limits the pool threads, zero uses all of them.
+ */
+
+void sortInt32(int32_t* keys, size_t size, size_t threadCount);
+
+/*
+ * Sort keys and move values along with them. Equal keys keep their order.
+ */
+void sortInt32Pairs(int32_t* keys, int32_t* values, size_t size, size_t threadCount);
+
+/*
+ * The indices that sort keys, in a stable order, without changing keys. size must fit in an int32.
+ */
+void argsortInt32(const int32_t* keys, int32_t* indices, size_t size, size_t threadCount);
+
+/*
+ * sortInt32 on all pool threads.
+ */
+void sortList(int32_t* list, size_t size);
+
+/*
+ * Sort each of the first blocks*64 keys block of 64 into 8 consecutive runs of 8, with AVX2.
+ */
+void sortRunsAvx2(int32_t* keys, size_t blocks);
+
+#endif /* __SORT__ */
@@ -0,0 +1,35 @@
+#ifndef __SPMM__
+#define __SPMM__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Sparse times dense products, res = a*b with a sparse m x k a in CSR or block CSR (BSR) form and a dense row major
+ * k x n b. A BSR a is made of dense blockRows x blockCols blocks: indptr has m/blockRows + 1 entries, block p sits at
+ * block column indices[p] and its values are data[p*blockRows*blockCols...] row major, like scipy.sparse.bsr_matrix.
+ * CSR is the same with 1 x 1 blocks. indptr does not have to start at zero, so a slice of the rows of a larger
+ * matrix can be passed. Column indices must be in range, within a row they may come in any order.
+ *
+ * The kernels keep a strip of a row of res in registers and stream the matching strips of the rows of b, so every
+ * block costs one broadcast and one multiply-add per vector. The work is split across the pool threads along the
+ * merge path of the row ends and the blocks, which gives every thread the same amount of blocks plus rows, however
+ * unevenly the nonzeros are spread: a row shared by several threads is summed in pieces that are added up at the end.
+ * threadCount limits the pool threads, zero uses all of them.
+ */
+void matmulCsrDense(size_t m, size_t n, size_t k, const int64_t* indptr, const int32_t* indices, const double* data,
+        const double* b, size_t ldb, double* res, size_t ldr, size_t threadCount);
+
+void matmulBsrDense(size_t m, size_t n, size_t k, size_t blockRows, size_t blockCols, const int64_t* indptr,
+        const int32_t* indices, const double* data, const double* b, size_t ldb, double* res, size_t ldr, size_t threadCount);
+
+/*
+ * res (blockRows x n, leading dimension ldr) = the blocks [0, count) of one block row times b, overwriting res.
+ */
+typedef void (*SpmmRow)(size_t count, const int32_t* indices, const double* data, size_t blockRows, size_t blockCols,
+        const double* b, size_t ldb, size_t n, double* res, size_t ldr);
+
+void spmmRowAvx2(size_t count, const int32_t* indices, const double* data, size_t blockRows, size_t blockCols,
+        const double* b, size_t ldb, size_t n, double* res, size_t ldr);
+
+#endif /* __SPMM__ */
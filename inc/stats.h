@@ -0,0 +1,91 @@
+#ifndef __MATMUL_STATS__
+#define __MATMUL_STATS__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Opt-in instrumentation. Between matmulStatsBegin and matmulStatsEnd the library calls made on the calling thread
+ * add the wall time of their phases, the busy time of every pool worker and, on Linux, hardware counters of the
+ * calling thread and the pool workers to one MatmulStats. Device phases come from OpenCL event profiling. Outside a
+ * section every hook is a thread local load and a branch.
+ */
+
+enum MatmulPhase {
+    // b^T for the dot product kernels
+    MATMUL_PHASE_TRANSPOSE,
+    // Zeroing res before the kernels accumulate into it
+    MATMUL_PHASE_CLEAR,
+    // Packing panels of b for the packed GEMM, a is packed inside the compute tasks
+    MATMUL_PHASE_PACK,
+    MATMUL_PHASE_COMPUTE,
+    // Starting pool threads and handing a run to them
+    MATMUL_PHASE_THREADS,
+    MATMUL_PHASE_DEVICE_UPLOAD,
+    MATMUL_PHASE_DEVICE_KERNEL,
+    MATMUL_PHASE_DEVICE_DOWNLOAD,
+    MATMUL_PHASE_COUNT,
+};
+
+enum MatmulCounter {
+    MATMUL_COUNTER_CYCLES,
+    MATMUL_COUNTER_INSTRUCTIONS,
+    MATMUL_COUNTER_LLC_MISSES,
+    // There is no generic event for it, MATMUL_PERF_FP_EVENT holds the raw event of the cpu in hex. On Intel 0x15c7
+    // is FP_ARITH_INST_RETIRED for scalar, 128 and 256 bit doubles, which counts instructions rather than flops.
+    MATMUL_COUNTER_FP_OPS,
+    MATMUL_COUNTER_COUNT,
+};
+
+// Workers with a higher index are not reported
+#define MATMUL_STATS_MAX_WORKERS 256
+
+struct MatmulStats {
+    // Wall time between matmulStatsBegin and matmulStatsEnd
+    double seconds;
+    double phaseSeconds[MATMUL_PHASE_COUNT];
+    // Time every worker spent in tasks and the amount of tasks it ran, workerCount is the highest worker seen + 1
+    size_t workerCount;
+    double workerSeconds[MATMUL_STATS_MAX_WORKERS];
+    uint64_t workerTasks[MATMUL_STATS_MAX_WORKERS];
+    // Summed over the calling thread and the pool workers. A counter the kernel refused to open stays invalid.
+    uint64_t counters[MATMUL_COUNTER_COUNT];
+    bool counterValid[MATMUL_COUNTER_COUNT];
+};
+
+/*
+ * Clear stats and collect into it on the calling thread until matmulStatsEnd. Sections do not nest. OpenCL requests
+ * started inside a section must be waited for before it ends.
+ */
+void matmulStatsBegin(struct MatmulStats* stats);
+
+void matmulStatsEnd(void);
+
+const char* matmulPhaseName(enum MatmulPhase phase);
+const char* matmulCounterName(enum MatmulCounter counter);
+
+/*
+ * The hooks used by the library.
+ */
+extern _Thread_local struct MatmulStats* statsActive;
+
+double statsNow(void);
+
+// Atomic, threads other than the one of the section add to it as well
+void statsAdd(struct MatmulStats* stats, enum MatmulPhase phase, double seconds);
+void statsAddWorker(struct MatmulStats* stats, size_t worker, double seconds, size_t tasks);
+
+// Counters of the calling thread, for statsAddCounters to add the difference to stats
+void statsReadCounters(uint64_t values[MATMUL_COUNTER_COUNT]);
+void statsAddCounters(struct MatmulStats* stats, const uint64_t begin[MATMUL_COUNTER_COUNT]);
+
+static inline double statsStart(void){
+    return statsActive != NULL ? statsNow() : 0;
+}
+
+static inline void statsStop(const enum MatmulPhase phase, const double start){
+    if (statsActive != NULL) statsAdd(statsActive, phase, statsNow() - start);
+}
+
+#endif /* __MATMUL_STATS__ */
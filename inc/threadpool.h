@@ -0,0 +1,70 @@
+#ifndef __THREADPOOL__
+#define __THREADPOOL__
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * A task function is called once for every task index in [0, taskCount).
+ * worker is in [0, threadCount) and identifies the calling thread for the duration of one run, so it can be used to
+ * index per thread scratch buffers.
+ */
+typedef void (*PoolTask)(void* ctx, size_t task, size_t worker);
+
+/*
+ * Start the library owned pool with coreCount threads (the calling thread included). Zero picks the
+ * MATMUL_NUM_THREADS environment variable or the amount of online cores. Calling it while the pool runs resizes it.
+ */
+void threadPoolInit(size_t coreCount);
+
+/*
+ * Stop and join all pool threads. The pool is restarted lazily by the next run.
+ */
+void threadPoolShutdown(void);
+
+/*
+ * The amount of threads (the calling thread included) a run can use. Inside a task this is 1.
+ */
+size_t threadPoolSize(void);
+
+/*
+ * Run taskCount tasks on at most threadCount threads and return when all of them are done. Zero means all pool
+ * threads. The calling thread takes part in the work. Tasks are dealt out in contiguous ranges and idle threads
+ * steal the back half of the range of a busy one.
+ * Runs issued from inside a task are executed serially on the calling thread.
+ */
+void threadPoolRun(size_t threadCount, size_t taskCount, PoolTask fn, void* ctx);
+
+/*
+ * How the pool treats a machine with several NUMA nodes, picked by the MATMUL_NUMA environment variable when the
+ * pool starts. "pin" pins every worker to one cpu, filling one node before the next, and places the packing buffers
+ * of a worker on its node and shared operands interleaved over the nodes. "replicate" also keeps a copy of packed
+ * right hand operands on every node, so that no worker reads b across the interconnect. Unset or "off" does neither.
+ */
+enum PoolNuma {
+    POOL_NUMA_OFF,
+    POOL_NUMA_PIN,
+    POOL_NUMA_REPLICATE,
+};
+
+enum PoolNuma threadPoolNuma(void);
+
+/*
+ * The amount of nodes the workers of a run on threadCount threads are pinned to (zero means all pool threads).
+ * 1 when the workers are not pinned or inside a task.
+ */
+size_t threadPoolNodeCount(size_t threadCount);
+
+/*
+ * Copy the node of every worker in [0, threadCount) into nodes and return how many nodes they span, like
+ * threadPoolNodeCount. It is one snapshot, so buffers placed by it agree with each other even when the pool is
+ * resized before the run. threadCount must not exceed the pool size for the map to match the run.
+ */
+size_t threadPoolNodeMap(size_t threadCount, size_t* nodes);
+
+/*
+ * The node worker (as passed to a task) is pinned to, in [0, threadPoolNodeCount(threadCount)) for the run.
+ */
+size_t threadPoolWorkerNode(size_t worker);
+
+#endif /* __THREADPOOL__ */
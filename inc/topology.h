@@ -0,0 +1,38 @@
+#ifndef __TOPOLOGY__
+#define __TOPOLOGY__
+
+#include <stddef.h>
+
+/*
+ * The NUMA layout of the cpus this process may run on, read from sysfs, and memory placed on a given node. Nodes are
+ * numbered densely from zero in the order of their sysfs ids and only nodes with allowed cpus count. Without sysfs
+ * (or on a single node machine) everything is node 0 and the allocations below are plain anonymous mappings.
+ */
+
+size_t topologyNodeCount(void);
+
+size_t topologyCpuCount(void);
+
+/*
+ * The allowed cpus ordered node by node, so that consecutive indices fill one node before the next.
+ * index is taken modulo topologyCpuCount.
+ */
+int topologyCpu(size_t index);
+size_t topologyCpuNode(size_t index);
+
+/*
+ * Page aligned memory whose pages are preferably placed on node (interleaved over the first nodes nodes), zero
+ * filled. The placement is a hint: when the node is full the kernel takes pages from another one.
+ */
+void* topologyAlloc(size_t bytes, size_t node);
+void* topologyAllocInterleaved(size_t bytes, size_t nodes);
+
+void topologyFree(void* ptr, size_t bytes);
+
+/*
+ * Prefer node for the pages of a page aligned mapping of bytes that are not touched yet, like topologyAlloc does for
+ * its own mappings.
+ */
+void topologyPlace(void* ptr, size_t bytes, size_t node);
+
+#endif /* __TOPOLOGY__ */
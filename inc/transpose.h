@@ -0,0 +1,25 @@
+#ifndef __TRANSPOSE__
+#define __TRANSPOSE__
+
+#include <stddef.h>
+
+/*
+ * dst = src^T for a row major rows x cols src with leading dimension lds into a cols x rows dst with leading
+ * dimension ldd. The matrix is split into bands of dst for the pool threads and every band recursively into halves
+ * until a block fits in L1, which is transposed 4x4 in registers. threadCount limits the pool threads, zero uses all.
+ * src and dst must not overlap.
+ */
+void matmulTranspose(size_t rows, size_t cols, const double* src, size_t lds, double* dst, size_t ldd, size_t threadCount);
+
+/*
+ * a = a^T in place for a square size x size a with leading dimension lda. Pairs of blocks mirrored at the diagonal
+ * are swapped by the pool threads.
+ */
+void matmulTransposeSquare(size_t size, double* a, size_t lda, size_t threadCount);
+
+/*
+ * matmulTranspose without the stats of a section, for the kernels that time it as part of their own phase.
+ */
+void transposeRun(size_t rows, size_t cols, const double* src, size_t lds, double* dst, size_t ldd, size_t threadCount);
+
+#endif /* __TRANSPOSE__ */
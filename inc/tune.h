@@ -0,0 +1,66 @@
+#ifndef __TUNE__
+#define __TUNE__
+
+#include <cpu.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * A tuning profile holds, for a set of measured problem shapes, the configuration that was fastest on the machine
+ * that measured it. matmulTune writes one, the library loads it on first use and the kernels below look up the
+ * measured shape closest to every call. Without a profile, or for a configuration it does not fit, the built in
+ * defaults apply.
+ */
+
+enum TuneKernel {
+    TUNE_DGEMM,
+    TUNE_SGEMM,
+    TUNE_I32GEMM,
+    TUNE_I8GEMM,
+    // matmulSIMDMT, which only takes tile and threads
+    TUNE_SIMDMT,
+    TUNE_KERNEL_COUNT,
+};
+
+/*
+ * Zero in a field keeps its default. The GEMM rounds mc, kc and nc up to the multiples its micro kernel needs.
+ */
+struct TuneConfig {
+    // The instruction set variant of the packed GEMM, ignored when it is above cpuIsa
+    enum CpuIsa isa;
+    size_t mc;
+    size_t kc;
+    size_t nc;
+    // Square tiles of res dealt out to the workers of matmulSIMDMT, rounded down to an even size
+    size_t tile;
+    // At most this many of the requested threads are used
+    size_t threads;
+};
+
+/*
+ * The configuration for an m x k times k x n product of kernel on threads threads (the amount the call may use,
+ * not zero). False when the profile has no entry for kernel that can run on this cpu.
+ */
+bool tuneLookup(enum TuneKernel kernel, size_t m, size_t n, size_t k, size_t threads, struct TuneConfig* config);
+
+/*
+ * The profile used when no path is given: MATMUL_TUNE_PROFILE, or tune-<cpu>.profile in $XDG_CACHE_HOME/matmul or
+ * ~/.cache/matmul, where <cpu> is a hash of the cpu brand so that hosts sharing a home directory keep their own
+ * profiles. An empty MATMUL_TUNE_PROFILE disables the profile. Empty when there is no path.
+ */
+const char* matmulTuneProfilePath(void);
+
+/*
+ * Replace the loaded profile with the one at path (NULL for the default). A profile measured on another cpu model
+ * is refused. Returns the amount of entries loaded.
+ */
+size_t matmulTuneLoad(const char* path);
+
+/*
+ * Measure every kernel above on square shapes up to maxSize (zero for 1024) and two flat shapes of that size, on one
+ * thread and on threadCount threads (zero for the pool size), write the fastest configurations to path (NULL for
+ * the default) and load them. Takes minutes for the default sizes.
+ */
+void matmulTune(const char* path, size_t maxSize, size_t threadCount);
+
+#endif /* __TUNE__ */
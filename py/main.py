@@ -1,8 +1,10 @@
 #!/usr/bin/python
+import concurrent.futures
 import ctypes
 import numpy
 import timeit
 import sys
+import weakref
 
 matmullib = ctypes.CDLL('./libmatmul')
 matmullib.sortList.argtypes = [numpy.ctypeslib.ndpointer(dtype=numpy.int32, flags = ["C_CONTIGUOUS", "ALIGNED"]), ctypes.c_size_t]
@@ -19,7 +21,8 @@ matmullib.matmulMT.argtypes = [numpy.ctypeslib.ndpointer(dtype=ctypes.c_double,
                             numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim = 2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
                             ctypes.c_size_t,
                             ctypes.c_size_t]
-matmullib.matmulOpenClNaive.argtypes = [numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim=2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+for name in ["matmulOpenClNaive", "matmulOpenCl"]:
+    getattr(matmullib, name).argtypes = [numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim=2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
                             numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim = 2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
                             numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim = 2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
                             ctypes.c_size_t]
@@ -31,45 +34,813 @@ matmullib.simdMoreOptimized.argtypes = [numpy.ctypeslib.ndpointer(dtype=ctypes.c
                             numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim = 2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
                             numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim = 2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
                             ctypes.c_size_t]
+matmullib.matmulPacked.argtypes = [numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim=2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+                            numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim = 2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+                            numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim = 2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+                            ctypes.c_size_t]
 matmullib.matmulSIMDMT.argtypes = [numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim=2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
                             numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim = 2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
                             numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim = 2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
                             ctypes.c_size_t,
                             ctypes.c_size_t]
+matmullib.matmulPackedMT.argtypes = [numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim=2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+                            numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim = 2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+                            numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim = 2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+                            ctypes.c_size_t,
+                            ctypes.c_size_t]
+matmullib.matmulDgemm.argtypes = [ctypes.c_bool, ctypes.c_bool, ctypes.c_bool,
+                            ctypes.c_size_t, ctypes.c_size_t, ctypes.c_size_t,
+                            ctypes.c_double, ctypes.c_void_p, ctypes.c_size_t,
+                            ctypes.c_void_p, ctypes.c_size_t,
+                            ctypes.c_double, ctypes.c_void_p, ctypes.c_size_t,
+                            ctypes.c_size_t]
+matmullib.matmulSgemm.argtypes = [ctypes.c_bool, ctypes.c_bool, ctypes.c_bool,
+                            ctypes.c_size_t, ctypes.c_size_t, ctypes.c_size_t,
+                            ctypes.c_float, ctypes.c_void_p, ctypes.c_size_t,
+                            ctypes.c_void_p, ctypes.c_size_t,
+                            ctypes.c_float, ctypes.c_void_p, ctypes.c_size_t,
+                            ctypes.c_size_t]
+for name in ["matmulGemmInt32", "matmulGemmInt8"]:
+    getattr(matmullib, name).argtypes = [ctypes.c_size_t, ctypes.c_size_t, ctypes.c_size_t,
+                            ctypes.c_void_p, ctypes.c_size_t,
+                            ctypes.c_void_p, ctypes.c_size_t,
+                            ctypes.c_void_p, ctypes.c_size_t,
+                            ctypes.c_size_t]
+# Mirrors the enums and struct MatmulEpilogue of inc/epilogue.h
+BIAS_NONE, BIAS_ROW, BIAS_COLUMN = range(3)
+ACTIVATIONS = {None: 0, "relu": 1, "gelu": 2, "sigmoid": 3, "tanh": 4}
+OUTPUTS = {numpy.dtype(numpy.float64): 1, numpy.dtype(numpy.float32): 2, numpy.dtype(numpy.int32): 3, numpy.dtype(numpy.int8): 4}
+class MatmulEpilogue(ctypes.Structure):
+    _fields_ = [("bias", ctypes.c_int),
+                ("biasValues", ctypes.c_void_p),
+                ("activation", ctypes.c_int),
+                ("output", ctypes.c_int),
+                ("out", ctypes.c_void_p),
+                ("ldo", ctypes.c_size_t)]
+matmullib.matmulDgemmEpilogue.argtypes = matmullib.matmulDgemm.argtypes[:-1] + [ctypes.POINTER(MatmulEpilogue), ctypes.c_size_t]
+matmullib.matmulSgemmEpilogue.argtypes = matmullib.matmulSgemm.argtypes[:-1] + [ctypes.POINTER(MatmulEpilogue), ctypes.c_size_t]
+for name in ["matmulGemmInt32Epilogue", "matmulGemmInt8Epilogue"]:
+    getattr(matmullib, name).argtypes = [ctypes.c_size_t, ctypes.c_size_t, ctypes.c_size_t,
+                            ctypes.c_void_p, ctypes.c_size_t,
+                            ctypes.c_void_p, ctypes.c_size_t,
+                            ctypes.c_double, ctypes.c_void_p, ctypes.c_size_t,
+                            ctypes.POINTER(MatmulEpilogue), ctypes.c_size_t]
+matmullib.matmulPackedFloat.argtypes = [numpy.ctypeslib.ndpointer(dtype=ctypes.c_float, ndim=2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+                            numpy.ctypeslib.ndpointer(dtype=ctypes.c_float, ndim = 2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+                            numpy.ctypeslib.ndpointer(dtype=ctypes.c_float, ndim = 2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+                            ctypes.c_size_t]
+matmullib.matmulPackedFloatMT.argtypes = [numpy.ctypeslib.ndpointer(dtype=ctypes.c_float, ndim=2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+                            numpy.ctypeslib.ndpointer(dtype=ctypes.c_float, ndim = 2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+                            numpy.ctypeslib.ndpointer(dtype=ctypes.c_float, ndim = 2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+                            ctypes.c_size_t,
+                            ctypes.c_size_t]
+matmullib.matmulNaiveBlock.argtypes = [numpy.ctypeslib.ndpointer(dtype=numpy.int32, ndim=2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+                            numpy.ctypeslib.ndpointer(dtype=numpy.int32, ndim = 2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+                            numpy.ctypeslib.ndpointer(dtype=numpy.int32, ndim = 2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+                            ctypes.c_size_t]
+matmullib.matmulBatched.argtypes = [ctypes.c_size_t, ctypes.c_size_t, ctypes.c_size_t,
+                            ctypes.c_void_p, ctypes.c_size_t,
+                            ctypes.c_void_p, ctypes.c_size_t,
+                            ctypes.c_void_p, ctypes.c_size_t,
+                            ctypes.c_size_t, ctypes.c_size_t]
+matmullib.matmulBatchedPointers.argtypes = [ctypes.c_size_t, ctypes.c_size_t, ctypes.c_size_t,
+                            ctypes.POINTER(ctypes.c_void_p), ctypes.POINTER(ctypes.c_void_p), ctypes.POINTER(ctypes.c_void_p),
+                            ctypes.c_size_t, ctypes.c_size_t]
+matmullib.matmulSyrk.argtypes = [ctypes.c_bool, ctypes.c_bool, ctypes.c_size_t, ctypes.c_size_t,
+                            ctypes.c_double, ctypes.c_void_p, ctypes.c_size_t,
+                            ctypes.c_double, ctypes.c_void_p, ctypes.c_size_t,
+                            ctypes.c_bool, ctypes.c_size_t]
+matmullib.matmulGemv.argtypes = [ctypes.c_bool, ctypes.c_size_t, ctypes.c_size_t, ctypes.c_double, ctypes.c_void_p, ctypes.c_size_t,
+                            ctypes.c_void_p, ctypes.c_double, ctypes.c_void_p, ctypes.c_size_t]
+matmullib.matmulChainPlan.argtypes = [ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+matmullib.matmulChainPlan.restype = ctypes.c_void_p
+matmullib.matmulChainRun.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_void_p), ctypes.c_void_p, ctypes.c_size_t]
+for name in ["matmulChainCost", "matmulChainNaiveCost"]:
+    getattr(matmullib, name).argtypes = [ctypes.c_void_p]
+    getattr(matmullib, name).restype = ctypes.c_double
+matmullib.matmulChainFree.argtypes = [ctypes.c_void_p]
+matmullib.matmulSubmitDgemm.argtypes = matmullib.matmulDgemm.argtypes[:-1]
+matmullib.matmulSubmitDgemm.restype = ctypes.c_void_p
+matmullib.matmulJobDone.argtypes = [ctypes.c_void_p]
+matmullib.matmulJobDone.restype = ctypes.c_bool
+matmullib.matmulJobWait.argtypes = [ctypes.c_void_p]
+matmullib.matmulStrassen.argtypes = [numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim=2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+                            numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim = 2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+                            numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim = 2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+                            ctypes.c_size_t,
+                            ctypes.c_size_t,
+                            ctypes.c_size_t]
+matmullib.matmulStrassenErrorBound.argtypes = [ctypes.c_size_t, ctypes.c_size_t, ctypes.c_double, ctypes.c_double]
+matmullib.matmulStrassenErrorBound.restype = ctypes.c_double
+matmullib.matmulPrepackB.argtypes = [numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim = 2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+                            ctypes.c_size_t]
+matmullib.matmulPrepackB.restype = ctypes.c_void_p
+matmullib.matmulDgemmPrepackB.argtypes = [ctypes.c_bool, ctypes.c_bool, ctypes.c_size_t, ctypes.c_size_t, ctypes.c_void_p, ctypes.c_size_t]
+matmullib.matmulDgemmPrepackB.restype = ctypes.c_void_p
+matmullib.matmulFreePrepacked.argtypes = [ctypes.c_void_p]
+matmullib.matmulDgemmPrepacked.argtypes = [ctypes.c_bool, ctypes.c_size_t,
+                            ctypes.c_double, ctypes.c_void_p, ctypes.c_size_t,
+                            ctypes.c_void_p,
+                            ctypes.c_double, ctypes.c_void_p, ctypes.c_size_t,
+                            ctypes.c_size_t]
+for name in ["matmulMTPrepacked", "matmulSIMDMTPrepacked"]:
+    getattr(matmullib, name).argtypes = [numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim=2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+                            ctypes.c_void_p,
+                            numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim = 2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+                            ctypes.c_size_t,
+                            ctypes.c_size_t]
+for name in ["simdMultiplyFourPrepacked", "simdMoreOptimizedPrepacked", "matmulOpenClNaivePrepacked", "matmulOpenClPrepacked"]:
+    getattr(matmullib, name).argtypes = [numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim=2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+                            ctypes.c_void_p,
+                            numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim = 2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+                            ctypes.c_size_t]
+matmullib.matmulOpenClPrepackB.argtypes = [numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim = 2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+                            ctypes.c_size_t]
+matmullib.matmulOpenClPrepackB.restype = ctypes.c_void_p
+matmullib.matmulOpenClFreePrepacked.argtypes = [ctypes.c_void_p]
+matmullib.matmulOpenClVariant.restype = ctypes.c_char_p
+matmullib.matmulOpenClAvailable.restype = ctypes.c_bool
+matmullib.matmulOpenClAsync.argtypes = [numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim=2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+                            numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim = 2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+                            numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim = 2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+                            ctypes.c_size_t]
+matmullib.matmulOpenClAsync.restype = ctypes.c_void_p
+matmullib.matmulOpenClPrepackedAsync.argtypes = [numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim=2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+                            ctypes.c_void_p,
+                            numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim = 2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+                            ctypes.c_size_t]
+matmullib.matmulOpenClPrepackedAsync.restype = ctypes.c_void_p
+matmullib.matmulOpenClDone.argtypes = [ctypes.c_void_p]
+matmullib.matmulOpenClDone.restype = ctypes.c_bool
+matmullib.matmulOpenClWait.argtypes = [ctypes.c_void_p]
+matmullib.matmulHybrid.argtypes = [numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim=2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+                            numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim = 2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+                            numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim = 2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+                            ctypes.c_size_t,
+                            ctypes.c_size_t]
+matmullib.matmulHybridRatio.restype = ctypes.c_double
+matmullib.matfileCreate.argtypes = [ctypes.c_char_p, ctypes.c_size_t, ctypes.c_size_t, ctypes.c_size_t]
+matmullib.matfileCreate.restype = ctypes.c_void_p
+matmullib.matfileOpen.argtypes = [ctypes.c_char_p, ctypes.c_bool]
+matmullib.matfileOpen.restype = ctypes.c_void_p
+matmullib.matfileClose.argtypes = [ctypes.c_void_p]
+for name in ["matfileRows", "matfileCols"]:
+    getattr(matmullib, name).argtypes = [ctypes.c_void_p]
+    getattr(matmullib, name).restype = ctypes.c_size_t
+for name in ["matfileWriteRows", "matfileReadRows"]:
+    getattr(matmullib, name).argtypes = [ctypes.c_void_p, ctypes.c_size_t, ctypes.c_size_t, ctypes.c_void_p, ctypes.c_size_t]
+matmullib.matmulOutOfCore.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.c_size_t]
+matmullib.matmulAlloc.argtypes = [ctypes.c_size_t]
+matmullib.matmulAlloc.restype = ctypes.c_void_p
+matmullib.matmulFree.argtypes = [ctypes.c_void_p]
+matmullib.matmulArenaLimit.argtypes = [ctypes.c_size_t]
+matmullib.matmulArenaCached.restype = ctypes.c_size_t
+matmullib.matmulIsaName.restype = ctypes.c_char_p
+matmullib.threadPoolInit.argtypes = [ctypes.c_size_t]
+matmullib.threadPoolShutdown.argtypes = []
+matmullib.threadPoolSize.restype = ctypes.c_size_t
+# Mirrors the enums and struct MatmulStats of inc/stats.h
+PHASE_COUNT = 8
+COUNTER_COUNT = 4
+STATS_MAX_WORKERS = 256
+class MatmulStats(ctypes.Structure):
+    _fields_ = [("seconds", ctypes.c_double),
+                ("phaseSeconds", ctypes.c_double*PHASE_COUNT),
+                ("workerCount", ctypes.c_size_t),
+                ("workerSeconds", ctypes.c_double*STATS_MAX_WORKERS),
+                ("workerTasks", ctypes.c_uint64*STATS_MAX_WORKERS),
+                ("counters", ctypes.c_uint64*COUNTER_COUNT),
+                ("counterValid", ctypes.c_bool*COUNTER_COUNT)]
+matmullib.matmulStatsBegin.argtypes = [ctypes.POINTER(MatmulStats)]
+matmullib.matmulStatsEnd.argtypes = []
+for name in ["matmulPhaseName", "matmulCounterName"]:
+    getattr(matmullib, name).argtypes = [ctypes.c_int]
+    getattr(matmullib, name).restype = ctypes.c_char_p
+matmullib.matmulTune.argtypes = [ctypes.c_char_p, ctypes.c_size_t, ctypes.c_size_t]
+matmullib.matmulTuneLoad.argtypes = [ctypes.c_char_p]
+matmullib.matmulTuneLoad.restype = ctypes.c_size_t
+matmullib.matmulTuneProfilePath.restype = ctypes.c_char_p
+matmullib.matmulSIMDMTEpilogue.argtypes = [numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim=2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+                            numpy.ctypeslib.ndpointer(dtype=ctypes.c_double, ndim = 2, flags = ["C_CONTIGUOUS", "ALIGNED"]),
+                            ctypes.c_void_p,
+                            ctypes.c_size_t,
+                            ctypes.c_size_t,
+                            ctypes.POINTER(MatmulEpilogue)]
+matmullib.matmulTranspose.argtypes = [ctypes.c_size_t, ctypes.c_size_t, ctypes.c_void_p, ctypes.c_size_t, ctypes.c_void_p, ctypes.c_size_t, ctypes.c_size_t]
+matmullib.matmulTransposeSquare.argtypes = [ctypes.c_size_t, ctypes.c_void_p, ctypes.c_size_t, ctypes.c_size_t]
+int32Vector = numpy.ctypeslib.ndpointer(dtype=numpy.int32, ndim=1, flags = ["C_CONTIGUOUS", "ALIGNED"])
+matmullib.sortInt32.argtypes = [int32Vector, ctypes.c_size_t, ctypes.c_size_t]
+matmullib.sortInt32Pairs.argtypes = [int32Vector, int32Vector, ctypes.c_size_t, ctypes.c_size_t]
+matmullib.argsortInt32.argtypes = [int32Vector, int32Vector, ctypes.c_size_t, ctypes.c_size_t]
+matmullib.matmulBsrDense.argtypes = [ctypes.c_size_t, ctypes.c_size_t, ctypes.c_size_t, ctypes.c_size_t, ctypes.c_size_t,
+                            ctypes.c_void_p, ctypes.c_void_p, ctypes.c_void_p, ctypes.c_void_p, ctypes.c_size_t, ctypes.c_void_p, ctypes.c_size_t,
+                            ctypes.c_size_t]
 def wrapper(func, *args, **kwargs):
     def wrapped():
         return func(*args, **kwargs)
     return wrapped
 
-def aligned(a, alignment=32):
+def leadingDimension(x, rowMajor, dtype=numpy.float64):
+    """Return the leading dimension of x in the given storage order, or None if x can not be passed in place"""
+    if x.dtype != dtype or x.ndim != 2 or min(x.strides) < 0:
+        return None
+    rows, cols = x.shape
+    rowStride, colStride = (stride // x.itemsize for stride in x.strides)
+    if rowMajor:
+        if colStride != 1 and cols > 1:
+            return None
+        return rowStride if rows > 1 else max(cols, 1)
+    if rowStride != 1 and rows > 1:
+        return None
+    return colStride if cols > 1 else max(rows, 1)
+
+def operand(x, rowMajor, dtype=numpy.float64):
+    """Return (array, transposed, leading dimension) so that x can be passed without copying whenever possible"""
+    ld = leadingDimension(x, rowMajor, dtype)
+    if ld is not None:
+        return x, False, ld
+    ld = leadingDimension(x.T, rowMajor, dtype)
+    if ld is not None:
+        return x.T, True, ld
+    x = numpy.ascontiguousarray(x, dtype=dtype) if rowMajor else numpy.asfortranarray(x, dtype=dtype)
+    return x, False, leadingDimension(x, rowMajor, dtype)
+
+def gemmEpilogue(c, ldc, dtype, bias, activation):
+    """The MatmulEpilogue that adds bias, applies activation and converts to the dtype of c, or None for none. bias
+    broadcasts like in numpy: n values or a 1 x n array per column, a m x 1 array per row. The bias array is kept in
+    the returned tuple, which must live until the call returns."""
+    if activation not in ACTIVATIONS:
+        raise ValueError("Unknown activation {}, expected one of {}".format(activation, list(ACTIVATIONS)))
+    if c.dtype not in OUTPUTS:
+        raise ValueError("Results can only be stored as {}".format([str(t) for t in OUTPUTS]))
+    if bias is None and activation is None and c.dtype == dtype:
+        return None, None
+    epilogue = MatmulEpilogue(activation=ACTIVATIONS[activation])
+    m, n = c.shape
+    if bias is not None:
+        bias = numpy.asarray(bias, dtype=numpy.float64)
+        if bias.shape in ((n,), (1, n)):
+            epilogue.bias = BIAS_COLUMN
+        elif bias.shape == (m, 1):
+            epilogue.bias = BIAS_ROW
+        else:
+            raise ValueError("A bias of shape {} does not broadcast to {}".format(bias.shape, c.shape))
+        bias = numpy.ascontiguousarray(bias).ravel()
+        epilogue.biasValues = bias.ctypes.data
+    if c.dtype != dtype:
+        epilogue.output = OUTPUTS[c.dtype]
+        epilogue.out = c.ctypes.data
+        epilogue.ldo = ldc
+    return ctypes.byref(epilogue), (epilogue, bias)
+
+def blasGemm(func, dtype, a, b, c, alpha, beta, threads, bias=None, activation=None, outDtype=None):
+    m, k = a.shape
+    if b.shape[0] != k:
+        raise ValueError("Inner dimensions do not match: {} and {}".format(a.shape, b.shape))
+    n = b.shape[1]
+    if c is None:
+        c = numpy.empty((m, n), dtype=outDtype or dtype)
+        beta = 0.0
+    if c.shape != (m, n):
+        raise ValueError("Result has shape {}, expected {}".format(c.shape, (m, n)))
+    rowMajor = leadingDimension(c, True, c.dtype) is not None
+    ldc = leadingDimension(c, rowMajor, c.dtype)
+    if ldc is None:
+        raise ValueError("The result must have unit stride in one dimension")
+    a, transA, lda = operand(a, rowMajor, dtype)
+    b, transB, ldb = operand(b, rowMajor, dtype)
+    epilogue, keep = gemmEpilogue(c, ldc, dtype, bias, activation)
+    # A converted result is written through the epilogue, c of the native type is not needed
+    res = c.ctypes.data if c.dtype == dtype else None
+    func(not rowMajor, transA, transB, m, n, k, alpha, a.ctypes.data, lda, b.ctypes.data, ldb, beta, res, ldc, epilogue, threads)
+    return c
+
+def dgemm(a, b, c=None, alpha=1.0, beta=0.0, threads=0, bias=None, activation=None, dtype=None):
+    """c = activation(alpha*a*b + beta*c + bias) for any 2D float64 arrays, including strided views, without padding
+    copies. The bias, the activation ("relu", "gelu", "sigmoid" or "tanh") and the conversion to a c of another
+    dtype (or a new one of dtype) are applied to every tile as it is computed."""
+    return blasGemm(matmullib.matmulDgemmEpilogue, numpy.float64, a, b, c, alpha, beta, threads, bias, activation, dtype)
+
+def sgemm(a, b, c=None, alpha=1.0, beta=0.0, threads=0, bias=None, activation=None, dtype=None):
+    """The float32 version of dgemm"""
+    return blasGemm(matmullib.matmulSgemmEpilogue, numpy.float32, a, b, c, alpha, beta, threads, bias, activation, dtype)
+
+def igemm(a, b, threads=0, alpha=1.0, bias=None, activation=None, dtype=numpy.int32):
+    """a*b for int8 or int32 arrays with an int32 result, wrapping around on overflow. With an alpha, bias or
+    activation the result is computed in double, for example to dequantize into float32 or requantize into int8."""
+    if a.dtype != b.dtype or a.dtype not in (numpy.int8, numpy.int32):
+        raise ValueError("Both operands must be int8 or int32, got {} and {}".format(a.dtype, b.dtype))
+    m, k = a.shape
+    if b.shape[0] != k:
+        raise ValueError("Inner dimensions do not match: {} and {}".format(a.shape, b.shape))
+    n = b.shape[1]
+    a = numpy.ascontiguousarray(a)
+    b = numpy.ascontiguousarray(b)
+    c = numpy.empty((m, n), dtype=dtype)
+    epilogue, keep = gemmEpilogue(c, max(n, 1), numpy.int32, bias, activation)
+    res = c.ctypes.data if c.dtype == numpy.int32 else None
+    func = matmullib.matmulGemmInt8Epilogue if a.dtype == numpy.int8 else matmullib.matmulGemmInt32Epilogue
+    func(m, n, k, a.ctypes.data, max(k, 1), b.ctypes.data, max(n, 1), alpha, res, max(n, 1), epilogue, threads)
+    return c
+
+def gemm(a, b, threads=0):
+    """a*b on the packed GEMM of the element type of a and b"""
+    if a.dtype == numpy.float32:
+        return sgemm(a, b, threads=threads)
+    if a.dtype in (numpy.int8, numpy.int32):
+        return igemm(a, b, threads)
+    return dgemm(a, b, threads=threads)
+
+def batched(a, b, threads=0):
+    """a[i]*b[i] for a stack of matrices a (batch x m x k) and b (batch x k x n, or k x n shared by all of a)"""
+    a = numpy.ascontiguousarray(a, dtype=numpy.float64)
+    b = numpy.ascontiguousarray(b, dtype=numpy.float64)
+    if a.ndim != 3 or b.ndim not in (2, 3):
+        raise ValueError("Expected a 3D a and a 2D or 3D b, got {} and {}".format(a.shape, b.shape))
+    batch, m, k = a.shape
+    if b.shape[-2] != k or (b.ndim == 3 and b.shape[0] != batch):
+        raise ValueError("Shapes do not match: {} and {}".format(a.shape, b.shape))
+    n = b.shape[-1]
+    c = numpy.empty((batch, m, n), dtype=numpy.float64)
+    strideB = k*n if b.ndim == 3 else 0
+    matmullib.matmulBatched(m, n, k, a.ctypes.data, m*k, b.ctypes.data, strideB, c.ctypes.data, m*n, batch, threads)
+    return c
+
+def batchedList(aList, bList, threads=0):
+    """[a*b for a, b in zip(aList, bList)] in one call, for equally shaped float64 C contiguous matrices"""
+    if len(aList) != len(bList) or not aList:
+        raise ValueError("Expected two non empty lists of the same length")
+    (m, k), n = aList[0].shape, bList[0].shape[1]
+    for a, b in zip(aList, bList):
+        if a.shape != (m, k) or b.shape != (k, n) or a.dtype != numpy.float64 or b.dtype != numpy.float64 \
+                or not a.flags.c_contiguous or not b.flags.c_contiguous:
+            raise ValueError("All matrices must be C contiguous float64 of the same shape")
+    cList = [numpy.empty((m, n), dtype=numpy.float64) for _ in aList]
+    pointers = lambda xs: (ctypes.c_void_p*len(xs))(*[x.ctypes.data for x in xs])
+    matmullib.matmulBatchedPointers(m, n, k, pointers(aList), pointers(bList), pointers(cList), len(aList), threads)
+    return cList
+
+def syrk(a, c=None, alpha=1.0, beta=0.0, upper=False, mirror=True, threads=0):
+    """c = alpha*a*a.T + beta*c computing one triangle only, the lower one unless upper is set. With mirror c is
+    filled in to the full symmetric result, otherwise the other triangle is left untouched. a may be a view of any
+    storage order, a column major one is passed as the transposed operand without a copy."""
+    if a.ndim != 2:
+        raise ValueError("Expected a 2D array, got shape {}".format(a.shape))
+    n, k = a.shape
+    if c is None:
+        c = numpy.empty((n, n), dtype=numpy.float64)
+        beta = 0.0
+    ldc = leadingDimension(c, True)
+    if c.shape != (n, n) or ldc is None:
+        raise ValueError("The result must be a row major float64 array of shape {}".format((n, n)))
+    a, trans, lda = operand(a, True)
+    matmullib.matmulSyrk(upper, trans, n, k, alpha, a.ctypes.data, lda, beta, c.ctypes.data, ldc, mirror, threads)
+    return c
+
+def gemv(a, x, y=None, alpha=1.0, beta=0.0, threads=0):
+    """y = alpha*a*x + beta*y for a 2D float64 a of either storage order and contiguous float64 vectors"""
+    m, n = a.shape
+    x = numpy.ascontiguousarray(x, dtype=numpy.float64)
+    if x.shape != (n,):
+        raise ValueError("x has shape {}, expected {}".format(x.shape, (n,)))
+    if y is None:
+        y = numpy.empty(m, dtype=numpy.float64)
+        beta = 0.0
+    if y.shape != (m,) or y.dtype != numpy.float64 or not y.flags.c_contiguous:
+        raise ValueError("y must be a contiguous float64 vector of shape {}".format((m,)))
+    a, trans, lda = operand(a, True)
+    rows, cols = a.shape
+    matmullib.matmulGemv(trans, rows, cols, alpha, a.ctypes.data, lda, x.ctypes.data, beta, y.ctypes.data, threads)
+    return y
+
+class ChainPlan:
+    """The cheapest order of a chain of products for the given shapes, and the workspace that runs it, for
+    repeated chains of the same shapes"""
+    def __init__(self, shapes):
+        if not shapes or any(len(shape) != 2 for shape in shapes):
+            raise ValueError("Expected a non empty list of 2D shapes")
+        for left, right in zip(shapes, shapes[1:]):
+            if left[1] != right[0]:
+                raise ValueError("Shapes do not chain: {} and {}".format(left, right))
+        self.shapes = [tuple(shape) for shape in shapes]
+        dims = [shape[0] for shape in shapes] + [shapes[-1][1]]
+        self.handle = matmullib.matmulChainPlan(len(shapes), (ctypes.c_size_t*len(dims))(*dims))
+        self.cost = matmullib.matmulChainCost(self.handle)
+        self.naiveCost = matmullib.matmulChainNaiveCost(self.handle)
+
+    def run(self, matrices, out=None, threads=0):
+        matrices = [numpy.ascontiguousarray(x, dtype=numpy.float64) for x in matrices]
+        if [x.shape for x in matrices] != self.shapes:
+            raise ValueError("The matrices have shapes {}, the plan {}".format([x.shape for x in matrices], self.shapes))
+        shape = (self.shapes[0][0], self.shapes[-1][1])
+        if out is None:
+            out = numpy.empty(shape, dtype=numpy.float64)
+        if out.shape != shape or out.dtype != numpy.float64 or not out.flags.c_contiguous:
+            raise ValueError("out must be a C contiguous float64 array of shape {}".format(shape))
+        pointers = (ctypes.c_void_p*len(matrices))(*[x.ctypes.data for x in matrices])
+        matmullib.matmulChainRun(self.handle, pointers, out.ctypes.data, threads)
+        return out
+
+    def __del__(self):
+        matmullib.matmulChainFree(self.handle)
+
+def multiDot(matrices, threads=0):
+    """The product of a list of 2D arrays in the cheapest order, like numpy.linalg.multi_dot. A 1D first or last
+    array is taken as a row or a column vector and the result has the matching dimensions."""
+    matrices = list(matrices)
+    first, last = matrices[0].ndim == 1, matrices[-1].ndim == 1
+    if first:
+        matrices[0] = matrices[0].reshape(1, -1)
+    if last:
+        matrices[-1] = matrices[-1].reshape(-1, 1)
+    res = ChainPlan([x.shape for x in matrices]).run(matrices, threads=threads)
+    if first and last:
+        return res[0, 0]
+    return res[0] if first else res[:, 0] if last else res
+
+class PrepackedB:
+    """b packed once into the panel layout of the packed GEMM, for many dgemmPrepacked calls with the same b"""
+    def __init__(self, b):
+        b, transB, ldb = operand(b, True)
+        self.shape = (b.shape[1], b.shape[0]) if transB else b.shape
+        self.handle = matmullib.matmulDgemmPrepackB(False, transB, self.shape[0], self.shape[1], b.ctypes.data, ldb)
+
+    def __del__(self):
+        matmullib.matmulFreePrepacked(self.handle)
+
+def transpose(x, out=None, threads=0):
+    """x.T as a new C contiguous array, or written into out. A square out that is x itself is transposed in place."""
+    if x.ndim != 2:
+        raise ValueError("Expected a 2D array, got shape {}".format(x.shape))
+    rows, cols = x.shape
+    if out is x:
+        ld = leadingDimension(x, True)
+        if rows != cols or ld is None:
+            raise ValueError("In place transposes need a square row major float64 array")
+        matmullib.matmulTransposeSquare(rows, x.ctypes.data, ld, threads)
+        return x
+    src, transposed, lds = operand(x, True)
+    if out is None:
+        out = numpy.empty((cols, rows), dtype=numpy.float64)
+    ldd = leadingDimension(out, True)
+    if out.shape != (cols, rows) or ldd is None:
+        raise ValueError("out must be a row major float64 array of shape {}".format((cols, rows)))
+    if transposed:
+        # x is column major, so x.T is row major already and only needs a copy
+        numpy.copyto(out, x.T)
+    else:
+        matmullib.matmulTranspose(rows, cols, src.ctypes.data, lds, out.ctypes.data, ldd, threads)
+    return out
+
+def sort(x, threads=0):
+    """Sort a contiguous int32 vector in place"""
+    matmullib.sortInt32(x, x.size, threads)
+    return x
+
+def sortPairs(keys, values, threads=0):
+    """Sort int32 keys in place and move the int32 values along, equal keys keep their order"""
+    if keys.shape != values.shape:
+        raise ValueError("Keys and values differ in shape: {} and {}".format(keys.shape, values.shape))
+    matmullib.sortInt32Pairs(keys, values, keys.size, threads)
+    return keys, values
+
+def argsort(x, threads=0):
+    """The stable int32 indices that sort an int32 vector, like numpy.argsort(x, kind="stable")"""
+    indices = numpy.empty(x.size, dtype=numpy.int32)
+    matmullib.argsortInt32(x, indices, x.size, threads)
+    return indices
+
+class SparseMatrix:
+    """A float64 matrix in block CSR form, the layout of scipy.sparse.bsr_matrix, with 1 x 1 blocks for CSR. a @ b
+    multiplies it with a dense b on the library threads."""
+    def __init__(self, indptr, indices, data, shape, blockShape=(1, 1)):
+        rows, cols = shape
+        blockRows, blockCols = blockShape
+        if blockRows < 1 or blockCols < 1 or rows % blockRows or cols % blockCols:
+            raise ValueError("{} blocks do not tile a {} matrix".format(blockShape, shape))
+        self.indptr = numpy.ascontiguousarray(indptr, dtype=numpy.int64)
+        self.indices = numpy.ascontiguousarray(indices, dtype=numpy.int32)
+        self.data = numpy.ascontiguousarray(data, dtype=numpy.float64).reshape(-1, blockRows, blockCols)
+        if self.indptr.shape != (rows//blockRows + 1,) or numpy.any(numpy.diff(self.indptr) < 0):
+            raise ValueError("indptr needs {} ascending entries".format(rows//blockRows + 1))
+        used = slice(self.indptr[0], self.indptr[-1])
+        if self.indices.size < self.indptr[-1] or self.data.shape[0] < self.indptr[-1]:
+            raise ValueError("indptr runs past the {} indices and {} blocks".format(self.indices.size, self.data.shape[0]))
+        if numpy.any(self.indices[used] < 0) or numpy.any(self.indices[used] >= cols//blockCols):
+            raise ValueError("Column indices out of range for {} block columns".format(cols//blockCols))
+        self.shape = (rows, cols)
+        self.blockShape = (blockRows, blockCols)
+
+    @classmethod
+    def fromScipy(cls, x):
+        """From a scipy.sparse csr_matrix or bsr_matrix"""
+        blockShape = x.blocksize if hasattr(x, "blocksize") else (1, 1)
+        return cls(x.indptr, x.indices, x.data, x.shape, blockShape)
+
+    @classmethod
+    def fromDense(cls, x, blockShape=(1, 1)):
+        """The nonzero blocks of a dense x"""
+        rows, cols = x.shape
+        blockRows, blockCols = blockShape
+        blocks = numpy.asarray(x, dtype=numpy.float64).reshape(rows//blockRows, blockRows, cols//blockCols, blockCols).swapaxes(1, 2)
+        nonzero = numpy.any(blocks != 0, axis=(2, 3))
+        indptr = numpy.concatenate(([0], numpy.cumsum(nonzero.sum(axis=1))))
+        blockRowIndex, indices = numpy.nonzero(nonzero)
+        return cls(indptr, indices, blocks[blockRowIndex, indices], x.shape, blockShape)
+
+    def matmul(self, b, out=None, threads=0):
+        """self*b with a dense float64 b, into a new array or the row major out"""
+        b = numpy.asarray(b, dtype=numpy.float64)
+        if b.ndim != 2 or b.shape[0] != self.shape[1]:
+            raise ValueError("Inner dimensions do not match: {} and {}".format(self.shape, b.shape))
+        ldb = leadingDimension(b, True)
+        if ldb is None:
+            b = numpy.ascontiguousarray(b)
+            ldb = b.shape[1]
+        if out is None:
+            out = numpy.empty((self.shape[0], b.shape[1]), dtype=numpy.float64)
+        ldr = leadingDimension(out, True)
+        if out.shape != (self.shape[0], b.shape[1]) or ldr is None:
+            raise ValueError("out must be a row major float64 array of shape {}".format((self.shape[0], b.shape[1])))
+        matmullib.matmulBsrDense(self.shape[0], b.shape[1], self.shape[1], self.blockShape[0], self.blockShape[1], self.indptr.ctypes.data,
+                                 self.indices.ctypes.data, self.data.ctypes.data, b.ctypes.data, ldb, out.ctypes.data, ldr, threads)
+        return out
+
+    def __matmul__(self, b):
+        return self.matmul(b)
+
+def csrMatrix(indptr, indices, data, shape):
+    """A CSR matrix from scipy style indptr, indices and data arrays"""
+    return SparseMatrix(indptr, indices, data, shape)
+
+def bsrMatrix(indptr, indices, data, shape, blockShape):
+    """A block CSR matrix from scipy style arrays, data holds one blockShape block for every index"""
+    return SparseMatrix(indptr, indices, data, shape, blockShape)
+
+def dgemmPrepacked(a, b, c=None, alpha=1.0, beta=0.0, threads=0):
+    """c = alpha*a*b + beta*c with b a PrepackedB, c is row major"""
+    m, k = a.shape
+    if b.shape[0] != k:
+        raise ValueError("Inner dimensions do not match: {} and {}".format(a.shape, b.shape))
+    if c is None:
+        c = numpy.empty((m, b.shape[1]), dtype=numpy.float64)
+        beta = 0.0
+    ldc = leadingDimension(c, True)
+    if c.shape != (m, b.shape[1]) or ldc is None:
+        raise ValueError("The result must be a row major {} array".format((m, b.shape[1])))
+    a, transA, lda = operand(a, True)
+    matmullib.matmulDgemmPrepacked(transA, m, alpha, a.ctypes.data, lda, b.handle, beta, c.ctypes.data, ldc, threads)
+    return c
+
+class OpenClFuture:
+    """a*b for square float64 matrices, running on the OpenCL device while Python goes on"""
+    def __init__(self, a, b):
+        if a.ndim != 2 or a.shape[0] != a.shape[1] or a.shape != b.shape:
+            raise ValueError("Expected two square matrices of the same size, got {} and {}".format(a.shape, b.shape))
+        # The library reads and writes these until the request is done, so they are kept alive here
+        self.a = numpy.ascontiguousarray(a, dtype=numpy.float64)
+        self.b = numpy.ascontiguousarray(b, dtype=numpy.float64)
+        self.c = numpy.empty(a.shape, dtype=numpy.float64)
+        self.handle = matmullib.matmulOpenClAsync(self.a, self.b, self.c, a.shape[0])
+
+    def done(self):
+        return self.handle is None or matmullib.matmulOpenClDone(self.handle)
+
+    def result(self):
+        if self.handle is not None:
+            matmullib.matmulOpenClWait(self.handle)
+            self.handle = None
+        return self.c
+
+    def __del__(self):
+        self.result()
+
+class MatmulFuture:
+    """c = alpha*a*b + beta*c like dgemm, queued to the scheduler of the library (see inc/scheduler.h). Threads that
+    each submit their products share the pool, small products are run in batches"""
+    def __init__(self, a, b, c=None, alpha=1.0, beta=0.0):
+        if a.ndim != 2 or b.ndim != 2 or a.shape[1] != b.shape[0]:
+            raise ValueError("Inner dimensions do not match: {} and {}".format(a.shape, b.shape))
+        m, k = a.shape
+        n = b.shape[1]
+        if c is None:
+            c = numpy.empty((m, n), dtype=numpy.float64)
+            beta = 0.0
+        rowMajor = leadingDimension(c, True) is not None
+        ldc = leadingDimension(c, rowMajor)
+        if c.shape != (m, n) or ldc is None:
+            raise ValueError("The result must be a float64 array of shape {} with unit stride in one dimension".format((m, n)))
+        # The library reads and writes these until the job is done, so they are kept alive here
+        self.a, transA, lda = operand(a, rowMajor)
+        self.b, transB, ldb = operand(b, rowMajor)
+        self.c = c
+        self.handle = matmullib.matmulSubmitDgemm(not rowMajor, transA, transB, m, n, k, alpha, self.a.ctypes.data, lda,
+                                                  self.b.ctypes.data, ldb, beta, c.ctypes.data, ldc)
+
+    def done(self):
+        return self.handle is None or matmullib.matmulJobDone(self.handle)
+
+    def result(self):
+        if self.handle is not None:
+            matmullib.matmulJobWait(self.handle)
+            self.handle = None
+        return self.c
+
+    def __del__(self):
+        self.result()
+
+def submit(a, b, c=None, alpha=1.0, beta=0.0):
+    """Queue alpha*a*b + beta*c and return a MatmulFuture for it"""
+    return MatmulFuture(a, b, c, alpha, beta)
+
+class Stats:
+    """Collects the phase times, worker times and hardware counters of the library calls made inside a with block"""
+    def __enter__(self):
+        self.stats = MatmulStats()
+        matmullib.matmulStatsBegin(ctypes.byref(self.stats))
+        return self
+
+    def __exit__(self, *exc):
+        matmullib.matmulStatsEnd()
+        return False
+
+    def phases(self):
+        return {matmullib.matmulPhaseName(p).decode(): self.stats.phaseSeconds[p] for p in range(PHASE_COUNT) if self.stats.phaseSeconds[p] > 0}
+
+    def workers(self):
+        return [(self.stats.workerSeconds[w], self.stats.workerTasks[w]) for w in range(self.stats.workerCount)]
+
+    def counters(self):
+        return {matmullib.matmulCounterName(c).decode(): self.stats.counters[c] for c in range(COUNTER_COUNT) if self.stats.counterValid[c]}
+
+def tune(path=None, maxSize=0, threads=0):
+    """Measure the kernels on this machine and write the tuning profile the library picks its block sizes, kernel
+    variants and thread counts from. Without a path it goes to the default profile, which is loaded automatically."""
+    matmullib.matmulTune(path.encode() if path is not None else None, maxSize, threads)
+    return path if path is not None else matmullib.matmulTuneProfilePath().decode()
+
+def loadTuning(path=None):
+    """Use the tuning profile at path, or reload the default one. Returns the amount of measured shapes in it."""
+    return matmullib.matmulTuneLoad(path.encode() if path is not None else None)
+
+def saveMatrix(path, x, tile=512):
+    """Write a 2D array to a matrix file for matmulFiles. x may be a numpy.memmap, it is converted a row of tiles at a
+    time, so it does not have to fit in memory."""
+    if x.ndim != 2:
+        raise ValueError("Expected a 2D array, got shape {}".format(x.shape))
+    handle = matmullib.matfileCreate(path.encode(), x.shape[0], x.shape[1], tile)
+    try:
+        for row in range(0, x.shape[0], tile):
+            chunk = numpy.ascontiguousarray(x[row:row + tile], dtype=numpy.float64)
+            matmullib.matfileWriteRows(handle, row, chunk.shape[0], chunk.ctypes.data, x.shape[1])
+    finally:
+        matmullib.matfileClose(handle)
+
+def loadMatrix(path):
+    """Read a whole matrix file into a float64 array"""
+    handle = matmullib.matfileOpen(path.encode(), False)
+    try:
+        x = numpy.empty((matmullib.matfileRows(handle), matmullib.matfileCols(handle)), dtype=numpy.float64)
+        matmullib.matfileReadRows(handle, 0, x.shape[0], x.ctypes.data, x.shape[1])
+    finally:
+        matmullib.matfileClose(handle)
+    return x
+
+def matmulFiles(aPath, bPath, resPath, memoryBudget=0, threads=0):
+    """resPath = aPath*bPath for matrix files, holding at most about memoryBudget bytes in memory (0 is a quarter of
+    the physical memory)"""
+    matmullib.matmulOutOfCore(aPath.encode(), bPath.encode(), resPath.encode(), memoryBudget, threads)
+
+def empty(shape, dtype=numpy.float64):
+    """An uninitialized C contiguous array in library memory (see inc/arena.h): 64 byte aligned and on huge pages when
+    large, so it passes the alignment checks of the SIMD kernels as it is. The memory goes back to the library when
+    the last view of the array is gone."""
+    dtype = numpy.dtype(dtype)
+    shape = (shape,) if isinstance(shape, int) else tuple(shape)
+    count = 1
+    for extent in shape:
+        count *= extent
+    nbytes = max(count*dtype.itemsize, 1)
+    buffer = (ctypes.c_char*nbytes).from_address(matmullib.matmulAlloc(nbytes))
+    weakref.finalize(buffer, matmullib.matmulFree, ctypes.addressof(buffer))
+    return numpy.frombuffer(buffer, dtype=dtype, count=count).reshape(shape)
+
+def aligned(a, alignment=64):
+    """a itself when it is aligned, otherwise a copy in library memory"""
     if (a.ctypes.data % alignment) == 0:
         return a
-    extra = alignment // a.itemsize
-    buf = numpy.empty(a.size + extra, dtype=a.dtype)
-    ofs = (-buf.ctypes.data % alignment) // a.itemsize
-    aa = buf[ofs:ofs+a.size].reshape(a.shape)
+    aa = empty(a.shape, a.dtype)
     numpy.copyto(aa, a)
-    assert (aa.ctypes.data % alignment) == 0
     return aa
 
 epsilon = 2**-50
 
 if __name__ == '__main__':
+    # All cores, the tuning profile lowers the thread count where fewer are faster
+    threads = 0
+    matmullib.threadPoolInit(threads)
+    print("Kernels:", matmullib.matmulIsaName().decode())
+    if "--tune" in sys.argv:
+        print("Tuning profile written to", tune())
     for arrSize in [2000, 4000]:
-        arrA = numpy.array(numpy.random.rand(arrSize, arrSize),dtype=ctypes.c_double,order = 'C')
+        # Library memory is aligned for the SIMD kernels, so a is filled in place instead of copied by aligned()
+        arrA = empty((arrSize, arrSize))
+        arrA[:] = numpy.random.rand(arrSize, arrSize)
         arrB = numpy.array(numpy.random.rand(arrSize, arrSize),dtype=ctypes.c_double,order = 'C')
-        arrResA = numpy.empty((arrSize, arrSize), dtype = ctypes.c_double, order = 'C')
-        arrResB = numpy.empty((arrSize, arrSize), dtype = ctypes.c_double, order = 'C')
-        arrResC = numpy.empty((arrSize, arrSize), dtype = ctypes.c_double, order = 'C')
-        arrA = aligned(arrA)
-        # No need to align arrB, since it will be transposed anyway
-        wrapped = wrapper(matmullib.matmulOpenClNaive, arrA, arrB, arrResA, arrSize)
-        t = timeit.timeit(wrapped, number=1)
-        print("OpenCL", t)
-        wrapped = wrapper(matmullib.matmulSIMDMT, arrA, arrB, arrResB, arrSize, 12)
+        arrResA = empty((arrSize, arrSize))
+        arrResB = empty((arrSize, arrSize))
+        arrResC = empty((arrSize, arrSize))
+        if matmullib.matmulOpenClAvailable():
+            wrapped = wrapper(matmullib.matmulOpenClNaive, arrA, arrB, arrResA, arrSize)
+            t = timeit.timeit(wrapped, number=1)
+            print("OpenCL naive", t)
+            wrapped = wrapper(matmullib.matmulOpenCl, arrA, arrB, arrResA, arrSize)
+            t = timeit.timeit(wrapped, number=1)
+            print("OpenCL", matmullib.matmulOpenClVariant().decode(), t)
+            for _ in range(3):
+                wrapped = wrapper(matmullib.matmulHybrid, arrA, arrB, arrResA, arrSize, threads)
+                t = timeit.timeit(wrapped, number=1)
+                print("Hybrid", t, "device share", matmullib.matmulHybridRatio())
+        with Stats() as stats:
+            wrapped = wrapper(matmullib.matmulSIMDMT, arrA, arrB, arrResB, arrSize, threads)
+            t = timeit.timeit(wrapped, number=1)
+        print("MT", t, stats.phases(), "worker seconds", [round(seconds, 4) for seconds, _ in stats.workers()], stats.counters())
+        bias = numpy.random.rand(arrSize)
+        epilogue, keep = gemmEpilogue(arrResB, arrSize, numpy.float64, bias, "relu")
+        wrapped = wrapper(matmullib.matmulSIMDMTEpilogue, arrA, arrB, arrResB.ctypes.data, arrSize, threads, epilogue)
         t = timeit.timeit(wrapped, number=1)
-        print("MT", t)
+        print("MT + bias + relu", t)
         wrapped = wrapper(matmullib.simdMoreOptimized, arrA, arrB, arrResC, arrSize)
         timeit.timeit(wrapped, number=1)
         t = timeit.timeit(wrapped, number=1)
         print("SIMD new", t)
+        wrapped = wrapper(matmullib.matmulPacked, arrA, arrB, arrResC, arrSize)
+        t = timeit.timeit(wrapped, number=1)
+        print("Packed", t)
+        wrapped = wrapper(matmullib.matmulPackedMT, arrA, arrB, arrResC, arrSize, threads)
+        t = timeit.timeit(wrapped, number=1)
+        print("Packed MT", t)
+        # Odd sized sub matrix views go straight into the library, without aligned() or padding
+        wrapped = wrapper(dgemm, arrA[1:, 1:], arrB[1:, 1:].T, arrResC[1:, 1:], 1.0, 0.0, threads)
+        t = timeit.timeit(wrapped, number=1)
+        print("Dgemm view", t)
+        packedB = PrepackedB(arrB)
+        wrapped = wrapper(dgemmPrepacked, arrA, packedB, arrResC, 1.0, 0.0, threads)
+        t = timeit.timeit(wrapped, number=1)
+        print("Dgemm prepacked", t)
+        wrapped = wrapper(syrk, arrA, arrResC, 1.0, 0.0, False, True, threads)
+        t = timeit.timeit(wrapped, number=1)
+        print("Syrk", t)
+        del packedB
+        arrFloatA = arrA.astype(numpy.float32)
+        arrFloatB = arrB.astype(numpy.float32)
+        wrapped = wrapper(gemm, arrFloatA, arrFloatB, threads)
+        t = timeit.timeit(wrapped, number=1)
+        print("Sgemm", t)
+        arrInt8A = numpy.random.randint(-128, 128, (arrSize, arrSize), dtype=numpy.int8)
+        arrInt8B = numpy.random.randint(-128, 128, (arrSize, arrSize), dtype=numpy.int8)
+        wrapped = wrapper(gemm, arrInt8A, arrInt8B, threads)
+        t = timeit.timeit(wrapped, number=1)
+        print("Int8 gemm", t)
+        wrapped = wrapper(matmullib.matmulStrassen, arrA, arrB, arrResC, arrSize, 0, threads)
+        t = timeit.timeit(wrapped, number=1)
+        normA, normB = numpy.abs(arrA).max(), numpy.abs(arrB).max()
+        print("Strassen", t, "error bound", matmullib.matmulStrassenErrorBound(arrSize, 0, normA, normB),
+              "naive bound", matmullib.matmulStrassenErrorBound(arrSize, arrSize, normA, normB))
+        vector = numpy.random.rand(arrSize)
+        wrapped = wrapper(gemv, arrA, vector, None, 1.0, 0.0, threads)
+        t = timeit.timeit(wrapped, number=1)
+        print("Gemv", t)
+        chain = [arrA, arrB, arrA, vector]
+        plan = ChainPlan([x.shape for x in chain[:-1]] + [(arrSize, 1)])
+        wrapped = wrapper(multiDot, chain, threads)
+        t = timeit.timeit(wrapped, number=1)
+        print("Chain", t, "multiply-adds", plan.cost, "left to right", plan.naiveCost)
+        # Small products from several Python threads at once, queued to the scheduler instead of calling in parallel
+        smallPairs = [(numpy.random.rand(64, 64), numpy.random.rand(64, 64)) for _ in range(512)]
+        submitAll = lambda pairs: [f.result() for f in [submit(x, y) for x, y in pairs]]
+        with concurrent.futures.ThreadPoolExecutor(8) as executor:
+            wrapped = wrapper(lambda: list(executor.map(submitAll, [smallPairs[i::8] for i in range(8)])))
+            t = timeit.timeit(wrapped, number=1)
+        print("Submitted", t)
+    for smallSize in [4, 8, 16, 32]:
+        batchA = numpy.random.rand(100000, smallSize, smallSize)
+        batchB = numpy.random.rand(100000, smallSize, smallSize)
+        wrapped = wrapper(batched, batchA, batchB, threads)
+        t = timeit.timeit(wrapped, number=1)
+        print("Batched", smallSize, t)
+    keys = numpy.random.randint(-2**31, 2**31, 10000000, dtype=numpy.int32)
+    wrapped = wrapper(sort, keys.copy(), threads)
+    t = timeit.timeit(wrapped, number=1)
+    print("Sort", t)
+    wrapped = wrapper(argsort, keys, threads)
+    t = timeit.timeit(wrapped, number=1)
+    print("Argsort", t)
+    for density in [0.01, 0.05]:
+        denseA = numpy.random.rand(4000, 4000)
+        denseA[numpy.random.rand(4000, 4000) >= density] = 0
+        sparseA = SparseMatrix.fromDense(denseA)
+        arrB = numpy.random.rand(4000, 512)
+        wrapped = wrapper(sparseA.matmul, arrB, None, threads)
+        t = timeit.timeit(wrapped, number=1)
+        print("Sparse", density, t)
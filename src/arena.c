@@ -0,0 +1,247 @@
+#define _GNU_SOURCE
+#include <arena.h>
+#include <topology.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define HUGE_PAGE ((size_t)2 << 20)
+// Every block starts with a struct BlockHeader, padded to one cache line so that the block stays aligned
+#define HEADER 64
+// Blocks whose pages are left to the default first touch placement
+#define ANY_NODE SIZE_MAX
+// Slots the cache starts with, it grows when a GEMM releases more blocks at once, like the panels of many workers
+#define CACHE_SLOTS 32
+// A cached block is only handed out for requests of at least half its size
+#define MAX_WASTE 2
+#define DEFAULT_LIMIT_MB 1024
+
+enum HugePages {
+    HUGE_PAGES_OFF,
+    HUGE_PAGES_MADVISE,
+    HUGE_PAGES_HUGETLB,
+};
+
+static pthread_once_t configOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER;
+static enum HugePages hugePages = HUGE_PAGES_MADVISE;
+static size_t limit;
+struct BlockHeader {
+    size_t length;
+    // The node the pages were placed on, see arenaAllocNode, or ANY_NODE
+    size_t node;
+    // Chains the blocks dropped from the cache until they are unmapped
+    struct BlockHeader* nextVictim;
+};
+
+// The cache keeps the length and node of a block next to it, so that a lookup does not touch the blocks
+struct CacheSlot {
+    struct BlockHeader* block;
+    size_t length;
+    size_t node;
+};
+
+// Cached blocks, oldest first
+static struct CacheSlot* cached = NULL;
+static size_t cachedCapacity = 0;
+static size_t cachedCount = 0;
+static size_t cachedBytes = 0;
+
+static void readConfig(void){
+    limit = (size_t)DEFAULT_LIMIT_MB << 20;
+    const char* env = getenv("MATMUL_ARENA_MB");
+    if (env != NULL && env[0] != 0){
+        char* end;
+        const unsigned long long megabytes = strtoull(env, &end, 10);
+        if (*end == 0){
+            limit = (size_t)megabytes << 20;
+        } else {
+            fprintf(stderr, "MATMUL_ARENA_MB=%s is not a number, the arena keeps %d MB\n", env, DEFAULT_LIMIT_MB);
+        }
+    }
+    env = getenv("MATMUL_HUGEPAGES");
+    if (env == NULL || env[0] == 0 || strcmp(env, "madvise") == 0) return;
+    if (strcmp(env, "off") == 0){
+        hugePages = HUGE_PAGES_OFF;
+    } else if (strcmp(env, "hugetlb") == 0){
+        hugePages = HUGE_PAGES_HUGETLB;
+    } else {
+        fprintf(stderr, "MATMUL_HUGEPAGES=%s is unknown, expected off, madvise or hugetlb. Using madvise\n", env);
+    }
+}
+
+// Blocks of a huge page or more take whole huge pages, smaller ones whole normal pages
+static size_t blockLength(const size_t bytes){
+    const size_t total = bytes + HEADER;
+    if (total >= HUGE_PAGE) return (total + HUGE_PAGE - 1)/HUGE_PAGE*HUGE_PAGE;
+    const long page = sysconf(_SC_PAGESIZE);
+    const size_t size = page > 0 ? (size_t)page : 4096;
+    return (total + size - 1)/size*size;
+}
+
+static void* mapBlock(const size_t length){
+    if (length >= HUGE_PAGE && hugePages != HUGE_PAGES_OFF){
+#ifdef MAP_HUGETLB
+        if (hugePages == HUGE_PAGES_HUGETLB){
+            void* const ptr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (ptr != MAP_FAILED) return ptr;
+        }
+#endif
+        // Map one huge page more and cut the ends off, so that the block starts on a huge page boundary
+        char* const ptr = mmap(NULL, length + HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED) return NULL;
+        const size_t head = (HUGE_PAGE - (uintptr_t)ptr % HUGE_PAGE) % HUGE_PAGE;
+        if (head > 0) munmap(ptr, head);
+        munmap(ptr + head + length, HUGE_PAGE - head);
+#ifdef MADV_HUGEPAGE
+        madvise(ptr + head, length, MADV_HUGEPAGE);
+#endif
+        return ptr + head;
+    }
+    void* const ptr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+// Unmap a chain of evict, outside of the lock
+static void unmapVictims(struct BlockHeader* victim){
+    while (victim != NULL){
+        struct BlockHeader* const next = victim->nextVictim;
+        munmap(victim, victim->length);
+        victim = next;
+    }
+}
+
+// Drop the oldest count cached blocks and return them as a chain for unmapVictims
+static struct BlockHeader* dropOldest(const size_t count){
+    if (count == 0) return NULL;
+    struct BlockHeader* victims = NULL;
+    for (size_t i = count; i-- > 0;){
+        cached[i].block->nextVictim = victims;
+        victims = cached[i].block;
+        cachedBytes -= cached[i].length;
+    }
+    cachedCount -= count;
+    memmove(&cached[0], &cached[count], cachedCount*sizeof(struct CacheSlot));
+    return victims;
+}
+
+// Drop cached blocks, oldest first, until a block of keep more bytes fits under the limit (keep zero only trims).
+// The blocks a GEMM releases are the newest, so they are the last to go.
+static struct BlockHeader* evict(const size_t keep){
+    size_t count = 0;
+    size_t bytes = cachedBytes;
+    while (count < cachedCount && bytes + keep > limit){
+        bytes -= cached[count].length;
+        ++count;
+    }
+    return dropOldest(count);
+}
+
+// Room for one more cached block, false if the slots can not grow
+static bool reserveSlot(void){
+    if (cachedCount < cachedCapacity) return true;
+    const size_t capacity = cachedCapacity > 0 ? 2*cachedCapacity : CACHE_SLOTS;
+    struct CacheSlot* const slots = realloc(cached, capacity*sizeof(struct CacheSlot));
+    if (slots == NULL) return false;
+    cached = slots;
+    cachedCapacity = capacity;
+    return true;
+}
+
+static void* allocBlock(const size_t bytes, const size_t node){
+    pthread_once(&configOnce, readConfig);
+    const size_t length = blockLength(bytes);
+    struct BlockHeader* block = NULL;
+    pthread_mutex_lock(&cacheLock);
+    size_t best = cachedCount;
+    for (size_t i = 0; i < cachedCount; ++i){
+        if (cached[i].node != node || cached[i].length < length || cached[i].length > MAX_WASTE*length) continue;
+        if (best == cachedCount || cached[i].length < cached[best].length) best = i;
+    }
+    if (best != cachedCount){
+        block = cached[best].block;
+        cachedBytes -= cached[best].length;
+        --cachedCount;
+        memmove(&cached[best], &cached[best + 1], (cachedCount - best)*sizeof(struct CacheSlot));
+    }
+    pthread_mutex_unlock(&cacheLock);
+    if (block == NULL){
+        block = mapBlock(length);
+        if (block == NULL){
+            fprintf(stderr, "Failed to map a scratch block of %zu bytes\n", length);
+            exit(1);
+        }
+        // Before the header faults in the first page
+        if (node != ANY_NODE) topologyPlace(block, length, node);
+        block->length = length;
+        block->node = node;
+    }
+    return (char*)block + HEADER;
+}
+
+void* arenaAlloc(const size_t bytes){
+    return allocBlock(bytes, ANY_NODE);
+}
+
+void* arenaAllocNode(const size_t bytes, const size_t node){
+    return allocBlock(bytes, node);
+}
+
+void arenaRelease(void* const ptr){
+    if (ptr == NULL) return;
+    pthread_once(&configOnce, readConfig);
+    struct BlockHeader* const block = (struct BlockHeader*)((char*)ptr - HEADER);
+    struct BlockHeader* victims = NULL;
+    bool keep = false;
+    pthread_mutex_lock(&cacheLock);
+    if (block->length <= limit && reserveSlot()){
+        victims = evict(block->length);
+        cached[cachedCount] = (struct CacheSlot){
+            .block = block,
+            .length = block->length,
+            .node = block->node,
+        };
+        ++cachedCount;
+        cachedBytes += block->length;
+        keep = true;
+    }
+    pthread_mutex_unlock(&cacheLock);
+    unmapVictims(victims);
+    if (!keep) munmap(block, block->length);
+}
+
+void* matmulAlloc(const size_t bytes){
+    return arenaAlloc(bytes);
+}
+
+void matmulFree(void* const ptr){
+    arenaRelease(ptr);
+}
+
+void matmulArenaLimit(const size_t bytes){
+    pthread_once(&configOnce, readConfig);
+    pthread_mutex_lock(&cacheLock);
+    limit = bytes;
+    struct BlockHeader* const victims = evict(0);
+    pthread_mutex_unlock(&cacheLock);
+    unmapVictims(victims);
+}
+
+void matmulArenaTrim(void){
+    pthread_mutex_lock(&cacheLock);
+    struct BlockHeader* const victims = dropOldest(cachedCount);
+    pthread_mutex_unlock(&cacheLock);
+    unmapVictims(victims);
+}
+
+size_t matmulArenaCached(void){
+    pthread_mutex_lock(&cacheLock);
+    const size_t bytes = cachedBytes;
+    pthread_mutex_unlock(&cacheLock);
+    return bytes;
+}
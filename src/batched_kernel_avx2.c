@@ -0,0 +1,6 @@
+#include <batched.h>
+
+// The AVX2 + FMA build of the small matrix kernels, also used on AVX-512 cpus since the rows are at most 32 wide
+#define BATCHED_NAME batchedKernelsAvx2
+#define BATCHED_ISA "avx2"
+#include <batched_template.h>
@@ -0,0 +1,6 @@
+#include <batched.h>
+
+// The x86-64 baseline build of the small matrix kernels
+#define BATCHED_NAME batchedKernelsSse2
+#define BATCHED_ISA "sse2"
+#include <batched_template.h>
@@ -0,0 +1,88 @@
+#include <cpu.h>
+#include <cpuid.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char* const isaNames[] = {
+    [ISA_SSE2] = "sse2",
+    [ISA_AVX] = "avx",
+    [ISA_AVX2] = "avx2",
+    [ISA_AVX512] = "avx512",
+};
+
+static pthread_once_t detectOnce = PTHREAD_ONCE_INIT;
+static enum CpuIsa detected;
+static pthread_once_t brandOnce = PTHREAD_ONCE_INIT;
+static char brand[49];
+
+static enum CpuIsa detectHardware(void){
+    // __builtin_cpu_supports runs cpuid and also checks that the operating system saves the wider registers
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return ISA_AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return ISA_AVX2;
+    if (__builtin_cpu_supports("avx")) return ISA_AVX;
+    return ISA_SSE2;
+}
+
+static void detect(void){
+    detected = detectHardware();
+    const char* env = getenv("MATMUL_ISA");
+    if (env == NULL) return;
+    const int level = cpuIsaFromName(env);
+    if (level >= 0){
+        if ((enum CpuIsa)level > detected){
+            fprintf(stderr, "Warning: MATMUL_ISA=%s is not supported by this cpu, using %s\n", env, isaNames[detected]);
+        } else {
+            detected = (enum CpuIsa)level;
+        }
+        return;
+    }
+    fprintf(stderr, "Warning: unknown MATMUL_ISA=%s, using %s\n", env, isaNames[detected]);
+}
+
+enum CpuIsa cpuIsa(void){
+    pthread_once(&detectOnce, detect);
+    return detected;
+}
+
+const char* matmulIsaName(void){
+    return isaNames[cpuIsa()];
+}
+
+const char* cpuIsaName(const enum CpuIsa isa){
+    return isaNames[isa];
+}
+
+int cpuIsaFromName(const char* const name){
+    for (size_t i = 0; i < sizeof(isaNames)/sizeof(isaNames[0]); ++i){
+        if (strcmp(name, isaNames[i]) == 0) return (int)i;
+    }
+    return -1;
+}
+
+static void readBrand(void){
+    unsigned int regs[12];
+    unsigned int maxLeaf = __get_cpuid_max(0x80000000, NULL);
+    if (maxLeaf < 0x80000004){
+        snprintf(brand, sizeof(brand), "unknown");
+        return;
+    }
+    for (unsigned int i = 0; i < 3; ++i){
+        __get_cpuid(0x80000002 + i, &regs[4*i], &regs[4*i + 1], &regs[4*i + 2], &regs[4*i + 3]);
+    }
+    memcpy(brand, regs, sizeof(regs));
+    brand[48] = 0;
+    // The string is padded with spaces on some cpus
+    char* start = brand;
+    while (*start == ' ') ++start;
+    memmove(brand, start, strlen(start) + 1);
+    for (size_t length = strlen(brand); length > 0 && brand[length - 1] == ' '; --length) brand[length - 1] = 0;
+    if (brand[0] == 0) snprintf(brand, sizeof(brand), "unknown");
+}
+
+const char* cpuBrand(void){
+    pthread_once(&brandOnce, readBrand);
+    return brand;
+}
@@ -0,0 +1,136 @@
+#include <epilogue.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+// Columns of a tile row that are processed at a time, in a buffer of doubles on the stack
+#define CHUNK 64
+
+bool epiloguePrepare(const struct MatmulEpilogue* const epilogue, const bool colMajor, const size_t m, const size_t n, const double scale,
+        const double beta, struct EpilogueRun* const run, const char* const caller){
+    *run = (struct EpilogueRun){
+        .scale = scale,
+    };
+    if (epilogue == NULL) return scale != 1;
+    if (epilogue->bias > MATMUL_BIAS_COLUMN || epilogue->activation > MATMUL_ACTIVATION_TANH || epilogue->output > MATMUL_OUTPUT_INT8){
+        fprintf(stderr, "%s: unknown epilogue bias %d, activation %d or output %d\n", caller, epilogue->bias, epilogue->activation, epilogue->output);
+        exit(1);
+    }
+    if (epilogue->bias != MATMUL_BIAS_NONE && epilogue->biasValues == NULL){
+        fprintf(stderr, "%s: the epilogue has a bias but no values\n", caller);
+        exit(1);
+    }
+    if (epilogue->output != MATMUL_OUTPUT_NATIVE){
+        if (epilogue->out == NULL){
+            fprintf(stderr, "%s: the epilogue converts the output but out is NULL\n", caller);
+            exit(1);
+        }
+        const size_t minimum = colMajor ? m : n;
+        if (epilogue->ldo < minimum || epilogue->ldo == 0){
+            fprintf(stderr, "%s: ldo is %zu, but must be at least %zu\n", caller, epilogue->ldo, minimum > 0 ? minimum : 1);
+            exit(1);
+        }
+    }
+    run->bias = epilogue->bias;
+    if (colMajor && epilogue->bias != MATMUL_BIAS_NONE) run->bias = epilogue->bias == MATMUL_BIAS_ROW ? MATMUL_BIAS_COLUMN : MATMUL_BIAS_ROW;
+    run->biasValues = epilogue->biasValues;
+    run->activation = epilogue->activation;
+    run->output = epilogue->output;
+    run->out = epilogue->out;
+    run->ldo = epilogue->ldo;
+    run->beta = epilogue->output != MATMUL_OUTPUT_NATIVE ? beta : 0;
+    return scale != 1 || run->bias != MATMUL_BIAS_NONE || run->activation != MATMUL_ACTIVATION_NONE || run->output != MATMUL_OUTPUT_NATIVE;
+}
+
+static inline double saturate(const double x, const double low, const double high){
+    if (x != x) return 0;
+    return x < low ? low : x > high ? high : x;
+}
+
+// Bias and activation of values, the elements [col, col + count) of row row of the product
+static void finish(const struct EpilogueRun* const run, const size_t row, const size_t col, const size_t count, double* const restrict values){
+    if (run->bias == MATMUL_BIAS_ROW){
+        const double bias = run->biasValues[row];
+        for (size_t j = 0; j < count; ++j) values[j] += bias;
+    } else if (run->bias == MATMUL_BIAS_COLUMN){
+        const double* const bias = &run->biasValues[col];
+        for (size_t j = 0; j < count; ++j) values[j] += bias[j];
+    }
+    switch (run->activation){
+        case MATMUL_ACTIVATION_RELU:
+            for (size_t j = 0; j < count; ++j) values[j] = values[j] > 0 ? values[j] : 0;
+            break;
+        case MATMUL_ACTIVATION_GELU:
+            for (size_t j = 0; j < count; ++j) values[j] = 0.5*values[j]*(1 + erf(values[j]*M_SQRT1_2));
+            break;
+        case MATMUL_ACTIVATION_SIGMOID:
+            for (size_t j = 0; j < count; ++j) values[j] = 1/(1 + exp(-values[j]));
+            break;
+        case MATMUL_ACTIVATION_TANH:
+            for (size_t j = 0; j < count; ++j) values[j] = tanh(values[j]);
+            break;
+        default:
+            break;
+    }
+}
+
+// beta times the old converted output, before finish, and the store of the result after it
+#define OUTPUT_CASES(X) \
+    X(MATMUL_OUTPUT_FLOAT64, double, values[j]) \
+    X(MATMUL_OUTPUT_FLOAT32, float, (float)values[j]) \
+    X(MATMUL_OUTPUT_INT32, int32_t, (int32_t)lrint(saturate(values[j], INT32_MIN, INT32_MAX))) \
+    X(MATMUL_OUTPUT_INT8, int8_t, (int8_t)lrint(saturate(values[j], INT8_MIN, INT8_MAX)))
+
+#define OUTPUT_BETA(OUTPUT, T, CONVERTED) \
+    case OUTPUT: { \
+        const T* const old = &((const T*)run->out)[row*run->ldo + col]; \
+        for (size_t j = 0; j < count; ++j) values[j] += run->beta*old[j]; \
+        break; \
+    }
+
+#define OUTPUT_STORE(OUTPUT, T, CONVERTED) \
+    case OUTPUT: { \
+        T* const out = &((T*)run->out)[row*run->ldo + col]; \
+        for (size_t j = 0; j < count; ++j) out[j] = CONVERTED; \
+        break; \
+    }
+
+static void convert(const struct EpilogueRun* const run, const size_t row, const size_t col, const size_t count, double* const restrict values){
+    if (run->beta != 0){
+        switch (run->output){
+            OUTPUT_CASES(OUTPUT_BETA)
+            default: break;
+        }
+    }
+    finish(run, row, col, count, values);
+    switch (run->output){
+        OUTPUT_CASES(OUTPUT_STORE)
+        default: break;
+    }
+}
+
+/*
+ * The tile functions take CHUNK columns of a row at a time into a buffer of doubles, scaled, and either convert
+ * them to out or finish them and store them back as the native type.
+ */
+#define EPILOGUE_TILE(NAME, T, NATIVE) \
+    void NAME(const struct EpilogueRun* const run, const size_t row, const size_t col, const size_t rows, const size_t cols, T* const tile, const size_t ldt){ \
+        double values[CHUNK]; \
+        for (size_t i = 0; i < rows; ++i){ \
+            for (size_t c = 0; c < cols; c += CHUNK){ \
+                const size_t count = cols - c < CHUNK ? cols - c : CHUNK; \
+                T* const src = &tile[i*ldt + c]; \
+                for (size_t j = 0; j < count; ++j) values[j] = run->scale*(double)src[j]; \
+                if (run->output != MATMUL_OUTPUT_NATIVE){ \
+                    convert(run, row + i, col + c, count, values); \
+                } else { \
+                    finish(run, row + i, col + c, count, values); \
+                    for (size_t j = 0; j < count; ++j) src[j] = NATIVE; \
+                } \
+            } \
+        } \
+    }
+
+EPILOGUE_TILE(epilogueDouble, double, values[j])
+EPILOGUE_TILE(epilogueFloat, float, (float)values[j])
+EPILOGUE_TILE(epilogueInt32, int32_t, (int32_t)lrint(saturate(values[j], INT32_MIN, INT32_MAX)))
@@ -0,0 +1,159 @@
+#include <gemm.h>
+#include <immintrin.h>
+#include <stdint.h>
+
+/*
+ * AVX2 + FMA micro kernels. The floating point and int32 tiles are 6 rows of two ymm registers, which keeps 12
+ * accumulators in registers.
+ */
+
+// All ones in the 32 bit lanes first + i with i < n, the masks of the masked loads and stores
+static inline __m256i laneMask32(const int n, const int first){
+    return _mm256_cmpgt_epi32(_mm256_set1_epi32(n), _mm256_setr_epi32(first, first + 1, first + 2, first + 3, first + 4,
+            first + 5, first + 6, first + 7));
+}
+
+#define MICRO_NAME kernel6x8
+#define MICRO_T double
+#define MICRO_VEC __m256d
+#define MICRO_VLEN 4
+#define MICRO_MR 6
+#define MICRO_NV 2
+#define MICRO_ZERO() _mm256_setzero_pd()
+#define MICRO_LOAD(p) _mm256_load_pd(p)
+#define MICRO_LOADU(p) _mm256_loadu_pd(p)
+#define MICRO_STOREU(p, v) _mm256_storeu_pd(p, v)
+#define MICRO_SET1(x) _mm256_set1_pd(x)
+#define MICRO_MUL(a, b) _mm256_mul_pd(a, b)
+#define MICRO_FMA(a, b, c) _mm256_fmadd_pd(a, b, c)
+#define MICRO_MASK_T __m256i
+#define MICRO_MASK(n) _mm256_cmpgt_epi64(_mm256_set1_epi64x((long long)(n)), _mm256_setr_epi64x(0, 1, 2, 3))
+#define MICRO_MASKLOAD(p, m) _mm256_maskload_pd(p, m)
+#define MICRO_MASKSTORE(p, m, v) _mm256_maskstore_pd(p, m, v)
+#include <gemm_micro_template.h>
+
+#define MICRO_NAME kernel6x16Float
+#define MICRO_T float
+#define MICRO_VEC __m256
+#define MICRO_VLEN 8
+#define MICRO_MR 6
+#define MICRO_NV 2
+#define MICRO_ZERO() _mm256_setzero_ps()
+#define MICRO_LOAD(p) _mm256_load_ps(p)
+#define MICRO_LOADU(p) _mm256_loadu_ps(p)
+#define MICRO_STOREU(p, v) _mm256_storeu_ps(p, v)
+#define MICRO_SET1(x) _mm256_set1_ps(x)
+#define MICRO_MUL(a, b) _mm256_mul_ps(a, b)
+#define MICRO_FMA(a, b, c) _mm256_fmadd_ps(a, b, c)
+#define MICRO_MASK_T __m256i
+#define MICRO_MASK(n) laneMask32((int)(n), 0)
+#define MICRO_MASKLOAD(p, m) _mm256_maskload_ps(p, m)
+#define MICRO_MASKSTORE(p, m, v) _mm256_maskstore_ps(p, m, v)
+#include <gemm_micro_template.h>
+
+#define MICRO_NAME kernel6x16Int32
+#define MICRO_T int32_t
+#define MICRO_VEC __m256i
+#define MICRO_VLEN 8
+#define MICRO_MR 6
+#define MICRO_NV 2
+#define MICRO_ZERO() _mm256_setzero_si256()
+#define MICRO_LOAD(p) _mm256_load_si256((const __m256i*)(p))
+#define MICRO_LOADU(p) _mm256_loadu_si256((const __m256i*)(p))
+#define MICRO_STOREU(p, v) _mm256_storeu_si256((__m256i*)(p), v)
+#define MICRO_SET1(x) _mm256_set1_epi32(x)
+#define MICRO_MUL(a, b) _mm256_mullo_epi32(a, b)
+#define MICRO_FMA(a, b, c) _mm256_add_epi32(_mm256_mullo_epi32(a, b), c)
+#define MICRO_MASK_T __m256i
+#define MICRO_MASK(n) laneMask32((int)(n), 0)
+#define MICRO_MASKLOAD(p, m) _mm256_maskload_epi32((const int*)(p), m)
+#define MICRO_MASKSTORE(p, m, v) _mm256_maskstore_epi32((int*)(p), m, v)
+#include <gemm_micro_template.h>
+
+/*
+ * int8 x int8 -> int32 with a 6x16 tile and k interleaved in pairs. Every step widens 16 columns x 2 values of b
+ * to int16 and _mm256_madd_epi16 multiplies them with a broadcast pair of a and adds the two products, which is
+ * exact for the whole int8 range (_mm256_maddubs_epi16 would be twice as wide but saturates on -128 * -128 pairs).
+ */
+#define I8_MR 6
+#define I8_NR 16
+
+static void kernel6x16Int8(const size_t kc, const int8_t* restrict pa, const int8_t* restrict pb, int32_t* const restrict res, const size_t ldr, const size_t rows, const size_t cols, const int32_t alpha, const int32_t beta){
+    __m256i acc[I8_MR][2];
+    for (size_t i = 0; i < I8_MR; ++i){
+        acc[i][0] = _mm256_setzero_si256();
+        acc[i][1] = _mm256_setzero_si256();
+    }
+    for (size_t p = 0; p < kc; p += 2){
+        const __m256i b0 = _mm256_cvtepi8_epi16(_mm_load_si128((const __m128i*)pb));
+        const __m256i b1 = _mm256_cvtepi8_epi16(_mm_load_si128((const __m128i*)(pb + 16)));
+        for (size_t i = 0; i < I8_MR; ++i){
+            const uint32_t pair = (uint16_t)(int16_t)pa[2*i] | ((uint32_t)(uint16_t)(int16_t)pa[2*i + 1] << 16);
+            const __m256i a = _mm256_set1_epi32((int32_t)pair);
+            acc[i][0] = _mm256_add_epi32(acc[i][0], _mm256_madd_epi16(a, b0));
+            acc[i][1] = _mm256_add_epi32(acc[i][1], _mm256_madd_epi16(a, b1));
+        }
+        pa += 2*I8_MR;
+        pb += 2*I8_NR;
+    }
+    const __m256i alphaV = _mm256_set1_epi32(alpha);
+    const __m256i betaV = _mm256_set1_epi32(beta);
+    // Edge tiles are read and written in place through masks, like the template kernels
+    const __m256i mask0 = laneMask32((int)cols, 0);
+    const __m256i mask1 = laneMask32((int)cols, 8);
+    for (size_t i = 0; i < rows; ++i){
+        int* const row = (int*)&res[i*ldr];
+        __m256i x0 = _mm256_mullo_epi32(acc[i][0], alphaV);
+        __m256i x1 = _mm256_mullo_epi32(acc[i][1], alphaV);
+        if (beta != 0){
+            x0 = _mm256_add_epi32(_mm256_mullo_epi32(betaV, _mm256_maskload_epi32(row, mask0)), x0);
+            x1 = _mm256_add_epi32(_mm256_mullo_epi32(betaV, _mm256_maskload_epi32(row + 8, mask1)), x1);
+        }
+        _mm256_maskstore_epi32(row, mask0, x0);
+        _mm256_maskstore_epi32(row + 8, mask1, x1);
+    }
+}
+
+const struct GemmKernel gemmKernelAvx2 = {
+    .name = "avx2",
+    .mr = 6,
+    .nr = 8,
+    .mc = 72,
+    .kc = 256,
+    .nc = 4080,
+    .kgroup = 1,
+    .micro = kernel6x8,
+};
+
+const struct SgemmKernel sgemmKernelAvx2 = {
+    .name = "avx2",
+    .mr = 6,
+    .nr = 16,
+    .mc = 72,
+    .kc = 512,
+    .nc = 4080,
+    .kgroup = 1,
+    .micro = kernel6x16Float,
+};
+
+const struct I32gemmKernel i32gemmKernelAvx2 = {
+    .name = "avx2",
+    .mr = 6,
+    .nr = 16,
+    .mc = 72,
+    .kc = 512,
+    .nc = 4080,
+    .kgroup = 1,
+    .micro = kernel6x16Int32,
+};
+
+const struct I8gemmKernel i8gemmKernelAvx2 = {
+    .name = "avx2",
+    .mr = I8_MR,
+    .nr = I8_NR,
+    .mc = 120,
+    .kc = 1024,
+    .nc = 4080,
+    .kgroup = 2,
+    .micro = kernel6x16Int8,
+};
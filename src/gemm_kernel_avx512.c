@@ -0,0 +1,98 @@
+#include <gemm.h>
+#include <immintrin.h>
+#include <stdint.h>
+
+/*
+ * AVX-512F micro kernels: 12 rows of two 8 (double) or 16 (float, int32) wide zmm registers, which keeps 24
+ * accumulators in registers. int8 uses the AVX2 kernel.
+ */
+
+#define MICRO_NAME kernel12x16
+#define MICRO_T double
+#define MICRO_VEC __m512d
+#define MICRO_VLEN 8
+#define MICRO_MR 12
+#define MICRO_NV 2
+#define MICRO_ZERO() _mm512_setzero_pd()
+#define MICRO_LOAD(p) _mm512_load_pd(p)
+#define MICRO_LOADU(p) _mm512_loadu_pd(p)
+#define MICRO_STOREU(p, v) _mm512_storeu_pd(p, v)
+#define MICRO_SET1(x) _mm512_set1_pd(x)
+#define MICRO_MUL(a, b) _mm512_mul_pd(a, b)
+#define MICRO_FMA(a, b, c) _mm512_fmadd_pd(a, b, c)
+#define MICRO_MASK_T __mmask8
+#define MICRO_MASK(n) ((__mmask8)((1u << (n)) - 1))
+#define MICRO_MASKLOAD(p, m) _mm512_maskz_loadu_pd(m, p)
+#define MICRO_MASKSTORE(p, m, v) _mm512_mask_storeu_pd(p, m, v)
+#include <gemm_micro_template.h>
+
+#define MICRO_NAME kernel12x32Float
+#define MICRO_T float
+#define MICRO_VEC __m512
+#define MICRO_VLEN 16
+#define MICRO_MR 12
+#define MICRO_NV 2
+#define MICRO_ZERO() _mm512_setzero_ps()
+#define MICRO_LOAD(p) _mm512_load_ps(p)
+#define MICRO_LOADU(p) _mm512_loadu_ps(p)
+#define MICRO_STOREU(p, v) _mm512_storeu_ps(p, v)
+#define MICRO_SET1(x) _mm512_set1_ps(x)
+#define MICRO_MUL(a, b) _mm512_mul_ps(a, b)
+#define MICRO_FMA(a, b, c) _mm512_fmadd_ps(a, b, c)
+#define MICRO_MASK_T __mmask16
+#define MICRO_MASK(n) ((__mmask16)((1u << (n)) - 1))
+#define MICRO_MASKLOAD(p, m) _mm512_maskz_loadu_ps(m, p)
+#define MICRO_MASKSTORE(p, m, v) _mm512_mask_storeu_ps(p, m, v)
+#include <gemm_micro_template.h>
+
+#define MICRO_NAME kernel12x32Int32
+#define MICRO_T int32_t
+#define MICRO_VEC __m512i
+#define MICRO_VLEN 16
+#define MICRO_MR 12
+#define MICRO_NV 2
+#define MICRO_ZERO() _mm512_setzero_si512()
+#define MICRO_LOAD(p) _mm512_load_si512((const void*)(p))
+#define MICRO_LOADU(p) _mm512_loadu_si512((const void*)(p))
+#define MICRO_STOREU(p, v) _mm512_storeu_si512((void*)(p), v)
+#define MICRO_SET1(x) _mm512_set1_epi32(x)
+#define MICRO_MUL(a, b) _mm512_mullo_epi32(a, b)
+#define MICRO_FMA(a, b, c) _mm512_add_epi32(_mm512_mullo_epi32(a, b), c)
+#define MICRO_MASK_T __mmask16
+#define MICRO_MASK(n) ((__mmask16)((1u << (n)) - 1))
+#define MICRO_MASKLOAD(p, m) _mm512_maskz_loadu_epi32(m, p)
+#define MICRO_MASKSTORE(p, m, v) _mm512_mask_storeu_epi32(p, m, v)
+#include <gemm_micro_template.h>
+
+const struct GemmKernel gemmKernelAvx512 = {
+    .name = "avx512",
+    .mr = 12,
+    .nr = 16,
+    .mc = 144,
+    .kc = 384,
+    .nc = 4096,
+    .kgroup = 1,
+    .micro = kernel12x16,
+};
+
+const struct SgemmKernel sgemmKernelAvx512 = {
+    .name = "avx512",
+    .mr = 12,
+    .nr = 32,
+    .mc = 144,
+    .kc = 512,
+    .nc = 4096,
+    .kgroup = 1,
+    .micro = kernel12x32Float,
+};
+
+const struct I32gemmKernel i32gemmKernelAvx512 = {
+    .name = "avx512",
+    .mr = 12,
+    .nr = 32,
+    .mc = 144,
+    .kc = 512,
+    .nc = 4096,
+    .kgroup = 1,
+    .micro = kernel12x32Int32,
+};
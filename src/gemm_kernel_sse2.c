@@ -0,0 +1,121 @@
+#include <gemm.h>
+#include <emmintrin.h>
+#include <stdint.h>
+
+/*
+ * SSE2 baseline micro kernels, which run on every x86-64 cpu: 4 rows of two xmm registers. SSE2 has no fused
+ * multiply-add and no 32 bit multiply, so the integer kernels use the same template on plain scalars and leave the
+ * vectorisation to the compiler. They compute in uint32_t and convert back, so that overflow wraps around like the
+ * vector kernels instead of being undefined.
+ */
+
+#define MICRO_NAME kernel4x4
+#define MICRO_T double
+#define MICRO_VEC __m128d
+#define MICRO_VLEN 2
+#define MICRO_MR 4
+#define MICRO_NV 2
+#define MICRO_ZERO() _mm_setzero_pd()
+#define MICRO_LOAD(p) _mm_load_pd(p)
+#define MICRO_LOADU(p) _mm_loadu_pd(p)
+#define MICRO_STOREU(p, v) _mm_storeu_pd(p, v)
+#define MICRO_SET1(x) _mm_set1_pd(x)
+#define MICRO_MUL(a, b) _mm_mul_pd(a, b)
+#define MICRO_FMA(a, b, c) _mm_add_pd(_mm_mul_pd(a, b), c)
+#include <gemm_micro_template.h>
+
+#define MICRO_NAME kernel4x8Float
+#define MICRO_T float
+#define MICRO_VEC __m128
+#define MICRO_VLEN 4
+#define MICRO_MR 4
+#define MICRO_NV 2
+#define MICRO_ZERO() _mm_setzero_ps()
+#define MICRO_LOAD(p) _mm_load_ps(p)
+#define MICRO_LOADU(p) _mm_loadu_ps(p)
+#define MICRO_STOREU(p, v) _mm_storeu_ps(p, v)
+#define MICRO_SET1(x) _mm_set1_ps(x)
+#define MICRO_MUL(a, b) _mm_mul_ps(a, b)
+#define MICRO_FMA(a, b, c) _mm_add_ps(_mm_mul_ps(a, b), c)
+#include <gemm_micro_template.h>
+
+#define MICRO_NAME kernel4x8Int32
+#define MICRO_T int32_t
+#define MICRO_VEC uint32_t
+#define MICRO_VLEN 1
+#define MICRO_MR 4
+#define MICRO_NV 8
+#define MICRO_ZERO() 0
+#define MICRO_LOAD(p) ((uint32_t)*(p))
+#define MICRO_LOADU(p) ((uint32_t)*(p))
+#define MICRO_STOREU(p, v) (*(p) = (int32_t)(v))
+#define MICRO_SET1(x) ((uint32_t)(x))
+#define MICRO_MUL(a, b) ((a)*(b))
+#define MICRO_FMA(a, b, c) ((a)*(b) + (c))
+#include <gemm_micro_template.h>
+
+// int8 with k interleaved in pairs, the layout of the AVX2 kernel
+static void kernel4x8Int8(const size_t kc, const int8_t* restrict pa, const int8_t* restrict pb, int32_t* const restrict res, const size_t ldr, const size_t rows, const size_t cols, const int32_t alpha, const int32_t beta){
+    uint32_t acc[4][8] = {{0}};
+    for (size_t p = 0; p < kc; p += 2){
+        for (size_t i = 0; i < 4; ++i){
+            for (size_t j = 0; j < 8; ++j){
+                // A pair of int8 products always fits an int
+                acc[i][j] += (uint32_t)(pa[2*i]*pb[2*j] + pa[2*i + 1]*pb[2*j + 1]);
+            }
+        }
+        pa += 8;
+        pb += 16;
+    }
+    for (size_t i = 0; i < rows; ++i){
+        for (size_t j = 0; j < cols; ++j){
+            uint32_t x = (uint32_t)alpha*acc[i][j];
+            if (beta != 0) x += (uint32_t)beta*(uint32_t)res[i*ldr + j];
+            res[i*ldr + j] = (int32_t)x;
+        }
+    }
+}
+
+const struct GemmKernel gemmKernelSse2 = {
+    .name = "sse2",
+    .mr = 4,
+    .nr = 4,
+    .mc = 128,
+    .kc = 256,
+    .nc = 4096,
+    .kgroup = 1,
+    .micro = kernel4x4,
+};
+
+const struct SgemmKernel sgemmKernelSse2 = {
+    .name = "sse2",
+    .mr = 4,
+    .nr = 8,
+    .mc = 128,
+    .kc = 512,
+    .nc = 4096,
+    .kgroup = 1,
+    .micro = kernel4x8Float,
+};
+
+const struct I32gemmKernel i32gemmKernelScalar = {
+    .name = "scalar",
+    .mr = 4,
+    .nr = 8,
+    .mc = 128,
+    .kc = 512,
+    .nc = 4096,
+    .kgroup = 1,
+    .micro = kernel4x8Int32,
+};
+
+const struct I8gemmKernel i8gemmKernelScalar = {
+    .name = "scalar",
+    .mr = 4,
+    .nr = 8,
+    .mc = 128,
+    .kc = 1024,
+    .nc = 4096,
+    .kgroup = 2,
+    .micro = kernel4x8Int8,
+};
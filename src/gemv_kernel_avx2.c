@@ -0,0 +1,121 @@
+#include <gemv.h>
+#include <immintrin.h>
+
+/*
+ * The AVX2 + FMA kernels of matmul_gemv.c. a*x takes four rows at a time with two accumulators each, so every load
+ * of x feeds four multiply-adds and the rows stream side by side. a^T*x adds four scaled rows to each vector of acc
+ * before storing it, which keeps the loads and stores of acc at a quarter of the loads of a. The last 1 to 3 columns
+ * take a masked load.
+ */
+
+static const long long maskValues[4][4] = {
+    {0, 0, 0, 0},
+    {-1, 0, 0, 0},
+    {-1, -1, 0, 0},
+    {-1, -1, -1, 0},
+};
+
+static inline double horizontalSum(const __m256d x){
+    const __m128d pair = _mm_add_pd(_mm256_castpd256_pd128(x), _mm256_extractf128_pd(x, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(pair, _mm_unpackhi_pd(pair, pair)));
+}
+
+void gemvRowsAvx2(const size_t rows, const size_t n, const double* const a, const size_t lda, const double* const x, double* const dots){
+    const __m256i mask = _mm256_loadu_si256((const __m256i*)maskValues[n % 4]);
+    size_t i = 0;
+    for (; i + 4 <= rows; i += 4){
+        const double* const r0 = &a[i*lda];
+        const double* const r1 = &r0[lda];
+        const double* const r2 = &r1[lda];
+        const double* const r3 = &r2[lda];
+        __m256d acc[8];
+        for (size_t v = 0; v < 8; ++v) acc[v] = _mm256_setzero_pd();
+        size_t j = 0;
+        for (; j + 8 <= n; j += 8){
+            const __m256d x0 = _mm256_loadu_pd(&x[j]);
+            const __m256d x1 = _mm256_loadu_pd(&x[j + 4]);
+            acc[0] = _mm256_fmadd_pd(_mm256_loadu_pd(&r0[j]), x0, acc[0]);
+            acc[1] = _mm256_fmadd_pd(_mm256_loadu_pd(&r1[j]), x0, acc[1]);
+            acc[2] = _mm256_fmadd_pd(_mm256_loadu_pd(&r2[j]), x0, acc[2]);
+            acc[3] = _mm256_fmadd_pd(_mm256_loadu_pd(&r3[j]), x0, acc[3]);
+            acc[4] = _mm256_fmadd_pd(_mm256_loadu_pd(&r0[j + 4]), x1, acc[4]);
+            acc[5] = _mm256_fmadd_pd(_mm256_loadu_pd(&r1[j + 4]), x1, acc[5]);
+            acc[6] = _mm256_fmadd_pd(_mm256_loadu_pd(&r2[j + 4]), x1, acc[6]);
+            acc[7] = _mm256_fmadd_pd(_mm256_loadu_pd(&r3[j + 4]), x1, acc[7]);
+        }
+        for (; j + 4 <= n; j += 4){
+            const __m256d x0 = _mm256_loadu_pd(&x[j]);
+            acc[0] = _mm256_fmadd_pd(_mm256_loadu_pd(&r0[j]), x0, acc[0]);
+            acc[1] = _mm256_fmadd_pd(_mm256_loadu_pd(&r1[j]), x0, acc[1]);
+            acc[2] = _mm256_fmadd_pd(_mm256_loadu_pd(&r2[j]), x0, acc[2]);
+            acc[3] = _mm256_fmadd_pd(_mm256_loadu_pd(&r3[j]), x0, acc[3]);
+        }
+        if (j < n){
+            const __m256d x0 = _mm256_maskload_pd(&x[j], mask);
+            acc[4] = _mm256_fmadd_pd(_mm256_maskload_pd(&r0[j], mask), x0, acc[4]);
+            acc[5] = _mm256_fmadd_pd(_mm256_maskload_pd(&r1[j], mask), x0, acc[5]);
+            acc[6] = _mm256_fmadd_pd(_mm256_maskload_pd(&r2[j], mask), x0, acc[6]);
+            acc[7] = _mm256_fmadd_pd(_mm256_maskload_pd(&r3[j], mask), x0, acc[7]);
+        }
+        for (size_t r = 0; r < 4; ++r) dots[i + r] = horizontalSum(_mm256_add_pd(acc[r], acc[r + 4]));
+    }
+    for (; i < rows; ++i){
+        const double* const row = &a[i*lda];
+        __m256d acc0 = _mm256_setzero_pd();
+        __m256d acc1 = _mm256_setzero_pd();
+        size_t j = 0;
+        for (; j + 8 <= n; j += 8){
+            acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(&row[j]), _mm256_loadu_pd(&x[j]), acc0);
+            acc1 = _mm256_fmadd_pd(_mm256_loadu_pd(&row[j + 4]), _mm256_loadu_pd(&x[j + 4]), acc1);
+        }
+        for (; j + 4 <= n; j += 4){
+            acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(&row[j]), _mm256_loadu_pd(&x[j]), acc0);
+        }
+        if (j < n){
+            acc1 = _mm256_fmadd_pd(_mm256_maskload_pd(&row[j], mask), _mm256_maskload_pd(&x[j], mask), acc1);
+        }
+        dots[i] = horizontalSum(_mm256_add_pd(acc0, acc1));
+    }
+}
+
+void gemvColumnsAvx2(const size_t rows, const size_t cols, const double* const a, const size_t lda, const double* const x, double* const acc){
+    const __m256i mask = _mm256_loadu_si256((const __m256i*)maskValues[cols % 4]);
+    const size_t full = cols - cols % 4;
+    size_t i = 0;
+    for (; i + 4 <= rows; i += 4){
+        const double* const r0 = &a[i*lda];
+        const double* const r1 = &r0[lda];
+        const double* const r2 = &r1[lda];
+        const double* const r3 = &r2[lda];
+        const __m256d x0 = _mm256_set1_pd(x[i]);
+        const __m256d x1 = _mm256_set1_pd(x[i + 1]);
+        const __m256d x2 = _mm256_set1_pd(x[i + 2]);
+        const __m256d x3 = _mm256_set1_pd(x[i + 3]);
+        for (size_t j = 0; j < full; j += 4){
+            __m256d sum = _mm256_loadu_pd(&acc[j]);
+            sum = _mm256_fmadd_pd(_mm256_loadu_pd(&r0[j]), x0, sum);
+            sum = _mm256_fmadd_pd(_mm256_loadu_pd(&r1[j]), x1, sum);
+            sum = _mm256_fmadd_pd(_mm256_loadu_pd(&r2[j]), x2, sum);
+            sum = _mm256_fmadd_pd(_mm256_loadu_pd(&r3[j]), x3, sum);
+            _mm256_storeu_pd(&acc[j], sum);
+        }
+        if (full < cols){
+            __m256d sum = _mm256_maskload_pd(&acc[full], mask);
+            sum = _mm256_fmadd_pd(_mm256_maskload_pd(&r0[full], mask), x0, sum);
+            sum = _mm256_fmadd_pd(_mm256_maskload_pd(&r1[full], mask), x1, sum);
+            sum = _mm256_fmadd_pd(_mm256_maskload_pd(&r2[full], mask), x2, sum);
+            sum = _mm256_fmadd_pd(_mm256_maskload_pd(&r3[full], mask), x3, sum);
+            _mm256_maskstore_pd(&acc[full], mask, sum);
+        }
+    }
+    for (; i < rows; ++i){
+        const double* const row = &a[i*lda];
+        const __m256d x0 = _mm256_set1_pd(x[i]);
+        for (size_t j = 0; j < full; j += 4){
+            _mm256_storeu_pd(&acc[j], _mm256_fmadd_pd(_mm256_loadu_pd(&row[j]), x0, _mm256_loadu_pd(&acc[j])));
+        }
+        if (full < cols){
+            _mm256_maskstore_pd(&acc[full], mask, _mm256_fmadd_pd(_mm256_maskload_pd(&row[full], mask), x0, _mm256_maskload_pd(&acc[full], mask)));
+        }
+    }
+}
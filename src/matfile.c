@@ -0,0 +1,162 @@
+#include <matfile.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "Matrix files are little endian and read in place"
+#endif
+
+static void fileError(const char* const what, const char* const path){
+    fprintf(stderr, "%s %s. Error: %d (%s)\n", what, path, errno, strerror(errno));
+    exit(1);
+}
+
+static size_t dataBytes(const struct MatFile* const file){
+    return file->tileRows*file->tileCols*matfileTileBytes(file);
+}
+
+static struct MatFile* mapFile(const int fd, const char* const path, const bool writable, const struct MatFileHeader* const header){
+    struct MatFile* file = malloc(sizeof(struct MatFile));
+    if (file == NULL){
+        fprintf(stderr, "Failed to allocate a matrix file handle\n");
+        exit(1);
+    }
+    file->fd = fd;
+    file->writable = writable;
+    file->rows = header->rows;
+    file->cols = header->cols;
+    file->tile = header->tile;
+    file->tileRows = (file->rows + file->tile - 1)/file->tile;
+    file->tileCols = (file->cols + file->tile - 1)/file->tile;
+    file->mapBytes = header->dataOffset + dataBytes(file);
+    struct stat st;
+    if (fstat(fd, &st) != 0) fileError("Failed to stat", path);
+    if ((size_t)st.st_size < file->mapBytes){
+        fprintf(stderr, "%s is truncated: %zu bytes, the header needs %zu\n", path, (size_t)st.st_size, file->mapBytes);
+        exit(1);
+    }
+    file->map = mmap(NULL, file->mapBytes, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    if (file->map == MAP_FAILED) fileError("Failed to map", path);
+    file->data = (double*)(file->map + header->dataOffset);
+    return file;
+}
+
+struct MatFile* matfileCreate(const char* const path, const size_t rows, const size_t cols, size_t tile){
+    if (tile == 0) tile = MATFILE_DEFAULT_TILE;
+    if (tile % MATFILE_TILE_ALIGN != 0){
+        fprintf(stderr, "%s: the tile size %zu is not a multiple of %d\n", __func__, tile, MATFILE_TILE_ALIGN);
+        exit(1);
+    }
+    const int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) fileError("Failed to create", path);
+    struct MatFileHeader header = {
+        .version = MATFILE_VERSION,
+        .type = MATFILE_FLOAT64,
+        .rows = rows,
+        .cols = cols,
+        .tile = tile,
+        .dataOffset = MATFILE_HEADER_BYTES,
+    };
+    memcpy(header.magic, MATFILE_MAGIC, sizeof(MATFILE_MAGIC));
+    const size_t tiles = ((rows + tile - 1)/tile)*((cols + tile - 1)/tile);
+    // The tiles stay a hole in the file until written, so they read as zeros
+    if (ftruncate(fd, (off_t)(MATFILE_HEADER_BYTES + tiles*tile*tile*sizeof(double))) != 0) fileError("Failed to size", path);
+    if (pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) fileError("Failed to write the header of", path);
+    return mapFile(fd, path, true, &header);
+}
+
+struct MatFile* matfileOpen(const char* const path, const bool writable){
+    const int fd = open(path, writable ? O_RDWR : O_RDONLY);
+    if (fd < 0) fileError("Failed to open", path);
+    struct MatFileHeader header;
+    if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) fileError("Failed to read the header of", path);
+    if (memcmp(header.magic, MATFILE_MAGIC, sizeof(MATFILE_MAGIC)) != 0){
+        fprintf(stderr, "%s is not a matrix file\n", path);
+        exit(1);
+    }
+    if (header.version != MATFILE_VERSION || header.type != MATFILE_FLOAT64){
+        fprintf(stderr, "%s has version %u and type %u, only version %d float64 files are supported\n", path, header.version, header.type, MATFILE_VERSION);
+        exit(1);
+    }
+    if (header.tile == 0 || header.tile % MATFILE_TILE_ALIGN != 0 || header.dataOffset % MATFILE_HEADER_BYTES != 0){
+        fprintf(stderr, "%s has a corrupt header\n", path);
+        exit(1);
+    }
+    return mapFile(fd, path, writable, &header);
+}
+
+void matfileClose(struct MatFile* const file){
+    if (file == NULL) return;
+    if (file->writable && msync(file->map, file->mapBytes, MS_SYNC) != 0){
+        fprintf(stderr, "Failed to write back a matrix file. Error: %d (%s)\n", errno, strerror(errno));
+        exit(1);
+    }
+    munmap(file->map, file->mapBytes);
+    close(file->fd);
+    free(file);
+}
+
+size_t matfileRows(const struct MatFile* const file){
+    return file->rows;
+}
+
+size_t matfileCols(const struct MatFile* const file){
+    return file->cols;
+}
+
+size_t matfileTileBytes(const struct MatFile* const file){
+    return file->tile*file->tile*sizeof(double);
+}
+
+double* matfileTile(const struct MatFile* const file, const size_t i, const size_t j){
+    return &file->data[(i*file->tileCols + j)*file->tile*file->tile];
+}
+
+static void checkRows(const struct MatFile* const file, const size_t row, const size_t count, const size_t ld, const char* const caller){
+    if (row > file->rows || count > file->rows - row || ld < file->cols){
+        fprintf(stderr, "%s: rows %zu to %zu with ld %zu do not fit a %zu x %zu matrix\n", caller, row, row + count, ld, file->rows, file->cols);
+        exit(1);
+    }
+}
+
+/*
+ * Written tile rows are handed to the kernel for write back and dropped from memory once complete, so converting a
+ * matrix that is larger than memory keeps few pages resident.
+ */
+void matfileWriteRows(struct MatFile* const file, const size_t row, const size_t count, const double* const src, const size_t ld){
+    checkRows(file, row, count, ld, __func__);
+    if (!file->writable){
+        fprintf(stderr, "%s: the file was opened read only\n", __func__);
+        exit(1);
+    }
+    const size_t t = file->tile;
+    for (size_t r = row; r < row + count; ++r){
+        for (size_t j = 0; j < file->tileCols; ++j){
+            const size_t cols = file->cols - j*t < t ? file->cols - j*t : t;
+            memcpy(&matfileTile(file, r/t, j)[(r % t)*t], &src[(r - row)*ld + j*t], cols*sizeof(double));
+        }
+        if ((r + 1) % t == 0 || r + 1 == file->rows){
+            unsigned char* const start = (unsigned char*)matfileTile(file, r/t, 0);
+            const size_t bytes = file->tileCols*matfileTileBytes(file);
+            msync(start, bytes, MS_ASYNC);
+            madvise(start, bytes, MADV_DONTNEED);
+        }
+    }
+}
+
+void matfileReadRows(const struct MatFile* const file, const size_t row, const size_t count, double* const dst, const size_t ld){
+    checkRows(file, row, count, ld, __func__);
+    const size_t t = file->tile;
+    for (size_t r = row; r < row + count; ++r){
+        for (size_t j = 0; j < file->tileCols; ++j){
+            const size_t cols = file->cols - j*t < t ? file->cols - j*t : t;
+            memcpy(&dst[(r - row)*ld + j*t], &matfileTile(file, r/t, j)[(r % t)*t], cols*sizeof(double));
+        }
+    }
+}
@@ -0,0 +1,129 @@
+#include <threadpool.h>
+#include <batched.h>
+#include <gemm.h>
+#include <cpu.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Batched multiplies of many small matrices. One call runs the whole batch on the pool, split into chunks of
+ * matrices, so a single tiny product pays neither an allocation nor a thread hand off. Square products of the sizes
+ * in BATCHED_SIZES use the unrolled kernels, other shapes the generic loop and large ones the packed GEMM.
+ */
+
+// Aim for at least this many multiply-adds per task so that scheduling stays cheap next to the work
+#define TASK_WORK (1 << 16)
+// Above this many multiply-adds per product the packing of the packed GEMM pays off
+#define GEMM_WORK (64*64*64)
+
+struct BatchedJob {
+    size_t m;
+    size_t n;
+    size_t k;
+    // Strided form: matrix i is at a + i*strideA, pointer form: at a[i]
+    const double* a;
+    const double* b;
+    double* c;
+    size_t strideA;
+    size_t strideB;
+    size_t strideC;
+    const double* const* aList;
+    const double* const* bList;
+    double* const* cList;
+    size_t batchCount;
+    size_t chunk;
+    const struct BatchedKernels* kernels;
+    BatchedFixed fixed;
+};
+
+static const struct BatchedKernels* batchedKernels(void){
+    return cpuIsa() >= ISA_AVX2 ? &batchedKernelsAvx2 : &batchedKernelsSse2;
+}
+
+#define BATCHED_CASE(N) case N: return kernels->fixed##N;
+
+static BatchedFixed fixedKernel(const struct BatchedKernels* const kernels, const size_t m, const size_t n, const size_t k){
+    if (m != n || n != k) return NULL;
+    switch (m){
+        BATCHED_SIZES(BATCHED_CASE)
+        default: return NULL;
+    }
+}
+
+static void multiplyOne(const struct BatchedJob* const job, const double* const a, const double* const b, double* const c){
+    if (job->fixed != NULL){
+        job->fixed(a, b, c);
+    } else if (job->m*job->n*job->k <= GEMM_WORK){
+        job->kernels->generic(job->m, job->n, job->k, a, b, c);
+    } else {
+        // Inside a pool task this runs serially on the calling thread
+        gemmStrided(job->m, job->n, job->k, 1.0, a, job->k, 1, b, job->n, 1, 0.0, c, job->n, 1);
+    }
+}
+
+static void batchedTask(void* s, const size_t task, const size_t worker){
+    (void)worker;
+    const struct BatchedJob* job = s;
+    const size_t start = task*job->chunk;
+    const size_t end = start + job->chunk < job->batchCount ? start + job->chunk : job->batchCount;
+    for (size_t i = start; i < end; ++i){
+        if (job->aList != NULL){
+            multiplyOne(job, job->aList[i], job->bList[i], job->cList[i]);
+        } else {
+            multiplyOne(job, &job->a[i*job->strideA], &job->b[i*job->strideB], &job->c[i*job->strideC]);
+        }
+    }
+}
+
+static void runBatch(struct BatchedJob* const job, const size_t threadCount){
+    if (job->batchCount == 0 || job->m == 0 || job->n == 0) return;
+    job->kernels = batchedKernels();
+    job->fixed = fixedKernel(job->kernels, job->m, job->n, job->k);
+    const size_t work = job->m*job->n*(job->k > 0 ? job->k : 1);
+    job->chunk = work >= TASK_WORK ? 1 : TASK_WORK/work;
+    threadPoolRun(threadCount, (job->batchCount + job->chunk - 1)/job->chunk, batchedTask, job);
+}
+
+/*
+ * c[i] = a[i]*b[i] for i in [0, batchCount), with a[i] m x k, b[i] k x n and c[i] m x n, all row major and
+ * contiguous. Matrix i of a starts at a + i*strideA (in elements) and likewise for b and c, so a stride of zero
+ * multiplies every matrix with the same operand. threadCount limits the amount of pool threads, zero uses all.
+ */
+void matmulBatched(const size_t m, const size_t n, const size_t k, const double* const a, const size_t strideA,
+        const double* const b, const size_t strideB, double* const c, const size_t strideC, const size_t batchCount, const size_t threadCount){
+    if (batchCount > 1 && strideC < m*n){
+        fprintf(stderr, "%s: strideC is %zu, the results of a %zu x %zu batch would overlap\n", __func__, strideC, m, n);
+        exit(1);
+    }
+    struct BatchedJob job = {
+        .m = m,
+        .n = n,
+        .k = k,
+        .a = a,
+        .b = b,
+        .c = c,
+        .strideA = strideA,
+        .strideB = strideB,
+        .strideC = strideC,
+        .batchCount = batchCount,
+    };
+    runBatch(&job, threadCount);
+}
+
+/*
+ * The same as matmulBatched for matrices that are scattered in memory: product i reads a[i] and b[i] and writes
+ * c[i]. The c[i] must not overlap.
+ */
+void matmulBatchedPointers(const size_t m, const size_t n, const size_t k, const double* const* const a,
+        const double* const* const b, double* const* const c, const size_t batchCount, const size_t threadCount){
+    struct BatchedJob job = {
+        .m = m,
+        .n = n,
+        .k = k,
+        .aList = a,
+        .bList = b,
+        .cList = c,
+        .batchCount = batchCount,
+    };
+    runBatch(&job, threadCount);
+}
@@ -0,0 +1,146 @@
+#include <gemv.h>
+#include <gemm.h>
+#include <arena.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Intermediate products start on a cache line in the workspace
+#define ALIGNMENT 64
+#define NONE SIZE_MAX
+
+struct MatmulChain {
+    size_t count;
+    size_t* dims;
+    // For the sub chain [i, j], at i*count + j: the last matrix of its left half, and the workspace offset of its
+    // product in doubles (NONE for the whole chain, which goes to res)
+    size_t* split;
+    size_t* offset;
+    double cost;
+    double naiveCost;
+    double* workspace;
+};
+
+/*
+ * The workspace is used like a stack: the left half of a sub chain is computed at top, then the right half above it,
+ * and both are dead once their product is stored, so the space of a plan is the deepest path and not the sum of all
+ * the intermediate products.
+ */
+static size_t assign(struct MatmulChain* const plan, const size_t i, const size_t j, const size_t top){
+    if (i == j) return top;
+    const size_t s = plan->split[i*plan->count + j];
+    const size_t* const dims = plan->dims;
+    const size_t align = ALIGNMENT/sizeof(double);
+    const size_t leftSize = i == s ? 0 : (dims[i]*dims[s + 1] + align - 1)/align*align;
+    const size_t rightSize = s + 1 == j ? 0 : (dims[s + 1]*dims[j + 1] + align - 1)/align*align;
+    if (i != s) plan->offset[i*plan->count + s] = top;
+    if (s + 1 != j) plan->offset[(s + 1)*plan->count + j] = top + leftSize;
+    const size_t left = assign(plan, i, s, top + leftSize + rightSize);
+    const size_t right = assign(plan, s + 1, j, top + leftSize + rightSize);
+    return left > right ? left : right;
+}
+
+struct MatmulChain* matmulChainPlan(const size_t count, const size_t* const dims){
+    if (count == 0){
+        fprintf(stderr, "%s: a chain needs at least one matrix\n", __func__);
+        exit(1);
+    }
+    struct MatmulChain* const plan = malloc(sizeof(struct MatmulChain));
+    double* const costs = malloc(count*count*sizeof(double));
+    if (plan == NULL || costs == NULL){
+        fprintf(stderr, "Failed to allocate the plan of a chain of %zu matrices\n", count);
+        exit(1);
+    }
+    plan->count = count;
+    plan->dims = malloc((count + 1)*sizeof(size_t));
+    plan->split = malloc(count*count*sizeof(size_t));
+    plan->offset = malloc(count*count*sizeof(size_t));
+    if (plan->dims == NULL || plan->split == NULL || plan->offset == NULL){
+        fprintf(stderr, "Failed to allocate the plan of a chain of %zu matrices\n", count);
+        exit(1);
+    }
+    memcpy(plan->dims, dims, (count + 1)*sizeof(size_t));
+    // costs[i*count + j] is the fewest multiply-adds of the sub chain [i, j], built up by length
+    for (size_t i = 0; i < count; ++i){
+        costs[i*count + i] = 0;
+        plan->split[i*count + i] = i;
+    }
+    for (size_t length = 2; length <= count; ++length){
+        for (size_t i = 0; i + length <= count; ++i){
+            const size_t j = i + length - 1;
+            double best = -1;
+            for (size_t s = i; s < j; ++s){
+                const double cost = costs[i*count + s] + costs[(s + 1)*count + j] + (double)dims[i]*(double)dims[s + 1]*(double)dims[j + 1];
+                if (best < 0 || cost < best){
+                    best = cost;
+                    plan->split[i*count + j] = s;
+                }
+            }
+            costs[i*count + j] = best;
+        }
+    }
+    plan->cost = costs[count - 1];
+    free(costs);
+    plan->naiveCost = 0;
+    for (size_t j = 1; j < count; ++j) plan->naiveCost += (double)dims[0]*(double)dims[j]*(double)dims[j + 1];
+    for (size_t i = 0; i < count*count; ++i) plan->offset[i] = NONE;
+    const size_t size = assign(plan, 0, count - 1, 0);
+    plan->workspace = NULL;
+    if (size > 0){
+        plan->workspace = arenaAlloc(size*sizeof(double));
+    }
+    return plan;
+}
+
+// out = left*right for a row major m x k left and k x n right, a vector on either side goes to the GEMV
+static void product(const size_t m, const size_t k, const size_t n, const double* const left, const double* const right, double* const out,
+        const size_t threadCount){
+    if (n == 1){
+        matmulGemv(false, m, k, 1.0, left, k > 0 ? k : 1, right, 0.0, out, threadCount);
+    } else if (m == 1){
+        // out^T = right^T*left^T
+        matmulGemv(true, k, n, 1.0, right, n > 0 ? n : 1, left, 0.0, out, threadCount);
+    } else {
+        gemmStrided(m, n, k, 1.0, left, k, 1, right, n, 1, 0.0, out, n, threadCount);
+    }
+}
+
+static const double* evaluate(const struct MatmulChain* const plan, const double* const* const a, const size_t i, const size_t j, double* const res,
+        const size_t threadCount){
+    if (i == j) return a[i];
+    const size_t offset = plan->offset[i*plan->count + j];
+    double* const out = offset == NONE ? res : &plan->workspace[offset];
+    const size_t s = plan->split[i*plan->count + j];
+    const double* const left = evaluate(plan, a, i, s, res, threadCount);
+    const double* const right = evaluate(plan, a, s + 1, j, res, threadCount);
+    product(plan->dims[i], plan->dims[s + 1], plan->dims[j + 1], left, right, out, threadCount);
+    return out;
+}
+
+/*
+ * Plans are not changed by a run, but the workspace is shared: one plan runs one chain at a time.
+ */
+void matmulChainRun(const struct MatmulChain* const plan, const double* const* const a, double* const res, const size_t threadCount){
+    if (plan->count == 1){
+        memcpy(res, a[0], plan->dims[0]*plan->dims[1]*sizeof(double));
+        return;
+    }
+    evaluate(plan, a, 0, plan->count - 1, res, threadCount);
+}
+
+double matmulChainCost(const struct MatmulChain* const plan){
+    return plan->cost;
+}
+
+double matmulChainNaiveCost(const struct MatmulChain* const plan){
+    return plan->naiveCost;
+}
+
+void matmulChainFree(struct MatmulChain* const plan){
+    if (plan == NULL) return;
+    arenaRelease(plan->workspace);
+    free(plan->dims);
+    free(plan->split);
+    free(plan->offset);
+    free(plan);
+}
@@ -0,0 +1,197 @@
+#include <threadpool.h>
+#include <arena.h>
+#include <stats.h>
+#include <tune.h>
+#include <prepacked.h>
+#include <epilogue.h>
+#include <gemm.h>
+#include <cpu.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The double precision instantiation of the packed GEMM (see gemm_template.h) and its exported entry points.
+ */
+
+const struct GemmKernel* gemmKernelFor(const enum CpuIsa isa){
+    switch (isa){
+        case ISA_AVX512: return &gemmKernelAvx512;
+        case ISA_AVX2: return &gemmKernelAvx2;
+        default: return &gemmKernelSse2;
+    }
+}
+
+const struct GemmKernel* gemmKernel(void){
+    return gemmKernelFor(cpuIsa());
+}
+
+#define GEMM_T double
+#define GEMM_ACC double
+#define GEMM_KERNEL struct GemmKernel
+#define GEMM_SELECT gemmKernel
+#define GEMM_SELECT_ISA gemmKernelFor
+#define GEMM_TUNE TUNE_DGEMM
+#define GEMM_EPILOGUE epilogueDouble
+#define GEMM_FN(x) d ## x
+#include <gemm_template.h>
+
+void gemmStridedEpilogue(const size_t m, const size_t n, const size_t k, const double alpha, const double* const a, const size_t rsa,
+        const size_t csa, const double* const b, const size_t rsb, const size_t csb, const double beta, double* const res, const size_t ldr,
+        const struct EpilogueRun* const epilogue, const size_t threadCount){
+    struct dJob job = {
+        .m = m,
+        .a = a,
+        .rsa = rsa,
+        .csa = csa,
+        .b = b,
+        .rsb = rsb,
+        .csb = csb,
+        .res = res,
+        .ldr = ldr,
+        .alpha = alpha,
+        .beta = beta,
+        .epilogue = epilogue,
+    };
+    dRun(&job, n, k, threadCount);
+}
+
+void gemmStrided(const size_t m, const size_t n, const size_t k, const double alpha, const double* const a, const size_t rsa, const size_t csa,
+        const double* const b, const size_t rsb, const size_t csb, const double beta, double* const res, const size_t ldr, const size_t threadCount){
+    gemmStridedEpilogue(m, n, k, alpha, a, rsa, csa, b, rsb, csb, beta, res, ldr, NULL, threadCount);
+}
+
+void matmulPacked(double* const restrict a, double* const restrict b, double* const restrict res, const size_t size){
+    gemmStrided(size, size, size, 1.0, a, size, 1, b, size, 1, 0.0, res, size, 1);
+}
+
+void matmulPackedMT(double* const restrict a, double* const restrict b, double* const restrict res, const size_t size, const size_t threadCount){
+    gemmStrided(size, size, size, 1.0, a, size, 1, b, size, 1, 0.0, res, size, threadCount);
+}
+
+/*
+ * matmulDgemm with an epilogue (see epilogue.h) applied to every tile of c before it is stored, NULL for none.
+ */
+void matmulDgemmEpilogue(const bool colMajor, const bool transA, const bool transB, const size_t m, const size_t n, const size_t k,
+        const double alpha, const double* const a, const size_t lda, const double* const b, const size_t ldb,
+        const double beta, double* const c, const size_t ldc, const struct MatmulEpilogue* const epilogue, const size_t threadCount){
+    // Stored shapes of a, b and c as (rows, columns) in the storage order
+    const size_t aCols = transA ? m : k;
+    const size_t aRows = transA ? k : m;
+    const size_t bCols = transB ? k : n;
+    const size_t bRows = transB ? n : k;
+    checkLeadingDimension("lda", lda, colMajor ? aRows : aCols);
+    checkLeadingDimension("ldb", ldb, colMajor ? bRows : bCols);
+    struct EpilogueRun run;
+    const bool fused = epiloguePrepare(epilogue, colMajor, m, n, 1, beta, &run, __func__);
+    if (!epilogueConverts(&run) || c != NULL) checkLeadingDimension("ldc", ldc, colMajor ? m : n);
+    // Strides of op(a) and op(b) when walking (row, column)
+    const bool aRowMajor = colMajor == transA;
+    const bool bRowMajor = colMajor == transB;
+    const size_t rsa = aRowMajor ? lda : 1;
+    const size_t csa = aRowMajor ? 1 : lda;
+    const size_t rsb = bRowMajor ? ldb : 1;
+    const size_t csb = bRowMajor ? 1 : ldb;
+    if (!colMajor){
+        gemmStridedEpilogue(m, n, k, alpha, a, rsa, csa, b, rsb, csb, beta, c, ldc, fused ? &run : NULL, threadCount);
+    } else {
+        // A column major c is a row major c^T = op(b)^T*op(a)^T
+        gemmStridedEpilogue(n, m, k, alpha, b, csb, rsb, a, csa, rsa, beta, c, ldc, fused ? &run : NULL, threadCount);
+    }
+}
+
+/*
+ * c = alpha*op(a)*op(b) + beta*c, where op(a) is m x k, op(b) is k x n and c is m x n.
+ * colMajor selects the storage order of all three matrices and transA/transB select op(x) = x^T.
+ * lda, ldb and ldc are the distances between consecutive rows (row major) or columns (column major), so that
+ * sub matrices of a larger matrix can be passed in place. No alignment or size restrictions apply.
+ * When beta is zero c is not read. threadCount limits the amount of pool threads, zero uses all of them.
+ */
+void matmulDgemm(const bool colMajor, const bool transA, const bool transB, const size_t m, const size_t n, const size_t k,
+        const double alpha, const double* const a, const size_t lda, const double* const b, const size_t ldb,
+        const double beta, double* const c, const size_t ldc, const size_t threadCount){
+    matmulDgemmEpilogue(colMajor, transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, NULL, threadCount);
+}
+
+struct PrepackJob {
+    const struct GemmKernel* kernel;
+    const double* b;
+    size_t rsb;
+    size_t csb;
+    size_t k;
+    size_t n;
+    size_t blocksOfK;
+    double* data;
+};
+
+// Pack one kc x nc panel of b into its final place in the prepacked buffer
+static void prepackTask(void* s, const size_t task, const size_t worker){
+    (void)worker;
+    const struct PrepackJob* job = s;
+    const struct GemmKernel* const kernel = job->kernel;
+    const size_t jc = (task / job->blocksOfK)*kernel->nc;
+    const size_t pc = (task % job->blocksOfK)*kernel->kc;
+    const size_t nc = job->n - jc < kernel->nc ? job->n - jc : kernel->nc;
+    const size_t kc = job->k - pc < kernel->kc ? job->k - pc : kernel->kc;
+    dPackB(&job->b[pc*job->rsb + jc*job->csb], job->rsb, job->csb, kc, nc, kernel->nr, kernel->kgroup, &job->data[dPanelOffset(kernel, job->k, jc, pc, nc)]);
+}
+
+/*
+ * Pack op(b) (k x n) once into the panel layout of the packed GEMM and return a handle for matmulDgemmPrepacked.
+ * colMajor, transB and ldb have the same meaning as for matmulDgemm. Free it with matmulFreePrepacked.
+ */
+struct Prepacked* matmulDgemmPrepackB(const bool colMajor, const bool transB, const size_t k, const size_t n, const double* const b, const size_t ldb){
+    const size_t bCols = transB ? k : n;
+    const size_t bRows = transB ? n : k;
+    checkLeadingDimension("ldb", ldb, colMajor ? bRows : bCols);
+    const bool bRowMajor = colMajor == transB;
+    const struct GemmKernel* const kernel = gemmKernel();
+    struct Prepacked* prepacked = prepackedAlloc(PREPACKED_PANELS, k, n, roundUp(k, kernel->kgroup)*roundUp(n, kernel->nr), 0);
+    struct PrepackJob job = {
+        .kernel = kernel,
+        .b = b,
+        .rsb = bRowMajor ? ldb : 1,
+        .csb = bRowMajor ? 1 : ldb,
+        .k = k,
+        .n = n,
+        .blocksOfK = (k + kernel->kc - 1)/kernel->kc,
+        .data = prepacked->data,
+    };
+    const double start = statsStart();
+    threadPoolRun(0, job.blocksOfK*((n + kernel->nc - 1)/kernel->nc), prepackTask, &job);
+    prepackedReplicate(prepacked);
+    statsStop(MATMUL_PHASE_PACK, start);
+    return prepacked;
+}
+
+/*
+ * c = alpha*op(a)*b + beta*c with b prepacked by matmulDgemmPrepackB. c is m x n and always row major here, a is
+ * row major (or column major when transA is set) with leading dimension lda.
+ */
+void matmulDgemmPrepacked(const bool transA, const size_t m, const double alpha, const double* const a, const size_t lda,
+        const struct Prepacked* const b, const double beta, double* const c, const size_t ldc, const size_t threadCount){
+    if (b == NULL){
+        fprintf(stderr, "%s: the prepacked matrix is NULL\n", __func__);
+        exit(1);
+    }
+    const size_t k = b->rows;
+    const size_t n = b->columns;
+    prepackedCheck(b, PREPACKED_PANELS, k, n, __func__);
+    checkLeadingDimension("lda", lda, transA ? m : k);
+    checkLeadingDimension("ldc", ldc, n);
+    struct dJob job = {
+        .m = m,
+        .a = a,
+        .rsa = transA ? 1 : lda,
+        .csa = transA ? lda : 1,
+        .prepacked = (const double* const*)(b->replicas != NULL ? b->replicas : &b->data),
+        .prepackedNodes = b->replicas != NULL ? b->replicaCount : 1,
+        .res = c,
+        .ldr = ldc,
+        .alpha = alpha,
+        .beta = beta,
+    };
+    dRun(&job, n, k, threadCount);
+}
@@ -0,0 +1,104 @@
+#include <threadpool.h>
+#include <arena.h>
+#include <stats.h>
+#include <tune.h>
+#include <epilogue.h>
+#include <gemm.h>
+#include <cpu.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The single precision instantiation of the packed GEMM (see gemm_template.h). A vector holds twice as many floats
+ * as doubles, so the register tiles are twice as wide as the double ones.
+ */
+
+const struct SgemmKernel* sgemmKernelFor(const enum CpuIsa isa){
+    switch (isa){
+        case ISA_AVX512: return &sgemmKernelAvx512;
+        case ISA_AVX2: return &sgemmKernelAvx2;
+        default: return &sgemmKernelSse2;
+    }
+}
+
+const struct SgemmKernel* sgemmKernel(void){
+    return sgemmKernelFor(cpuIsa());
+}
+
+#define GEMM_T float
+#define GEMM_ACC float
+#define GEMM_KERNEL struct SgemmKernel
+#define GEMM_SELECT sgemmKernel
+#define GEMM_SELECT_ISA sgemmKernelFor
+#define GEMM_TUNE TUNE_SGEMM
+#define GEMM_EPILOGUE epilogueFloat
+#define GEMM_FN(x) s ## x
+#include <gemm_template.h>
+
+static void sgemmStrided(const size_t m, const size_t n, const size_t k, const float alpha, const float* const a, const size_t rsa, const size_t csa,
+        const float* const b, const size_t rsb, const size_t csb, const float beta, float* const res, const size_t ldr,
+        const struct EpilogueRun* const epilogue, const size_t threadCount){
+    struct sJob job = {
+        .m = m,
+        .a = a,
+        .rsa = rsa,
+        .csa = csa,
+        .b = b,
+        .rsb = rsb,
+        .csb = csb,
+        .res = res,
+        .ldr = ldr,
+        .alpha = alpha,
+        .beta = beta,
+        .epilogue = epilogue,
+    };
+    sRun(&job, n, k, threadCount);
+}
+
+void matmulPackedFloat(float* const restrict a, float* const restrict b, float* const restrict res, const size_t size){
+    sgemmStrided(size, size, size, 1.0f, a, size, 1, b, size, 1, 0.0f, res, size, NULL, 1);
+}
+
+void matmulPackedFloatMT(float* const restrict a, float* const restrict b, float* const restrict res, const size_t size, const size_t threadCount){
+    sgemmStrided(size, size, size, 1.0f, a, size, 1, b, size, 1, 0.0f, res, size, NULL, threadCount);
+}
+
+/*
+ * The float version of matmulDgemmEpilogue, with the same arguments.
+ */
+void matmulSgemmEpilogue(const bool colMajor, const bool transA, const bool transB, const size_t m, const size_t n, const size_t k,
+        const float alpha, const float* const a, const size_t lda, const float* const b, const size_t ldb,
+        const float beta, float* const c, const size_t ldc, const struct MatmulEpilogue* const epilogue, const size_t threadCount){
+    const size_t aCols = transA ? m : k;
+    const size_t aRows = transA ? k : m;
+    const size_t bCols = transB ? k : n;
+    const size_t bRows = transB ? n : k;
+    checkLeadingDimension("lda", lda, colMajor ? aRows : aCols);
+    checkLeadingDimension("ldb", ldb, colMajor ? bRows : bCols);
+    struct EpilogueRun run;
+    const bool fused = epiloguePrepare(epilogue, colMajor, m, n, 1, beta, &run, __func__);
+    if (!epilogueConverts(&run) || c != NULL) checkLeadingDimension("ldc", ldc, colMajor ? m : n);
+    const bool aRowMajor = colMajor == transA;
+    const bool bRowMajor = colMajor == transB;
+    const size_t rsa = aRowMajor ? lda : 1;
+    const size_t csa = aRowMajor ? 1 : lda;
+    const size_t rsb = bRowMajor ? ldb : 1;
+    const size_t csb = bRowMajor ? 1 : ldb;
+    if (!colMajor){
+        sgemmStrided(m, n, k, alpha, a, rsa, csa, b, rsb, csb, beta, c, ldc, fused ? &run : NULL, threadCount);
+    } else {
+        // A column major c is a row major c^T = op(b)^T*op(a)^T
+        sgemmStrided(n, m, k, alpha, b, csb, rsb, a, csa, rsa, beta, c, ldc, fused ? &run : NULL, threadCount);
+    }
+}
+
+/*
+ * The float version of matmulDgemm, with the same arguments.
+ */
+void matmulSgemm(const bool colMajor, const bool transA, const bool transB, const size_t m, const size_t n, const size_t k,
+        const float alpha, const float* const a, const size_t lda, const float* const b, const size_t ldb,
+        const float beta, float* const c, const size_t ldc, const size_t threadCount){
+    matmulSgemmEpilogue(colMajor, transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, NULL, threadCount);
+}
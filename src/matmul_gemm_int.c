@@ -0,0 +1,134 @@
+#include <threadpool.h>
+#include <arena.h>
+#include <stats.h>
+#include <tune.h>
+#include <epilogue.h>
+#include <gemm.h>
+#include <cpu.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The integer instantiations of the packed GEMM (see gemm_template.h): int32 x int32 -> int32 and the quantized
+ * int8 x int8 -> int32. Both wrap around on overflow like the scalar matmulNaiveBlock.
+ */
+
+const struct I32gemmKernel* i32gemmKernelFor(const enum CpuIsa isa){
+    switch (isa){
+        case ISA_AVX512: return &i32gemmKernelAvx512;
+        case ISA_AVX2: return &i32gemmKernelAvx2;
+        default: return &i32gemmKernelScalar;
+    }
+}
+
+const struct I32gemmKernel* i32gemmKernel(void){
+    return i32gemmKernelFor(cpuIsa());
+}
+
+// There is no AVX-512BW kernel, the AVX2 one runs on AVX-512 cpus as well
+const struct I8gemmKernel* i8gemmKernelFor(const enum CpuIsa isa){
+    return isa >= ISA_AVX2 ? &i8gemmKernelAvx2 : &i8gemmKernelScalar;
+}
+
+const struct I8gemmKernel* i8gemmKernel(void){
+    return i8gemmKernelFor(cpuIsa());
+}
+
+#define GEMM_T int32_t
+#define GEMM_ACC int32_t
+#define GEMM_KERNEL struct I32gemmKernel
+#define GEMM_SELECT i32gemmKernel
+#define GEMM_SELECT_ISA i32gemmKernelFor
+#define GEMM_TUNE TUNE_I32GEMM
+#define GEMM_EPILOGUE epilogueInt32
+#define GEMM_FN(x) i32 ## x
+#include <gemm_template.h>
+
+#define GEMM_T int8_t
+#define GEMM_ACC int32_t
+#define GEMM_KERNEL struct I8gemmKernel
+#define GEMM_SELECT i8gemmKernel
+#define GEMM_SELECT_ISA i8gemmKernelFor
+#define GEMM_TUNE TUNE_I8GEMM
+#define GEMM_EPILOGUE epilogueInt32
+#define GEMM_FN(x) i8 ## x
+#include <gemm_template.h>
+
+/*
+ * c = a*b for row major int32 matrices, a m x k, b k x n and c m x n with leading dimensions lda, ldb and ldc, and
+ * the result scaled by alpha and run through epilogue (see epilogue.h, NULL for none) before it is stored. The
+ * scaling and the epilogue are done in double, so a native int32 c is rounded. threadCount limits the amount of pool
+ * threads, zero uses all of them.
+ */
+void matmulGemmInt32Epilogue(const size_t m, const size_t n, const size_t k, const int32_t* const a, const size_t lda,
+        const int32_t* const b, const size_t ldb, const double alpha, int32_t* const c, const size_t ldc,
+        const struct MatmulEpilogue* const epilogue, const size_t threadCount){
+    checkLeadingDimension("lda", lda, k);
+    checkLeadingDimension("ldb", ldb, n);
+    struct EpilogueRun run;
+    const bool fused = epiloguePrepare(epilogue, false, m, n, alpha, 0, &run, __func__);
+    if (!epilogueConverts(&run) || c != NULL) checkLeadingDimension("ldc", ldc, n);
+    struct i32Job job = {
+        .m = m,
+        .a = a,
+        .rsa = lda,
+        .csa = 1,
+        .b = b,
+        .rsb = ldb,
+        .csb = 1,
+        .res = c,
+        .ldr = ldc,
+        .alpha = 1,
+        .beta = 0,
+        .epilogue = fused ? &run : NULL,
+    };
+    i32Run(&job, n, k, threadCount);
+}
+
+/*
+ * The quantized version of matmulGemmInt32Epilogue, int8 a and b with an int32 product, so that for example
+ * alpha = scaleA*scaleB and an int8 or float32 output dequantize or requantize the result on the fly.
+ */
+void matmulGemmInt8Epilogue(const size_t m, const size_t n, const size_t k, const int8_t* const a, const size_t lda,
+        const int8_t* const b, const size_t ldb, const double alpha, int32_t* const c, const size_t ldc,
+        const struct MatmulEpilogue* const epilogue, const size_t threadCount){
+    checkLeadingDimension("lda", lda, k);
+    checkLeadingDimension("ldb", ldb, n);
+    struct EpilogueRun run;
+    const bool fused = epiloguePrepare(epilogue, false, m, n, alpha, 0, &run, __func__);
+    if (!epilogueConverts(&run) || c != NULL) checkLeadingDimension("ldc", ldc, n);
+    struct i8Job job = {
+        .m = m,
+        .a = a,
+        .rsa = lda,
+        .csa = 1,
+        .b = b,
+        .rsb = ldb,
+        .csb = 1,
+        .res = c,
+        .ldr = ldc,
+        .alpha = 1,
+        .beta = 0,
+        .epilogue = fused ? &run : NULL,
+    };
+    i8Run(&job, n, k, threadCount);
+}
+
+/*
+ * c = a*b for row major int32 matrices, the arguments are those of matmulGemmInt32Epilogue. Wraps around on
+ * overflow.
+ */
+void matmulGemmInt32(const size_t m, const size_t n, const size_t k, const int32_t* const a, const size_t lda,
+        const int32_t* const b, const size_t ldb, int32_t* const c, const size_t ldc, const size_t threadCount){
+    matmulGemmInt32Epilogue(m, n, k, a, lda, b, ldb, 1, c, ldc, NULL, threadCount);
+}
+
+/*
+ * c = a*b for row major int8 matrices with an int32 result, the arguments are those of matmulGemmInt32.
+ */
+void matmulGemmInt8(const size_t m, const size_t n, const size_t k, const int8_t* const a, const size_t lda,
+        const int8_t* const b, const size_t ldb, int32_t* const c, const size_t ldc, const size_t threadCount){
+    matmulGemmInt8Epilogue(m, n, k, a, lda, b, ldb, 1, c, ldc, NULL, threadCount);
+}
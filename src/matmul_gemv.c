@@ -0,0 +1,155 @@
+#include <gemv.h>
+#include <threadpool.h>
+#include <stats.h>
+#include <cpu.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Pieces for each thread, more than one lets the pool even out threads that share a memory channel unevenly
+#define PIECES_PER_THREAD 4
+// Aim for at least this many elements of a per task so that scheduling stays cheap next to the streaming
+#define TASK_WORK (1 << 15)
+// Rows of a*x whose dots are collected on the stack before alpha and beta are applied
+#define ROW_CHUNK 64
+// Columns of a^T*x one task sums, a block of acc stays in L1 while the rows stream through
+#define COLUMN_BLOCK 512
+
+struct GemvJob {
+    size_t m;
+    size_t n;
+    double alpha;
+    const double* a;
+    size_t lda;
+    const double* x;
+    double beta;
+    double* y;
+    // Rows every task of a*x takes, or that every row piece of a^T*x sums
+    size_t rowsPerTask;
+    size_t columnBlocks;
+    size_t rowPieces;
+    // rowPieces x n partial sums of a^T*x when the rows are split
+    double* partial;
+    GemvRows rows;
+    GemvColumns columns;
+};
+
+// The x86-64 baseline, four partial sums so that the compiler can keep them in two sse registers
+static void gemvRowsSse2(const size_t rows, const size_t n, const double* const a, const size_t lda, const double* const x, double* const dots){
+    for (size_t i = 0; i < rows; ++i){
+        const double* const row = &a[i*lda];
+        double sum[4] = {0};
+        size_t j = 0;
+        for (; j + 4 <= n; j += 4){
+            for (size_t v = 0; v < 4; ++v) sum[v] += row[j + v]*x[j + v];
+        }
+        for (; j < n; ++j) sum[0] += row[j]*x[j];
+        dots[i] = (sum[0] + sum[2]) + (sum[1] + sum[3]);
+    }
+}
+
+static void gemvColumnsSse2(const size_t rows, const size_t cols, const double* const a, const size_t lda, const double* const x, double* const acc){
+    for (size_t i = 0; i < rows; ++i){
+        const double* const row = &a[i*lda];
+        const double scale = x[i];
+        for (size_t j = 0; j < cols; ++j) acc[j] += scale*row[j];
+    }
+}
+
+static inline double finish(const struct GemvJob* const job, const double sum, const double old){
+    return job->beta == 0 ? job->alpha*sum : job->alpha*sum + job->beta*old;
+}
+
+static void rowsTask(void* s, const size_t task, const size_t worker){
+    (void)worker;
+    const struct GemvJob* const job = s;
+    const size_t first = task*job->rowsPerTask;
+    const size_t last = first + job->rowsPerTask < job->m ? first + job->rowsPerTask : job->m;
+    double dots[ROW_CHUNK];
+    for (size_t i = first; i < last; i += ROW_CHUNK){
+        const size_t count = last - i < ROW_CHUNK ? last - i : ROW_CHUNK;
+        job->rows(count, job->n, &job->a[i*job->lda], job->lda, job->x, dots);
+        for (size_t r = 0; r < count; ++r) job->y[i + r] = finish(job, dots[r], job->y[i + r]);
+    }
+}
+
+// One column block of one row piece, finished right away when the rows are not split
+static void columnsTask(void* s, const size_t task, const size_t worker){
+    (void)worker;
+    const struct GemvJob* const job = s;
+    const size_t block = task % job->columnBlocks;
+    const size_t piece = task/job->columnBlocks;
+    const size_t col = block*COLUMN_BLOCK;
+    const size_t cols = job->n - col < COLUMN_BLOCK ? job->n - col : COLUMN_BLOCK;
+    const size_t first = piece*job->rowsPerTask;
+    const size_t last = first + job->rowsPerTask < job->m ? first + job->rowsPerTask : job->m;
+    double acc[COLUMN_BLOCK] = {0};
+    if (first < last) job->columns(last - first, cols, &job->a[first*job->lda + col], job->lda, &job->x[first], acc);
+    if (job->rowPieces == 1){
+        for (size_t j = 0; j < cols; ++j) job->y[col + j] = finish(job, acc[j], job->y[col + j]);
+    } else {
+        double* const partial = &job->partial[piece*job->n + col];
+        for (size_t j = 0; j < cols; ++j) partial[j] = acc[j];
+    }
+}
+
+static void reduceTask(void* s, const size_t task, const size_t worker){
+    (void)worker;
+    const struct GemvJob* const job = s;
+    const size_t col = task*COLUMN_BLOCK;
+    const size_t cols = job->n - col < COLUMN_BLOCK ? job->n - col : COLUMN_BLOCK;
+    for (size_t j = col; j < col + cols; ++j){
+        double sum = 0;
+        for (size_t p = 0; p < job->rowPieces; ++p) sum += job->partial[p*job->n + j];
+        job->y[j] = finish(job, sum, job->y[j]);
+    }
+}
+
+void matmulGemv(const bool trans, const size_t m, const size_t n, const double alpha, const double* const a, const size_t lda,
+        const double* const x, const double beta, double* const y, const size_t threadCount){
+    if (lda < n || lda == 0){
+        fprintf(stderr, "%s: lda is %zu, but must be at least %zu\n", __func__, lda, n > 0 ? n : 1);
+        exit(1);
+    }
+    const size_t length = trans ? n : m;
+    if (length == 0) return;
+    const double start = statsStart();
+    const bool avx2 = cpuIsa() >= ISA_AVX2;
+    struct GemvJob job = {
+        .m = m,
+        .n = n,
+        .alpha = alpha,
+        .a = a,
+        .lda = lda,
+        .x = x,
+        .beta = beta,
+        .y = y,
+        .rows = avx2 ? gemvRowsAvx2 : gemvRowsSse2,
+        .columns = avx2 ? gemvColumnsAvx2 : gemvColumnsSse2,
+    };
+    const size_t workers = threadCount == 0 || threadCount > threadPoolSize() ? threadPoolSize() : threadCount;
+    size_t taskCount = m*n/TASK_WORK < PIECES_PER_THREAD*workers ? m*n/TASK_WORK : PIECES_PER_THREAD*workers;
+    if (workers == 1 || taskCount == 0) taskCount = 1;
+    if (!trans){
+        job.rowsPerTask = (m + taskCount - 1)/taskCount;
+        threadPoolRun(workers, (m + job.rowsPerTask - 1)/job.rowsPerTask, rowsTask, &job);
+        statsStop(MATMUL_PHASE_COMPUTE, start);
+        return;
+    }
+    // Wide matrices split the columns only, tall ones the rows as well and add up the pieces afterwards
+    job.columnBlocks = (n + COLUMN_BLOCK - 1)/COLUMN_BLOCK;
+    job.rowPieces = taskCount > job.columnBlocks && m > 0 ? (taskCount + job.columnBlocks - 1)/job.columnBlocks : 1;
+    job.rowsPerTask = (m + job.rowPieces - 1)/job.rowPieces;
+    if (job.rowPieces > 1){
+        job.partial = malloc(job.rowPieces*n*sizeof(double));
+        if (job.partial == NULL){
+            fprintf(stderr, "Failed to allocate the partial sums of %zu row pieces\n", job.rowPieces);
+            exit(1);
+        }
+    }
+    threadPoolRun(workers, job.rowPieces*job.columnBlocks, columnsTask, &job);
+    if (job.rowPieces > 1){
+        threadPoolRun(workers, job.columnBlocks, reduceTask, &job);
+        free(job.partial);
+    }
+    statsStop(MATMUL_PHASE_COMPUTE, start);
+}
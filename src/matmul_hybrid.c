@@ -0,0 +1,164 @@
+#include <gemm.h>
+#include <opencl.h>
+#include <prepacked.h>
+#include <stats.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * One product split between the OpenCL device and the packed GEMM on the cpu. The device claims row blocks from the
+ * top of res and the cpu from the bottom until they meet, so whichever side is faster ends up with more rows. The
+ * device share of the last call sizes the blocks: the device gets its share in DEVICE_PIECES blocks and never has
+ * more than DEVICE_IN_FLIGHT of them queued, so when it falls behind the cpu takes the blocks it has not claimed yet.
+ */
+
+#define DEVICE_PIECES 4
+#define DEVICE_IN_FLIGHT 2
+#define CPU_PIECES 8
+// Smaller blocks cost more in per call overhead than they save in balance
+#define MIN_PIECE 64
+// The device always gets a little work, so that its throughput keeps being measured
+#define MIN_RATIO 0.05
+#define MAX_RATIO 0.95
+
+// Fraction of the rows the device took in the previous calls, shared by concurrent callers
+static _Atomic double deviceRatio = 0.5;
+
+struct Hybrid {
+    const double* a;
+    const double* b;
+    double* res;
+    size_t size;
+    size_t devicePiece;
+    pthread_mutex_t lock;
+    // Rows [0, front) are claimed by the device and rows [back, size) by the cpu
+    size_t front;
+    size_t back;
+    size_t deviceRows;
+    double deviceSeconds;
+    // The stats section of the calling thread, which the device side reports to as well
+    struct MatmulStats* stats;
+};
+
+static double secondsSince(const struct timespec* const start){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec)*1e-9;
+}
+
+static size_t pieceRows(const double rows){
+    return rows <= MIN_PIECE ? MIN_PIECE : ((size_t)rows + MIN_PIECE - 1)/MIN_PIECE*MIN_PIECE;
+}
+
+// Claim up to piece rows from the top (device) or the bottom (cpu), returns the amount claimed
+static size_t claimRows(struct Hybrid* const hybrid, const bool fromFront, const size_t piece, size_t* const begin){
+    pthread_mutex_lock(&hybrid->lock);
+    const size_t left = hybrid->back - hybrid->front;
+    const size_t rows = piece < left ? piece : left;
+    if (fromFront){
+        *begin = hybrid->front;
+        hybrid->front += rows;
+    } else {
+        hybrid->back -= rows;
+        *begin = hybrid->back;
+    }
+    pthread_mutex_unlock(&hybrid->lock);
+    return rows;
+}
+
+// Feeds the device from its own thread, the calling thread drives the cpu side
+static void* deviceThread(void* s){
+    struct Hybrid* hybrid = s;
+    statsActive = hybrid->stats;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    // b^T is prepared here, so that it overlaps the packing of b for the cpu
+    struct ClPrepacked* bt = matmulOpenClPrepackB(hybrid->b, hybrid->size);
+    struct ClRequest* inFlight[DEVICE_IN_FLIGHT];
+    size_t queued = 0;
+    size_t begin, rows;
+    while ((rows = claimRows(hybrid, true, hybrid->devicePiece, &begin)) > 0){
+        if (queued == DEVICE_IN_FLIGHT){
+            matmulOpenClWait(inFlight[0]);
+            for (size_t i = 1; i < DEVICE_IN_FLIGHT; ++i) inFlight[i - 1] = inFlight[i];
+            --queued;
+        }
+        inFlight[queued++] = matmulOpenClRowsAsync(hybrid->a, bt, hybrid->res, hybrid->size, begin, begin + rows);
+        hybrid->deviceRows += rows;
+    }
+    for (size_t i = 0; i < queued; ++i){
+        matmulOpenClWait(inFlight[i]);
+    }
+    matmulOpenClFreePrepacked(bt);
+    hybrid->deviceSeconds = secondsSince(&start);
+    return NULL;
+}
+
+/*
+ * res = a*b for size x size row major matrices on the OpenCL device and the cpu together. threadCount limits the
+ * pool threads of the cpu side, zero uses all. Without an OpenCL device the whole product runs on the cpu.
+ */
+void matmulHybrid(const double* const a, const double* const b, double* const res, const size_t size, const size_t threadCount){
+    if (size == 0) return;
+    if (!matmulOpenClAvailable()){
+        gemmStrided(size, size, size, 1.0, a, size, 1, b, size, 1, 0.0, res, size, threadCount);
+        return;
+    }
+    // One value for the whole call, the blocks of both sides are sized from the same split
+    const double ratio = atomic_load(&deviceRatio);
+    struct Hybrid hybrid = {
+        .a = a,
+        .b = b,
+        .res = res,
+        .size = size,
+        .devicePiece = pieceRows(ratio*size/DEVICE_PIECES),
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .front = 0,
+        .back = size,
+        .stats = statsActive,
+    };
+    pthread_t device;
+    if (pthread_create(&device, NULL, deviceThread, &hybrid) != 0){
+        fprintf(stderr, "Failed to start the OpenCL feeder thread\n");
+        exit(1);
+    }
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    struct Prepacked* packed = matmulDgemmPrepackB(false, false, size, size, b, size);
+    const size_t cpuPiece = pieceRows((1 - ratio)*size/CPU_PIECES);
+    size_t cpuRows = 0;
+    size_t begin, rows;
+    while ((rows = claimRows(&hybrid, false, cpuPiece, &begin)) > 0){
+        matmulDgemmPrepacked(false, rows, 1.0, &a[begin*size], size, packed, 0.0, &res[begin*size], size, threadCount);
+        cpuRows += rows;
+    }
+    const double cpuSeconds = secondsSince(&start);
+    matmulFreePrepacked(packed);
+    pthread_join(device, NULL);
+    pthread_mutex_destroy(&hybrid.lock);
+    // Steer the next split toward the throughputs measured in this one. A side without rows measured nothing.
+    if (hybrid.deviceRows > 0 && cpuRows > 0){
+        const double deviceRate = hybrid.deviceRows/(hybrid.deviceSeconds > 0 ? hybrid.deviceSeconds : 1e-9);
+        const double cpuRate = cpuRows/(cpuSeconds > 0 ? cpuSeconds : 1e-9);
+        const double measured = deviceRate/(deviceRate + cpuRate);
+        // Blended into the current value, which another caller may have moved since this call read it
+        double old = atomic_load(&deviceRatio);
+        double next;
+        do {
+            next = 0.5*old + 0.5*measured;
+            if (next < MIN_RATIO) next = MIN_RATIO;
+            if (next > MAX_RATIO) next = MAX_RATIO;
+        } while (!atomic_compare_exchange_weak(&deviceRatio, &old, next));
+    }
+}
+
+/*
+ * The fraction of the rows the next matmulHybrid call expects the device to take.
+ */
+double matmulHybridRatio(void){
+    return atomic_load(&deviceRatio);
+}
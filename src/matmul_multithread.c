@@ -1,65 +1,57 @@
-#include <pthread.h>
+#include <threadpool.h>
+#include <prepacked.h>
+#include <stats.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <string.h>
+
+#define TILESIZE 32
 
 struct InformationStruct {
-    double* matA;
-    double* matB;
+    const double* matA;
+    const struct Prepacked* matB;
     double* matRes;
     size_t size;
-    size_t columnCount;
-    size_t startColumn;
+    size_t tileColumns;
 };
 
-static void matmulNaiveTransposeFDoWork(const double* const restrict a, const double* const restrict b, double* const restrict res, const size_t size, const size_t columnCount, const size_t startColumn){
-    printf("%zu, %zu\n", startColumn, startColumn + columnCount - 1);
-    for (size_t i = 0; i < size; ++i){
-        for (size_t j = startColumn; j < startColumn + columnCount; ++j){
+static void matmulNaiveTransposeFDoWork(const double* const restrict a, const double* const restrict b, double* const restrict res, const size_t size, const size_t startRow, const size_t endRow, const size_t startColumn, const size_t endColumn){
+    for (size_t i = startRow; i < endRow; ++i){
+        for (size_t j = startColumn; j < endColumn; ++j){
+            double sum = 0;
             for (size_t k = 0; k < size; ++k){
-                res[i*size + j] += a[i*size + k] * b[j*size + k];
+                sum += a[i*size + k] * b[j*size + k];
             }
+            res[i*size + j] = sum;
         }
     }
 }
 
-static void* matmulNaiveMTTransposeFirstThread(void* s){
-    struct InformationStruct* infStruct = s;
-    matmulNaiveTransposeFDoWork(infStruct->matA, infStruct->matB, infStruct->matRes, infStruct->size, infStruct->columnCount, infStruct->startColumn);
-    return NULL;
+static void matmulNaiveMTTransposeFirstTile(void* s, const size_t tile, const size_t worker){
+    const struct InformationStruct* infStruct = s;
+    const size_t startRow = (tile / infStruct->tileColumns)*TILESIZE;
+    const size_t startColumn = (tile % infStruct->tileColumns)*TILESIZE;
+    const size_t endRow = startRow + TILESIZE < infStruct->size ? startRow + TILESIZE : infStruct->size;
+    const size_t endColumn = startColumn + TILESIZE < infStruct->size ? startColumn + TILESIZE : infStruct->size;
+    matmulNaiveTransposeFDoWork(infStruct->matA, prepackedData(infStruct->matB, worker), infStruct->matRes, infStruct->size, startRow, endRow, startColumn, endColumn);
+}
+
+void matmulMTPrepacked(double* const restrict a, const struct Prepacked* const restrict prepacked, double* const restrict res, const size_t size, size_t threadCount){
+    prepackedCheck(prepacked, PREPACKED_TRANSPOSED, size, size, __func__);
+    const size_t tiles = (size + TILESIZE - 1)/TILESIZE;
+    struct InformationStruct iStruct = {
+        .matA = a,
+        .matB = prepacked,
+        .matRes = res,
+        .size = size,
+        .tileColumns = tiles,
+    };
+    const double start = statsStart();
+    threadPoolRun(threadCount, tiles*tiles, matmulNaiveMTTransposeFirstTile, &iStruct);
+    statsStop(MATMUL_PHASE_COMPUTE, start);
 }
 
 void matmulMT( double* const restrict a,  double* const restrict b, double* const restrict res, const size_t size, size_t threadCount){
-    double* c = malloc(size*size*sizeof(double));
-    for (size_t i = 0; i < size; ++i){
-        for (size_t j = 0; j < size; ++j){
-            c[j + i*size] = b[i + j*size];
-        }
-    }
-    threadCount = size > threadCount ? threadCount : size;
-    memset(res, 0, sizeof(double)*size*size);
-    pthread_t threads[threadCount - 1];
-    struct InformationStruct iStructs[threadCount - 1];
-    const size_t columnsPerThread = size/threadCount;
-    size_t rest = size % threadCount;
-    size_t lastEnd = 0;
-    for (size_t i = 0; i < threadCount - 1; ++i){
-        iStructs[i].matA = a;
-        iStructs[i].matB = c;
-        iStructs[i].matRes = res;
-        iStructs[i].size = size;
-        iStructs[i].columnCount = columnsPerThread;
-        iStructs[i].startColumn = lastEnd;
-        if (rest > 0){
-            iStructs[i].columnCount += 1;
-            rest--;
-        }
-        lastEnd += iStructs[i].columnCount;
-        pthread_create(&threads[i], NULL, matmulNaiveMTTransposeFirstThread, (void*)&iStructs[i]);
-    }
-    matmulNaiveTransposeFDoWork(a, b, res, size, columnsPerThread, lastEnd);
-    for (size_t i = 0; i < threadCount - 1; ++i){
-        pthread_join(threads[i], NULL);
-    }
-    free(c);
+    struct Prepacked* c = prepackedTranspose(b, size, threadCount);
+    matmulMTPrepacked(a, c, res, size, threadCount);
+    matmulFreePrepacked(c);
 }
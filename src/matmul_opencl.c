@@ -1,26 +1,107 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <clext.h>
+#include <prepacked.h>
+#include <opencl.h>
+#include <stats.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
 #include <errno.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #define CL_USE_DEPRECATED_OPENCL_1_2_APIS
 #include <CL/cl.h>
 
-#define KERNELFILENAME "clKernel/matmulNaive.cl"
-#define KERNELNAME "matmul"
+// clKernel/matmul.cl, turned into a string literal by the Makefile so the library does not depend on the working directory
+static const char kernelSource[] =
+#include <matmul.cl.h>
+;
 
 static const char BUILDOPTIONS[] = "-Werror";
 
-static bool initialized = false;
+// Matrices are padded to a multiple of this on the device, which is a multiple of the tile size of every variant
+#define PADDING 64
+// Size of the product that is timed to pick the fastest variant for a device
+#define PROBESIZE 256
+// Programs are built per variant and tile shape, this many of them are kept
+#define KERNELCACHESIZE 8
+// Consecutive steps of a product alternate between the queues, so the uploads of one overlap the kernel of the other
+#define QUEUECOUNT 2
+// Device buffers that are kept for reuse by later products
+#define BUFFERPOOLSIZE 16
 
-static cl_command_queue commandQueue;
+/*
+ * A kernel of clKernel/matmul.cl with its compile time parameters. A work-item computes rowsPerItem x colsPerItem
+ * outputs and a work-group is localCols x localRows work-items.
+ */
+struct ClVariant {
+    const char* name;
+    const char* kernelName;
+    size_t tile;
+    size_t wpt;
+    size_t tk;
+    size_t colsPerItem;
+    size_t rowsPerItem;
+    size_t localCols;
+    size_t localRows;
+};
+
+static const struct ClVariant variants[] = {
+    {"naive", "matmulNaive", 0, 0, 0, 1, 1, 8, 8},
+    {"tiled16", "matmulTiled", 16, 2, 16, 4, 2, 4, 8},
+    {"tiled32", "matmulTiled", 32, 4, 16, 4, 4, 8, 8},
+    {"tiled64", "matmulTiled", 64, 8, 16, 4, 8, 16, 8},
+};
+#define VARIANTCOUNT (sizeof(variants)/sizeof(variants[0]))
+#define NAIVEVARIANT 0
+
+struct ClKernelEntry {
+    const struct ClVariant* variant;
+    size_t depth;
+    size_t ldc;
+    cl_program program;
+    cl_kernel kernel;
+};
+
+struct ClPooledBuffer {
+    cl_mem buffer;
+    size_t bytes;
+    bool inUse;
+};
+
+/*
+ * Calls may come from several threads at once. clLock guards the setup and teardown, the kernel cache (whose kernels
+ * carry their arguments between clSetKernelArg and the enqueue), the buffer pool, the variant pick and the creation
+ * of the profiling queues. It is recursive, as pickVariant takes buffers and enqueues products. The queues themselves
+ * are thread safe.
+ */
+static pthread_mutex_t clLock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+static atomic_bool initialized = false;
+
+static cl_command_queue commandQueues[QUEUECOUNT];
+// Queues with event profiling for the requests of a stats section, created on first use
+static cl_command_queue profilingQueues[QUEUECOUNT];
 static cl_context context;
-static cl_kernel kernel;
+static cl_device_id device;
 static size_t workitem_size[3];
 static size_t kernelWorkGroupSize;
+static cl_ulong localMemSize;
+static cl_ulong globalMemSize;
+static cl_ulong maxAllocSize;
+static char cacheDir[PATH_MAX];
+static char deviceKey[1280];
+static struct ClKernelEntry kernelCache[KERNELCACHESIZE];
+static size_t kernelCacheNext;
+static const struct ClVariant* bestVariant;
+static struct ClPooledBuffer bufferPool[BUFFERPOOLSIZE];
 
 static volatile bool contextError = false;
 static volatile const char* contextErrInfo;
@@ -48,64 +129,235 @@ static void checkContextError(void){
     exit(1);
 }
 
-void initialize(void){
-    // Setup openCl
-    cl_uint ret_num_platforms;
-    cl_program program;
-    cl_int ret;
-    // First, get the number of platforms available
-    ret = clGetPlatformIDs(0, NULL, &ret_num_platforms);
-    clCheckError(ret, __LINE__);
-    if (ret_num_platforms == 0){
-        fprintf(stderr, "No platforms available.\n");
-        exit(1);
-    }
-    // Get the information of all platforms
+struct ClDevice {
+    cl_device_id id;
+    cl_uint platform;
+    cl_uint index;
+    cl_device_type type;
+    cl_ulong globalMem;
+    // The kernels are all double precision, devices without it can't build them
+    bool fp64;
+};
+
+/*
+ * Pick the device to run on. MATMUL_CL_DEVICE set to gpu, cpu, accelerator or all restricts the device type and
+ * <platform>:<device> picks a device by index. Without it a GPU is preferred and any other device is the fallback.
+ * Among the candidates the device with the largest global memory wins, devices without double precision are never
+ * candidates. Returns false if there is none.
+ */
+static bool pickDevice(cl_device_id* const picked){
+    cl_uint ret_num_platforms = 0;
+    // Without any installed platform the ICD loader returns an error instead of zero platforms
+    cl_int ret = clGetPlatformIDs(0, NULL, &ret_num_platforms);
+    if (ret != CL_SUCCESS || ret_num_platforms == 0) return false;
     cl_platform_id platform_id[ret_num_platforms];
     ret = clGetPlatformIDs(ret_num_platforms, platform_id, NULL);
     clCheckError(ret, __LINE__);
-    cl_device_id* device_id[ret_num_platforms];
-    cl_uint ret_num_devices[ret_num_platforms];
-    cl_uint deviceCount = 0;
+    struct ClDevice* devices = NULL;
+    size_t deviceCount = 0;
     for (cl_uint i = 0; i < ret_num_platforms; ++i){
-        ret = clGetDeviceIDs(platform_id[i], CL_DEVICE_TYPE_GPU, 0, NULL, &ret_num_devices[i]);
-        if (ret != CL_DEVICE_NOT_FOUND && ret != CL_SUCCESS){
-            clError(ret, __LINE__);
-        } else if (ret == CL_DEVICE_NOT_FOUND){
-            device_id[i] = NULL;
-            continue;
-        }
-        deviceCount += ret_num_devices[i];
-        device_id[i] = malloc(ret_num_devices[i]*sizeof(device_id));
-        ret = clGetDeviceIDs(platform_id[i], CL_DEVICE_TYPE_GPU, ret_num_devices[i], device_id[i], NULL);
+        cl_uint ret_num_devices;
+        ret = clGetDeviceIDs(platform_id[i], CL_DEVICE_TYPE_ALL, 0, NULL, &ret_num_devices);
+        if (ret == CL_DEVICE_NOT_FOUND) continue;
+        clCheckError(ret, __LINE__);
+        cl_device_id ids[ret_num_devices];
+        ret = clGetDeviceIDs(platform_id[i], CL_DEVICE_TYPE_ALL, ret_num_devices, ids, NULL);
         clCheckError(ret, __LINE__);
+        devices = realloc(devices, (deviceCount + ret_num_devices)*sizeof(struct ClDevice));
+        if (devices == NULL){
+            fprintf(stderr, "Failed to allocate the OpenCL device list\n");
+            exit(1);
+        }
+        for (cl_uint j = 0; j < ret_num_devices; ++j){
+            struct ClDevice* d = &devices[deviceCount++];
+            d->id = ids[j];
+            d->platform = i;
+            d->index = j;
+            ret = clGetDeviceInfo(ids[j], CL_DEVICE_TYPE, sizeof(d->type), &d->type, NULL);
+            clCheckError(ret, __LINE__);
+            ret = clGetDeviceInfo(ids[j], CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(d->globalMem), &d->globalMem, NULL);
+            clCheckError(ret, __LINE__);
+            cl_device_fp_config fpConfig = 0;
+            ret = clGetDeviceInfo(ids[j], CL_DEVICE_DOUBLE_FP_CONFIG, sizeof(fpConfig), &fpConfig, NULL);
+            d->fp64 = ret == CL_SUCCESS && fpConfig != 0;
+        }
     }
-    if (deviceCount == 0){
-        fprintf(stderr, "No GPU devices found\n");
-        exit(1);
+    cl_device_type type = CL_DEVICE_TYPE_GPU;
+    bool fallback = true;
+    cl_uint platformIndex = 0, deviceIndex = 0;
+    bool byIndex = false;
+    const char* env = getenv("MATMUL_CL_DEVICE");
+    if (env != NULL && env[0] != 0){
+        fallback = false;
+        if (strcmp(env, "gpu") == 0){
+            type = CL_DEVICE_TYPE_GPU;
+        } else if (strcmp(env, "cpu") == 0){
+            type = CL_DEVICE_TYPE_CPU;
+        } else if (strcmp(env, "accelerator") == 0){
+            type = CL_DEVICE_TYPE_ACCELERATOR;
+        } else if (strcmp(env, "all") == 0){
+            type = CL_DEVICE_TYPE_ALL;
+        } else if (sscanf(env, "%u:%u", &platformIndex, &deviceIndex) == 2){
+            byIndex = true;
+        } else {
+            fprintf(stderr, "MATMUL_CL_DEVICE=%s is not one of gpu, cpu, accelerator, all or <platform>:<device>\n", env);
+            exit(1);
+        }
     }
-    // Select the device. Heuristicly pick the device with the largest global memory.
-    cl_device_id pickedDevice;
-    cl_ulong maxGMem = 0;
-    for (cl_uint i = 0; i < ret_num_platforms; ++i){
-        for (cl_uint j = 0; j < ret_num_devices[i]; ++j){
-            cl_ulong gMem;
-            ret = clGetDeviceInfo(device_id[i][j], CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(gMem), &gMem, NULL);
-            clCheckError(ret, __LINE__);
-            if (gMem > maxGMem){
-                maxGMem = gMem;
-                pickedDevice = device_id[i][j];
+    bool found = false;
+    for (int pass = 0; pass < 2 && !found; ++pass){
+        cl_ulong maxGMem = 0;
+        for (size_t i = 0; i < deviceCount; ++i){
+            const struct ClDevice* d = &devices[i];
+            const bool candidate = d->fp64 &&
+                (byIndex ? d->platform == platformIndex && d->index == deviceIndex : (d->type & type) != 0);
+            if (candidate && (!found || d->globalMem > maxGMem)){
+                maxGMem = d->globalMem;
+                *picked = d->id;
+                found = true;
             }
         }
+        if (!fallback) break;
+        type = CL_DEVICE_TYPE_ALL;
     }
-    // Clean the allocated memory
-    for (cl_uint i = 0; i < ret_num_platforms; ++i){
-        if (device_id[i] != NULL){
-            free(device_id[i]);
-            device_id[i] = NULL;
+    free(devices);
+    return found;
+}
+
+// FNV-1a, only used to name cache files
+static uint64_t hashString(const char* s, uint64_t hash){
+    for (; *s != 0; ++s){
+        hash = (hash ^ (unsigned char)*s)*1099511628211ULL;
+    }
+    return hash;
+}
+
+#define HASHSEED 14695981039346656037ULL
+
+static void deviceString(const cl_device_info param, char* const out, const size_t size){
+    cl_int ret = clGetDeviceInfo(device, param, size, out, NULL);
+    if (ret != CL_SUCCESS) snprintf(out, size, "?");
+}
+
+/*
+ * Compiled programs are cached in MATMUL_CL_CACHE, or $XDG_CACHE_HOME/matmul, or ~/.cache/matmul. An empty
+ * MATMUL_CL_CACHE disables the cache. Files are keyed by the device, its driver version, the build options and the
+ * kernel source, so a driver update or a changed kernel simply misses.
+ */
+static void setupCache(void){
+    cacheDir[0] = 0;
+    const char* env = getenv("MATMUL_CL_CACHE");
+    if (env != NULL){
+        if (env[0] == 0) return;
+        snprintf(cacheDir, sizeof(cacheDir), "%s", env);
+    } else if (getenv("XDG_CACHE_HOME") != NULL && getenv("XDG_CACHE_HOME")[0] != 0){
+        snprintf(cacheDir, sizeof(cacheDir), "%s/matmul", getenv("XDG_CACHE_HOME"));
+    } else if (getenv("HOME") != NULL && getenv("HOME")[0] != 0){
+        snprintf(cacheDir, sizeof(cacheDir), "%s/.cache/matmul", getenv("HOME"));
+    } else {
+        return;
+    }
+    // Create every missing directory of the path, a cache that cannot be created is not used
+    for (char* p = cacheDir + 1; ; ++p){
+        if (*p != '/' && *p != 0) continue;
+        const char c = *p;
+        *p = 0;
+        const bool failed = mkdir(cacheDir, 0755) != 0 && errno != EEXIST;
+        *p = c;
+        if (failed){
+            cacheDir[0] = 0;
+            return;
+        }
+        if (c == 0) break;
+    }
+    char name[256], vendor[256], driver[256], version[256];
+    deviceString(CL_DEVICE_NAME, name, sizeof(name));
+    deviceString(CL_DEVICE_VENDOR, vendor, sizeof(vendor));
+    deviceString(CL_DRIVER_VERSION, driver, sizeof(driver));
+    deviceString(CL_DEVICE_VERSION, version, sizeof(version));
+    snprintf(deviceKey, sizeof(deviceKey), "%s|%s|%s|%s|%016llx", name, vendor, driver, version, (unsigned long long)hashString(kernelSource, HASHSEED));
+}
+
+// The key of a program is stored at the start of its file, so that a hash collision is a miss and not a wrong kernel
+static void cacheKey(const char* const options, char* const key, const size_t keySize, char* const path, const size_t pathSize, const char* const extension){
+    snprintf(key, keySize, "%s|%s", deviceKey, options);
+    snprintf(path, pathSize, "%s/%016llx.%s", cacheDir, (unsigned long long)hashString(key, HASHSEED), extension);
+}
+
+static unsigned char* readCacheFile(const char* const options, const char* const extension, size_t* const length){
+    if (cacheDir[0] == 0) return NULL;
+    char key[sizeof(deviceKey) + 256], path[PATH_MAX + 64];
+    cacheKey(options, key, sizeof(key), path, sizeof(path), extension);
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) return NULL;
+    unsigned char* data = NULL;
+    const size_t keyLength = strlen(key) + 1;
+    if (fseek(fp, 0L, SEEK_END) == 0){
+        const long size = ftell(fp);
+        rewind(fp);
+        if (size > (long)keyLength && (data = malloc((size_t)size)) != NULL){
+            if (fread(data, 1, (size_t)size, fp) == (size_t)size && memcmp(data, key, keyLength) == 0){
+                *length = (size_t)size - keyLength;
+                memmove(data, data + keyLength, *length);
+            } else {
+                free(data);
+                data = NULL;
+            }
         }
     }
-    // Finally, create the context
+    fclose(fp);
+    return data;
+}
+
+// Written to a temporary file first, so that concurrent processes never read half a file
+static void writeCacheFile(const char* const options, const char* const extension, const void* const data, const size_t length){
+    if (cacheDir[0] == 0) return;
+    char key[sizeof(deviceKey) + 256], path[PATH_MAX + 64], tmpPath[PATH_MAX + 96];
+    cacheKey(options, key, sizeof(key), path, sizeof(path), extension);
+    snprintf(tmpPath, sizeof(tmpPath), "%s.%ld.tmp", path, (long)getpid());
+    FILE* fp = fopen(tmpPath, "wb");
+    if (fp == NULL) return;
+    const bool written = fwrite(key, 1, strlen(key) + 1, fp) == strlen(key) + 1 && fwrite(data, 1, length, fp) == length;
+    if (fclose(fp) == 0 && written && rename(tmpPath, path) == 0) return;
+    remove(tmpPath);
+}
+
+static cl_program loadCachedProgram(const char* const options){
+    size_t length;
+    unsigned char* binary = readCacheFile(options, "clbin", &length);
+    if (binary == NULL) return NULL;
+    cl_int ret, status;
+    const unsigned char* binaryPtr = binary;
+    cl_program program = clCreateProgramWithBinary(context, 1, &device, &length, &binaryPtr, &status, &ret);
+    free(binary);
+    if (ret != CL_SUCCESS) return NULL;
+    if (status != CL_SUCCESS || clBuildProgram(program, 1, &device, options, NULL, NULL) != CL_SUCCESS){
+        clReleaseProgram(program);
+        return NULL;
+    }
+    return program;
+}
+
+static void storeCachedProgram(const cl_program program, const char* const options){
+    if (cacheDir[0] == 0) return;
+    size_t length;
+    if (clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(length), &length, NULL) != CL_SUCCESS || length == 0) return;
+    unsigned char* binary = malloc(length);
+    if (binary == NULL) return;
+    if (clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(binary), &binary, NULL) == CL_SUCCESS){
+        writeCacheFile(options, "clbin", binary, length);
+    }
+    free(binary);
+}
+
+/*
+ * Set up the context and queue on the device from pickDevice. Returns false without a device, so that callers can
+ * check for OpenCL with matmulOpenClAvailable instead of exiting.
+ */
+static bool tryInitialize(void){
+    cl_device_id pickedDevice;
+    if (!pickDevice(&pickedDevice)) return false;
+    cl_int ret;
     context = clCreateContext( NULL, 1, &pickedDevice, contextErrorCallback, NULL, &ret);
     clCheckError(ret, __LINE__);
     // Get some information from the device
@@ -113,108 +365,669 @@ void initialize(void){
     clCheckError(ret, __LINE__);
     ret = clGetDeviceInfo(pickedDevice, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(kernelWorkGroupSize), &kernelWorkGroupSize, NULL);
     clCheckError(ret, __LINE__);
-    commandQueue = clCreateCommandQueue(context, pickedDevice, 0, &ret);
+    ret = clGetDeviceInfo(pickedDevice, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(localMemSize), &localMemSize, NULL);
     clCheckError(ret, __LINE__);
+    ret = clGetDeviceInfo(pickedDevice, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(globalMemSize), &globalMemSize, NULL);
+    clCheckError(ret, __LINE__);
+    ret = clGetDeviceInfo(pickedDevice, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(maxAllocSize), &maxAllocSize, NULL);
+    clCheckError(ret, __LINE__);
+    for (size_t i = 0; i < QUEUECOUNT; ++i){
+        commandQueues[i] = clCreateCommandQueue(context, pickedDevice, 0, &ret);
+        clCheckError(ret, __LINE__);
+    }
+    device = pickedDevice;
+    setupCache();
+    initialized = true;
+    return true;
+}
 
-    // Read the OpenCL kernel from the file
-    FILE *fp = fopen(KERNELFILENAME, "r");
-    if (!fp) {
-        fprintf(stderr, "%s:%d Failed to load kernel %s. Error: %d (%s)\n",__FILE__, __LINE__, KERNELFILENAME, errno, strerror(errno));
-        exit(1);
+void initialize(void){
+    if (initialized) return;
+    pthread_mutex_lock(&clLock);
+    const bool found = initialized || tryInitialize();
+    pthread_mutex_unlock(&clLock);
+    if (found) return;
+    fprintf(stderr, "No OpenCL devices found\n");
+    exit(1);
+}
+
+/*
+ * Whether an OpenCL device is available, initializing it if so. The matmulOpenCl functions exit when there is none.
+ */
+bool matmulOpenClAvailable(void){
+    if (initialized) return true;
+    pthread_mutex_lock(&clLock);
+    const bool found = initialized || tryInitialize();
+    pthread_mutex_unlock(&clLock);
+    return found;
+}
+
+void uninialize(void){
+    pthread_mutex_lock(&clLock);
+    initialized = false;
+    cl_int ret;
+    for (size_t i = 0; i < QUEUECOUNT; ++i){
+        ret = clFlush(commandQueues[i]);
+        if (ret != CL_SUCCESS) clError(ret, __LINE__);
+        ret = clFinish(commandQueues[i]);
+        if (ret != CL_SUCCESS) clError(ret, __LINE__);
     }
-    if(fseek(fp, 0L, SEEK_END) == -1){
-        fprintf(stderr, "%s:%d Failed to load kernel %s. Error: %d (%s)\n",__FILE__, __LINE__, KERNELFILENAME, errno, strerror(errno));
-        exit(1);
+    for (size_t i = 0; i < BUFFERPOOLSIZE; ++i){
+        if (bufferPool[i].buffer == NULL) continue;
+        ret = clReleaseMemObject(bufferPool[i].buffer);
+        if (ret != CL_SUCCESS) clError(ret, __LINE__);
+        bufferPool[i].buffer = NULL;
+        bufferPool[i].inUse = false;
     }
-    size_t size = (size_t)ftell(fp);
-    rewind(fp);
-    char sourceStr[size + 1];
-    sourceStr[size] = 0;
-    size_t readBytes = fread(sourceStr, 1, size, fp);
-    fclose(fp);
-    // Create the OpenCL program
-    const char *sourceStrPtr = sourceStr;
-    program = clCreateProgramWithSource(context, 1, &sourceStrPtr, (const size_t *)&readBytes, &ret);
+    for (size_t i = 0; i < KERNELCACHESIZE; ++i){
+        if (kernelCache[i].variant == NULL) continue;
+        ret = clReleaseKernel(kernelCache[i].kernel);
+        if (ret != CL_SUCCESS) clError(ret, __LINE__);
+        ret = clReleaseProgram(kernelCache[i].program);
+        if (ret != CL_SUCCESS) clError(ret, __LINE__);
+        kernelCache[i].variant = NULL;
+    }
+    bestVariant = NULL;
+    for (size_t i = 0; i < QUEUECOUNT; ++i){
+        ret = clReleaseCommandQueue(commandQueues[i]);
+        if (ret != CL_SUCCESS) clError(ret, __LINE__);
+        if (profilingQueues[i] == NULL) continue;
+        ret = clReleaseCommandQueue(profilingQueues[i]);
+        if (ret != CL_SUCCESS) clError(ret, __LINE__);
+        profilingQueues[i] = NULL;
+    }
+    ret = clReleaseContext(context);
+    if (ret != CL_SUCCESS) clError(ret, __LINE__);
+    pthread_mutex_unlock(&clLock);
+}
+
+static size_t paddedSize(const size_t size){
+    return ((size + PADDING - 1)/PADDING)*PADDING;
+}
+
+static bool variantFits(const struct ClVariant* const variant){
+    const size_t localBytes = 2*variant->tile*variant->tk*sizeof(double);
+    return variant->localCols*variant->localRows <= kernelWorkGroupSize && variant->localCols <= workitem_size[0] &&
+        variant->localRows <= workitem_size[1] && localBytes <= localMemSize;
+}
+
+static cl_program buildProgram(const struct ClVariant* const variant, const char* const options){
+    cl_int ret;
+    const char* sourcePtr = kernelSource;
+    const size_t sourceLength = sizeof(kernelSource) - 1;
+    cl_program program = clCreateProgramWithSource(context, 1, &sourcePtr, &sourceLength, &ret);
     clCheckError(ret, __LINE__);
-    ret = clBuildProgram(program, 1, &pickedDevice, BUILDOPTIONS, NULL, NULL);
+    ret = clBuildProgram(program, 1, &device, options, NULL, NULL);
     if (ret != CL_SUCCESS){
         char errString[1000];
-        fprintf(stderr, "Error while building\n");
-        cl_int newRet = clGetProgramBuildInfo(program, pickedDevice, CL_PROGRAM_BUILD_LOG, sizeof(char)*1000, errString, NULL);
+        fprintf(stderr, "Error while building %s with %s\n", variant->name, options);
+        cl_int newRet = clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, sizeof(char)*1000, errString, NULL);
         if (newRet != CL_SUCCESS) clError(newRet, __LINE__);
         fprintf(stderr, "%s", errString);
         clError(ret, __LINE__);
     }
-    kernel = clCreateKernel(program, KERNELNAME, &ret);
+    return program;
+}
+
+/*
+ * The kernel of a variant built for tiles of the given depth and res row length. Building takes long compared to
+ * small products, so the most recent builds are kept and every build is cached on disk as well. Called with clLock
+ * held, like enqueueMultiply, so that no other thread sets the arguments of the kernel before it is enqueued.
+ */
+static cl_kernel variantKernel(const struct ClVariant* const variant, const size_t depth, const size_t ldc){
+    for (size_t i = 0; i < KERNELCACHESIZE; ++i){
+        if (kernelCache[i].variant == variant && kernelCache[i].depth == depth && kernelCache[i].ldc == ldc) return kernelCache[i].kernel;
+    }
+    char options[256];
+    if (variant->tile == 0){
+        snprintf(options, sizeof(options), "%s -D K=%zu -D LDC=%zu", BUILDOPTIONS, depth, ldc);
+    } else {
+        snprintf(options, sizeof(options), "%s -D K=%zu -D LDC=%zu -D TILE=%zu -D WPT=%zu -D TK=%zu", BUILDOPTIONS, depth, ldc, variant->tile, variant->wpt, variant->tk);
+    }
+    cl_int ret;
+    cl_program program = loadCachedProgram(options);
+    if (program == NULL){
+        program = buildProgram(variant, options);
+        storeCachedProgram(program, options);
+    }
+    cl_kernel kernel = clCreateKernel(program, variant->kernelName, &ret);
     clCheckError(ret, __LINE__);
-    initialized = true;
+    struct ClKernelEntry* entry = &kernelCache[kernelCacheNext];
+    kernelCacheNext = (kernelCacheNext + 1) % KERNELCACHESIZE;
+    if (entry->variant != NULL){
+        clCheckError(clReleaseKernel(entry->kernel), __LINE__);
+        clCheckError(clReleaseProgram(entry->program), __LINE__);
+    }
+    entry->variant = variant;
+    entry->depth = depth;
+    entry->ldc = ldc;
+    entry->program = program;
+    entry->kernel = kernel;
+    return kernel;
 }
 
-void uninialize(void){
-    initialized = false;
+/*
+ * res = a*b^T, or res += a*b^T with accumulate, for a rows x depth tile of a and a cols x depth tile of b^T, after
+ * the wait event if there is one.
+ */
+static cl_event enqueueMultiply(const struct ClVariant* const variant, const cl_command_queue queue, const size_t rows, const size_t cols, const size_t depth,
+        const cl_mem a, const cl_mem bt, const cl_mem res, const cl_int accumulate, const cl_event wait){
+    cl_kernel kernel = variantKernel(variant, depth, cols);
+    cl_int ret = clSetKernelArg(kernel, 0, sizeof(cl_mem), &a);
+    clCheckError(ret, __LINE__);
+    ret = clSetKernelArg(kernel, 1, sizeof(cl_mem), &bt);
+    clCheckError(ret, __LINE__);
+    ret = clSetKernelArg(kernel, 2, sizeof(cl_mem), &res);
+    clCheckError(ret, __LINE__);
+    ret = clSetKernelArg(kernel, 3, sizeof(cl_int), &accumulate);
+    clCheckError(ret, __LINE__);
+    const size_t global_item_size[2] = {cols/variant->colsPerItem, rows/variant->rowsPerItem};
+    const size_t local_item_size[2] = {variant->localCols, variant->localRows};
+    cl_event event;
+    ret = clEnqueueNDRangeKernel(queue, kernel, 2, NULL, global_item_size, local_item_size, wait != NULL ? 1 : 0, wait != NULL ? &wait : NULL, &event);
+    checkContextError();
+    clCheckError(ret, __LINE__);
+    return event;
+}
+
+static cl_mem createBuffer(const cl_mem_flags flags, const size_t bytes){
     cl_int ret;
-    ret = clFlush(commandQueue);
-    if (ret != CL_SUCCESS) clError(ret, __LINE__);
-    ret = clFinish(commandQueue);
-    if (ret != CL_SUCCESS) clError(ret, __LINE__);
-    ret = clReleaseKernel(kernel);
-    if (ret != CL_SUCCESS) clError(ret, __LINE__);
-    ret = clReleaseCommandQueue(commandQueue);
-    if (ret != CL_SUCCESS) clError(ret, __LINE__);
-    ret = clReleaseContext(context);
-    if (ret != CL_SUCCESS) clError(ret, __LINE__);
+    cl_mem buffer = clCreateBuffer(context, flags, bytes, NULL, &ret);
+    clCheckError(ret, __LINE__);
+    return buffer;
 }
 
-void matmulOpenClNaive(double* const restrict a, double* const restrict b, double* const restrict res, const size_t size){
-    if (!initialized) initialize();
-    double* c = malloc(size*size*sizeof(double));
-    for (size_t i = 0; i < size; ++i){
-        for (size_t j = 0; j < size; ++j){
-            c[j + i*size] = b[i + j*size];
+// Release the pooled buffers that no product uses, to make room on the device. Called with clLock held.
+static void trimBufferPool(void){
+    for (size_t i = 0; i < BUFFERPOOLSIZE; ++i){
+        if (bufferPool[i].buffer == NULL || bufferPool[i].inUse) continue;
+        clCheckError(clReleaseMemObject(bufferPool[i].buffer), __LINE__);
+        bufferPool[i].buffer = NULL;
+    }
+}
+
+/*
+ * A device buffer of exactly bytes, from the pool if an idle one has that size. Products of one shape reuse the same
+ * buffers, so a steady stream of them allocates nothing.
+ */
+static cl_mem acquireBuffer(const size_t bytes){
+    pthread_mutex_lock(&clLock);
+    for (size_t i = 0; i < BUFFERPOOLSIZE; ++i){
+        if (bufferPool[i].buffer != NULL && !bufferPool[i].inUse && bufferPool[i].bytes == bytes){
+            bufferPool[i].inUse = true;
+            pthread_mutex_unlock(&clLock);
+            return bufferPool[i].buffer;
         }
     }
-    // Create the required buffers
     cl_int ret;
-    cl_mem a_mem_obj = clCreateBuffer(context, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR, size*size*sizeof(double), a, &ret);
-    if (ret != CL_SUCCESS) clError(ret, __LINE__);
-    cl_mem b_mem_obj = clCreateBuffer(context, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR, size*size*sizeof(double), c, &ret);
-    if (ret != CL_SUCCESS) clError(ret, __LINE__);
-    cl_mem c_mem_obj = clCreateBuffer(context, CL_MEM_WRITE_ONLY, size * size * sizeof(double), NULL, &ret);
-    if (ret != CL_SUCCESS) clError(ret, __LINE__);
+    cl_mem buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &ret);
+    if (ret == CL_MEM_OBJECT_ALLOCATION_FAILURE || ret == CL_OUT_OF_RESOURCES){
+        trimBufferPool();
+        buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &ret);
+    }
+    clCheckError(ret, __LINE__);
+    // Take a free slot, or evict an idle buffer of another size. With every slot in use the buffer is not pooled.
+    size_t slot = BUFFERPOOLSIZE;
+    for (size_t i = 0; i < BUFFERPOOLSIZE; ++i){
+        if (bufferPool[i].buffer == NULL){
+            slot = i;
+            break;
+        }
+        if (!bufferPool[i].inUse && slot == BUFFERPOOLSIZE) slot = i;
+    }
+    if (slot < BUFFERPOOLSIZE){
+        if (bufferPool[slot].buffer != NULL) clCheckError(clReleaseMemObject(bufferPool[slot].buffer), __LINE__);
+        bufferPool[slot].buffer = buffer;
+        bufferPool[slot].bytes = bytes;
+        bufferPool[slot].inUse = true;
+    }
+    pthread_mutex_unlock(&clLock);
+    return buffer;
+}
 
-    // Set the arguments of the kernel
-    ret = clSetKernelArg(kernel, 0, sizeof(cl_mem), (void *)&a_mem_obj);
-    if (ret != CL_SUCCESS) clError(ret, __LINE__);
-    ret = clSetKernelArg(kernel, 1, sizeof(cl_mem), (void *)&b_mem_obj);
-    if (ret != CL_SUCCESS) clError(ret, __LINE__);
-    ret = clSetKernelArg(kernel, 2, sizeof(cl_mem), (void *)&c_mem_obj);
-    if (ret != CL_SUCCESS) clError(ret, __LINE__);
-    unsigned int mSize = size;
-    ret = clSetKernelArg(kernel, 3, sizeof(mSize), &mSize);
-    if (ret != CL_SUCCESS) clError(ret, __LINE__);
-    size_t global_item_size[2] = {size, size};
-    size_t local_item_size[2];
-    local_item_size[0] = size*size > kernelWorkGroupSize ? sqrt(kernelWorkGroupSize) : size;
-    local_item_size[0] = local_item_size[0] > workitem_size[0] ? workitem_size[0] : local_item_size[0];
-    local_item_size[1] = size*size > kernelWorkGroupSize ? sqrt(kernelWorkGroupSize) : size;
-    local_item_size[1] = local_item_size[1] > workitem_size[1] ? workitem_size[1] : local_item_size[1];
-    if (global_item_size[0] % local_item_size[0] != 0) fprintf(stderr, "Warning: Amount of threads in dim 0 is not a multiple of %zu, so that the kernel will not run optimally\n", local_item_size[0]);
-    while(global_item_size[0] % local_item_size[0] != 0) local_item_size[0]--;
-    if (global_item_size[1] % local_item_size[1] != 0) fprintf(stderr, "Warning: Amount of threads in dim 1 is not a multiple of %zu, so that the kernel will not run optimally\n", local_item_size[1]);
-    while(global_item_size[1] % local_item_size[1] != 0) local_item_size[1]--;
-    cl_event waitEvents[2];
-    ret = clEnqueueNDRangeKernel(commandQueue, kernel, 2, NULL, (const size_t*)global_item_size, (const size_t*)local_item_size, 0, NULL, &waitEvents[0]);
-    checkContextError();
-    if (ret != CL_SUCCESS) clError(ret, __LINE__);
-    ret = clEnqueueReadBuffer(commandQueue, c_mem_obj, CL_TRUE, 0, size*size * sizeof(double), res, 1, &waitEvents[0], &waitEvents[1]);
-    if (ret != CL_SUCCESS) clError(ret, __LINE__);
-    ret = clWaitForEvents(2, waitEvents);
-    if (ret != CL_SUCCESS) clError(ret, __LINE__);
-    ret = clReleaseMemObject(a_mem_obj);
-    if (ret != CL_SUCCESS) clError(ret, __LINE__);
-    ret = clReleaseMemObject(b_mem_obj);
-    if (ret != CL_SUCCESS) clError(ret, __LINE__);
-    ret = clReleaseMemObject(c_mem_obj);
-    if (ret != CL_SUCCESS) clError(ret, __LINE__);
-    free(c);
+static void releaseBuffer(const cl_mem buffer){
+    pthread_mutex_lock(&clLock);
+    for (size_t i = 0; i < BUFFERPOOLSIZE; ++i){
+        if (bufferPool[i].buffer == buffer){
+            bufferPool[i].inUse = false;
+            pthread_mutex_unlock(&clLock);
+            return;
+        }
+    }
+    pthread_mutex_unlock(&clLock);
+    clCheckError(clReleaseMemObject(buffer), __LINE__);
+}
+
+/*
+ * Upload the part of a hostRows x hostCols row major host matrix that starts at row, col into a rows x cols device
+ * tile, without blocking. Where the tile reaches past the matrix it is zero filled, so the padding adds nothing to
+ * the product.
+ */
+static cl_event uploadTile(const cl_command_queue queue, const cl_mem buffer, const double* const host, const size_t hostRows, const size_t hostCols,
+        const size_t row, const size_t col, const size_t rows, const size_t cols){
+    static const double zero = 0;
+    const size_t copyRows = hostRows - row < rows ? hostRows - row : rows;
+    const size_t copyCols = hostCols - col < cols ? hostCols - col : cols;
+    cl_int ret;
+    if (copyRows != rows || copyCols != cols){
+        ret = clEnqueueFillBuffer(queue, buffer, &zero, sizeof(zero), 0, rows*cols*sizeof(double), 0, NULL, NULL);
+        clCheckError(ret, __LINE__);
+    }
+    const size_t bufferOrigin[3] = {0, 0, 0};
+    const size_t hostOrigin[3] = {col*sizeof(double), row, 0};
+    const size_t region[3] = {copyCols*sizeof(double), copyRows, 1};
+    cl_event event;
+    ret = clEnqueueWriteBufferRect(queue, buffer, CL_FALSE, bufferOrigin, hostOrigin, region, cols*sizeof(double), 0, hostCols*sizeof(double), 0, host, 0, NULL, &event);
+    clCheckError(ret, __LINE__);
+    return event;
+}
+
+static double secondsSince(const struct timespec* const start){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec)*1e-9;
+}
+
+/*
+ * Time every variant that fits the device on a PROBESIZE product and keep the fastest, the result is cached like the
+ * programs. MATMUL_CL_VARIANT picks one by name instead. Called with clLock held.
+ */
+static const struct ClVariant* chooseVariant(void){
+    if (bestVariant != NULL) return bestVariant;
+    const char* env = getenv("MATMUL_CL_VARIANT");
+    if (env != NULL && env[0] != 0){
+        for (size_t i = 0; i < VARIANTCOUNT; ++i){
+            if (strcmp(env, variants[i].name) == 0 && variantFits(&variants[i])) return bestVariant = &variants[i];
+        }
+        fprintf(stderr, "MATMUL_CL_VARIANT=%s is unknown or does not fit the device, picking the fastest variant\n", env);
+    }
+    // The pick of an earlier process on the same device and driver
+    size_t length;
+    char* cached = (char*)readCacheFile("variant", "variant", &length);
+    if (cached != NULL){
+        for (size_t i = 0; i < VARIANTCOUNT; ++i){
+            if (strlen(variants[i].name) == length && memcmp(cached, variants[i].name, length) == 0 && variantFits(&variants[i])) bestVariant = &variants[i];
+        }
+        free(cached);
+        if (bestVariant != NULL) return bestVariant;
+    }
+    const size_t bytes = PROBESIZE*PROBESIZE*sizeof(double);
+    cl_mem a = acquireBuffer(bytes);
+    cl_mem res = acquireBuffer(bytes);
+    const double one = 1;
+    clCheckError(clEnqueueFillBuffer(commandQueues[0], a, &one, sizeof(one), 0, bytes, 0, NULL, NULL), __LINE__);
+    double bestTime = INFINITY;
+    for (size_t i = 0; i < VARIANTCOUNT; ++i){
+        if (!variantFits(&variants[i])) continue;
+        // The first run includes the build and warms up the device
+        double time = INFINITY;
+        for (int run = 0; run < 2; ++run){
+            struct timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            cl_event event = enqueueMultiply(&variants[i], commandQueues[0], PROBESIZE, PROBESIZE, PROBESIZE, a, a, res, 0, NULL);
+            clCheckError(clWaitForEvents(1, &event), __LINE__);
+            clCheckError(clReleaseEvent(event), __LINE__);
+            time = secondsSince(&start);
+        }
+        if (time < bestTime){
+            bestTime = time;
+            bestVariant = &variants[i];
+        }
+    }
+    releaseBuffer(a);
+    releaseBuffer(res);
+    if (bestVariant == NULL){
+        fprintf(stderr, "No OpenCL kernel variant fits the device\n");
+        exit(1);
+    }
+    writeCacheFile("variant", "variant", bestVariant->name, strlen(bestVariant->name));
+    return bestVariant;
+}
+
+static const struct ClVariant* pickVariant(void){
+    pthread_mutex_lock(&clLock);
+    const struct ClVariant* const variant = chooseVariant();
+    pthread_mutex_unlock(&clLock);
+    return variant;
+}
+
+/*
+ * The name of the kernel variant matmulOpenCl uses on this device.
+ */
+const char* matmulOpenClVariant(void){
+    initialize();
+    return pickVariant()->name;
+}
+
+/*
+ * Device memory one product may occupy: MATMUL_CL_MEMORY bytes, or half of the global memory so that the pool and
+ * other products in flight fit next to it.
+ */
+static size_t memoryBudget(void){
+    const char* env = getenv("MATMUL_CL_MEMORY");
+    if (env != NULL && env[0] != 0) return strtoull(env, NULL, 10);
+    return globalMemSize/2;
+}
+
+/*
+ * How a product is cut into steps that fit the device. Every tile of res is rows x cols and sums depth long pieces
+ * of k, all multiples of PADDING. With more than one step there are two slots of buffers, so that the uploads of the
+ * next step fill one while the kernel of the current step reads the other.
+ */
+struct ClPlan {
+    size_t rows;
+    size_t cols;
+    size_t depth;
+    size_t slots;
+};
+
+/*
+ * The fewest tiles that fit the memory budget, for m rows of a size x size product. A b^T that already lives on the
+ * device (resident, padded to that size) is used whole, so only a and res are cut into row blocks.
+ */
+static struct ClPlan planProduct(const size_t m, const size_t size, const size_t resident){
+    const size_t budget = memoryBudget();
+    struct ClPlan plan;
+    for (size_t blocks = 1; ; ++blocks){
+        const size_t tile = paddedSize((size + blocks - 1)/blocks);
+        plan.rows = tile < paddedSize(m) ? tile : paddedSize(m);
+        plan.cols = resident != 0 ? resident : tile;
+        plan.depth = plan.cols;
+        const size_t rowBlocks = (m + plan.rows - 1)/plan.rows;
+        const size_t steps = resident != 0 ? rowBlocks : rowBlocks*blocks*blocks;
+        plan.slots = steps > 1 ? 2 : 1;
+        const size_t btBytes = resident != 0 ? 0 : plan.cols*plan.depth*sizeof(double);
+        const size_t largest = (plan.rows*plan.depth > plan.rows*plan.cols ? plan.rows*plan.depth : plan.rows*plan.cols)*sizeof(double);
+        const size_t bytes = plan.slots*(plan.rows*plan.depth*sizeof(double) + btBytes + plan.rows*plan.cols*sizeof(double)) + resident*resident*sizeof(double);
+        // The smallest tiles are tried even if they do not fit, the allocation reports the error then
+        if ((bytes <= budget && largest <= maxAllocSize && btBytes <= maxAllocSize) || tile == PADDING) return plan;
+    }
+}
+
+/*
+ * A transposed b, padded to a multiple of PADDING. It lives in device memory when it takes at most half the memory
+ * budget, so that repeated multiplies only upload a, and otherwise stays on the host and is streamed in tiles.
+ */
+struct ClPrepacked {
+    size_t size;
+    size_t padded;
+    cl_mem buffer;
+    struct Prepacked* host;
+};
+
+struct ClPrepacked* matmulOpenClPrepackB(const double* const restrict b, const size_t size){
+    initialize();
+    struct ClPrepacked* prepacked = malloc(sizeof(struct ClPrepacked));
+    if (prepacked == NULL){
+        fprintf(stderr, "Failed to allocate a prepacked matrix\n");
+        exit(1);
+    }
+    struct Prepacked* c = matmulPrepackB(b, size);
+    prepacked->size = size;
+    prepacked->padded = paddedSize(size);
+    prepacked->buffer = NULL;
+    prepacked->host = c;
+    const size_t bytes = prepacked->padded*prepacked->padded*sizeof(double);
+    if (size > 0 && bytes <= memoryBudget()/2 && bytes <= maxAllocSize){
+        prepacked->buffer = createBuffer(CL_MEM_READ_ONLY, bytes);
+        const double start = statsStart();
+        cl_event event = uploadTile(commandQueues[0], prepacked->buffer, c->data, size, size, 0, 0, prepacked->padded, prepacked->padded);
+        clCheckError(clWaitForEvents(1, &event), __LINE__);
+        clCheckError(clReleaseEvent(event), __LINE__);
+        statsStop(MATMUL_PHASE_DEVICE_UPLOAD, start);
+        matmulFreePrepacked(c);
+        prepacked->host = NULL;
+    }
+    return prepacked;
+}
+
+void matmulOpenClFreePrepacked(struct ClPrepacked* const prepacked){
+    if (prepacked == NULL) return;
+    if (prepacked->buffer != NULL){
+        cl_int ret = clReleaseMemObject(prepacked->buffer);
+        if (ret != CL_SUCCESS) clError(ret, __LINE__);
+    }
+    matmulFreePrepacked(prepacked->host);
+    free(prepacked);
+}
+
+/*
+ * A product in flight. The host matrices it was started with must stay valid until matmulOpenClWait returns.
+ */
+struct ClRequest {
+    cl_event done[QUEUECOUNT];
+    size_t doneCount;
+    cl_mem buffers[3*QUEUECOUNT];
+    size_t bufferCount;
+    // The transposed b of matmulOpenClAsync, freed with the request
+    struct ClPrepacked* owned;
+    // The stats section the request was started in and the commands whose device time is added to it
+    struct MatmulStats* stats;
+    cl_event* profiled;
+    enum MatmulPhase* profiledPhases;
+    size_t profiledCount;
+    size_t profiledCapacity;
+};
+
+// Called with clLock held
+static cl_command_queue* queuesFor(const struct ClRequest* const request){
+    if (request->stats == NULL) return commandQueues;
+    for (size_t i = 0; i < QUEUECOUNT; ++i){
+        if (profilingQueues[i] != NULL) continue;
+        cl_int ret;
+        profilingQueues[i] = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &ret);
+        clCheckError(ret, __LINE__);
+    }
+    return profilingQueues;
+}
+
+// Takes over the reference to event: kept for the profile in a stats section, released otherwise
+static void keepEvent(struct ClRequest* const request, const cl_event event, const enum MatmulPhase phase){
+    if (request->stats == NULL){
+        clCheckError(clReleaseEvent(event), __LINE__);
+        return;
+    }
+    if (request->profiledCount == request->profiledCapacity){
+        request->profiledCapacity = request->profiledCapacity == 0 ? 64 : 2*request->profiledCapacity;
+        request->profiled = realloc(request->profiled, request->profiledCapacity*sizeof(cl_event));
+        request->profiledPhases = realloc(request->profiledPhases, request->profiledCapacity*sizeof(enum MatmulPhase));
+        if (request->profiled == NULL || request->profiledPhases == NULL){
+            fprintf(stderr, "Failed to allocate the profile of an OpenCL request\n");
+            exit(1);
+        }
+    }
+    request->profiled[request->profiledCount] = event;
+    request->profiledPhases[request->profiledCount++] = phase;
+}
+
+// Add the device time of the kept commands to the stats section, the request is complete
+static void reportProfile(struct ClRequest* const request){
+    for (size_t i = 0; i < request->profiledCount; ++i){
+        cl_ulong start, end;
+        cl_int ret = clGetEventProfilingInfo(request->profiled[i], CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL);
+        if (ret == CL_SUCCESS) ret = clGetEventProfilingInfo(request->profiled[i], CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
+        if (ret == CL_SUCCESS && end >= start) statsAdd(request->stats, request->profiledPhases[i], (end - start)*1e-9);
+        clCheckError(clReleaseEvent(request->profiled[i]), __LINE__);
+    }
+    free(request->profiled);
+    free(request->profiledPhases);
+}
+
+static cl_mem requestBuffer(struct ClRequest* const request, const size_t bytes){
+    cl_mem buffer = acquireBuffer(bytes);
+    request->buffers[request->bufferCount++] = buffer;
+    return buffer;
+}
+
+/*
+ * Enqueue res = a*b for the m rows of a and res without blocking, as the steps of planProduct. Step t uploads its tiles to slot t % slots on
+ * queue t % slots, so in order execution on a queue keeps a slot from being overwritten before its kernel ran, and
+ * the kernel of a step only waits on the kernel before it that adds into the same res tile. A res tile is read back
+ * as soon as its last step is done, while the next tile is computed into the other res buffer.
+ */
+static struct ClRequest* enqueueProduct(const struct ClVariant* const variant, const double* const a, const struct ClPrepacked* const prepacked, double* const res,
+        const size_t m, const size_t size){
+    if (prepacked == NULL || prepacked->size != size){
+        fprintf(stderr, "%s: the prepacked matrix does not hold a %zu x %zu matrix\n", __func__, size, size);
+        exit(1);
+    }
+    struct ClRequest* request = calloc(1, sizeof(struct ClRequest));
+    if (request == NULL){
+        fprintf(stderr, "Failed to allocate an OpenCL request\n");
+        exit(1);
+    }
+    if (m == 0 || size == 0) return request;
+    // The steps of one product are enqueued together, so that products of other threads only queue up behind them
+    pthread_mutex_lock(&clLock);
+    request->stats = statsActive;
+    cl_command_queue* const queues = queuesFor(request);
+    const bool resident = prepacked->buffer != NULL;
+    const struct ClPlan plan = planProduct(m, size, resident ? prepacked->padded : 0);
+    cl_mem aTiles[QUEUECOUNT], btTiles[QUEUECOUNT], resTiles[QUEUECOUNT];
+    for (size_t s = 0; s < plan.slots; ++s){
+        aTiles[s] = requestBuffer(request, plan.rows*plan.depth*sizeof(double));
+        btTiles[s] = resident ? prepacked->buffer : requestBuffer(request, plan.cols*plan.depth*sizeof(double));
+        resTiles[s] = requestBuffer(request, plan.rows*plan.cols*sizeof(double));
+    }
+    const size_t rowBlocks = (m + plan.rows - 1)/plan.rows;
+    const size_t colBlocks = (size + plan.cols - 1)/plan.cols;
+    const size_t depthBlocks = (size + plan.depth - 1)/plan.depth;
+    // The read back of the tile that last used each res buffer
+    cl_event resFree[QUEUECOUNT] = {NULL};
+    size_t step = 0;
+    for (size_t i = 0; i < rowBlocks; ++i){
+        for (size_t j = 0; j < colBlocks; ++j){
+            const size_t r = (i*colBlocks + j) % plan.slots;
+            cl_event previous = resFree[r];
+            cl_command_queue queue = NULL;
+            for (size_t p = 0; p < depthBlocks; ++p, ++step){
+                const size_t s = step % plan.slots;
+                queue = queues[s];
+                keepEvent(request, uploadTile(queue, aTiles[s], a, m, size, i*plan.rows, p*plan.depth, plan.rows, plan.depth), MATMUL_PHASE_DEVICE_UPLOAD);
+                if (!resident){
+                    keepEvent(request, uploadTile(queue, btTiles[s], prepacked->host->data, size, size, j*plan.cols, p*plan.depth, plan.cols, plan.depth), MATMUL_PHASE_DEVICE_UPLOAD);
+                }
+                cl_event kernelEvent = enqueueMultiply(variant, queue, plan.rows, plan.cols, plan.depth, aTiles[s], btTiles[s], resTiles[r], p > 0, previous);
+                if (request->stats != NULL){
+                    clCheckError(clRetainEvent(kernelEvent), __LINE__);
+                    keepEvent(request, kernelEvent, MATMUL_PHASE_DEVICE_KERNEL);
+                }
+                if (previous != NULL) clCheckError(clReleaseEvent(previous), __LINE__);
+                previous = kernelEvent;
+            }
+            const size_t bufferOrigin[3] = {0, 0, 0};
+            const size_t hostOrigin[3] = {j*plan.cols*sizeof(double), i*plan.rows, 0};
+            const size_t region[3] = {(size - j*plan.cols < plan.cols ? size - j*plan.cols : plan.cols)*sizeof(double), m - i*plan.rows < plan.rows ? m - i*plan.rows : plan.rows, 1};
+            cl_int ret = clEnqueueReadBufferRect(queue, resTiles[r], CL_FALSE, bufferOrigin, hostOrigin, region, plan.cols*sizeof(double), 0, size*sizeof(double), 0, res, 1, &previous, &resFree[r]);
+            clCheckError(ret, __LINE__);
+            clCheckError(clReleaseEvent(previous), __LINE__);
+            if (request->stats != NULL){
+                clCheckError(clRetainEvent(resFree[r]), __LINE__);
+                keepEvent(request, resFree[r], MATMUL_PHASE_DEVICE_DOWNLOAD);
+            }
+        }
+    }
+    for (size_t s = 0; s < plan.slots; ++s){
+        if (resFree[s] != NULL) clCheckError(clReleaseEvent(resFree[s]), __LINE__);
+        // Without a wait list the marker completes after everything enqueued before it on the queue
+        clCheckError(clEnqueueMarkerWithWaitList(queues[s], 0, NULL, &request->done[s]), __LINE__);
+        clCheckError(clFlush(queues[s]), __LINE__);
+    }
+    request->doneCount = plan.slots;
+    pthread_mutex_unlock(&clLock);
+    return request;
+}
+
+static bool requestComplete(const struct ClRequest* const request){
+    for (size_t i = 0; i < request->doneCount; ++i){
+        cl_int status;
+        cl_int ret = clGetEventInfo(request->done[i], CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, NULL);
+        clCheckError(ret, __LINE__);
+        // A negative status is the error of a command the marker waited for
+        if (status < 0) clError(status, __LINE__);
+        if (status != CL_COMPLETE) return false;
+    }
+    return true;
+}
+
+/*
+ * Start res = a*b on the device and return without waiting. b is transposed on the host first, everything else runs
+ * on the device queues. Matrices larger than the device memory are multiplied in tiles.
+ */
+struct ClRequest* matmulOpenClAsync(const double* const a, const double* const b, double* const res, const size_t size){
+    initialize();
+    struct ClPrepacked* bt = matmulOpenClPrepackB(b, size);
+    struct ClRequest* request = enqueueProduct(pickVariant(), a, bt, res, size, size);
+    request->owned = bt;
+    return request;
+}
+
+struct ClRequest* matmulOpenClPrepackedAsync(const double* const a, const struct ClPrepacked* const prepacked, double* const res, const size_t size){
+    initialize();
+    return enqueueProduct(pickVariant(), a, prepacked, res, size, size);
+}
+
+/*
+ * Start rows [rowBegin, rowEnd) of res = a*b, for splitting one product between the device and the cpu.
+ */
+struct ClRequest* matmulOpenClRowsAsync(const double* const a, const struct ClPrepacked* const prepacked, double* const res, const size_t size,
+        const size_t rowBegin, const size_t rowEnd){
+    initialize();
+    if (rowBegin > rowEnd || rowEnd > size){
+        fprintf(stderr, "%s: rows %zu to %zu are not inside a %zu x %zu matrix\n", __func__, rowBegin, rowEnd, size, size);
+        exit(1);
+    }
+    return enqueueProduct(pickVariant(), &a[rowBegin*size], prepacked, &res[rowBegin*size], rowEnd - rowBegin, size);
+}
+
+/*
+ * Whether res of the request is ready, without blocking.
+ */
+bool matmulOpenClDone(const struct ClRequest* const request){
+    return requestComplete(request);
+}
+
+/*
+ * Block until res of the request is ready, then free the request. Its device buffers go back to the pool.
+ */
+void matmulOpenClWait(struct ClRequest* const request){
+    if (request == NULL) return;
+    if (request->doneCount > 0){
+        cl_int ret = clWaitForEvents(request->doneCount, request->done);
+        if (ret != CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST) clCheckError(ret, __LINE__);
+        requestComplete(request);
+    }
+    reportProfile(request);
+    for (size_t i = 0; i < request->doneCount; ++i){
+        clCheckError(clReleaseEvent(request->done[i]), __LINE__);
+    }
+    for (size_t i = 0; i < request->bufferCount; ++i){
+        releaseBuffer(request->buffers[i]);
+    }
+    matmulOpenClFreePrepacked(request->owned);
+    free(request);
+}
+
+/*
+ * res = a*b on the fastest kernel variant for the device, see matmulOpenClVariant. Any size works, the device
+ * buffers are padded.
+ */
+void matmulOpenClPrepacked(const double* const restrict a, const struct ClPrepacked* const restrict prepacked, double* const restrict res, const size_t size){
+    matmulOpenClWait(matmulOpenClPrepackedAsync(a, prepacked, res, size));
+}
+
+void matmulOpenCl(const double* const restrict a, const double* const restrict b, double* const restrict res, const size_t size){
+    matmulOpenClWait(matmulOpenClAsync(a, b, res, size));
+}
+
+// The one output per work-item kernel, as a baseline for the tiled ones
+void matmulOpenClNaivePrepacked(double* const restrict a, const struct ClPrepacked* const restrict prepacked, double* const restrict res, const size_t size){
+    initialize();
+    matmulOpenClWait(enqueueProduct(&variants[NAIVEVARIANT], a, prepacked, res, size, size));
+}
+
+void matmulOpenClNaive(double* const restrict a, double* const restrict b, double* const restrict res, const size_t size){
+    struct ClPrepacked* c = matmulOpenClPrepackB(b, size);
+    matmulOpenClNaivePrepacked(a, c, res, size);
+    matmulOpenClFreePrepacked(c);
 }
@@ -0,0 +1,165 @@
+#include <matfile.h>
+#include <gemm.h>
+#include <threadpool.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*
+ * res = a*b for matrix files (see matfile.h) that need not fit in memory. res is computed in blocks of r x r tiles:
+ * for every k the block adds the product of a panel of r tiles of a and a panel of r tiles of b. The panels of the
+ * next step are prefetched with MADV_WILLNEED while the current ones are multiplied, and dropped with MADV_DONTNEED
+ * afterwards. A finished block of res is handed to the kernel for write back and dropped as well, so the resident
+ * memory stays at about r*r + 4*r tiles: the res block and two sets of panels.
+ */
+
+struct OutOfCore {
+    const struct MatFile* a;
+    const struct MatFile* b;
+    const struct MatFile* res;
+    size_t blockTiles;
+    size_t depthTiles;
+};
+
+struct OutOfCoreStep {
+    size_t row;
+    size_t col;
+    size_t rows;
+    size_t cols;
+    size_t k;
+};
+
+struct TileJob {
+    const struct OutOfCore* job;
+    const struct OutOfCoreStep* step;
+};
+
+// Physical memory divided by this is the default budget
+#define DEFAULT_BUDGET_SHARE 4
+
+static size_t defaultBudget(void){
+    const long pages = sysconf(_SC_PHYS_PAGES);
+    const long pageSize = sysconf(_SC_PAGESIZE);
+    if (pages <= 0 || pageSize <= 0) return (size_t)1 << 30;
+    return (size_t)pages*(size_t)pageSize/DEFAULT_BUDGET_SHARE;
+}
+
+// Step s of the walk: the block of res it adds to and the k of its panels
+static struct OutOfCoreStep stepAt(const struct OutOfCore* const job, const size_t s){
+    const size_t blockCols = (job->res->tileCols + job->blockTiles - 1)/job->blockTiles;
+    const size_t block = s/job->depthTiles;
+    struct OutOfCoreStep step = {
+        .row = (block/blockCols)*job->blockTiles,
+        .col = (block % blockCols)*job->blockTiles,
+        .k = s % job->depthTiles,
+    };
+    step.rows = job->res->tileRows - step.row < job->blockTiles ? job->res->tileRows - step.row : job->blockTiles;
+    step.cols = job->res->tileCols - step.col < job->blockTiles ? job->res->tileCols - step.col : job->blockTiles;
+    return step;
+}
+
+static void adviseTile(const struct MatFile* const file, const size_t i, const size_t j, const int advice){
+    // Advice is only a hint, a failure changes nothing about the result
+    madvise(matfileTile(file, i, j), matfileTileBytes(file), advice);
+}
+
+static bool inPanels(const struct OutOfCoreStep* const step, const bool ofA, const size_t i, const size_t j){
+    if (step == NULL) return false;
+    if (ofA) return j == step->k && i >= step->row && i < step->row + step->rows;
+    return i == step->k && j >= step->col && j < step->col + step->cols;
+}
+
+// Advise the panels of step, except the tiles that are also in the panels of keep
+static void advisePanels(const struct OutOfCore* const job, const struct OutOfCoreStep* const step, const int advice, const struct OutOfCoreStep* const keep){
+    for (size_t i = 0; i < step->rows; ++i){
+        if (!inPanels(keep, true, step->row + i, step->k)) adviseTile(job->a, step->row + i, step->k, advice);
+    }
+    for (size_t j = 0; j < step->cols; ++j){
+        if (!inPanels(keep, false, step->k, step->col + j)) adviseTile(job->b, step->k, step->col + j, advice);
+    }
+}
+
+static void multiplyTile(const struct TileJob* const tileJob, const size_t task, const size_t threadCount){
+    const struct OutOfCore* const job = tileJob->job;
+    const struct OutOfCoreStep* const step = tileJob->step;
+    const size_t i = step->row + task/step->cols;
+    const size_t j = step->col + task % step->cols;
+    const size_t t = job->res->tile;
+    // Tiles are padded with zeros, so whole tiles are multiplied. The first k overwrites what the block held before.
+    gemmStrided(t, t, t, 1.0, matfileTile(job->a, i, step->k), t, 1, matfileTile(job->b, step->k, j), t, 1, step->k == 0 ? 0.0 : 1.0,
+            matfileTile(job->res, i, j), t, threadCount);
+}
+
+static void tileTask(void* s, const size_t task, const size_t worker){
+    (void)worker;
+    multiplyTile(s, task, 1);
+}
+
+/*
+ * res = a*b for the matrix files at aPath and bPath, written to a new file at resPath with the tile size of a.
+ * memoryBudget bounds the resident memory in bytes, zero uses a quarter of the physical memory. threadCount limits
+ * the pool threads, zero uses all.
+ */
+void matmulOutOfCore(const char* const aPath, const char* const bPath, const char* const resPath, size_t memoryBudget, const size_t threadCount){
+    struct MatFile* a = matfileOpen(aPath, false);
+    struct MatFile* b = matfileOpen(bPath, false);
+    if (matfileCols(a) != matfileRows(b)){
+        fprintf(stderr, "%s: a is %zu x %zu and b is %zu x %zu\n", __func__, a->rows, a->cols, b->rows, b->cols);
+        exit(1);
+    }
+    if (a->tile != b->tile){
+        fprintf(stderr, "%s: a has %zu x %zu tiles and b %zu x %zu, convert them with the same tile size\n", __func__, a->tile, a->tile, b->tile, b->tile);
+        exit(1);
+    }
+    struct MatFile* res = matfileCreate(resPath, a->rows, b->cols, a->tile);
+    if (memoryBudget == 0) memoryBudget = defaultBudget();
+    // The largest block whose tiles and two sets of panels fit the budget, at least one tile
+    const size_t tileBytes = matfileTileBytes(res);
+    size_t blockTiles = 1;
+    const size_t maxBlock = res->tileRows > res->tileCols ? res->tileRows : res->tileCols;
+    while (blockTiles < maxBlock && (blockTiles + 1)*(blockTiles + 1 + 4)*tileBytes <= memoryBudget){
+        ++blockTiles;
+    }
+    const struct OutOfCore job = {
+        .a = a,
+        .b = b,
+        .res = res,
+        .blockTiles = blockTiles,
+        .depthTiles = a->tileCols,
+    };
+    const size_t blockCount = ((res->tileRows + blockTiles - 1)/blockTiles)*((res->tileCols + blockTiles - 1)/blockTiles);
+    const size_t stepCount = a->tileCols > 0 ? blockCount*job.depthTiles : 0;
+    const size_t workers = threadCount == 0 ? threadPoolSize() : threadCount;
+    for (size_t s = 0; s < stepCount; ++s){
+        const struct OutOfCoreStep step = stepAt(&job, s);
+        const struct OutOfCoreStep next = stepAt(&job, s + 1 < stepCount ? s + 1 : s);
+        if (s == 0) advisePanels(&job, &step, MADV_WILLNEED, NULL);
+        if (s + 1 < stepCount) advisePanels(&job, &next, MADV_WILLNEED, &step);
+        struct TileJob tileJob = {
+            .job = &job,
+            .step = &step,
+        };
+        const size_t tiles = step.rows*step.cols;
+        if (tiles >= workers){
+            threadPoolRun(threadCount, tiles, tileTask, &tileJob);
+        } else {
+            for (size_t task = 0; task < tiles; ++task){
+                multiplyTile(&tileJob, task, threadCount);
+            }
+        }
+        advisePanels(&job, &step, MADV_DONTNEED, s + 1 < stepCount ? &next : NULL);
+        if (step.k + 1 == job.depthTiles){
+            // The block is final: start its write back and drop it
+            for (size_t i = 0; i < step.rows; ++i){
+                unsigned char* const start = (unsigned char*)matfileTile(res, step.row + i, step.col);
+                msync(start, step.cols*tileBytes, MS_ASYNC);
+                madvise(start, step.cols*tileBytes, MADV_DONTNEED);
+            }
+        }
+    }
+    matfileClose(res);
+    matfileClose(b);
+    matfileClose(a);
+}
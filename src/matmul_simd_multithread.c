@@ -1,20 +1,31 @@
+#include <threadpool.h>
+#include <prepacked.h>
+#include <stats.h>
+#include <tune.h>
+#include <epilogue.h>
+#include <gemm.h>
+#include <cpu.h>
 #include <immintrin.h>
-#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <malloc.h>
+
+// Must be even, the worker computes 2x2 blocks. The tuning profile can pick another one.
+#define TILESIZE 64
+
 struct InformationStruct {
     double* matA;
-    double* matB;
+    const struct Prepacked* matB;
     double* matRes;
+    const struct EpilogueRun* epilogue;
     size_t size;
-    size_t columnCount;
-    size_t startColumn;
+    size_t tileSize;
+    size_t tileColumns;
 };
 
-static __m256d fourDotProductsFour(double* restrict u0, double* restrict v0, double* restrict u1, double* restrict v1){
+static TARGET_AVX __m256d fourDotProductsFour(double* restrict u0, double* restrict v0, double* restrict u1, double* restrict v1){
     __m256d xy0 = _mm256_mul_pd(_mm256_load_pd(u0), _mm256_load_pd(v0));
     __m256d xy1 = _mm256_mul_pd(_mm256_load_pd(u1), _mm256_load_pd(v1));
     __m256d xy2 = _mm256_mul_pd(_mm256_load_pd(u1), _mm256_load_pd(v0));
@@ -32,66 +43,97 @@ static uintptr_t offset32Alignment(const double* const ptr){
 }
 
 
-static void worker(double* const restrict a, double* const restrict b, double* const restrict res, const size_t size, const size_t columnCount, const size_t startColumn){
-    for (size_t i = 0; i < size; i+=2){
-        for (size_t j = startColumn; j < startColumn + columnCount; j+=2){
+/*
+ * The four sums of a 2x2 block stay in one register over all of k and are stored once, so res needs no clearing.
+ * The epilogue finishes the block right after, a converted output never touches res.
+ */
+static TARGET_AVX void worker(double* const restrict a, double* const restrict b, double* const restrict res, const size_t size, const size_t startRow, const size_t endRow, const size_t startColumn, const size_t endColumn, const struct EpilogueRun* const epilogue){
+    const bool converts = epilogueConverts(epilogue);
+    for (size_t i = startRow; i < endRow; i+=2){
+        for (size_t j = startColumn; j < endColumn; j+=2){
+            __m256d acc = _mm256_setzero_pd();
             for (size_t k = 0; k < size; k+=4){
-                __m256d t = fourDotProductsFour(&a[i*size + k], &b[j*size + k], &a[(i+1)*size + k], &b[(j+1)*size + k]);
-                double* temp = (double*)&t;
-                res[i*size + j] += temp[0];
-                res[(i+1)*size + (j+1)] += temp[1];
-                res[(i+1)*size + j] += temp[2];
-                res[i*size + (j+1)] += temp[3];
+                acc = _mm256_add_pd(acc, fourDotProductsFour(&a[i*size + k], &b[j*size + k], &a[(i+1)*size + k], &b[(j+1)*size + k]));
             }
+            double temp[4];
+            _mm256_storeu_pd(temp, acc);
+            double block[2][2] = {{temp[0], temp[3]}, {temp[2], temp[1]}};
+            if (epilogue != NULL) epilogueDouble(epilogue, i, j, 2, 2, &block[0][0], 2);
+            if (converts) continue;
+            res[i*size + j] = block[0][0];
+            res[i*size + (j+1)] = block[0][1];
+            res[(i+1)*size + j] = block[1][0];
+            res[(i+1)*size + (j+1)] = block[1][1];
         }
     }
 }
 
-static void* thread(void* s){
+static void tileWorker(void* s, const size_t tile, const size_t workerIndex){
     struct InformationStruct* infStruct = s;
-    worker(infStruct->matA, infStruct->matB, infStruct->matRes, infStruct->size, infStruct->columnCount, infStruct->startColumn);
-    return NULL;
+    const size_t tileSize = infStruct->tileSize;
+    const size_t startRow = (tile / infStruct->tileColumns)*tileSize;
+    const size_t startColumn = (tile % infStruct->tileColumns)*tileSize;
+    const size_t endRow = startRow + tileSize < infStruct->size ? startRow + tileSize : infStruct->size;
+    const size_t endColumn = startColumn + tileSize < infStruct->size ? startColumn + tileSize : infStruct->size;
+    worker(infStruct->matA, prepackedData(infStruct->matB, workerIndex), infStruct->matRes, infStruct->size, startRow, endRow, startColumn, endColumn, infStruct->epilogue);
 }
 
-void matmulSIMDMT(double* const restrict a,  double* const restrict b, double* const restrict res, const size_t size, size_t threadCount){
+static void simdMultithread(double* const restrict a, const struct Prepacked* const restrict prepacked, double* const restrict res, const size_t size, size_t threadCount, const struct EpilogueRun* const epilogue){
     if (size % 4 != 0){
         fprintf(stderr, "Size is not a multiple of 4\n");
         exit(1);
     }
-    double* c = aligned_alloc(32, size*size*sizeof(double));
-    for (size_t i = 0; i < size; ++i){
-        for (size_t j = 0; j < size; ++j){
-            c[j + i*size] = b[i + j*size];
-        }
-    }
+    prepackedCheck(prepacked, PREPACKED_TRANSPOSED, size, size, __func__);
     if(offset32Alignment(a) != 0){
         fprintf(stderr, "Array a is not correctly aligned\n");
         exit(1);
     }
-    threadCount = size/2 > threadCount ? threadCount : size/2;
-    memset(res, 0, sizeof(double)*size*size);
-    pthread_t threads[threadCount - 1];
-    struct InformationStruct iStructs[threadCount - 1];
-    const size_t columnsPerThread = ((size/2)/threadCount)*2;
-    size_t rest = ((size/2) % threadCount)*2;
-    size_t lastEnd = 0;
-    for (size_t i = 0; i < threadCount - 1; ++i){
-        iStructs[i].matA = a;
-        iStructs[i].matB = c;
-        iStructs[i].matRes = res;
-        iStructs[i].size = size;
-        iStructs[i].columnCount = columnsPerThread;
-        iStructs[i].startColumn = lastEnd;
-        if (rest > 0){
-            iStructs[i].columnCount += 2;
-            rest-=2;
-        }
-        lastEnd += iStructs[i].columnCount;
-        pthread_create(&threads[i], NULL, thread, (void*)&iStructs[i]);
+    if (cpuIsa() < ISA_AVX){
+        // prepacked holds b^T, which is the same as b with its row and column strides swapped
+        gemmStridedEpilogue(size, size, size, 1.0, a, size, 1, prepacked->data, 1, size, 0.0, res, size, epilogue, threadCount);
+        return;
     }
-    worker(a, c, res, size, columnsPerThread, lastEnd);
-    for (size_t i = 0; i < threadCount - 1; ++i){
-        pthread_join(threads[i], NULL);
+    size_t tileSize = TILESIZE;
+    const size_t workers = threadCount == 0 || threadCount > threadPoolSize() ? threadPoolSize() : threadCount;
+    struct TuneConfig config;
+    if (tuneLookup(TUNE_SIMDMT, size, size, size, workers, &config)){
+        if (config.tile >= 2) tileSize = config.tile & ~(size_t)1;
+        if (config.threads > 0 && config.threads < workers) threadCount = config.threads;
     }
-    free(c);
+    const size_t tiles = (size + tileSize - 1)/tileSize;
+    struct InformationStruct iStruct = {
+        .matA = a,
+        .matB = prepacked,
+        .matRes = res,
+        .epilogue = epilogue,
+        .size = size,
+        .tileSize = tileSize,
+        .tileColumns = tiles,
+    };
+    const double start = statsStart();
+    threadPoolRun(threadCount, tiles*tiles, tileWorker, &iStruct);
+    statsStop(MATMUL_PHASE_COMPUTE, start);
+}
+
+void matmulSIMDMTPrepacked(double* const restrict a, const struct Prepacked* const restrict prepacked, double* const restrict res, const size_t size, size_t threadCount){
+    simdMultithread(a, prepacked, res, size, threadCount, NULL);
+}
+
+void matmulSIMDMT(double* const restrict a,  double* const restrict b, double* const restrict res, const size_t size, size_t threadCount){
+    struct Prepacked* c = prepackedTranspose(b, size, threadCount);
+    simdMultithread(a, c, res, size, threadCount, NULL);
+    matmulFreePrepacked(c);
+}
+
+/*
+ * matmulSIMDMT with res finished by epilogue (see epilogue.h), which has the row major layout of res. With a
+ * converted output res is not written and may be NULL.
+ */
+void matmulSIMDMTEpilogue(double* const restrict a,  double* const restrict b, double* const restrict res, const size_t size, size_t threadCount,
+        const struct MatmulEpilogue* const epilogue){
+    struct EpilogueRun run;
+    const bool fused = epiloguePrepare(epilogue, false, size, size, 1, 0, &run, __func__);
+    struct Prepacked* c = prepackedTranspose(b, size, threadCount);
+    simdMultithread(a, c, res, size, threadCount, fused ? &run : NULL);
+    matmulFreePrepacked(c);
 }
@@ -1,10 +1,14 @@
+#include <prepacked.h>
+#include <stats.h>
+#include <gemm.h>
+#include <cpu.h>
 #include <immintrin.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
 
-static double dotProduct_4(const double* const restrict u, const double* const restrict v){
+static TARGET_AVX double dotProduct_4(const double* const restrict u, const double* const restrict v){
     __m256d dp = _mm256_mul_pd(_mm256_load_pd(u), _mm256_load_pd(v));
     __m128d a = _mm256_extractf128_pd(dp, 0);
     __m128d b = _mm256_extractf128_pd(dp, 1);
@@ -14,7 +18,7 @@ static double dotProduct_4(const double* const restrict u, const double* const r
     return _mm_cvtsd_f64(dotproduct);
 }
 
-static __m256d fourDotProductsFour(double* restrict u0, double* restrict v0, double* restrict u1, double* restrict v1){
+static TARGET_AVX __m256d fourDotProductsFour(double* restrict u0, double* restrict v0, double* restrict u1, double* restrict v1){
     __m256d xy0 = _mm256_mul_pd(_mm256_load_pd(u0), _mm256_load_pd(v0));
     __m256d xy1 = _mm256_mul_pd(_mm256_load_pd(u1), _mm256_load_pd(v1));
     __m256d xy2 = _mm256_mul_pd(_mm256_load_pd(u1), _mm256_load_pd(v0));
@@ -31,23 +35,12 @@ static uintptr_t offset32Alignment(const double* const ptr){
     return val % 32;
 }
 
-void simdMultiplyFour(double* restrict a, double* const restrict b, double* const restrict res, size_t size){
-    if (size % 4 != 0){
-        fprintf(stderr, "Size is not a multiple of 4\n");
-        exit(1);
-    }
-    memset(res, 0, sizeof(double)*size*size);
-    double* c = aligned_alloc(32, size*size*sizeof(double));
-    if(offset32Alignment(a) != 0){
-        fprintf(stderr, "Array a is not correctly aligned\n");
-        exit(1);
-    }
-    for (size_t i = 0; i < size; ++i){
-        for (size_t j = 0; j < size; ++j){
-            c[j + i*size] = b[i + j*size];
-        }
-    }
+// c holds b^T, which is the same as b with its row and column strides swapped
+static void multiplyWithoutAvx(const double* const restrict a, const double* const restrict c, double* const restrict res, const size_t size){
+    gemmStrided(size, size, size, 1.0, a, size, 1, c, 1, size, 0.0, res, size, 1);
+}
 
+static TARGET_AVX void multiplyFour(double* restrict a, const double* const restrict c, double* const restrict res, const size_t size){
     for (size_t i = 0; i < size; ++i){
         for (size_t j = 0; j < size; ++j){
             for (size_t k = 0; k < size; k+=4){
@@ -55,25 +48,9 @@ void simdMultiplyFour(double* restrict a, double* const restrict b, double* cons
             }
         }
     }
-    free(c);
 }
 
-void simdMoreOptimized(double* const restrict a, double* const restrict b, double* const restrict res, const size_t size){
-    if (size % 4 != 0){
-        fprintf(stderr, "Size is not a multiple of 4\n");
-        exit(1);
-    }
-    memset(res, 0, sizeof(double)*size*size);
-    double* c = aligned_alloc(32, size*size*sizeof(double));
-    if(offset32Alignment(a) != 0){
-        fprintf(stderr, "Array a is not correctly aligned\n");
-        exit(1);
-    }
-    for (size_t i = 0; i < size; ++i){
-        for (size_t j = 0; j < size; ++j){
-            c[j + i*size] = b[i + j*size];
-        }
-    }
+static TARGET_AVX void moreOptimized(double* const restrict a, double* const restrict c, double* const restrict res, const size_t size){
     for (size_t i = 0; i < size; i+=2){
         for (size_t j = 0; j < size; j+=2){
             for (size_t k = 0; k < size; k+=4){
@@ -86,5 +63,60 @@ void simdMoreOptimized(double* const restrict a, double* const restrict b, doubl
             }
         }
     }
-    free(c);
+}
+
+void simdMultiplyFourPrepacked(double* restrict a, const struct Prepacked* const restrict prepacked, double* const restrict res, size_t size){
+    if (size % 4 != 0){
+        fprintf(stderr, "Size is not a multiple of 4\n");
+        exit(1);
+    }
+    prepackedCheck(prepacked, PREPACKED_TRANSPOSED, size, size, __func__);
+    if (cpuIsa() < ISA_AVX){
+        multiplyWithoutAvx(a, prepacked->data, res, size);
+        return;
+    }
+    double start = statsStart();
+    memset(res, 0, sizeof(double)*size*size);
+    statsStop(MATMUL_PHASE_CLEAR, start);
+    if(offset32Alignment(a) != 0){
+        fprintf(stderr, "Array a is not correctly aligned\n");
+        exit(1);
+    }
+    start = statsStart();
+    multiplyFour(a, prepacked->data, res, size);
+    statsStop(MATMUL_PHASE_COMPUTE, start);
+}
+
+void simdMultiplyFour(double* restrict a, double* const restrict b, double* const restrict res, size_t size){
+    struct Prepacked* c = prepackedTranspose(b, size, 1);
+    simdMultiplyFourPrepacked(a, c, res, size);
+    matmulFreePrepacked(c);
+}
+
+void simdMoreOptimizedPrepacked(double* const restrict a, const struct Prepacked* const restrict prepacked, double* const restrict res, const size_t size){
+    if (size % 4 != 0){
+        fprintf(stderr, "Size is not a multiple of 4\n");
+        exit(1);
+    }
+    prepackedCheck(prepacked, PREPACKED_TRANSPOSED, size, size, __func__);
+    if (cpuIsa() < ISA_AVX){
+        multiplyWithoutAvx(a, prepacked->data, res, size);
+        return;
+    }
+    double start = statsStart();
+    memset(res, 0, sizeof(double)*size*size);
+    statsStop(MATMUL_PHASE_CLEAR, start);
+    if(offset32Alignment(a) != 0){
+        fprintf(stderr, "Array a is not correctly aligned\n");
+        exit(1);
+    }
+    start = statsStart();
+    moreOptimized(a, prepacked->data, res, size);
+    statsStop(MATMUL_PHASE_COMPUTE, start);
+}
+
+void simdMoreOptimized(double* const restrict a, double* const restrict b, double* const restrict res, const size_t size){
+    struct Prepacked* c = prepackedTranspose(b, size, 1);
+    simdMoreOptimizedPrepacked(a, c, res, size);
+    matmulFreePrepacked(c);
 }
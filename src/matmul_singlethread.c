@@ -1,5 +1,6 @@
-#include <stdlib.h>
-#include <stdio.h>
+#include <transpose.h>
+#include <arena.h>
+#include <stdint.h>
 
 void matmulNaive(const double* const restrict a, const double* const restrict b, double* const restrict res, const size_t size){
 	for (size_t i = 0; i < size; ++i){
@@ -13,13 +14,10 @@ void matmulNaive(const double* const restrict a, const double* const restrict b,
 }
 
 void matmulNaiveTransposeFirst(const double* const restrict a, double* const restrict b, double* const restrict res, const size_t size){
-	double* c = malloc(size*size*sizeof(double));
-	for (size_t i = 0; i < size; ++i){
-		for (size_t j = 0; j < size; ++j){
-            printf("%f\n", b[i + j*size]);
-			c[j + i*size] = b[i + j*size];
-			res[i*size + j] = 0;
-		}
+	double* c = arenaAlloc(size*size*sizeof(double));
+	matmulTranspose(size, size, b, size, c, size, 1);
+	for (size_t i = 0; i < size*size; ++i){
+		res[i] = 0;
 	}
 	for (size_t i = 0; i < size; ++i){
 		for (size_t j = 0; j < size; ++j){
@@ -28,7 +26,7 @@ void matmulNaiveTransposeFirst(const double* const restrict a, double* const res
 			}
 		}
 	}
-	free(c);
+	arenaRelease(c);
 }
 
 void matmulNaiveBlock(const int32_t* const restrict a, int32_t* const restrict b, int32_t* const restrict res, const size_t size){
@@ -0,0 +1,172 @@
+#include <spmm.h>
+#include <threadpool.h>
+#include <stats.h>
+#include <cpu.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Pieces of the merge path for each thread, more than one lets the pool even out rows of different cost
+#define PIECES_PER_THREAD 4
+// Aim for at least this many multiply-adds per piece so that scheduling stays cheap next to the work
+#define TASK_WORK (1 << 16)
+// Columns of a row of res the baseline kernel keeps in its accumulators
+#define STRIP 16
+
+struct SpmmJob {
+    size_t n;
+    size_t blockRows;
+    size_t blockCols;
+    // Block rows, the row ends on the merge path
+    size_t rowCount;
+    size_t blockCount;
+    const int64_t* indptr;
+    const int32_t* indices;
+    const double* data;
+    const double* b;
+    size_t ldb;
+    double* res;
+    size_t ldr;
+    // Length of the path a task walks, and for every task the partial sum of the row it stops inside of
+    size_t pieceLength;
+    double* carry;
+    size_t* carryRow;
+    SpmmRow kernel;
+};
+
+// The x86-64 baseline, the fixed strip lets the compiler keep acc in sse registers
+static void spmmRowSse2(const size_t count, const int32_t* const indices, const double* const data, const size_t blockRows, const size_t blockCols,
+        const double* const b, const size_t ldb, const size_t n, double* const res, const size_t ldr){
+    for (size_t i = 0; i < blockRows; ++i){
+        for (size_t j = 0; j < n; j += STRIP){
+            const size_t width = n - j < STRIP ? n - j : STRIP;
+            double acc[STRIP] = {0};
+            for (size_t p = 0; p < count; ++p){
+                const double* const values = &data[(p*blockRows + i)*blockCols];
+                const double* const rows = &b[(size_t)indices[p]*blockCols*ldb + j];
+                for (size_t q = 0; q < blockCols; ++q){
+                    const double x = values[q];
+                    const double* const row = &rows[q*ldb];
+                    if (width == STRIP){
+                        for (size_t v = 0; v < STRIP; ++v) acc[v] += x*row[v];
+                    } else {
+                        for (size_t v = 0; v < width; ++v) acc[v] += x*row[v];
+                    }
+                }
+            }
+            memcpy(&res[i*ldr + j], acc, width*sizeof(double));
+        }
+    }
+}
+
+/*
+ * The point where the merge of the row ends and the blocks crosses diagonal d: the amount of row ends before it. The
+ * remaining d minus that many steps are blocks.
+ */
+static size_t pathRow(const struct SpmmJob* const job, const size_t d){
+    size_t low = d > job->blockCount ? d - job->blockCount : 0;
+    size_t high = d < job->rowCount ? d : job->rowCount;
+    while (low < high){
+        const size_t pivot = low + (high - low)/2;
+        if ((size_t)(job->indptr[pivot + 1] - job->indptr[0]) <= d - pivot - 1){
+            low = pivot + 1;
+        } else {
+            high = pivot;
+        }
+    }
+    return low;
+}
+
+// Blocks [begin, end) of the path, which all belong to one block row
+static void rowRun(const struct SpmmJob* const job, const size_t begin, const size_t end, double* const res, const size_t ldr){
+    job->kernel(end - begin, &job->indices[begin], &job->data[begin*job->blockRows*job->blockCols], job->blockRows, job->blockCols,
+            job->b, job->ldb, job->n, res, ldr);
+}
+
+/*
+ * One piece of the merge path. The rows whose end lies on the piece are written to res, from the first block of the
+ * piece on, the blocks of the row the piece stops inside of go to the carry of the task.
+ */
+static void spmmTask(void* s, const size_t task, const size_t worker){
+    (void)worker;
+    const struct SpmmJob* const job = s;
+    const size_t total = job->rowCount + job->blockCount;
+    const size_t dBegin = task*job->pieceLength < total ? task*job->pieceLength : total;
+    const size_t dEnd = dBegin + job->pieceLength < total ? dBegin + job->pieceLength : total;
+    const size_t base = (size_t)job->indptr[0];
+    const size_t rowBegin = pathRow(job, dBegin);
+    const size_t rowEnd = pathRow(job, dEnd);
+    size_t block = dBegin - rowBegin;
+    for (size_t r = rowBegin; r < rowEnd; ++r){
+        const size_t last = (size_t)job->indptr[r + 1] - base;
+        rowRun(job, block, last, &job->res[r*job->blockRows*job->ldr], job->ldr);
+        block = last;
+    }
+    const size_t blockEnd = dEnd - rowEnd;
+    if (block < blockEnd){
+        rowRun(job, block, blockEnd, &job->carry[task*job->blockRows*job->n], job->n);
+        job->carryRow[task] = rowEnd;
+    }
+}
+
+void matmulBsrDense(const size_t m, const size_t n, const size_t k, const size_t blockRows, const size_t blockCols, const int64_t* const indptr,
+        const int32_t* const indices, const double* const data, const double* const b, const size_t ldb, double* const res, const size_t ldr,
+        const size_t threadCount){
+    if (blockRows == 0 || blockCols == 0 || m % blockRows != 0 || k % blockCols != 0){
+        fprintf(stderr, "%s: %zu x %zu blocks do not tile a %zu x %zu matrix\n", __func__, blockRows, blockCols, m, k);
+        exit(1);
+    }
+    if (indptr[m/blockRows] < indptr[0]){
+        fprintf(stderr, "%s: indptr ends at %lld before its start %lld\n", __func__, (long long)indptr[m/blockRows], (long long)indptr[0]);
+        exit(1);
+    }
+    if (m == 0 || n == 0) return;
+    const double start = statsStart();
+    struct SpmmJob job = {
+        .n = n,
+        .blockRows = blockRows,
+        .blockCols = blockCols,
+        .rowCount = m/blockRows,
+        .blockCount = (size_t)(indptr[m/blockRows] - indptr[0]),
+        .indptr = indptr,
+        .indices = &indices[indptr[0]],
+        .data = &data[(size_t)indptr[0]*blockRows*blockCols],
+        .b = b,
+        .ldb = ldb,
+        .res = res,
+        .ldr = ldr,
+        .kernel = cpuIsa() >= ISA_AVX2 ? spmmRowAvx2 : spmmRowSse2,
+    };
+    const size_t workers = threadCount == 0 || threadCount > threadPoolSize() ? threadPoolSize() : threadCount;
+    const size_t total = job.rowCount + job.blockCount;
+    const size_t work = (job.blockCount*blockCols + job.rowCount)*blockRows*n;
+    size_t taskCount = work/TASK_WORK < PIECES_PER_THREAD*workers ? work/TASK_WORK : PIECES_PER_THREAD*workers;
+    if (workers == 1 || taskCount == 0) taskCount = 1;
+    job.pieceLength = (total + taskCount - 1)/taskCount;
+    taskCount = (total + job.pieceLength - 1)/job.pieceLength;
+    job.carry = malloc(taskCount*blockRows*n*sizeof(double));
+    job.carryRow = malloc(taskCount*sizeof(size_t));
+    if (job.carry == NULL || job.carryRow == NULL){
+        fprintf(stderr, "Failed to allocate the row carries of %zu tasks\n", taskCount);
+        exit(1);
+    }
+    for (size_t t = 0; t < taskCount; ++t) job.carryRow[t] = SIZE_MAX;
+    threadPoolRun(workers, taskCount, spmmTask, &job);
+    // The row a piece stops inside of is finished by a later piece, which has written res by now
+    for (size_t t = 0; t < taskCount; ++t){
+        if (job.carryRow[t] == SIZE_MAX) continue;
+        for (size_t i = 0; i < blockRows; ++i){
+            double* const out = &res[(job.carryRow[t]*blockRows + i)*ldr];
+            const double* const partial = &job.carry[(t*blockRows + i)*n];
+            for (size_t j = 0; j < n; ++j) out[j] += partial[j];
+        }
+    }
+    free(job.carry);
+    free(job.carryRow);
+    statsStop(MATMUL_PHASE_COMPUTE, start);
+}
+
+void matmulCsrDense(const size_t m, const size_t n, const size_t k, const int64_t* const indptr, const int32_t* const indices,
+        const double* const data, const double* const b, const size_t ldb, double* const res, const size_t ldr, const size_t threadCount){
+    matmulBsrDense(m, n, k, 1, 1, indptr, indices, data, b, ldb, res, ldr, threadCount);
+}
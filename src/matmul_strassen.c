@@ -0,0 +1,296 @@
+#include <threadpool.h>
+#include <gemm.h>
+#include <arena.h>
+#include <float.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Strassen-Winograd: one level turns a n x n product into 7 products of the n/2 x n/2 quadrants and 15 additions,
+ * so recursing down to a crossover size does O(n^2.81) work. Below the crossover the packed GEMM is faster.
+ * Odd sizes are peeled: the even part recurses and the last row and column are fixed up with thin products.
+ *
+ * All temporaries come from one workspace allocated per call. Run serially, a level needs two quadrant sized
+ * temporaries and uses the quadrants of c for the rest (the schedule of Boyer, Dumas, Pernet and Zhou, "Memory
+ * efficient scheduling of Strassen-Winograd's matrix multiplication algorithm"). With 2 to 7 threads the seven
+ * products of the top level run as parallel tasks instead, which needs 11 quadrants of workspace. With more threads
+ * the levels run one after another and the leaf products use the whole pool.
+ */
+
+#define DEFAULT_CROSSOVER 1024
+// Below this the recursion only adds overhead
+#define MIN_CROSSOVER 16
+#define MAX_PARALLEL_PRODUCTS 7
+
+struct Strassen {
+    size_t crossover;
+    size_t workers;
+};
+
+static bool parallelProducts(const size_t workers){
+    return workers > 1 && workers <= MAX_PARALLEL_PRODUCTS;
+}
+
+static size_t workspaceSize(const size_t n, const size_t crossover, const size_t workers){
+    if (n <= crossover) return 0;
+    const size_t h = n/2;
+    if (parallelProducts(workers)){
+        return 11*h*h + MAX_PARALLEL_PRODUCTS*workspaceSize(h, crossover, 1);
+    }
+    return 2*h*h + workspaceSize(h, crossover, workers);
+}
+
+// out = x + sign*y on n x n matrices, out may be x or y
+static void addScaled(const size_t n, const double* const x, const size_t ldx, const double* const y, const size_t ldy, const double sign, double* const out, const size_t ldo){
+    for (size_t i = 0; i < n; ++i){
+        for (size_t j = 0; j < n; ++j){
+            out[i*ldo + j] = x[i*ldx + j] + sign*y[i*ldy + j];
+        }
+    }
+}
+
+static void multiply(const struct Strassen* s, size_t n, const double* a, size_t lda, const double* b, size_t ldb, double* c, size_t ldc, double* workspace);
+
+// Quadrants of a, b and c for one level with h x h quadrants
+struct Quadrants {
+    const double* a[2][2];
+    const double* b[2][2];
+    double* c[2][2];
+    size_t lda;
+    size_t ldb;
+    size_t ldc;
+    size_t h;
+};
+
+static struct Quadrants quadrants(const size_t h, const double* const a, const size_t lda, const double* const b, const size_t ldb, double* const c, const size_t ldc){
+    struct Quadrants q = {.lda = lda, .ldb = ldb, .ldc = ldc, .h = h};
+    for (size_t i = 0; i < 2; ++i){
+        for (size_t j = 0; j < 2; ++j){
+            q.a[i][j] = &a[i*h*lda + j*h];
+            q.b[i][j] = &b[i*h*ldb + j*h];
+            q.c[i][j] = &c[i*h*ldc + j*h];
+        }
+    }
+    return q;
+}
+
+static void winogradSerial(const struct Strassen* const s, const struct Quadrants* const q, double* const workspace){
+    const size_t h = q->h;
+    const size_t lda = q->lda;
+    const size_t ldb = q->ldb;
+    const size_t ldc = q->ldc;
+    double* const x = workspace;
+    double* const y = workspace + h*h;
+    double* const next = workspace + 2*h*h;
+    addScaled(h, q->a[0][0], lda, q->a[1][0], lda, -1, x, h);           // S3 = A11 - A21
+    addScaled(h, q->b[1][1], ldb, q->b[0][1], ldb, -1, y, h);           // T3 = B22 - B12
+    multiply(s, h, x, h, y, h, q->c[1][0], ldc, next);                  // P7 = S3*T3 in C21
+    addScaled(h, q->a[1][0], lda, q->a[1][1], lda, 1, x, h);            // S1 = A21 + A22
+    addScaled(h, q->b[0][1], ldb, q->b[0][0], ldb, -1, y, h);           // T1 = B12 - B11
+    multiply(s, h, x, h, y, h, q->c[1][1], ldc, next);                  // P5 = S1*T1 in C22
+    addScaled(h, x, h, q->a[0][0], lda, -1, x, h);                      // S2 = S1 - A11
+    addScaled(h, q->b[1][1], ldb, y, h, -1, y, h);                      // T2 = B22 - T1
+    multiply(s, h, x, h, y, h, q->c[0][1], ldc, next);                  // P6 = S2*T2 in C12
+    addScaled(h, q->a[0][1], lda, x, h, -1, x, h);                      // S4 = A12 - S2
+    multiply(s, h, x, h, q->b[1][1], ldb, q->c[0][0], ldc, next);       // P3 = S4*B22 in C11
+    multiply(s, h, q->a[0][0], lda, q->b[0][0], ldb, x, h, next);       // P1 = A11*B11 in X
+    addScaled(h, x, h, q->c[0][1], ldc, 1, q->c[0][1], ldc);            // U2 = P1 + P6 in C12
+    addScaled(h, q->c[0][1], ldc, q->c[1][0], ldc, 1, q->c[1][0], ldc); // U3 = U2 + P7 in C21
+    addScaled(h, q->c[0][1], ldc, q->c[1][1], ldc, 1, q->c[0][1], ldc); // U4 = U2 + P5 in C12
+    addScaled(h, q->c[1][0], ldc, q->c[1][1], ldc, 1, q->c[1][1], ldc); // U7 = U3 + P5 in C22
+    addScaled(h, q->c[0][1], ldc, q->c[0][0], ldc, 1, q->c[0][1], ldc); // U5 = U4 + P3 in C12
+    addScaled(h, y, h, q->b[1][0], ldb, -1, y, h);                      // T4 = T2 - B21
+    multiply(s, h, q->a[1][1], lda, y, h, q->c[0][0], ldc, next);       // P4 = A22*T4 in C11
+    addScaled(h, q->c[1][0], ldc, q->c[0][0], ldc, -1, q->c[1][0], ldc); // U6 = U3 - P4 in C21
+    multiply(s, h, q->a[0][1], lda, q->b[1][0], ldb, q->c[0][0], ldc, next); // P2 = A12*B21 in C11
+    addScaled(h, x, h, q->c[0][0], ldc, 1, q->c[0][0], ldc);            // U1 = P1 + P2 in C11
+}
+
+struct ParallelLevel {
+    const struct Strassen* serial;
+    const struct Quadrants* q;
+    double* workspace;
+    size_t childWorkspace;
+    size_t rowsPerTask;
+};
+
+// Slots of the parallel workspace, each h x h. The products P1 to P4 go straight into the quadrants of c.
+enum {
+    SLOT_S4,
+    SLOT_T4,
+    SLOT_S1,
+    SLOT_T1,
+    SLOT_S2,
+    SLOT_T2,
+    SLOT_S3,
+    SLOT_T3,
+    SLOT_P5,
+    SLOT_P6,
+    SLOT_P7,
+    SLOTS,
+};
+
+// Compute one of the seven products, together with the sums it needs
+static void productTask(void* ctx, const size_t task, const size_t worker){
+    (void)worker;
+    const struct ParallelLevel* level = ctx;
+    const struct Quadrants* q = level->q;
+    const size_t h = q->h;
+    const size_t lda = q->lda;
+    const size_t ldb = q->ldb;
+    const size_t ldc = q->ldc;
+    double* const slot = level->workspace;
+    double* const next = level->workspace + SLOTS*h*h + task*level->childWorkspace;
+    // Tasks 4 to 6 keep their pair of operands in SLOT_S1 to SLOT_T3
+    double* const x = &slot[(SLOT_S1 + 2*(task >= 4 ? task - 4 : 0))*h*h];
+    double* const y = x + h*h;
+    switch (task){
+        case 0:
+            multiply(level->serial, h, q->a[0][0], lda, q->b[0][0], ldb, q->c[0][0], ldc, next);
+            break;
+        case 1:
+            multiply(level->serial, h, q->a[0][1], lda, q->b[1][0], ldb, q->c[0][1], ldc, next);
+            break;
+        case 2: {
+            double* const s4 = &slot[SLOT_S4*h*h];
+            addScaled(h, q->a[1][0], lda, q->a[1][1], lda, 1, s4, h);
+            addScaled(h, s4, h, q->a[0][0], lda, -1, s4, h);
+            addScaled(h, q->a[0][1], lda, s4, h, -1, s4, h);
+            multiply(level->serial, h, s4, h, q->b[1][1], ldb, q->c[1][0], ldc, next);
+            break;
+        }
+        case 3: {
+            double* const t4 = &slot[SLOT_T4*h*h];
+            addScaled(h, q->b[0][1], ldb, q->b[0][0], ldb, -1, t4, h);
+            addScaled(h, q->b[1][1], ldb, t4, h, -1, t4, h);
+            addScaled(h, t4, h, q->b[1][0], ldb, -1, t4, h);
+            multiply(level->serial, h, q->a[1][1], lda, t4, h, q->c[1][1], ldc, next);
+            break;
+        }
+        case 4:
+            addScaled(h, q->a[1][0], lda, q->a[1][1], lda, 1, x, h);
+            addScaled(h, q->b[0][1], ldb, q->b[0][0], ldb, -1, y, h);
+            multiply(level->serial, h, x, h, y, h, &slot[SLOT_P5*h*h], h, next);
+            break;
+        case 5:
+            addScaled(h, q->a[1][0], lda, q->a[1][1], lda, 1, x, h);
+            addScaled(h, x, h, q->a[0][0], lda, -1, x, h);
+            addScaled(h, q->b[0][1], ldb, q->b[0][0], ldb, -1, y, h);
+            addScaled(h, q->b[1][1], ldb, y, h, -1, y, h);
+            multiply(level->serial, h, x, h, y, h, &slot[SLOT_P6*h*h], h, next);
+            break;
+        default:
+            addScaled(h, q->a[0][0], lda, q->a[1][0], lda, -1, x, h);
+            addScaled(h, q->b[1][1], ldb, q->b[0][1], ldb, -1, y, h);
+            multiply(level->serial, h, x, h, y, h, &slot[SLOT_P7*h*h], h, next);
+            break;
+    }
+}
+
+// Combine the seven products of a block of rows into the four quadrants of c
+static void combineTask(void* ctx, const size_t task, const size_t worker){
+    (void)worker;
+    const struct ParallelLevel* level = ctx;
+    const struct Quadrants* q = level->q;
+    const size_t h = q->h;
+    const size_t ldc = q->ldc;
+    const double* const p5 = &level->workspace[SLOT_P5*h*h];
+    const double* const p6 = &level->workspace[SLOT_P6*h*h];
+    const double* const p7 = &level->workspace[SLOT_P7*h*h];
+    const size_t start = task*level->rowsPerTask;
+    const size_t end = start + level->rowsPerTask < h ? start + level->rowsPerTask : h;
+    for (size_t i = start; i < end; ++i){
+        double* const c11 = &q->c[0][0][i*ldc];
+        double* const c12 = &q->c[0][1][i*ldc];
+        double* const c21 = &q->c[1][0][i*ldc];
+        double* const c22 = &q->c[1][1][i*ldc];
+        for (size_t j = 0; j < h; ++j){
+            const double p1 = c11[j];
+            const double u2 = p1 + p6[i*h + j];
+            const double u3 = u2 + p7[i*h + j];
+            c11[j] = p1 + c12[j];
+            c12[j] = u2 + p5[i*h + j] + c21[j];
+            c21[j] = u3 - c22[j];
+            c22[j] = u3 + p5[i*h + j];
+        }
+    }
+}
+
+static void winogradParallel(const struct Strassen* const s, const struct Quadrants* const q, double* const workspace){
+    const struct Strassen serial = {.crossover = s->crossover, .workers = 1};
+    struct ParallelLevel level = {
+        .serial = &serial,
+        .q = q,
+        .workspace = workspace,
+        .childWorkspace = workspaceSize(q->h, s->crossover, 1),
+        .rowsPerTask = (q->h + 4*s->workers - 1)/(4*s->workers),
+    };
+    threadPoolRun(s->workers, MAX_PARALLEL_PRODUCTS, productTask, &level);
+    threadPoolRun(s->workers, (q->h + level.rowsPerTask - 1)/level.rowsPerTask, combineTask, &level);
+}
+
+static void multiply(const struct Strassen* const s, const size_t n, const double* const a, const size_t lda, const double* const b, const size_t ldb, double* const c, const size_t ldc, double* const workspace){
+    if (n <= s->crossover){
+        gemmStrided(n, n, n, 1.0, a, lda, 1, b, ldb, 1, 0.0, c, ldc, s->workers);
+        return;
+    }
+    const size_t even = n & ~(size_t)1;
+    const struct Quadrants q = quadrants(even/2, a, lda, b, ldb, c, ldc);
+    if (parallelProducts(s->workers)){
+        winogradParallel(s, &q, workspace);
+    } else {
+        winogradSerial(s, &q, workspace);
+    }
+    if (even == n) return;
+    // Peel the last row and column: C11 += a12*b21 with a12 a column and b21 a row, then the last column and row of c
+    gemmStrided(even, even, 1, 1.0, &a[even], lda, 1, &b[even*ldb], ldb, 1, 1.0, c, ldc, s->workers);
+    gemmStrided(n, 1, n, 1.0, a, lda, 1, &b[even], ldb, 1, 0.0, &c[even], ldc, s->workers);
+    gemmStrided(1, even, n, 1.0, &a[even*lda], lda, 1, b, ldb, 1, 0.0, &c[even*ldc], ldc, s->workers);
+}
+
+static size_t effectiveCrossover(const size_t crossover){
+    if (crossover == 0) return DEFAULT_CROSSOVER;
+    return crossover < MIN_CROSSOVER ? MIN_CROSSOVER : crossover;
+}
+
+/*
+ * res = a*b for size x size row major matrices with Strassen-Winograd, recursing until the products are at most
+ * crossover large (zero picks a default). threadCount limits the amount of pool threads, zero uses all of them.
+ * The result is less accurate than the one of the O(n^3) kernels, see matmulStrassenErrorBound.
+ */
+void matmulStrassen(const double* const a, const double* const b, double* const res, const size_t size, const size_t crossover, const size_t threadCount){
+    size_t workers = threadCount == 1 ? 1 : threadPoolSize();
+    if (threadCount != 0 && threadCount < workers) workers = threadCount;
+    const struct Strassen s = {
+        .crossover = effectiveCrossover(crossover),
+        .workers = workers,
+    };
+    const size_t elements = workspaceSize(size, s.crossover, workers);
+    double* workspace = NULL;
+    if (elements > 0){
+        workspace = arenaAlloc(elements*sizeof(double));
+    }
+    multiply(&s, size, a, size, b, size, res, size, workspace);
+    arenaRelease(workspace);
+}
+
+/*
+ * The first order bound on max|res - a*b| of matmulStrassen, with normA and normB the largest absolute values of
+ * a and b: ((n/n0)^log2(18)*(n0^2 + 6*n0) - 6*n)*u*normA*normB for leaves of size n0 and the unit roundoff u
+ * (Higham, Accuracy and Stability of Numerical Algorithms, chapter 23). For a crossover of at least size this is
+ * n^2*u*normA*normB, the bound of matmulNaive, so the ratio of the two is the accuracy given up for speed.
+ */
+double matmulStrassenErrorBound(const size_t size, const size_t crossover, const double normA, const double normB){
+    const size_t leafLimit = effectiveCrossover(crossover);
+    size_t leaf = size;
+    double levels = 0;
+    while (leaf > leafLimit){
+        leaf /= 2;
+        levels += 1;
+    }
+    const double n0 = leaf;
+    const double growth = pow(18, levels)*(n0*n0 + 6*n0) - 6*(double)size;
+    return growth*(DBL_EPSILON/2)*normA*normB;
+}
@@ -0,0 +1,143 @@
+#include <threadpool.h>
+#include <gemm.h>
+#include <arena.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Symmetric rank k updates, c = alpha*a*a^T + beta*c, which only need one triangle of c. The triangle is cut into
+ * square tiles and every tile on or below (above) the diagonal is one task for the pool, so all tasks are the same
+ * size and the threads stay balanced however the triangle is shaped. A tile is one serial packed GEMM that reads a
+ * for both operands through strides, diagonal tiles go through a scratch tile of which only the triangle is kept.
+ */
+
+// Largest tile edge, tiles shrink down to MIN_TILE until there are a few tasks for every thread
+#define MAX_TILE 256
+#define MIN_TILE 64
+#define TASKS_PER_THREAD 4
+
+struct SyrkJob {
+    bool upper;
+    size_t n;
+    size_t k;
+    double alpha;
+    const double* a;
+    // op(a)(i, p) = a[i*rsa + p*csa]
+    size_t rsa;
+    size_t csa;
+    double beta;
+    double* c;
+    size_t ldc;
+    bool mirror;
+    size_t tile;
+    size_t tiles;
+    // One tile x tile scratch for every worker, for the diagonal tiles
+    double* scratch;
+};
+
+// Tile pair number task of the lower triangle, row by row: (0, 0), (1, 0), (1, 1), (2, 0), ...
+static void tilePair(const size_t task, size_t* const row, size_t* const col){
+    size_t r = 0;
+    while ((r + 1)*(r + 2)/2 <= task) ++r;
+    *row = r;
+    *col = task - r*(r + 1)/2;
+}
+
+static void syrkTask(void* s, const size_t task, const size_t worker){
+    const struct SyrkJob* const job = s;
+    size_t tileRow, tileCol;
+    tilePair(task, &tileRow, &tileCol);
+    // The upper triangle is the lower one of c^T, so its tile pairs are mirrored
+    if (job->upper){
+        const size_t swap = tileRow;
+        tileRow = tileCol;
+        tileCol = swap;
+    }
+    const size_t i0 = tileRow*job->tile;
+    const size_t j0 = tileCol*job->tile;
+    const size_t rows = job->n - i0 < job->tile ? job->n - i0 : job->tile;
+    const size_t cols = job->n - j0 < job->tile ? job->n - j0 : job->tile;
+    const double* const ai = &job->a[i0*job->rsa];
+    const double* const aj = &job->a[j0*job->rsa];
+    double* const c = job->c;
+    const size_t ldc = job->ldc;
+    if (tileRow != tileCol){
+        // b(p, j) = op(a)(j0 + j, p)
+        gemmStrided(rows, cols, job->k, job->alpha, ai, job->rsa, job->csa, aj, job->csa, job->rsa, job->beta, &c[i0*ldc + j0], ldc, 1);
+        if (job->mirror){
+            for (size_t i = 0; i < rows; ++i){
+                for (size_t j = 0; j < cols; ++j){
+                    c[(j0 + j)*ldc + i0 + i] = c[(i0 + i)*ldc + j0 + j];
+                }
+            }
+        }
+        return;
+    }
+    double* const scratch = &job->scratch[worker*job->tile*job->tile];
+    gemmStrided(rows, rows, job->k, job->alpha, ai, job->rsa, job->csa, ai, job->csa, job->rsa, 0.0, scratch, rows, 1);
+    for (size_t i = 0; i < rows; ++i){
+        const size_t first = job->upper ? i : 0;
+        const size_t last = job->upper ? rows : i + 1;
+        double* const row = &c[(i0 + i)*ldc + i0];
+        for (size_t j = first; j < last; ++j){
+            row[j] = job->beta == 0 ? scratch[i*rows + j] : scratch[i*rows + j] + job->beta*row[j];
+        }
+    }
+    if (job->mirror){
+        for (size_t i = 0; i < rows; ++i){
+            for (size_t j = i + 1; j < rows; ++j){
+                if (job->upper){
+                    c[(i0 + j)*ldc + i0 + i] = c[(i0 + i)*ldc + i0 + j];
+                } else {
+                    c[(i0 + i)*ldc + i0 + j] = c[(i0 + j)*ldc + i0 + i];
+                }
+            }
+        }
+    }
+}
+
+/*
+ * c = alpha*op(a)*op(a)^T + beta*c for a row major n x n c, with op(a) = a (n x k) or, when trans is set,
+ * op(a) = a^T (a is k x n). Only the upper or the lower triangle of c, diagonal included, is read and written.
+ * mirror copies it into the other triangle afterwards, which then holds the full symmetric result whatever it held
+ * before. When beta is zero c is not read. threadCount limits the amount of pool threads, zero uses all of them.
+ */
+void matmulSyrk(const bool upper, const bool trans, const size_t n, const size_t k, const double alpha, const double* const a, const size_t lda,
+        const double beta, double* const c, const size_t ldc, const bool mirror, const size_t threadCount){
+    if (lda < (trans ? n : k) || lda == 0 || ldc < n || ldc == 0){
+        fprintf(stderr, "%s: lda %zu or ldc %zu is too small for n = %zu and k = %zu\n", __func__, lda, ldc, n, k);
+        exit(1);
+    }
+    if (n == 0) return;
+    const size_t workers = threadCount == 0 || threadCount > threadPoolSize() ? threadPoolSize() : threadCount;
+    struct SyrkJob job = {
+        .upper = upper,
+        .n = n,
+        .k = k,
+        .alpha = alpha,
+        .a = a,
+        .rsa = trans ? 1 : lda,
+        .csa = trans ? lda : 1,
+        .beta = beta,
+        .c = c,
+        .ldc = ldc,
+        .mirror = mirror,
+        .tile = MAX_TILE,
+    };
+    for (;;){
+        job.tiles = (n + job.tile - 1)/job.tile;
+        if (job.tile <= MIN_TILE || job.tiles*(job.tiles + 1)/2 >= TASKS_PER_THREAD*workers) break;
+        job.tile /= 2;
+    }
+    job.scratch = arenaAlloc(workers*job.tile*job.tile*sizeof(double));
+    threadPoolRun(workers, job.tiles*(job.tiles + 1)/2, syrkTask, &job);
+    arenaRelease(job.scratch);
+}
+
+/*
+ * res = a*a^T for a row major size x size a, the full symmetric result from one triangle of work.
+ */
+void matmulGram(const double* const a, double* const res, const size_t size, const size_t threadCount){
+    matmulSyrk(false, false, size, size, 1.0, a, size, 0.0, res, size, true, threadCount);
+}
@@ -0,0 +1,110 @@
+#include <prepacked.h>
+#include <transpose.h>
+#include <threadpool.h>
+#include <topology.h>
+#include <arena.h>
+#include <stats.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ALIGNMENT 64
+// Bytes of a replica one copy task writes
+#define REPLICATE_CHUNK ((size_t)1 << 20)
+
+struct Prepacked* prepackedAlloc(const enum PrepackedLayout layout, const size_t rows, const size_t columns, const size_t elements, const size_t threadCount){
+    struct Prepacked* prepacked = malloc(sizeof(struct Prepacked));
+    size_t bytes = elements*sizeof(double);
+    bytes = (bytes + ALIGNMENT - 1) & ~((size_t)ALIGNMENT - 1);
+    if (bytes == 0) bytes = ALIGNMENT;
+    if (prepacked == NULL){
+        fprintf(stderr, "Failed to allocate a prepacked matrix of %zu bytes\n", bytes);
+        exit(1);
+    }
+    prepacked->layout = layout;
+    prepacked->rows = rows;
+    prepacked->columns = columns;
+    prepacked->bytes = bytes;
+    prepacked->replicas = NULL;
+    prepacked->replicaCount = 0;
+    const size_t nodes = threadPoolNodeCount(threadCount);
+    if (nodes == 1){
+        prepacked->data = arenaAlloc(bytes);
+        return prepacked;
+    }
+    // Every worker reads all of b, so one copy is spread over the nodes and a replicated one is placed per node
+    const bool replicate = threadPoolNuma() == POOL_NUMA_REPLICATE;
+    prepacked->replicaCount = replicate ? nodes : 1;
+    prepacked->replicas = malloc(prepacked->replicaCount*sizeof(double*));
+    if (prepacked->replicas == NULL){
+        fprintf(stderr, "Failed to allocate a prepacked matrix of %zu bytes\n", bytes);
+        exit(1);
+    }
+    for (size_t i = 0; i < prepacked->replicaCount; ++i){
+        prepacked->replicas[i] = replicate ? topologyAlloc(bytes, i) : topologyAllocInterleaved(bytes, nodes);
+    }
+    prepacked->data = prepacked->replicas[0];
+    return prepacked;
+}
+
+static void replicateTask(void* s, const size_t task, const size_t worker){
+    (void)worker;
+    const struct Prepacked* prepacked = s;
+    const size_t chunks = (prepacked->bytes + REPLICATE_CHUNK - 1)/REPLICATE_CHUNK;
+    const size_t start = (task % chunks)*REPLICATE_CHUNK;
+    const size_t bytes = prepacked->bytes - start < REPLICATE_CHUNK ? prepacked->bytes - start : REPLICATE_CHUNK;
+    memcpy((char*)prepacked->replicas[1 + task/chunks] + start, (const char*)prepacked->data + start, bytes);
+}
+
+void prepackedReplicate(struct Prepacked* const prepacked){
+    if (prepacked->replicaCount < 2) return;
+    const size_t chunks = (prepacked->bytes + REPLICATE_CHUNK - 1)/REPLICATE_CHUNK;
+    threadPoolRun(0, chunks*(prepacked->replicaCount - 1), replicateTask, prepacked);
+}
+
+double* prepackedData(const struct Prepacked* const prepacked, const size_t worker){
+    if (prepacked->replicaCount < 2) return prepacked->data;
+    const size_t node = threadPoolWorkerNode(worker);
+    return prepacked->replicas[node < prepacked->replicaCount ? node : 0];
+}
+
+void prepackedCheck(const struct Prepacked* const prepacked, const enum PrepackedLayout layout, const size_t rows, const size_t columns, const char* const caller){
+    if (prepacked == NULL){
+        fprintf(stderr, "%s: the prepacked matrix is NULL\n", caller);
+        exit(1);
+    }
+    if (prepacked->layout != layout){
+        fprintf(stderr, "%s: the prepacked matrix was packed for a different kernel\n", caller);
+        exit(1);
+    }
+    if (prepacked->rows != rows || prepacked->columns != columns){
+        fprintf(stderr, "%s: the prepacked matrix is %zu x %zu, expected %zu x %zu\n", caller, prepacked->rows, prepacked->columns, rows, columns);
+        exit(1);
+    }
+}
+
+struct Prepacked* prepackedTranspose(const double* const b, const size_t size, const size_t threadCount){
+    struct Prepacked* prepacked = prepackedAlloc(PREPACKED_TRANSPOSED, size, size, size*size, threadCount);
+    const double start = statsStart();
+    transposeRun(size, size, b, size, prepacked->data, size, threadCount);
+    prepackedReplicate(prepacked);
+    statsStop(MATMUL_PHASE_TRANSPOSE, start);
+    return prepacked;
+}
+
+struct Prepacked* matmulPrepackB(const double* const b, const size_t size){
+    return prepackedTranspose(b, size, 0);
+}
+
+void matmulFreePrepacked(struct Prepacked* const prepacked){
+    if (prepacked == NULL) return;
+    if (prepacked->replicas != NULL){
+        for (size_t i = 0; i < prepacked->replicaCount; ++i){
+            topologyFree(prepacked->replicas[i], prepacked->bytes);
+        }
+        free(prepacked->replicas);
+    } else {
+        arenaRelease(prepacked->data);
+    }
+    free(prepacked);
+}
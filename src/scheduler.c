@@ -0,0 +1,186 @@
+#include <scheduler.h>
+#include <threadpool.h>
+#include <gemm.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Jobs with fewer multiply-adds than this (a 128 x 128 x 128 product) are too short to spread over the pool
+#define SMALL_WORK ((double)(1 << 21))
+
+struct MatmulJob {
+    bool colMajor;
+    bool transA;
+    bool transB;
+    size_t m;
+    size_t n;
+    size_t k;
+    double alpha;
+    const double* a;
+    size_t lda;
+    const double* b;
+    size_t ldb;
+    double beta;
+    double* c;
+    size_t ldc;
+    // Set under queueLock once c is ready
+    bool done;
+    struct MatmulJob* next;
+};
+
+struct Round {
+    struct MatmulJob** jobs;
+};
+
+static pthread_once_t dispatcherOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t queueLock = PTHREAD_MUTEX_INITIALIZER;
+// queuedCond wakes the dispatcher, doneCond the callers waiting for their jobs
+static pthread_cond_t queuedCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t doneCond = PTHREAD_COND_INITIALIZER;
+// Queued jobs in submission order
+static struct MatmulJob* head = NULL;
+static struct MatmulJob* tail = NULL;
+
+static void runJob(const struct MatmulJob* const job, const size_t threadCount){
+    matmulDgemm(job->colMajor, job->transA, job->transB, job->m, job->n, job->k, job->alpha, job->a, job->lda, job->b, job->ldb,
+        job->beta, job->c, job->ldc, threadCount);
+}
+
+static void finishJob(struct MatmulJob* const job){
+    pthread_mutex_lock(&queueLock);
+    job->done = true;
+    pthread_cond_broadcast(&doneCond);
+    pthread_mutex_unlock(&queueLock);
+}
+
+// One job of a round on one thread, it is finished right away so its caller does not wait for the rest of the round
+static void jobTask(void* s, const size_t task, const size_t worker){
+    (void)worker;
+    const struct Round* const round = s;
+    runJob(round->jobs[task], 1);
+    finishJob(round->jobs[task]);
+}
+
+static bool smallJob(const struct MatmulJob* const job){
+    return (double)job->m*(double)job->n*(double)job->k < SMALL_WORK;
+}
+
+/*
+ * Run the jobs that were queued at the start of a round. Small ones go first, as one pool run, so that they are not
+ * held up behind large ones. Within each class the jobs keep their submission order.
+ */
+static void runRound(struct MatmulJob* const first, const size_t count, struct MatmulJob** const jobs){
+    const size_t workers = threadPoolSize();
+    size_t smallCount = 0;
+    for (struct MatmulJob* job = first; job != NULL; job = job->next){
+        if (smallJob(job)) jobs[smallCount++] = job;
+    }
+    size_t largeCount = 0;
+    for (struct MatmulJob* job = first; job != NULL; job = job->next){
+        if (!smallJob(job)) jobs[smallCount + largeCount++] = job;
+    }
+    // Enough large jobs to give every thread one of its own, which saves the synchronization inside each product
+    const size_t batched = largeCount >= workers ? count : smallCount;
+    struct Round round = {
+        .jobs = jobs,
+    };
+    if (batched > 0) threadPoolRun(0, batched, jobTask, &round);
+    for (size_t i = batched; i < count; ++i){
+        runJob(jobs[i], 0);
+        finishJob(jobs[i]);
+    }
+}
+
+static void* dispatch(void* unused){
+    (void)unused;
+    struct MatmulJob** jobs = NULL;
+    size_t capacity = 0;
+    for (;;){
+        pthread_mutex_lock(&queueLock);
+        while (head == NULL) pthread_cond_wait(&queuedCond, &queueLock);
+        struct MatmulJob* const first = head;
+        head = NULL;
+        tail = NULL;
+        pthread_mutex_unlock(&queueLock);
+        size_t count = 0;
+        for (const struct MatmulJob* job = first; job != NULL; job = job->next) ++count;
+        if (count > capacity){
+            capacity = count > 2*capacity ? count : 2*capacity;
+            jobs = realloc(jobs, capacity*sizeof(struct MatmulJob*));
+            if (jobs == NULL){
+                fprintf(stderr, "Failed to allocate a round of %zu jobs\n", count);
+                exit(1);
+            }
+        }
+        runRound(first, count, jobs);
+    }
+    return NULL;
+}
+
+static void startDispatcher(void){
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, dispatch, NULL) != 0){
+        fprintf(stderr, "Failed to start the job dispatcher thread\n");
+        exit(1);
+    }
+    pthread_detach(thread);
+}
+
+struct MatmulJob* matmulSubmitDgemm(const bool colMajor, const bool transA, const bool transB, const size_t m, const size_t n, const size_t k,
+        const double alpha, const double* const a, const size_t lda, const double* const b, const size_t ldb, const double beta,
+        double* const c, const size_t ldc){
+    pthread_once(&dispatcherOnce, startDispatcher);
+    struct MatmulJob* const job = malloc(sizeof(struct MatmulJob));
+    if (job == NULL){
+        fprintf(stderr, "Failed to allocate a job\n");
+        exit(1);
+    }
+    *job = (struct MatmulJob){
+        .colMajor = colMajor,
+        .transA = transA,
+        .transB = transB,
+        .m = m,
+        .n = n,
+        .k = k,
+        .alpha = alpha,
+        .a = a,
+        .lda = lda,
+        .b = b,
+        .ldb = ldb,
+        .beta = beta,
+        .c = c,
+        .ldc = ldc,
+        .done = false,
+        .next = NULL,
+    };
+    pthread_mutex_lock(&queueLock);
+    if (tail == NULL){
+        head = job;
+    } else {
+        tail->next = job;
+    }
+    tail = job;
+    pthread_cond_signal(&queuedCond);
+    pthread_mutex_unlock(&queueLock);
+    return job;
+}
+
+struct MatmulJob* matmulSubmit(const double* const a, const double* const b, double* const res, const size_t size){
+    const size_t ld = size > 0 ? size : 1;
+    return matmulSubmitDgemm(false, false, false, size, size, size, 1.0, a, ld, b, ld, 0.0, res, ld);
+}
+
+bool matmulJobDone(const struct MatmulJob* const job){
+    pthread_mutex_lock(&queueLock);
+    const bool done = job->done;
+    pthread_mutex_unlock(&queueLock);
+    return done;
+}
+
+void matmulJobWait(struct MatmulJob* const job){
+    if (job == NULL) return;
+    pthread_mutex_lock(&queueLock);
+    while (!job->done) pthread_cond_wait(&doneCond, &queueLock);
+    pthread_mutex_unlock(&queueLock);
+    free(job);
+}
@@ -1,15 +1,291 @@
-#include <stdlib.h>
+#include <sort.h>
+#include <threadpool.h>
+#include <cpu.h>
+#include <stdbool.h>
 #include <stdio.h>
-#include <time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+// Inputs shorter than this are merge sorted from runs of 8, longer ones radix sorted
+#define RADIX_MIN 2048
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_PASSES (32/RADIX_BITS)
+// Runs the sorting network or the insertion sort leaves for the merges
+#define RUN 8
+// Inputs shorter than this are sorted on one thread
+#define PARALLEL_MIN 65536
+// Pieces of every merge round for each thread, more than one evens out the work
+#define PIECES_PER_THREAD 4
+
+/*
+ * Keys and, for the pair sorts, values that move with them. values is NULL for the key only sorts.
+ */
+struct SortArrays {
+    int32_t* keys;
+    int32_t* values;
+};
+
+static inline struct SortArrays offsetArrays(const struct SortArrays arrays, const size_t offset){
+    return (struct SortArrays){
+        .keys = arrays.keys + offset,
+        .values = arrays.values != NULL ? arrays.values + offset : NULL,
+    };
+}
+
+// The order of the unsigned keys is that of the signed ones
+static inline uint32_t radixKey(const int32_t key){
+    return (uint32_t)key ^ 0x80000000u;
+}
+
+/*
+ * Stable LSD radix sort of data, with scratch of the same length. The counts of all passes are taken in one read,
+ * and a pass whose byte is the same for all keys is skipped.
+ */
+static void radixSort(const struct SortArrays data, const struct SortArrays scratch, const size_t n){
+    size_t counts[RADIX_PASSES][RADIX_BUCKETS] = {{0}};
+    for (size_t i = 0; i < n; ++i){
+        const uint32_t key = radixKey(data.keys[i]);
+        for (size_t d = 0; d < RADIX_PASSES; ++d){
+            ++counts[d][(key >> (d*RADIX_BITS)) & (RADIX_BUCKETS - 1)];
+        }
+    }
+    struct SortArrays src = data;
+    struct SortArrays dst = scratch;
+    for (size_t d = 0; d < RADIX_PASSES; ++d){
+        const size_t shift = d*RADIX_BITS;
+        if (counts[d][(radixKey(src.keys[0]) >> shift) & (RADIX_BUCKETS - 1)] == n) continue;
+        size_t offsets[RADIX_BUCKETS];
+        size_t sum = 0;
+        for (size_t b = 0; b < RADIX_BUCKETS; ++b){
+            offsets[b] = sum;
+            sum += counts[d][b];
+        }
+        for (size_t i = 0; i < n; ++i){
+            const size_t position = offsets[(radixKey(src.keys[i]) >> shift) & (RADIX_BUCKETS - 1)]++;
+            dst.keys[position] = src.keys[i];
+            if (src.values != NULL) dst.values[position] = src.values[i];
+        }
+        const struct SortArrays swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if (src.keys != data.keys){
+        memcpy(data.keys, src.keys, n*sizeof(int32_t));
+        if (data.values != NULL) memcpy(data.values, src.values, n*sizeof(int32_t));
+    }
+}
+
+// Stable, for the runs the network does not cover
+static void insertionSort(const struct SortArrays data, const size_t n){
+    for (size_t i = 1; i < n; ++i){
+        const int32_t key = data.keys[i];
+        const int32_t value = data.values != NULL ? data.values[i] : 0;
+        size_t j = i;
+        for (; j > 0 && data.keys[j - 1] > key; --j){
+            data.keys[j] = data.keys[j - 1];
+            if (data.values != NULL) data.values[j] = data.values[j - 1];
+        }
+        data.keys[j] = key;
+        if (data.values != NULL) data.values[j] = value;
+    }
+}
+
+// Stable merge of a (na) and b (nb) into out, a wins ties
+static void merge(const struct SortArrays a, const size_t na, const struct SortArrays b, const size_t nb, const struct SortArrays out){
+    size_t i = 0, j = 0, o = 0;
+    while (i < na && j < nb){
+        const bool takeA = a.keys[i] <= b.keys[j];
+        out.keys[o] = takeA ? a.keys[i] : b.keys[j];
+        if (out.values != NULL) out.values[o] = takeA ? a.values[i] : b.values[j];
+        i += takeA;
+        j += !takeA;
+        ++o;
+    }
+    memcpy(&out.keys[o], &a.keys[i], (na - i)*sizeof(int32_t));
+    memcpy(&out.keys[o + na - i], &b.keys[j], (nb - j)*sizeof(int32_t));
+    if (out.values != NULL){
+        memcpy(&out.values[o], &a.values[i], (na - i)*sizeof(int32_t));
+        memcpy(&out.values[o + na - i], &b.values[j], (nb - j)*sizeof(int32_t));
+    }
+}
+
+/*
+ * Merge sort from runs of RUN: blocks of 64 keys go through the sorting network, everything else is insertion sorted
+ * RUN at a time.
+ */
+static void mergeSort(const struct SortArrays data, const struct SortArrays scratch, const size_t n){
+    size_t sorted = 0;
+    if (data.values == NULL && cpuIsa() >= ISA_AVX2){
+        sortRunsAvx2(data.keys, n/64);
+        sorted = n/64*64;
+    }
+    for (size_t start = sorted; start < n; start += RUN){
+        insertionSort(offsetArrays(data, start), n - start < RUN ? n - start : RUN);
+    }
+    struct SortArrays src = data;
+    struct SortArrays dst = scratch;
+    for (size_t width = RUN; width < n; width *= 2){
+        for (size_t start = 0; start < n; start += 2*width){
+            const size_t na = n - start < width ? n - start : width;
+            const size_t nb = n - start - na < width ? n - start - na : width;
+            merge(offsetArrays(src, start), na, offsetArrays(src, start + na), nb, offsetArrays(dst, start));
+        }
+        const struct SortArrays swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if (src.keys != data.keys){
+        memcpy(data.keys, src.keys, n*sizeof(int32_t));
+        if (data.values != NULL) memcpy(data.values, src.values, n*sizeof(int32_t));
+    }
+}
+
+static void sortSerial(const struct SortArrays data, const struct SortArrays scratch, const size_t n){
+    if (n < 2) return;
+    if (n < RADIX_MIN){
+        mergeSort(data, scratch, n);
+    } else {
+        radixSort(data, scratch, n);
+    }
+}
+
+struct SortJob {
+    struct SortArrays data;
+    struct SortArrays scratch;
+    size_t size;
+    // Sorted runs of this length are merged in pairs
+    size_t width;
+    size_t piecesPerPair;
+    // The round reads src and writes dst
+    struct SortArrays src;
+    struct SortArrays dst;
+};
+
+static void chunkTask(void* s, const size_t task, const size_t worker){
+    (void)worker;
+    const struct SortJob* const job = s;
+    const size_t start = task*job->width;
+    if (start >= job->size) return;
+    const size_t length = job->size - start < job->width ? job->size - start : job->width;
+    sortSerial(offsetArrays(job->data, start), offsetArrays(job->scratch, start), length);
+}
+
+/*
+ * How many of the first o outputs of the stable merge of a and b come from a: the smallest i for which a[i] does not
+ * belong before b[o - i - 1].
+ */
+static size_t mergePath(const int32_t* const a, const size_t na, const int32_t* const b, const size_t nb, const size_t o){
+    size_t low = o > nb ? o - nb : 0;
+    size_t high = o < na ? o : na;
+    while (low < high){
+        const size_t i = low + (high - low)/2;
+        if (a[i] <= b[o - i - 1]){
+            low = i + 1;
+        } else {
+            high = i;
+        }
+    }
+    return low;
+}
+
+// One piece of the merge of a pair of runs, the outputs [begin, end) of that merge
+static void mergeTask(void* s, const size_t task, const size_t worker){
+    (void)worker;
+    const struct SortJob* const job = s;
+    const size_t start = (task/job->piecesPerPair)*2*job->width;
+    if (start >= job->size) return;
+    const size_t na = job->size - start < job->width ? job->size - start : job->width;
+    const size_t nb = job->size - start - na < job->width ? job->size - start - na : job->width;
+    const size_t pieceLength = (na + nb + job->piecesPerPair - 1)/job->piecesPerPair;
+    const size_t piece = task % job->piecesPerPair;
+    const size_t begin = piece*pieceLength < na + nb ? piece*pieceLength : na + nb;
+    const size_t end = begin + pieceLength < na + nb ? begin + pieceLength : na + nb;
+    if (begin == end) return;
+    const struct SortArrays a = offsetArrays(job->src, start);
+    const struct SortArrays b = offsetArrays(job->src, start + na);
+    const size_t ia = mergePath(a.keys, na, b.keys, nb, begin);
+    const size_t ja = mergePath(a.keys, na, b.keys, nb, end);
+    merge(offsetArrays(a, ia), ja - ia, offsetArrays(b, begin - ia), (end - ja) - (begin - ia), offsetArrays(job->dst, start + begin));
+}
+
+static void copyTask(void* s, const size_t task, const size_t worker){
+    (void)worker;
+    const struct SortJob* const job = s;
+    const size_t start = task*job->width;
+    if (start >= job->size) return;
+    const size_t length = job->size - start < job->width ? job->size - start : job->width;
+    memcpy(&job->data.keys[start], &job->scratch.keys[start], length*sizeof(int32_t));
+    if (job->data.values != NULL) memcpy(&job->data.values[start], &job->scratch.values[start], length*sizeof(int32_t));
+}
+
+static int32_t* allocScratch(const size_t size){
+    int32_t* scratch = malloc((size > 0 ? size : 1)*sizeof(int32_t));
+    if (scratch == NULL){
+        fprintf(stderr, "Failed to allocate %zu bytes of sort scratch\n", size*sizeof(int32_t));
+        exit(1);
+    }
+    return scratch;
+}
+
+static void sortArrays(const struct SortArrays data, const size_t size, const size_t threadCount){
+    if (size < 2) return;
+    size_t workers = threadCount == 1 ? 1 : threadPoolSize();
+    if (threadCount != 0 && threadCount < workers) workers = threadCount;
+    struct SortJob job = {
+        .data = data,
+        .scratch = {
+            .keys = allocScratch(size),
+            .values = data.values != NULL ? allocScratch(size) : NULL,
+        },
+        .size = size,
+    };
+    if (workers == 1 || size < PARALLEL_MIN){
+        sortSerial(data, job.scratch, size);
+    } else {
+        const size_t chunks = workers;
+        job.width = (size + chunks - 1)/chunks;
+        threadPoolRun(workers, chunks, chunkTask, &job);
+        job.src = data;
+        job.dst = job.scratch;
+        for (; job.width < size; job.width *= 2){
+            const size_t pairs = (size + 2*job.width - 1)/(2*job.width);
+            job.piecesPerPair = (PIECES_PER_THREAD*workers + pairs - 1)/pairs;
+            threadPoolRun(workers, pairs*job.piecesPerPair, mergeTask, &job);
+            const struct SortArrays swap = job.src;
+            job.src = job.dst;
+            job.dst = swap;
+        }
+        if (job.src.keys != data.keys){
+            job.width = (size + PIECES_PER_THREAD*workers - 1)/(PIECES_PER_THREAD*workers);
+            threadPoolRun(workers, PIECES_PER_THREAD*workers, copyTask, &job);
+        }
+    }
+    free(job.scratch.keys);
+    free(job.scratch.values);
+}
+
+void sortInt32(int32_t* const keys, const size_t size, const size_t threadCount){
+    sortArrays((struct SortArrays){.keys = keys}, size, threadCount);
+}
+
+void sortInt32Pairs(int32_t* const keys, int32_t* const values, const size_t size, const size_t threadCount){
+    sortArrays((struct SortArrays){.keys = keys, .values = values}, size, threadCount);
+}
 
-static int compare(const void* val1, const void* val2){
-    const int32_t a = *((int32_t*)val1);
-    const int32_t b = *((int32_t*)val2);
-    if (a > b) return 1;
-    else if (a < b) return -1;
-    else return 0;
+void argsortInt32(const int32_t* const keys, int32_t* const indices, const size_t size, const size_t threadCount){
+    if (size > (size_t)INT32_MAX){
+        fprintf(stderr, "%s: %zu keys do not fit int32 indices\n", __func__, size);
+        exit(1);
+    }
+    int32_t* copy = allocScratch(size);
+    memcpy(copy, keys, size*sizeof(int32_t));
+    for (size_t i = 0; i < size; ++i) indices[i] = (int32_t)i;
+    sortInt32Pairs(copy, indices, size, threadCount);
+    free(copy);
 }
 
-void sortList(int32_t* list, const size_t size){
-    qsort((void*)list, size, sizeof(int32_t), compare);
+void sortList(int32_t* const list, const size_t size){
+    sortInt32(list, size, 0);
 }
@@ -0,0 +1,49 @@
+#include <sort.h>
+#include <immintrin.h>
+#include <stdint.h>
+
+/*
+ * The sorting network of sort.c. The 64 keys of a block are 8 registers of 8 lanes. The optimal 19 comparator
+ * network for 8 inputs, applied to whole registers with min and max, sorts every lane across the registers, and
+ * an 8 x 8 transpose turns the sorted lanes into sorted rows.
+ */
+
+#define COEX(x, y) do { \
+        const __m256i low = _mm256_min_epi32(x, y); \
+        y = _mm256_max_epi32(x, y); \
+        x = low; \
+    } while (0)
+
+static inline void transpose8(__m256i r[8]){
+    __m256i t[8], u[8];
+    for (int i = 0; i < 4; ++i){
+        t[2*i] = _mm256_unpacklo_epi32(r[2*i], r[2*i + 1]);
+        t[2*i + 1] = _mm256_unpackhi_epi32(r[2*i], r[2*i + 1]);
+    }
+    for (int i = 0; i < 2; ++i){
+        u[4*i] = _mm256_unpacklo_epi64(t[4*i], t[4*i + 2]);
+        u[4*i + 1] = _mm256_unpackhi_epi64(t[4*i], t[4*i + 2]);
+        u[4*i + 2] = _mm256_unpacklo_epi64(t[4*i + 1], t[4*i + 3]);
+        u[4*i + 3] = _mm256_unpackhi_epi64(t[4*i + 1], t[4*i + 3]);
+    }
+    for (int i = 0; i < 4; ++i){
+        r[i] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+        r[i + 4] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+    }
+}
+
+void sortRunsAvx2(int32_t* const keys, const size_t blocks){
+    for (size_t b = 0; b < blocks; ++b){
+        __m256i* const block = (__m256i*)&keys[64*b];
+        __m256i r[8];
+        for (int i = 0; i < 8; ++i) r[i] = _mm256_loadu_si256(&block[i]);
+        COEX(r[0], r[2]); COEX(r[1], r[3]); COEX(r[4], r[6]); COEX(r[5], r[7]);
+        COEX(r[0], r[4]); COEX(r[1], r[5]); COEX(r[2], r[6]); COEX(r[3], r[7]);
+        COEX(r[0], r[1]); COEX(r[2], r[3]); COEX(r[4], r[5]); COEX(r[6], r[7]);
+        COEX(r[2], r[4]); COEX(r[3], r[5]);
+        COEX(r[1], r[4]); COEX(r[3], r[6]);
+        COEX(r[1], r[2]); COEX(r[3], r[4]); COEX(r[5], r[6]);
+        transpose8(r);
+        for (int i = 0; i < 8; ++i) _mm256_storeu_si256(&block[i], r[i]);
+    }
+}
@@ -0,0 +1,63 @@
+#include <spmm.h>
+#include <immintrin.h>
+#include <stdint.h>
+
+/*
+ * The AVX2 + FMA row kernel of matmul_spmm.c. A strip of 32 columns of one row of res lives in 8 ymm accumulators
+ * while the blocks of the row stream the matching strips of b, narrower remainders take one register at a time and
+ * the last 1 to 3 columns a masked load.
+ */
+
+#define STRIP 32
+#define STRIP_VECTORS (STRIP/4)
+
+// The entries of row i of the blocks, entry q of block p multiplies row indices[p]*blockCols + q of b
+#define SPMM_ENTRIES(body) \
+    for (size_t p = 0; p < count; ++p){ \
+        const double* const values = &data[(p*blockRows + i)*blockCols]; \
+        const double* const rows = &b[(size_t)indices[p]*blockCols*ldb]; \
+        for (size_t q = 0; q < blockCols; ++q){ \
+            const __m256d x = _mm256_set1_pd(values[q]); \
+            const double* const row = &rows[q*ldb]; \
+            body \
+        } \
+    }
+
+void spmmRowAvx2(const size_t count, const int32_t* const indices, const double* const data, const size_t blockRows, const size_t blockCols,
+        const double* const b, const size_t ldb, const size_t n, double* const res, const size_t ldr){
+    const __m256i masks[4] = {
+        _mm256_setr_epi64x(0, 0, 0, 0),
+        _mm256_setr_epi64x(-1, 0, 0, 0),
+        _mm256_setr_epi64x(-1, -1, 0, 0),
+        _mm256_setr_epi64x(-1, -1, -1, 0),
+    };
+    for (size_t i = 0; i < blockRows; ++i){
+        double* const out = &res[i*ldr];
+        size_t j = 0;
+        for (; j + STRIP <= n; j += STRIP){
+            __m256d acc[STRIP_VECTORS];
+            for (size_t v = 0; v < STRIP_VECTORS; ++v) acc[v] = _mm256_setzero_pd();
+            SPMM_ENTRIES(
+                for (size_t v = 0; v < STRIP_VECTORS; ++v){
+                    acc[v] = _mm256_fmadd_pd(x, _mm256_loadu_pd(&row[j + 4*v]), acc[v]);
+                }
+            )
+            for (size_t v = 0; v < STRIP_VECTORS; ++v) _mm256_storeu_pd(&out[j + 4*v], acc[v]);
+        }
+        for (; j + 4 <= n; j += 4){
+            __m256d acc = _mm256_setzero_pd();
+            SPMM_ENTRIES(
+                acc = _mm256_fmadd_pd(x, _mm256_loadu_pd(&row[j]), acc);
+            )
+            _mm256_storeu_pd(&out[j], acc);
+        }
+        if (j < n){
+            const __m256i mask = masks[n - j];
+            __m256d acc = _mm256_setzero_pd();
+            SPMM_ENTRIES(
+                acc = _mm256_fmadd_pd(x, _mm256_maskload_pd(&row[j], mask), acc);
+            )
+            _mm256_maskstore_pd(&out[j], mask, acc);
+        }
+    }
+}
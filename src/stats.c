@@ -0,0 +1,157 @@
+#include <stats.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+_Thread_local struct MatmulStats* statsActive = NULL;
+
+static _Thread_local struct MatmulStats* sectionStats = NULL;
+static _Thread_local double sectionStart;
+static _Thread_local uint64_t sectionCounters[MATMUL_COUNTER_COUNT];
+
+/*
+ * The counters of a thread are opened the first time it is measured and stay open until it exits, so a section
+ * costs a read per counter and not a system call to set them up.
+ */
+struct ThreadCounters {
+    bool opened;
+    int fds[MATMUL_COUNTER_COUNT];
+};
+
+static _Thread_local struct ThreadCounters threadCounters;
+static pthread_key_t counterKey;
+static pthread_once_t counterKeyOnce = PTHREAD_ONCE_INIT;
+
+static const char* const phaseNames[MATMUL_PHASE_COUNT] = {
+    "transpose", "clear", "pack", "compute", "threads", "device upload", "device kernel", "device download",
+};
+
+static const char* const counterNames[MATMUL_COUNTER_COUNT] = {
+    "cycles", "instructions", "llc misses", "fp ops",
+};
+
+const char* matmulPhaseName(const enum MatmulPhase phase){
+    return phase < MATMUL_PHASE_COUNT ? phaseNames[phase] : "unknown";
+}
+
+const char* matmulCounterName(const enum MatmulCounter counter){
+    return counter < MATMUL_COUNTER_COUNT ? counterNames[counter] : "unknown";
+}
+
+double statsNow(void){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+// Several threads add to one struct, so doubles are added with a compare and swap on their bits
+static void addDouble(double* const target, const double value){
+    double old;
+    __atomic_load(target, &old, __ATOMIC_RELAXED);
+    double sum = old + value;
+    while (!__atomic_compare_exchange(target, &old, &sum, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+        sum = old + value;
+    }
+}
+
+void statsAdd(struct MatmulStats* const stats, const enum MatmulPhase phase, const double seconds){
+    addDouble(&stats->phaseSeconds[phase], seconds);
+}
+
+void statsAddWorker(struct MatmulStats* const stats, const size_t worker, const double seconds, const size_t tasks){
+    if (worker >= MATMUL_STATS_MAX_WORKERS) return;
+    addDouble(&stats->workerSeconds[worker], seconds);
+    __atomic_fetch_add(&stats->workerTasks[worker], tasks, __ATOMIC_RELAXED);
+    size_t count = __atomic_load_n(&stats->workerCount, __ATOMIC_RELAXED);
+    while (count < worker + 1 && !__atomic_compare_exchange_n(&stats->workerCount, &count, worker + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+    }
+}
+
+static void closeCounters(void* s){
+    struct ThreadCounters* counters = s;
+    for (size_t i = 0; i < MATMUL_COUNTER_COUNT; ++i){
+        if (counters->fds[i] >= 0) close(counters->fds[i]);
+        counters->fds[i] = -1;
+    }
+}
+
+static void createCounterKey(void){
+    pthread_key_create(&counterKey, closeCounters);
+}
+
+static int openCounter(const uint32_t type, const uint64_t config){
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    // User space only, which most perf_event_paranoid settings allow without privileges
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void openCounters(struct ThreadCounters* const counters){
+    counters->opened = true;
+    counters->fds[MATMUL_COUNTER_CYCLES] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    counters->fds[MATMUL_COUNTER_INSTRUCTIONS] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    counters->fds[MATMUL_COUNTER_LLC_MISSES] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    counters->fds[MATMUL_COUNTER_FP_OPS] = -1;
+    const char* env = getenv("MATMUL_PERF_FP_EVENT");
+    if (env != NULL && env[0] != 0) counters->fds[MATMUL_COUNTER_FP_OPS] = openCounter(PERF_TYPE_RAW, strtoull(env, NULL, 16));
+    pthread_once(&counterKeyOnce, createCounterKey);
+    pthread_setspecific(counterKey, counters);
+}
+
+/*
+ * UINT64_MAX marks a counter that could not be read. Counters that had to share the hardware with others are scaled
+ * up to the whole time they were enabled.
+ */
+void statsReadCounters(uint64_t values[MATMUL_COUNTER_COUNT]){
+    struct ThreadCounters* const counters = &threadCounters;
+    if (!counters->opened) openCounters(counters);
+    for (size_t i = 0; i < MATMUL_COUNTER_COUNT; ++i){
+        uint64_t data[3];
+        if (counters->fds[i] < 0 || read(counters->fds[i], data, sizeof(data)) != (ssize_t)sizeof(data)){
+            values[i] = UINT64_MAX;
+            continue;
+        }
+        values[i] = data[2] > 0 && data[2] < data[1] ? (uint64_t)((double)data[0]*data[1]/data[2]) : data[0];
+    }
+}
+
+void statsAddCounters(struct MatmulStats* const stats, const uint64_t begin[MATMUL_COUNTER_COUNT]){
+    uint64_t end[MATMUL_COUNTER_COUNT];
+    statsReadCounters(end);
+    for (size_t i = 0; i < MATMUL_COUNTER_COUNT; ++i){
+        if (begin[i] == UINT64_MAX || end[i] == UINT64_MAX) continue;
+        __atomic_fetch_add(&stats->counters[i], end[i] - begin[i], __ATOMIC_RELAXED);
+        __atomic_store_n(&stats->counterValid[i], true, __ATOMIC_RELAXED);
+    }
+}
+
+void matmulStatsBegin(struct MatmulStats* const stats){
+    if (sectionStats != NULL){
+        fprintf(stderr, "%s: a stats section is already active on this thread\n", __func__);
+        exit(1);
+    }
+    memset(stats, 0, sizeof(struct MatmulStats));
+    sectionStats = stats;
+    statsReadCounters(sectionCounters);
+    sectionStart = statsNow();
+    statsActive = stats;
+}
+
+void matmulStatsEnd(void){
+    if (sectionStats == NULL) return;
+    statsActive = NULL;
+    sectionStats->seconds = statsNow() - sectionStart;
+    statsAddCounters(sectionStats, sectionCounters);
+    sectionStats = NULL;
+}
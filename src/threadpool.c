@@ -0,0 +1,344 @@
+#define _GNU_SOURCE
+#include <threadpool.h>
+#include <topology.h>
+#include <stats.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * The range of task indices still owned by one participant, packed as next (low 32 bits) and end (high 32 bits) so
+ * that the owner taking the front and a thief taking the back can both be done with a single compare and swap.
+ * Padded to a cache line so that the participants do not false share.
+ */
+struct WorkRange {
+    _Atomic uint64_t range;
+    char padding[64 - sizeof(uint64_t)];
+};
+
+// Held for a whole run, and to stop or resize the pool, which must not happen under a run
+static pthread_mutex_t runLock = PTHREAD_MUTEX_INITIALIZER;
+// Guards the layout of the pool (started, poolSize, numaMode, workerNodes), which changes only with it held. The
+// queries below take it alone so that setting up a call does not wait for the run of another caller.
+static pthread_mutex_t initLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t stateLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t doneCond = PTHREAD_COND_INITIALIZER;
+
+static bool started = false;
+static bool stopping = false;
+static size_t poolSize = 1;
+static pthread_t* threads;
+static struct WorkRange* ranges;
+static enum PoolNuma numaMode = POOL_NUMA_OFF;
+// The node every worker is pinned to, all zero when the workers are not pinned
+static size_t* workerNodes;
+static uint64_t startGeneration;
+static uint64_t generation = 0;
+static size_t pending;
+
+static PoolTask jobFn;
+static void* jobCtx;
+static size_t jobThreads;
+// The stats section of the thread that issued the run, NULL outside of one
+static struct MatmulStats* jobStats;
+
+static _Thread_local bool insidePool = false;
+
+static inline uint64_t packRange(const uint64_t next, const uint64_t end){
+    return next | (end << 32);
+}
+
+static bool popTask(const size_t self, size_t* const task){
+    uint64_t old = atomic_load_explicit(&ranges[self].range, memory_order_relaxed);
+    for (;;){
+        const uint64_t next = old & 0xFFFFFFFF;
+        const uint64_t end = old >> 32;
+        if (next >= end) return false;
+        if (atomic_compare_exchange_weak(&ranges[self].range, &old, packRange(next + 1, end))){
+            *task = next;
+            return true;
+        }
+    }
+}
+
+static bool stealTask(const size_t self, size_t* const task){
+    for (size_t i = 1; i < jobThreads; ++i){
+        const size_t victim = (self + i) % jobThreads;
+        uint64_t old = atomic_load_explicit(&ranges[victim].range, memory_order_relaxed);
+        for (;;){
+            const uint64_t next = old & 0xFFFFFFFF;
+            const uint64_t end = old >> 32;
+            if (next >= end) break;
+            const uint64_t newEnd = end - (end - next + 1)/2;
+            if (atomic_compare_exchange_weak(&ranges[victim].range, &old, packRange(next, newEnd))){
+                atomic_store(&ranges[self].range, packRange(newEnd + 1, end));
+                *task = newEnd;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static void work(const size_t self){
+    size_t task;
+    if (jobStats == NULL){
+        while (popTask(self, &task) || stealTask(self, &task)){
+            jobFn(jobCtx, task, self);
+        }
+        return;
+    }
+    const double start = statsNow();
+    size_t tasks = 0;
+    while (popTask(self, &task) || stealTask(self, &task)){
+        jobFn(jobCtx, task, self);
+        ++tasks;
+    }
+    statsAddWorker(jobStats, self, statsNow() - start, tasks);
+}
+
+// A run on the calling thread alone, which is worker 0
+static void runSerial(const size_t taskCount, const PoolTask fn, void* const ctx){
+    const double start = !insidePool && statsActive != NULL ? statsNow() : 0;
+    for (size_t i = 0; i < taskCount; ++i) fn(ctx, i, 0);
+    if (!insidePool && statsActive != NULL) statsAddWorker(statsActive, 0, statsNow() - start, taskCount);
+}
+
+static void* poolThread(void* arg){
+    const size_t self = (size_t)(uintptr_t)arg;
+    insidePool = true;
+    pthread_mutex_lock(&stateLock);
+    uint64_t seen = startGeneration;
+    for (;;){
+        while (generation == seen && !stopping) pthread_cond_wait(&wakeCond, &stateLock);
+        if (stopping) break;
+        seen = generation;
+        if (self >= jobThreads) continue;
+        pthread_mutex_unlock(&stateLock);
+        // The counters of the calling thread are read by its section, the ones of the pool threads per run
+        uint64_t counters[MATMUL_COUNTER_COUNT];
+        struct MatmulStats* const stats = jobStats;
+        if (stats != NULL) statsReadCounters(counters);
+        work(self);
+        if (stats != NULL) statsAddCounters(stats, counters);
+        pthread_mutex_lock(&stateLock);
+        if (--pending == 0) pthread_cond_signal(&doneCond);
+    }
+    pthread_mutex_unlock(&stateLock);
+    return NULL;
+}
+
+static size_t defaultPoolSize(void){
+    const char* env = getenv("MATMUL_NUM_THREADS");
+    if (env != NULL){
+        const long count = strtol(env, NULL, 10);
+        if (count > 0) return (size_t)count;
+    }
+    const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (size_t)cores : 1;
+}
+
+static enum PoolNuma readNumaMode(void){
+    const char* env = getenv("MATMUL_NUMA");
+    if (env == NULL || env[0] == 0 || strcmp(env, "off") == 0) return POOL_NUMA_OFF;
+    if (strcmp(env, "pin") == 0) return POOL_NUMA_PIN;
+    if (strcmp(env, "replicate") == 0) return POOL_NUMA_REPLICATE;
+    fprintf(stderr, "MATMUL_NUMA=%s is unknown, expected off, pin or replicate. The workers are not pinned\n", env);
+    return POOL_NUMA_OFF;
+}
+
+// Worker i runs on the i-th cpu of the topology order, so the workers fill one node before the next
+static void pinThread(const pthread_t thread, const size_t worker){
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(topologyCpu(worker), &set);
+    // Pinning is only a placement hint, a worker that could not be pinned still computes correct results
+    pthread_setaffinity_np(thread, sizeof(set), &set);
+}
+
+// Called with initLock held, and with runLock as well when it replaces a running pool. A pool that is not started
+// has no run to disturb.
+static void startPool(size_t coreCount){
+    poolSize = coreCount == 0 ? defaultPoolSize() : coreCount;
+    numaMode = readNumaMode();
+    ranges = aligned_alloc(64, poolSize*sizeof(struct WorkRange));
+    threads = malloc(poolSize*sizeof(pthread_t));
+    workerNodes = malloc(poolSize*sizeof(size_t));
+    if (ranges == NULL || threads == NULL || workerNodes == NULL){
+        fprintf(stderr, "Failed to allocate the thread pool\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < poolSize; ++i){
+        workerNodes[i] = numaMode == POOL_NUMA_OFF ? 0 : topologyCpuNode(i);
+    }
+    startGeneration = generation;
+    for (size_t i = 1; i < poolSize; ++i){
+        if (pthread_create(&threads[i], NULL, poolThread, (void*)(uintptr_t)i) != 0){
+            fprintf(stderr, "Failed to create pool thread %zu\n", i);
+            exit(1);
+        }
+        if (numaMode != POOL_NUMA_OFF) pinThread(threads[i], i);
+    }
+    started = true;
+}
+
+// Called with runLock and initLock held
+static void stopPool(void){
+    if (!started) return;
+    pthread_mutex_lock(&stateLock);
+    stopping = true;
+    pthread_cond_broadcast(&wakeCond);
+    pthread_mutex_unlock(&stateLock);
+    for (size_t i = 1; i < poolSize; ++i){
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    free(ranges);
+    free(workerNodes);
+    stopping = false;
+    started = false;
+    poolSize = 1;
+}
+
+static void lockStarted(void){
+    pthread_mutex_lock(&initLock);
+    if (!started) startPool(0);
+}
+
+void threadPoolInit(size_t coreCount){
+    pthread_mutex_lock(&runLock);
+    pthread_mutex_lock(&initLock);
+    stopPool();
+    startPool(coreCount);
+    pthread_mutex_unlock(&initLock);
+    pthread_mutex_unlock(&runLock);
+}
+
+void threadPoolShutdown(void){
+    pthread_mutex_lock(&runLock);
+    pthread_mutex_lock(&initLock);
+    stopPool();
+    pthread_mutex_unlock(&initLock);
+    pthread_mutex_unlock(&runLock);
+}
+
+size_t threadPoolSize(void){
+    if (insidePool) return 1;
+    lockStarted();
+    const size_t size = poolSize;
+    pthread_mutex_unlock(&initLock);
+    return size;
+}
+
+void threadPoolRun(size_t threadCount, const size_t taskCount, const PoolTask fn, void* const ctx){
+    if (taskCount == 0) return;
+    if (taskCount > UINT32_MAX){
+        fprintf(stderr, "Too many tasks for one pool run: %zu\n", taskCount);
+        exit(1);
+    }
+    if (insidePool || threadCount == 1 || taskCount == 1){
+        runSerial(taskCount, fn, ctx);
+        return;
+    }
+    struct MatmulStats* const stats = statsActive;
+    const double start = stats != NULL ? statsNow() : 0;
+    pthread_mutex_lock(&runLock);
+    // The layout can only change under runLock once the pool is started, so the run reads it without initLock
+    lockStarted();
+    pthread_mutex_unlock(&initLock);
+    if (threadCount == 0 || threadCount > poolSize) threadCount = poolSize;
+    if (threadCount > taskCount) threadCount = taskCount;
+    if (threadCount == 1){
+        pthread_mutex_unlock(&runLock);
+        runSerial(taskCount, fn, ctx);
+        return;
+    }
+    const size_t tasksPerThread = taskCount/threadCount;
+    size_t rest = taskCount % threadCount;
+    size_t lastEnd = 0;
+    for (size_t i = 0; i < threadCount; ++i){
+        size_t count = tasksPerThread;
+        if (rest > 0){
+            count++;
+            rest--;
+        }
+        atomic_store(&ranges[i].range, packRange(lastEnd, lastEnd + count));
+        lastEnd += count;
+    }
+    jobFn = fn;
+    jobCtx = ctx;
+    jobStats = stats;
+    pthread_mutex_lock(&stateLock);
+    jobThreads = threadCount;
+    pending = threadCount - 1;
+    generation++;
+    pthread_cond_broadcast(&wakeCond);
+    pthread_mutex_unlock(&stateLock);
+
+    // The calling thread is worker 0, so it runs on the cpu of worker 0 for the duration of the run
+    cpu_set_t callerCpus;
+    const bool pinCaller = numaMode != POOL_NUMA_OFF && pthread_getaffinity_np(pthread_self(), sizeof(callerCpus), &callerCpus) == 0;
+    if (pinCaller) pinThread(pthread_self(), 0);
+    if (stats != NULL) statsAdd(stats, MATMUL_PHASE_THREADS, statsNow() - start);
+    insidePool = true;
+    work(0);
+    insidePool = false;
+    if (pinCaller) pthread_setaffinity_np(pthread_self(), sizeof(callerCpus), &callerCpus);
+
+    pthread_mutex_lock(&stateLock);
+    while (pending != 0) pthread_cond_wait(&doneCond, &stateLock);
+    pthread_mutex_unlock(&stateLock);
+    pthread_mutex_unlock(&runLock);
+}
+
+enum PoolNuma threadPoolNuma(void){
+    // Runs from inside a task are serial on one thread
+    if (insidePool) return POOL_NUMA_OFF;
+    lockStarted();
+    const enum PoolNuma mode = numaMode;
+    pthread_mutex_unlock(&initLock);
+    return mode;
+}
+
+size_t threadPoolNodeCount(size_t threadCount){
+    if (insidePool) return 1;
+    lockStarted();
+    if (threadCount == 0 || threadCount > poolSize) threadCount = poolSize;
+    size_t nodes = 1;
+    for (size_t i = 0; i < threadCount; ++i){
+        if (workerNodes[i] + 1 > nodes) nodes = workerNodes[i] + 1;
+    }
+    pthread_mutex_unlock(&initLock);
+    return nodes;
+}
+
+size_t threadPoolNodeMap(const size_t threadCount, size_t* const nodes){
+    if (insidePool){
+        for (size_t i = 0; i < threadCount; ++i) nodes[i] = 0;
+        return 1;
+    }
+    lockStarted();
+    size_t spanned = 1;
+    for (size_t i = 0; i < threadCount; ++i){
+        nodes[i] = i < poolSize ? workerNodes[i] : 0;
+        if (nodes[i] + 1 > spanned) spanned = nodes[i] + 1;
+    }
+    pthread_mutex_unlock(&initLock);
+    return spanned;
+}
+
+size_t threadPoolWorkerNode(const size_t worker){
+    // Inside a task the run holds runLock, so the pool cannot be resized and the map is read as is
+    if (insidePool) return worker < poolSize ? workerNodes[worker] : 0;
+    lockStarted();
+    const size_t node = worker < poolSize ? workerNodes[worker] : 0;
+    pthread_mutex_unlock(&initLock);
+    return node;
+}
@@ -0,0 +1,192 @@
+#define _GNU_SOURCE
+#include <topology.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// The memory policies of linux/mempolicy.h, so that neither libnuma nor its headers are needed
+#define MPOL_PREFERRED 1
+#define MPOL_INTERLEAVE 3
+// Node ids above this are ignored
+#define MAX_NODES 1024
+#define MASK_WORDS (MAX_NODES/(8*sizeof(unsigned long)))
+
+static pthread_once_t detectOnce = PTHREAD_ONCE_INIT;
+static size_t nodeCount = 1;
+static int nodeIds[MAX_NODES];
+static size_t cpuCount = 0;
+static int* cpus;
+static size_t* cpuNodes;
+
+// Add the cpus of a sysfs list like "0-3,8,10-11" to set
+static void parseCpuList(const char* list, cpu_set_t* const set){
+    while (*list != 0 && *list != '\n'){
+        char* end;
+        const long first = strtol(list, &end, 10);
+        if (end == list) return;
+        long last = first;
+        list = end;
+        if (*list == '-'){
+            last = strtol(list + 1, &end, 10);
+            list = end;
+        }
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu){
+            if (cpu >= 0) CPU_SET(cpu, set);
+        }
+        if (*list == ',') ++list;
+    }
+}
+
+static bool readNodeCpus(const int id, cpu_set_t* const set){
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", id);
+    FILE* file = fopen(path, "r");
+    if (file == NULL) return false;
+    char list[4096];
+    const bool read = fgets(list, sizeof(list), file) != NULL;
+    fclose(file);
+    CPU_ZERO(set);
+    if (read) parseCpuList(list, set);
+    return read;
+}
+
+static int compareInts(const void* x, const void* y){
+    return *(const int*)x - *(const int*)y;
+}
+
+static void detect(void){
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0){
+        CPU_ZERO(&allowed);
+        const long online = sysconf(_SC_NPROCESSORS_ONLN);
+        for (long cpu = 0; cpu < (online > 0 ? online : 1) && cpu < CPU_SETSIZE; ++cpu) CPU_SET(cpu, &allowed);
+    }
+    // One more, for the cpu 0 fallback of an empty set
+    const size_t allowedCount = CPU_COUNT(&allowed) + 1;
+    cpus = malloc(allowedCount*sizeof(int));
+    cpuNodes = malloc(allowedCount*sizeof(size_t));
+    if (cpus == NULL || cpuNodes == NULL){
+        fprintf(stderr, "Failed to allocate the cpu topology\n");
+        exit(1);
+    }
+    int ids[MAX_NODES];
+    size_t idCount = 0;
+    DIR* dir = opendir("/sys/devices/system/node");
+    if (dir != NULL){
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL && idCount < MAX_NODES){
+            int id;
+            char rest;
+            if (sscanf(entry->d_name, "node%d%c", &id, &rest) == 1 && id >= 0 && id < MAX_NODES) ids[idCount++] = id;
+        }
+        closedir(dir);
+    }
+    qsort(ids, idCount, sizeof(int), compareInts);
+    cpu_set_t taken;
+    CPU_ZERO(&taken);
+    nodeCount = 0;
+    for (size_t i = 0; i < idCount; ++i){
+        cpu_set_t nodeCpus;
+        if (!readNodeCpus(ids[i], &nodeCpus)) continue;
+        CPU_AND(&nodeCpus, &nodeCpus, &allowed);
+        const size_t before = cpuCount;
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu){
+            if (!CPU_ISSET(cpu, &nodeCpus) || CPU_ISSET(cpu, &taken)) continue;
+            CPU_SET(cpu, &taken);
+            cpus[cpuCount] = cpu;
+            cpuNodes[cpuCount++] = nodeCount;
+        }
+        // Memory only nodes have no cpus to run a worker on
+        if (cpuCount > before) nodeIds[nodeCount++] = ids[i];
+    }
+    if (nodeCount == 0){
+        nodeIds[0] = 0;
+        nodeCount = 1;
+    }
+    // Cpus that sysfs does not list go to the first node
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu){
+        if (!CPU_ISSET(cpu, &allowed) || CPU_ISSET(cpu, &taken)) continue;
+        cpus[cpuCount] = cpu;
+        cpuNodes[cpuCount++] = 0;
+    }
+    if (cpuCount == 0){
+        cpus[0] = 0;
+        cpuNodes[0] = 0;
+        cpuCount = 1;
+    }
+}
+
+size_t topologyNodeCount(void){
+    pthread_once(&detectOnce, detect);
+    return nodeCount;
+}
+
+size_t topologyCpuCount(void){
+    pthread_once(&detectOnce, detect);
+    return cpuCount;
+}
+
+int topologyCpu(const size_t index){
+    pthread_once(&detectOnce, detect);
+    return cpus[index % cpuCount];
+}
+
+size_t topologyCpuNode(const size_t index){
+    pthread_once(&detectOnce, detect);
+    return cpuNodes[index % cpuCount];
+}
+
+static size_t pageBytes(const size_t bytes){
+    const long page = sysconf(_SC_PAGESIZE);
+    const size_t size = page > 0 ? (size_t)page : 4096;
+    const size_t rounded = (bytes + size - 1)/size*size;
+    return rounded > 0 ? rounded : size;
+}
+
+static void setPolicy(void* const ptr, const size_t length, const int mode, const size_t firstNode, const size_t nodes){
+    pthread_once(&detectOnce, detect);
+    if (nodeCount < 2) return;
+    unsigned long mask[MASK_WORDS] = {0};
+    for (size_t n = firstNode; n < firstNode + nodes && n < nodeCount; ++n){
+        const int id = nodeIds[n];
+        mask[id/(8*sizeof(unsigned long))] |= 1UL << (id % (8*sizeof(unsigned long)));
+    }
+    // The pages are not touched yet, so the policy decides where they are faulted in. A kernel without NUMA
+    // support refuses and leaves them to the default first touch placement.
+    syscall(SYS_mbind, ptr, length, mode, mask, (unsigned long)MAX_NODES + 1, 0);
+}
+
+static void* mapPlaced(const size_t bytes, const int mode, const size_t firstNode, const size_t nodes){
+    const size_t length = pageBytes(bytes);
+    void* ptr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED){
+        fprintf(stderr, "Failed to map %zu bytes of node local memory\n", length);
+        exit(1);
+    }
+    setPolicy(ptr, length, mode, firstNode, nodes);
+    return ptr;
+}
+
+void topologyPlace(void* const ptr, const size_t bytes, const size_t node){
+    setPolicy(ptr, bytes, MPOL_PREFERRED, node, 1);
+}
+
+void* topologyAlloc(const size_t bytes, const size_t node){
+    return mapPlaced(bytes, MPOL_PREFERRED, node, 1);
+}
+
+void* topologyAllocInterleaved(const size_t bytes, const size_t nodes){
+    return mapPlaced(bytes, MPOL_INTERLEAVE, 0, nodes > 0 ? nodes : 1);
+}
+
+void topologyFree(void* const ptr, const size_t bytes){
+    if (ptr == NULL) return;
+    munmap(ptr, pageBytes(bytes));
+}
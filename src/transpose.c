@@ -0,0 +1,248 @@
+#include <transpose.h>
+#include <threadpool.h>
+#include <stats.h>
+#include <cpu.h>
+#include <immintrin.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Side of the blocks of dst one task writes
+#define TASK_BLOCK 128
+// Blocks are halved until both sides are at most this, a 32 x 32 block of src and its transpose take 16 kB of L1
+#define LEAF 32
+// Side of the blocks whose mirrored pairs one in place task swaps
+#define SWAP_BLOCK 64
+
+struct TransposeJob {
+    const double* src;
+    size_t lds;
+    double* dst;
+    size_t ldd;
+    size_t rows;
+    size_t cols;
+    size_t rowBlocks;
+    bool avx;
+};
+
+struct SquareJob {
+    double* a;
+    size_t lda;
+    size_t size;
+    size_t blocks;
+    bool avx;
+};
+
+// Rows r0..r3 become the columns of the 4 x 4 block
+static TARGET_AVX inline void transpose4(__m256d* const r0, __m256d* const r1, __m256d* const r2, __m256d* const r3){
+    const __m256d t0 = _mm256_unpacklo_pd(*r0, *r1);
+    const __m256d t1 = _mm256_unpackhi_pd(*r0, *r1);
+    const __m256d t2 = _mm256_unpacklo_pd(*r2, *r3);
+    const __m256d t3 = _mm256_unpackhi_pd(*r2, *r3);
+    *r0 = _mm256_permute2f128_pd(t0, t2, 0x20);
+    *r1 = _mm256_permute2f128_pd(t1, t3, 0x20);
+    *r2 = _mm256_permute2f128_pd(t0, t2, 0x31);
+    *r3 = _mm256_permute2f128_pd(t1, t3, 0x31);
+}
+
+// dst[j*ldd + i] = src[i*lds + j] for i < rows and j < cols
+static void leafScalar(const double* const restrict src, const size_t lds, double* const restrict dst, const size_t ldd, const size_t rows, const size_t cols){
+    for (size_t i = 0; i < rows; ++i){
+        for (size_t j = 0; j < cols; ++j){
+            dst[j*ldd + i] = src[i*lds + j];
+        }
+    }
+}
+
+static TARGET_AVX void leafAvx(const double* const restrict src, const size_t lds, double* const restrict dst, const size_t ldd, const size_t rows, const size_t cols){
+    const size_t fullRows = rows & ~(size_t)3;
+    const size_t fullCols = cols & ~(size_t)3;
+    for (size_t i = 0; i < fullRows; i += 4){
+        for (size_t j = 0; j < fullCols; j += 4){
+            __m256d r0 = _mm256_loadu_pd(&src[i*lds + j]);
+            __m256d r1 = _mm256_loadu_pd(&src[(i + 1)*lds + j]);
+            __m256d r2 = _mm256_loadu_pd(&src[(i + 2)*lds + j]);
+            __m256d r3 = _mm256_loadu_pd(&src[(i + 3)*lds + j]);
+            transpose4(&r0, &r1, &r2, &r3);
+            _mm256_storeu_pd(&dst[j*ldd + i], r0);
+            _mm256_storeu_pd(&dst[(j + 1)*ldd + i], r1);
+            _mm256_storeu_pd(&dst[(j + 2)*ldd + i], r2);
+            _mm256_storeu_pd(&dst[(j + 3)*ldd + i], r3);
+        }
+    }
+    leafScalar(&src[fullCols], lds, &dst[fullCols*ldd], ldd, fullRows, cols - fullCols);
+    leafScalar(&src[fullRows*lds], lds, &dst[fullRows], ldd, rows - fullRows, cols);
+}
+
+// Halve the longer side, on a multiple of 4 so that the leaves keep whole register tiles
+static void transposeRecursive(const double* const src, const size_t lds, double* const dst, const size_t ldd, const size_t rows, const size_t cols, const bool avx){
+    if (rows <= LEAF && cols <= LEAF){
+        if (avx){
+            leafAvx(src, lds, dst, ldd, rows, cols);
+        } else {
+            leafScalar(src, lds, dst, ldd, rows, cols);
+        }
+        return;
+    }
+    if (rows >= cols){
+        const size_t half = (rows/2 + 3) & ~(size_t)3;
+        transposeRecursive(src, lds, dst, ldd, half, cols, avx);
+        transposeRecursive(&src[half*lds], lds, &dst[half], ldd, rows - half, cols, avx);
+    } else {
+        const size_t half = (cols/2 + 3) & ~(size_t)3;
+        transposeRecursive(src, lds, dst, ldd, rows, half, avx);
+        transposeRecursive(&src[half], lds, &dst[half*ldd], ldd, rows, cols - half, avx);
+    }
+}
+
+// One TASK_BLOCK square of dst, so that its pages are first touched by the worker that writes them
+static void transposeTask(void* s, const size_t task, const size_t worker){
+    (void)worker;
+    const struct TransposeJob* const job = s;
+    const size_t j = (task/job->rowBlocks)*TASK_BLOCK;
+    const size_t i = (task % job->rowBlocks)*TASK_BLOCK;
+    const size_t cols = job->cols - j < TASK_BLOCK ? job->cols - j : TASK_BLOCK;
+    const size_t rows = job->rows - i < TASK_BLOCK ? job->rows - i : TASK_BLOCK;
+    transposeRecursive(&job->src[i*job->lds + j], job->lds, &job->dst[j*job->ldd + i], job->ldd, rows, cols, job->avx);
+}
+
+void transposeRun(const size_t rows, const size_t cols, const double* const src, const size_t lds, double* const dst, const size_t ldd, const size_t threadCount){
+    if (rows == 0 || cols == 0) return;
+    if (lds < cols || ldd < rows){
+        fprintf(stderr, "Leading dimensions %zu and %zu are too small for a %zu x %zu transpose\n", lds, ldd, rows, cols);
+        exit(1);
+    }
+    struct TransposeJob job = {
+        .src = src,
+        .lds = lds,
+        .dst = dst,
+        .ldd = ldd,
+        .rows = rows,
+        .cols = cols,
+        .rowBlocks = (rows + TASK_BLOCK - 1)/TASK_BLOCK,
+        .avx = cpuIsa() >= ISA_AVX,
+    };
+    threadPoolRun(threadCount, job.rowBlocks*((cols + TASK_BLOCK - 1)/TASK_BLOCK), transposeTask, &job);
+}
+
+void matmulTranspose(const size_t rows, const size_t cols, const double* const src, const size_t lds, double* const dst, const size_t ldd, const size_t threadCount){
+    const double start = statsStart();
+    transposeRun(rows, cols, src, lds, dst, ldd, threadCount);
+    statsStop(MATMUL_PHASE_TRANSPOSE, start);
+}
+
+/*
+ * In place.
+ */
+
+// x[i*lda + j] <-> y[j*lda + i] for i < rows and j < cols, x and y are disjoint
+static void swapScalar(double* const restrict x, double* const restrict y, const size_t rows, const size_t cols, const size_t lda){
+    for (size_t i = 0; i < rows; ++i){
+        for (size_t j = 0; j < cols; ++j){
+            const double t = x[i*lda + j];
+            x[i*lda + j] = y[j*lda + i];
+            y[j*lda + i] = t;
+        }
+    }
+}
+
+static TARGET_AVX void swapAvx(double* const restrict x, double* const restrict y, const size_t rows, const size_t cols, const size_t lda){
+    const size_t fullRows = rows & ~(size_t)3;
+    const size_t fullCols = cols & ~(size_t)3;
+    for (size_t i = 0; i < fullRows; i += 4){
+        for (size_t j = 0; j < fullCols; j += 4){
+            __m256d x0 = _mm256_loadu_pd(&x[i*lda + j]);
+            __m256d x1 = _mm256_loadu_pd(&x[(i + 1)*lda + j]);
+            __m256d x2 = _mm256_loadu_pd(&x[(i + 2)*lda + j]);
+            __m256d x3 = _mm256_loadu_pd(&x[(i + 3)*lda + j]);
+            __m256d y0 = _mm256_loadu_pd(&y[j*lda + i]);
+            __m256d y1 = _mm256_loadu_pd(&y[(j + 1)*lda + i]);
+            __m256d y2 = _mm256_loadu_pd(&y[(j + 2)*lda + i]);
+            __m256d y3 = _mm256_loadu_pd(&y[(j + 3)*lda + i]);
+            transpose4(&x0, &x1, &x2, &x3);
+            transpose4(&y0, &y1, &y2, &y3);
+            _mm256_storeu_pd(&y[j*lda + i], x0);
+            _mm256_storeu_pd(&y[(j + 1)*lda + i], x1);
+            _mm256_storeu_pd(&y[(j + 2)*lda + i], x2);
+            _mm256_storeu_pd(&y[(j + 3)*lda + i], x3);
+            _mm256_storeu_pd(&x[i*lda + j], y0);
+            _mm256_storeu_pd(&x[(i + 1)*lda + j], y1);
+            _mm256_storeu_pd(&x[(i + 2)*lda + j], y2);
+            _mm256_storeu_pd(&x[(i + 3)*lda + j], y3);
+        }
+    }
+    swapScalar(&x[fullCols], &y[fullCols*lda], fullRows, cols - fullCols, lda);
+    swapScalar(&x[fullRows*lda], &y[fullRows], rows - fullRows, cols, lda);
+}
+
+static TARGET_AVX void diagonalAvx(double* const x, const size_t full, const size_t lda){
+    for (size_t i = 0; i < full; i += 4){
+        __m256d r0 = _mm256_loadu_pd(&x[i*lda + i]);
+        __m256d r1 = _mm256_loadu_pd(&x[(i + 1)*lda + i]);
+        __m256d r2 = _mm256_loadu_pd(&x[(i + 2)*lda + i]);
+        __m256d r3 = _mm256_loadu_pd(&x[(i + 3)*lda + i]);
+        transpose4(&r0, &r1, &r2, &r3);
+        _mm256_storeu_pd(&x[i*lda + i], r0);
+        _mm256_storeu_pd(&x[(i + 1)*lda + i], r1);
+        _mm256_storeu_pd(&x[(i + 2)*lda + i], r2);
+        _mm256_storeu_pd(&x[(i + 3)*lda + i], r3);
+        // The strip right of this tile with the one below it
+        if (i + 4 < full) swapAvx(&x[i*lda + i + 4], &x[(i + 4)*lda + i], 4, full - i - 4, lda);
+    }
+}
+
+// An n x n block on the diagonal, in place
+static void diagonalBlock(double* const x, const size_t n, const size_t lda, const bool avx){
+    const size_t full = avx ? n & ~(size_t)3 : 0;
+    if (full > 0) diagonalAvx(x, full, lda);
+    // The pairs that are not inside the whole 4 x 4 tiles
+    for (size_t i = 0; i < n; ++i){
+        for (size_t j = i < full ? full : i + 1; j < n; ++j){
+            const double t = x[i*lda + j];
+            x[i*lda + j] = x[j*lda + i];
+            x[j*lda + i] = t;
+        }
+    }
+}
+
+// Task t is the pair of blocks (bi, bj) with bi <= bj, counted row by row of the upper triangle
+static void squareTask(void* s, const size_t task, const size_t worker){
+    (void)worker;
+    const struct SquareJob* const job = s;
+    size_t bi = 0;
+    size_t rest = task;
+    while (rest >= job->blocks - bi){
+        rest -= job->blocks - bi;
+        ++bi;
+    }
+    const size_t bj = bi + rest;
+    const size_t i = bi*SWAP_BLOCK;
+    const size_t j = bj*SWAP_BLOCK;
+    const size_t rows = job->size - i < SWAP_BLOCK ? job->size - i : SWAP_BLOCK;
+    const size_t cols = job->size - j < SWAP_BLOCK ? job->size - j : SWAP_BLOCK;
+    if (bi == bj){
+        diagonalBlock(&job->a[i*job->lda + i], rows, job->lda, job->avx);
+    } else if (job->avx){
+        swapAvx(&job->a[i*job->lda + j], &job->a[j*job->lda + i], rows, cols, job->lda);
+    } else {
+        swapScalar(&job->a[i*job->lda + j], &job->a[j*job->lda + i], rows, cols, job->lda);
+    }
+}
+
+void matmulTransposeSquare(const size_t size, double* const a, const size_t lda, const size_t threadCount){
+    if (size == 0) return;
+    if (lda < size){
+        fprintf(stderr, "Leading dimension %zu is too small for a %zu x %zu transpose\n", lda, size, size);
+        exit(1);
+    }
+    const double start = statsStart();
+    struct SquareJob job = {
+        .a = a,
+        .lda = lda,
+        .size = size,
+        .blocks = (size + SWAP_BLOCK - 1)/SWAP_BLOCK,
+        .avx = cpuIsa() >= ISA_AVX,
+    };
+    threadPoolRun(threadCount, job.blocks*(job.blocks + 1)/2, squareTask, &job);
+    statsStop(MATMUL_PHASE_TRANSPOSE, start);
+}
@@ -0,0 +1,466 @@
+#include <tune.h>
+#include <threadpool.h>
+#include <stats.h>
+#include <gemm.h>
+#include <cpu.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*
+ * The profile is a text file. After a header naming the cpu it was measured on, every line is one measured shape:
+ *
+ *   kernel m n k threads isa mc kc nc tile use gflops
+ *
+ * threads is the amount the call could use and use the amount that was fastest. Lines starting with # are comments.
+ */
+
+#define DEFAULT_MAX_SIZE 1024
+#define MIN_SIZE 64
+// A candidate replaces the best one only when it is faster by this factor, so that noise does not pick the settings
+#define MIN_GAIN 1.02
+// A candidate is run until it took this long in total, but at least MIN_RUNS and at most MAX_RUNS times
+#define MIN_SECONDS 0.1
+#define MIN_RUNS 3
+#define MAX_RUNS 50
+// Block sizes are not searched beyond this
+#define MAX_BLOCK 16384
+
+struct TuneEntry {
+    enum TuneKernel kernel;
+    size_t m;
+    size_t n;
+    size_t k;
+    size_t threads;
+    struct TuneConfig config;
+    double gflops;
+};
+
+static const char* const kernelNames[] = {
+    [TUNE_DGEMM] = "dgemm",
+    [TUNE_SGEMM] = "sgemm",
+    [TUNE_I32GEMM] = "i32gemm",
+    [TUNE_I8GEMM] = "i8gemm",
+    [TUNE_SIMDMT] = "simdmt",
+};
+
+static pthread_once_t loadOnce = PTHREAD_ONCE_INIT;
+static pthread_rwlock_t profileLock = PTHREAD_RWLOCK_INITIALIZER;
+static struct TuneEntry* entries;
+static size_t entryCount;
+static pthread_once_t pathOnce = PTHREAD_ONCE_INIT;
+static char defaultPath[PATH_MAX];
+// The candidate being measured by matmulTune, which every lookup on its thread returns
+static _Thread_local const struct TuneConfig* forced;
+
+static void findDefaultPath(void){
+    defaultPath[0] = 0;
+    const char* env = getenv("MATMUL_TUNE_PROFILE");
+    if (env != NULL){
+        snprintf(defaultPath, sizeof(defaultPath), "%s", env);
+        return;
+    }
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char* s = cpuBrand(); *s != 0; ++s){
+        hash = (hash ^ (unsigned char)*s)*1099511628211ULL;
+    }
+    if (getenv("XDG_CACHE_HOME") != NULL && getenv("XDG_CACHE_HOME")[0] != 0){
+        snprintf(defaultPath, sizeof(defaultPath), "%s/matmul/tune-%016llx.profile", getenv("XDG_CACHE_HOME"), (unsigned long long)hash);
+    } else if (getenv("HOME") != NULL && getenv("HOME")[0] != 0){
+        snprintf(defaultPath, sizeof(defaultPath), "%s/.cache/matmul/tune-%016llx.profile", getenv("HOME"), (unsigned long long)hash);
+    }
+}
+
+const char* matmulTuneProfilePath(void){
+    pthread_once(&pathOnce, findDefaultPath);
+    return defaultPath;
+}
+
+static bool kernelFromName(const char* const name, enum TuneKernel* const kernel){
+    for (size_t i = 0; i < TUNE_KERNEL_COUNT; ++i){
+        if (strcmp(name, kernelNames[i]) != 0) continue;
+        *kernel = (enum TuneKernel)i;
+        return true;
+    }
+    return false;
+}
+
+static bool parseEntry(const char* const line, struct TuneEntry* const entry){
+    char kernel[16], isa[16];
+    *entry = (struct TuneEntry){0};
+    if (sscanf(line, "%15s %zu %zu %zu %zu %15s %zu %zu %zu %zu %zu %lf", kernel, &entry->m, &entry->n, &entry->k, &entry->threads, isa,
+            &entry->config.mc, &entry->config.kc, &entry->config.nc, &entry->config.tile, &entry->config.threads, &entry->gflops) != 12) return false;
+    const int level = cpuIsaFromName(isa);
+    if (!kernelFromName(kernel, &entry->kernel) || level < 0) return false;
+    entry->config.isa = (enum CpuIsa)level;
+    return entry->m > 0 && entry->n > 0 && entry->k > 0 && entry->threads > 0 && entry->config.mc <= MAX_BLOCK &&
+        entry->config.kc <= MAX_BLOCK && entry->config.nc <= MAX_BLOCK && entry->config.tile <= MAX_BLOCK;
+}
+
+// The entries of the profile at path, NULL when it cannot be read or was measured on another cpu
+static struct TuneEntry* readProfile(const char* const path, size_t* const count, const bool quiet){
+    *count = 0;
+    FILE* file = fopen(path, "r");
+    if (file == NULL){
+        if (!quiet) fprintf(stderr, "Warning: cannot read the tuning profile %s\n", path);
+        return NULL;
+    }
+    struct TuneEntry* read = NULL;
+    size_t capacity = 0;
+    bool cpuChecked = false;
+    char line[512];
+    for (size_t number = 1; fgets(line, sizeof(line), file) != NULL; ++number){
+        if (line[0] == '#' || line[0] == '\n') continue;
+        if (strncmp(line, "cpu ", 4) == 0){
+            line[strcspn(line, "\n")] = 0;
+            if (strcmp(line + 4, cpuBrand()) != 0){
+                fprintf(stderr, "Warning: the tuning profile %s was measured on %s, not on this %s, ignoring it\n", path, line + 4, cpuBrand());
+                break;
+            }
+            cpuChecked = true;
+            continue;
+        }
+        struct TuneEntry entry;
+        if (!cpuChecked || !parseEntry(line, &entry)){
+            fprintf(stderr, "Warning: ignoring line %zu of the tuning profile %s\n", number, path);
+            continue;
+        }
+        if (*count == capacity){
+            capacity = capacity > 0 ? 2*capacity : 64;
+            struct TuneEntry* grown = realloc(read, capacity*sizeof(struct TuneEntry));
+            if (grown == NULL){
+                fprintf(stderr, "Failed to allocate the tuning profile\n");
+                exit(1);
+            }
+            read = grown;
+        }
+        read[(*count)++] = entry;
+    }
+    fclose(file);
+    if (*count == 0){
+        free(read);
+        return NULL;
+    }
+    return read;
+}
+
+static void replaceProfile(struct TuneEntry* const loaded, const size_t count){
+    pthread_rwlock_wrlock(&profileLock);
+    struct TuneEntry* const old = entries;
+    entries = loaded;
+    entryCount = count;
+    pthread_rwlock_unlock(&profileLock);
+    free(old);
+}
+
+// A missing default profile is the normal untuned case and not worth a warning
+static void loadDefault(void){
+    const char* const path = matmulTuneProfilePath();
+    if (path[0] == 0) return;
+    size_t count;
+    struct TuneEntry* loaded = readProfile(path, &count, getenv("MATMUL_TUNE_PROFILE") == NULL);
+    replaceProfile(loaded, count);
+}
+
+size_t matmulTuneLoad(const char* path){
+    pthread_once(&loadOnce, loadDefault);
+    if (path == NULL) path = matmulTuneProfilePath();
+    size_t count = 0;
+    struct TuneEntry* loaded = path[0] != 0 ? readProfile(path, &count, false) : NULL;
+    replaceProfile(loaded, count);
+    return count;
+}
+
+// The larger of x/y and y/x, the product of these orders shapes like the sum of their log distances would
+static double ratio(const size_t x, const size_t y){
+    return x > y ? (double)x/y : (double)y/x;
+}
+
+bool tuneLookup(const enum TuneKernel kernel, const size_t m, const size_t n, const size_t k, const size_t threads, struct TuneConfig* const config){
+    if (forced != NULL){
+        *config = *forced;
+        return true;
+    }
+    pthread_once(&loadOnce, loadDefault);
+    pthread_rwlock_rdlock(&profileLock);
+    const struct TuneEntry* best = NULL;
+    double bestDistance = INFINITY;
+    const enum CpuIsa isa = cpuIsa();
+    for (size_t i = 0; i < entryCount; ++i){
+        const struct TuneEntry* const entry = &entries[i];
+        if (entry->kernel != kernel || entry->config.isa > isa) continue;
+        // The shape that is closest in relative terms, with the thread count as one more dimension
+        const double distance = ratio(m > 0 ? m : 1, entry->m)*ratio(n > 0 ? n : 1, entry->n)*ratio(k > 0 ? k : 1, entry->k)*
+            ratio(threads > 0 ? threads : 1, entry->threads);
+        if (distance < bestDistance){
+            best = entry;
+            bestDistance = distance;
+        }
+    }
+    if (best != NULL) *config = best->config;
+    pthread_rwlock_unlock(&profileLock);
+    return best != NULL;
+}
+
+/*
+ * The tuner.
+ */
+
+struct TuneProblem {
+    enum TuneKernel kernel;
+    size_t m;
+    size_t n;
+    size_t k;
+    size_t threads;
+    void* a;
+    void* b;
+    void* res;
+};
+
+static void runProblem(const struct TuneProblem* const p){
+    switch (p->kernel){
+        case TUNE_DGEMM:
+            matmulDgemm(false, false, false, p->m, p->n, p->k, 1.0, p->a, p->k, p->b, p->n, 0.0, p->res, p->n, p->threads);
+            break;
+        case TUNE_SGEMM:
+            matmulSgemm(false, false, false, p->m, p->n, p->k, 1.0f, p->a, p->k, p->b, p->n, 0.0f, p->res, p->n, p->threads);
+            break;
+        case TUNE_I32GEMM:
+            matmulGemmInt32(p->m, p->n, p->k, p->a, p->k, p->b, p->n, p->res, p->n, p->threads);
+            break;
+        case TUNE_I8GEMM:
+            matmulGemmInt8(p->m, p->n, p->k, p->a, p->k, p->b, p->n, p->res, p->n, p->threads);
+            break;
+        default:
+            matmulSIMDMT(p->a, p->b, p->res, p->m, p->threads);
+            break;
+    }
+}
+
+// Seconds of the fastest of several runs of p with config
+static double measure(const struct TuneProblem* const p, const struct TuneConfig* const config){
+    forced = config;
+    runProblem(p);
+    double best = INFINITY;
+    double total = 0;
+    for (size_t run = 0; run < MAX_RUNS && (run < MIN_RUNS || total < MIN_SECONDS); ++run){
+        const double start = statsNow();
+        runProblem(p);
+        const double seconds = statsNow() - start;
+        total += seconds;
+        if (seconds < best) best = seconds;
+    }
+    forced = NULL;
+    return best;
+}
+
+static void tryCandidate(const struct TuneProblem* const p, const struct TuneConfig* const candidate, struct TuneConfig* const best, double* const bestSeconds){
+    const double seconds = measure(p, candidate);
+    if (seconds*MIN_GAIN >= *bestSeconds) return;
+    *best = *candidate;
+    *bestSeconds = seconds;
+}
+
+// The blocking of the packed GEMM variant picked for isa, returns the name of that variant
+static const char* gemmDefaults(const enum TuneKernel kernel, const enum CpuIsa isa, struct TuneConfig* const config){
+    #define DEFAULTS(descriptor) config->mc = (descriptor)->mc, config->kc = (descriptor)->kc, config->nc = (descriptor)->nc, (descriptor)->name
+    config->isa = isa;
+    switch (kernel){
+        case TUNE_DGEMM: return DEFAULTS(gemmKernelFor(isa));
+        case TUNE_SGEMM: return DEFAULTS(sgemmKernelFor(isa));
+        case TUNE_I32GEMM: return DEFAULTS(i32gemmKernelFor(isa));
+        default: return DEFAULTS(i8gemmKernelFor(isa));
+    }
+    #undef DEFAULTS
+}
+
+// Halve a block size while that is faster, and if it was not, double it while that is faster
+static void searchBlock(const struct TuneProblem* const p, const size_t offset, const size_t dimension, struct TuneConfig* const best, double* const bestSeconds){
+    for (int direction = 0; direction < 2; ++direction){
+        bool improved = false;
+        for (;;){
+            struct TuneConfig candidate = *best;
+            size_t* const value = (size_t*)((char*)&candidate + offset);
+            if (direction == 0 ? *value < 16 : *value >= MAX_BLOCK || *value >= dimension) break;
+            *value = direction == 0 ? *value/2 : *value*2;
+            const double before = *bestSeconds;
+            tryCandidate(p, &candidate, best, bestSeconds);
+            if (*bestSeconds == before) break;
+            improved = true;
+        }
+        if (improved) break;
+    }
+}
+
+static struct TuneEntry tuneProblem(const struct TuneProblem* const p){
+    struct TuneConfig best = {.isa = cpuIsa(), .threads = p->threads};
+    const char* variant = p->kernel != TUNE_SIMDMT ? gemmDefaults(p->kernel, cpuIsa(), &best) : NULL;
+    double bestSeconds = measure(p, &best);
+    if (p->kernel == TUNE_SIMDMT){
+        for (size_t tile = 16; tile <= 256 && tile <= p->m; tile *= 2){
+            struct TuneConfig candidate = best;
+            candidate.tile = tile;
+            tryCandidate(p, &candidate, &best, &bestSeconds);
+        }
+    } else {
+        // The lower variants, which can win where the wider registers lower the clock or do not fill up
+        for (int isa = (int)cpuIsa() - 1; isa >= 0; --isa){
+            struct TuneConfig candidate = best;
+            const char* const lower = gemmDefaults(p->kernel, (enum CpuIsa)isa, &candidate);
+            if (lower != variant) tryCandidate(p, &candidate, &best, &bestSeconds);
+            variant = lower;
+        }
+        searchBlock(p, offsetof(struct TuneConfig, kc), p->k, &best, &bestSeconds);
+        searchBlock(p, offsetof(struct TuneConfig, mc), p->m, &best, &bestSeconds);
+        searchBlock(p, offsetof(struct TuneConfig, nc), p->n, &best, &bestSeconds);
+    }
+    // Small products can be faster on fewer threads than they may use
+    for (size_t threads = 1; threads < p->threads; threads *= 2){
+        struct TuneConfig candidate = best;
+        candidate.threads = threads;
+        tryCandidate(p, &candidate, &best, &bestSeconds);
+    }
+    return (struct TuneEntry){
+        .kernel = p->kernel,
+        .m = p->m,
+        .n = p->n,
+        .k = p->k,
+        .threads = p->threads,
+        .config = best,
+        .gflops = 2.0*p->m*p->n*p->k/bestSeconds*1e-9,
+    };
+}
+
+static size_t elementBytes(const enum TuneKernel kernel){
+    switch (kernel){
+        case TUNE_SGEMM: return sizeof(float);
+        case TUNE_I32GEMM: return sizeof(int32_t);
+        case TUNE_I8GEMM: return sizeof(int8_t);
+        default: return sizeof(double);
+    }
+}
+
+static void* allocOperand(const size_t elements, const size_t bytes){
+    void* ptr = aligned_alloc(64, (elements*bytes + 63)/64*64);
+    if (ptr == NULL){
+        fprintf(stderr, "Failed to allocate %zu bytes for tuning\n", elements*bytes);
+        exit(1);
+    }
+    return ptr;
+}
+
+// Small integers, so that the integer products cannot overflow
+static void fillOperand(void* const x, const size_t elements, const enum TuneKernel kernel){
+    for (size_t i = 0; i < elements; ++i){
+        const int value = rand() % 17 - 8;
+        switch (kernel){
+            case TUNE_SGEMM: ((float*)x)[i] = (float)value; break;
+            case TUNE_I32GEMM: ((int32_t*)x)[i] = value; break;
+            case TUNE_I8GEMM: ((int8_t*)x)[i] = (int8_t)value; break;
+            default: ((double*)x)[i] = value; break;
+        }
+    }
+}
+
+// Create the missing directories above path
+static void createParents(const char* const path){
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", path);
+    for (char* p = dir + 1; *p != 0; ++p){
+        if (*p != '/') continue;
+        *p = 0;
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST) return;
+        *p = '/';
+    }
+}
+
+static void writeProfile(const char* const path, const struct TuneEntry* const tuned, const size_t count){
+    createParents(path);
+    // Written to a temporary file first, so that a concurrent load never reads half a profile
+    char tmpPath[PATH_MAX + 32];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.%ld.tmp", path, (long)getpid());
+    FILE* file = fopen(tmpPath, "w");
+    if (file == NULL){
+        fprintf(stderr, "Failed to write the tuning profile %s: %s\n", tmpPath, strerror(errno));
+        exit(1);
+    }
+    fprintf(file, "# matmul tuning profile\ncpu %s\n", cpuBrand());
+    fprintf(file, "# kernel m n k threads isa mc kc nc tile use gflops\n");
+    for (size_t i = 0; i < count; ++i){
+        const struct TuneEntry* const e = &tuned[i];
+        fprintf(file, "%s %zu %zu %zu %zu %s %zu %zu %zu %zu %zu %.2f\n", kernelNames[e->kernel], e->m, e->n, e->k, e->threads,
+                cpuIsaName(e->config.isa), e->config.mc, e->config.kc, e->config.nc, e->config.tile, e->config.threads, e->gflops);
+    }
+    if (fclose(file) != 0 || rename(tmpPath, path) != 0){
+        fprintf(stderr, "Failed to write the tuning profile %s: %s\n", path, strerror(errno));
+        unlink(tmpPath);
+        exit(1);
+    }
+}
+
+void matmulTune(const char* path, size_t maxSize, size_t threadCount){
+    if (path == NULL) path = matmulTuneProfilePath();
+    if (path[0] == 0){
+        fprintf(stderr, "%s: there is no profile path, set MATMUL_TUNE_PROFILE or pass one\n", __func__);
+        exit(1);
+    }
+    if (maxSize == 0) maxSize = DEFAULT_MAX_SIZE;
+    if (maxSize < MIN_SIZE) maxSize = MIN_SIZE;
+    if (threadCount == 0) threadCount = threadPoolSize();
+    // Squares, a rank update (small k) and a short wide product (small m) of the largest size
+    size_t shapes[32][3];
+    size_t shapeCount = 0;
+    for (size_t size = MIN_SIZE; size <= maxSize && shapeCount < 30; size *= 2){
+        shapes[shapeCount][0] = shapes[shapeCount][1] = shapes[shapeCount][2] = size;
+        ++shapeCount;
+    }
+    const size_t largest = shapes[shapeCount - 1][0];
+    const size_t flat = largest/8 >= 16 ? largest/8 : 16;
+    memcpy(shapes[shapeCount++], (size_t[3]){largest, largest, flat}, sizeof(shapes[0]));
+    memcpy(shapes[shapeCount++], (size_t[3]){flat, largest, largest}, sizeof(shapes[0]));
+    const size_t threadSets[2] = {1, threadCount};
+    const size_t threadSetCount = threadCount > 1 ? 2 : 1;
+    struct TuneEntry* tuned = malloc(TUNE_KERNEL_COUNT*shapeCount*threadSetCount*sizeof(struct TuneEntry));
+    if (tuned == NULL){
+        fprintf(stderr, "Failed to allocate the tuning profile\n");
+        exit(1);
+    }
+    size_t count = 0;
+    srand(1);
+    for (size_t kernel = 0; kernel < TUNE_KERNEL_COUNT; ++kernel){
+        // matmulSIMDMT needs AVX and is square only
+        if (kernel == TUNE_SIMDMT && cpuIsa() < ISA_AVX) continue;
+        const size_t bytes = elementBytes(kernel);
+        struct TuneProblem p = {
+            .kernel = kernel,
+            .a = allocOperand(largest*largest, bytes),
+            .b = allocOperand(largest*largest, bytes),
+            .res = allocOperand(largest*largest, kernel == TUNE_I8GEMM ? sizeof(int32_t) : bytes),
+        };
+        fillOperand(p.a, largest*largest, kernel);
+        fillOperand(p.b, largest*largest, kernel);
+        for (size_t s = 0; s < shapeCount; ++s){
+            if (kernel == TUNE_SIMDMT && (shapes[s][0] != shapes[s][2] || shapes[s][1] != shapes[s][2])) continue;
+            p.m = shapes[s][0];
+            p.n = shapes[s][1];
+            p.k = shapes[s][2];
+            for (size_t t = 0; t < threadSetCount; ++t){
+                p.threads = threadSets[t];
+                tuned[count++] = tuneProblem(&p);
+            }
+        }
+        free(p.a);
+        free(p.b);
+        free(p.res);
+    }
+    writeProfile(path, tuned, count);
+    pthread_once(&loadOnce, loadDefault);
+    replaceProfile(tuned, count);
+}